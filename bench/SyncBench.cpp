@@ -0,0 +1,814 @@
+#include "DatabaseManager.hpp"
+#include "MetadataTable.hpp"
+#include "ReconciliationService.hpp"
+#include "SyncItemsParser.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <random>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+/**
+ * sync_bench times the reconcile paths against synthetic cloud, DB, queue
+ * and scan states. Every phase reports wall time and process RSS, and the
+ * run can be written as JSON for comparing builds. The last phases parse
+ * the cloud listing as a /getSyncItems body, streamed and as a DOM;
+ * --listing-only runs just those, on a listing of --files items.
+ *
+ *   sync_bench --files 100000 --churn 0.05 --json out.json
+ *   sync_bench --files 1000000 --listing-only
+ */
+
+namespace {
+
+struct BenchConfig {
+  size_t files = 10000;
+  size_t filesPerDir = 32;
+  size_t devices = 4;
+  size_t depth = 4;
+  double churn = 0.05;        // Share of files changed on each side
+  double renameRatio = 0.01;  // Files renamed in cloud / moved locally
+  double conflictRatio = 0.01; // Files modified on both sides
+  double dirRenameRatio = 0.01;
+  uint64_t seed = 42;
+  std::string dbPath;
+  std::string jsonPath;
+  bool keepDb = false;
+  bool verbose = false;
+  bool listingOnly = false;
+};
+
+struct MemorySample {
+  int64_t rssKb = 0;
+  int64_t peakRssKb = 0;
+};
+
+MemorySample sampleMemory() {
+  MemorySample sample;
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    sample.rssKb = static_cast<int64_t>(counters.WorkingSetSize / 1024);
+    sample.peakRssKb =
+        static_cast<int64_t>(counters.PeakWorkingSetSize / 1024);
+  }
+#else
+  // VmHWM/VmRSS where procfs exists, otherwise the rusage peak
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0)
+      sample.peakRssKb = std::stoll(line.substr(6));
+    else if (line.rfind("VmRSS:", 0) == 0)
+      sample.rssKb = std::stoll(line.substr(6));
+  }
+  if (sample.peakRssKb == 0) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+      sample.peakRssKb = usage.ru_maxrss;
+  }
+#endif
+  return sample;
+}
+
+// Swallows the per-item logging of the services under test
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+};
+
+class QuietScope {
+public:
+  explicit QuietScope(bool verbose) {
+    if (!verbose)
+      m_saved = std::cout.rdbuf(&m_null);
+  }
+  ~QuietScope() {
+    if (m_saved)
+      std::cout.rdbuf(m_saved);
+  }
+
+private:
+  NullBuffer m_null;
+  std::streambuf *m_saved = nullptr;
+};
+
+std::string randomHex(std::mt19937_64 &rng, size_t digits) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string out(digits, '0');
+  for (auto &c : out)
+    c = kDigits[rng() & 0x0f];
+  return out;
+}
+
+std::string randomUuid(std::mt19937_64 &rng) {
+  return randomHex(rng, 8) + "-" + randomHex(rng, 4) + "-4" +
+         randomHex(rng, 3) + "-a" + randomHex(rng, 3) + "-" +
+         randomHex(rng, 12);
+}
+
+struct SyntheticState {
+  std::vector<sync::DirectoryMetadata> dirs;
+  std::vector<sync::FileMetadata> files;
+  std::vector<sync::CloudFileMetadata> cloudFiles;
+  std::vector<sync::CloudFolderMetadata> cloudDirs;
+  std::vector<sync::FileQueueEntry> fileQueue;
+  std::vector<sync::DirectoryQueueEntry> dirQueue;
+  std::vector<sync::ScannedFile> scannedFiles;
+  std::vector<sync::ScannedDirectory> scannedDirs;
+};
+
+SyntheticState generate(const BenchConfig &config, const std::string &root) {
+  std::mt19937_64 rng(config.seed);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  SyntheticState state;
+
+  // Directory tree: one top level directory per device, the rest hang off
+  // random parents above the depth limit
+  size_t dirCount = std::max(
+      config.devices, config.files / std::max<size_t>(1, config.filesPerDir));
+  std::vector<size_t> depthOf;
+  for (size_t i = 0; i < dirCount; ++i) {
+    sync::DirectoryMetadata d;
+    d.uuid = randomUuid(rng);
+    if (i < config.devices) {
+      d.device = "device" + std::to_string(i);
+      d.path = "/" + d.device;
+      depthOf.push_back(1);
+    } else {
+      size_t parent = rng() % state.dirs.size();
+      while (depthOf[parent] >= config.depth)
+        parent = rng() % config.devices;
+      d.device = state.dirs[parent].device;
+      d.path = state.dirs[parent].path + "/dir" + std::to_string(i);
+      depthOf.push_back(depthOf[parent] + 1);
+    }
+    d.folder = d.path.substr(d.path.rfind('/') + 1);
+    d.created_at = std::to_string(1700000000 + rng() % 10000000);
+    d.absPath = root + d.path;
+    d.inode = std::to_string(1000000 + i);
+    state.dirs.push_back(d);
+  }
+
+  for (size_t i = 0; i < config.files; ++i) {
+    const auto &dir = state.dirs[rng() % state.dirs.size()];
+    sync::FileMetadata f;
+    f.uuid = randomUuid(rng);
+    f.origin = f.uuid;
+    f.path = dir.path;
+    f.filename = "file" + std::to_string(i) + ".dat";
+    f.hashvalue = randomHex(rng, 64);
+    f.lastSyncedHashValue = f.hashvalue;
+    f.size = static_cast<int64_t>(rng() % (1 << 20)) + 1;
+    f.last_modified = std::to_string(1700000000 + rng() % 10000000);
+    f.dirID = dir.uuid;
+    f.inode = std::to_string(5000000 + i);
+    f.absPath = root + f.path + "/" + f.filename;
+    f.versions = 1;
+    state.files.push_back(f);
+  }
+
+  // Cloud side: deletes, renames, content changes and additions
+  for (const auto &d : state.dirs)
+    state.cloudDirs.push_back(
+        {d.uuid, d.device, d.folder, d.path, d.created_at});
+  for (const auto &f : state.files) {
+    double roll = chance(rng);
+    if (roll < config.churn / 2)
+      continue; // deleted in cloud
+    sync::CloudFileMetadata c{f.uuid,      f.path, f.filename,
+                              f.last_modified, f.hashvalue, f.size,
+                              f.origin,    f.lastSyncedHashValue,
+                              f.versions,  std::nullopt};
+    if (roll < config.churn / 2 + config.renameRatio) {
+      c.filename = "renamed_" + c.filename;
+    } else if (roll < config.churn / 2 + config.renameRatio + config.churn) {
+      c.hashvalue = randomHex(rng, 64);
+      c.versions += 1;
+    } else if (roll < config.churn / 2 + config.renameRatio + config.churn +
+                          config.conflictRatio) {
+      // Conflict: changed in cloud and pending locally
+      c.hashvalue = randomHex(rng, 64);
+      c.versions += 1;
+      sync::FileQueueEntry q(f);
+      q.hashvalue = randomHex(rng, 64);
+      q.sync_status = "modified";
+      state.fileQueue.push_back(q);
+    }
+    state.cloudFiles.push_back(c);
+  }
+  size_t cloudAdds = static_cast<size_t>(config.files * config.churn / 2);
+  for (size_t i = 0; i < cloudAdds; ++i) {
+    const auto &dir = state.dirs[rng() % state.dirs.size()];
+    std::string uuid = randomUuid(rng);
+    state.cloudFiles.push_back({uuid, dir.path,
+                                "cloud" + std::to_string(i) + ".dat",
+                                std::to_string(1700000000 + rng() % 10000000),
+                                randomHex(rng, 64),
+                                static_cast<int64_t>(rng() % (1 << 20)) + 1,
+                                uuid, "", 1, std::nullopt});
+  }
+
+  // Directory queue rows outlive the sync, so every directory has one.
+  // Renamed directories turn theirs into a delete and gain a new entry
+  // sharing the inode.
+  for (const auto &d : state.dirs) {
+    sync::DirectoryQueueEntry q(d);
+    q.sync_status = "FILE_LINKED";
+    q.old_path = d.path;
+    state.dirQueue.push_back(q);
+  }
+  size_t dirRenames =
+      std::min(dirCount - config.devices,
+               static_cast<size_t>(dirCount * config.dirRenameRatio));
+  std::vector<size_t> renamedDirs(dirCount - config.devices);
+  std::iota(renamedDirs.begin(), renamedDirs.end(), config.devices);
+  std::shuffle(renamedDirs.begin(), renamedDirs.end(), rng);
+  for (size_t i = 0; i < dirRenames; ++i) {
+    const auto &dir = state.dirs[renamedDirs[i]];
+    state.dirQueue[renamedDirs[i]].sync_status = "delete";
+    sync::DirectoryMetadata renamed = dir;
+    renamed.uuid = randomUuid(rng);
+    renamed.folder = dir.folder + "_renamed";
+    renamed.path =
+        dir.path.substr(0, dir.path.rfind('/') + 1) + renamed.folder;
+    sync::DirectoryQueueEntry added(renamed);
+    added.sync_status = "new";
+    state.dirQueue.push_back(added);
+  }
+
+  // Local scan: deletes, moves, content changes and additions
+  for (const auto &d : state.dirs) {
+    sync::ScannedDirectory s;
+    s.path = d.path;
+    s.name = d.folder;
+    s.absPath = d.absPath;
+    s.inode = d.inode;
+    s.mtime = std::stoll(d.created_at);
+    state.scannedDirs.push_back(s);
+  }
+  state.scannedFiles.reserve(config.files);
+  for (const auto &f : state.files) {
+    double roll = chance(rng);
+    if (roll < config.churn / 2)
+      continue; // deleted locally
+    sync::ScannedFile s;
+    s.path = f.path;
+    s.filename = f.filename;
+    s.absPath = f.absPath;
+    s.inode = f.inode;
+    s.hash = f.hashvalue;
+    s.size = f.size;
+    s.mtime = std::stoll(f.last_modified);
+    if (roll < config.churn / 2 + config.renameRatio) {
+      const auto &dir = state.dirs[rng() % state.dirs.size()];
+      s.path = dir.path;
+      s.filename = "moved_" + f.filename;
+      s.absPath = root + s.path + "/" + s.filename;
+    } else if (roll < config.churn / 2 + config.renameRatio + config.churn) {
+      s.hash = randomHex(rng, 64);
+    }
+    state.scannedFiles.push_back(s);
+  }
+  size_t localAdds = static_cast<size_t>(config.files * config.churn / 2);
+  for (size_t i = 0; i < localAdds; ++i) {
+    const auto &dir = state.dirs[rng() % state.dirs.size()];
+    sync::ScannedFile s;
+    s.path = dir.path;
+    s.filename = "local" + std::to_string(i) + ".dat";
+    s.absPath = root + s.path + "/" + s.filename;
+    s.inode = std::to_string(9000000 + i);
+    s.hash = randomHex(rng, 64);
+    s.size = static_cast<int64_t>(rng() % (1 << 20)) + 1;
+    s.mtime = 1700000000 + static_cast<int64_t>(rng() % 10000000);
+    state.scannedFiles.push_back(s);
+  }
+  return state;
+}
+
+// Bulk loads the synthetic DB state in one transaction. The schema itself
+// comes from DatabaseManager::initializeSchema.
+bool loadDatabase(const std::string &dbPath, const SyntheticState &state) {
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
+    std::cerr << "[Bench] Cannot open " << dbPath << std::endl;
+    sqlite3_close(db);
+    return false;
+  }
+
+  auto exec = [&](const char *sql) {
+    return sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+  };
+  auto bind = [](sqlite3_stmt *stmt, int index, const std::string &value) {
+    sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_TRANSIENT);
+  };
+  auto bindOpt = [&](sqlite3_stmt *stmt, int index,
+                     const std::optional<std::string> &value) {
+    if (value)
+      bind(stmt, index, *value);
+    else
+      sqlite3_bind_null(stmt, index);
+  };
+  auto step = [&](sqlite3_stmt *stmt) {
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_reset(stmt);
+    return ok;
+  };
+
+  sqlite3_stmt *dirStmt = nullptr, *fileStmt = nullptr, *fqStmt = nullptr,
+               *dqStmt = nullptr;
+  bool ok =
+      exec("BEGIN") &&
+      sqlite3_prepare_v2(
+          db,
+          "INSERT INTO Directory (uuid, device, folder, path, created_at, "
+          "absPath, inode) VALUES (?, ?, ?, ?, ?, ?, ?)",
+          -1, &dirStmt, nullptr) == SQLITE_OK &&
+      sqlite3_prepare_v2(
+          db,
+          "INSERT INTO File (uuid, path, filename, last_modified, hashvalue, "
+          "size, dirID, inode, absPath, versions, origin, "
+          "lastSyncedHashValue) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+          -1, &fileStmt, nullptr) == SQLITE_OK &&
+      sqlite3_prepare_v2(
+          db,
+          "INSERT INTO FileQueue (uuid, path, filename, last_modified, "
+          "hashvalue, size, dirID, sync_status, inode, versions, origin, "
+          "absPath, old_path, old_filename, lastSyncedHashValue) VALUES (?, "
+          "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+          -1, &fqStmt, nullptr) == SQLITE_OK &&
+      sqlite3_prepare_v2(
+          db,
+          "INSERT INTO DirectoryQueue (uuid, device, folder, path, "
+          "created_at, sync_status, absPath, old_path, inode) VALUES (?, ?, "
+          "?, ?, ?, ?, ?, ?, ?)",
+          -1, &dqStmt, nullptr) == SQLITE_OK;
+
+  for (size_t i = 0; ok && i < state.dirs.size(); ++i) {
+    const auto &d = state.dirs[i];
+    bind(dirStmt, 1, d.uuid);
+    bind(dirStmt, 2, d.device);
+    bind(dirStmt, 3, d.folder);
+    bind(dirStmt, 4, d.path);
+    bind(dirStmt, 5, d.created_at);
+    bind(dirStmt, 6, d.absPath);
+    bind(dirStmt, 7, d.inode);
+    ok = step(dirStmt);
+  }
+  for (size_t i = 0; ok && i < state.files.size(); ++i) {
+    const auto &f = state.files[i];
+    bind(fileStmt, 1, f.uuid);
+    bind(fileStmt, 2, f.path);
+    bind(fileStmt, 3, f.filename);
+    bind(fileStmt, 4, f.last_modified);
+    bind(fileStmt, 5, f.hashvalue);
+    sqlite3_bind_int64(fileStmt, 6, f.size);
+    bind(fileStmt, 7, f.dirID);
+    bind(fileStmt, 8, f.inode);
+    bind(fileStmt, 9, f.absPath);
+    sqlite3_bind_int(fileStmt, 10, f.versions);
+    bind(fileStmt, 11, f.origin);
+    bind(fileStmt, 12, f.lastSyncedHashValue);
+    ok = step(fileStmt);
+  }
+  for (size_t i = 0; ok && i < state.fileQueue.size(); ++i) {
+    const auto &q = state.fileQueue[i];
+    bind(fqStmt, 1, q.uuid);
+    bind(fqStmt, 2, q.path);
+    bind(fqStmt, 3, q.filename);
+    bind(fqStmt, 4, q.last_modified);
+    bind(fqStmt, 5, q.hashvalue);
+    sqlite3_bind_int64(fqStmt, 6, q.size);
+    bind(fqStmt, 7, q.dirID);
+    bind(fqStmt, 8, q.sync_status);
+    bind(fqStmt, 9, q.inode);
+    sqlite3_bind_int(fqStmt, 10, q.versions);
+    bind(fqStmt, 11, q.origin);
+    bind(fqStmt, 12, q.absPath);
+    bindOpt(fqStmt, 13, q.old_path);
+    bindOpt(fqStmt, 14, q.old_filename);
+    bind(fqStmt, 15, q.lastSyncedHashValue);
+    ok = step(fqStmt);
+  }
+  for (size_t i = 0; ok && i < state.dirQueue.size(); ++i) {
+    const auto &q = state.dirQueue[i];
+    bind(dqStmt, 1, q.uuid);
+    bind(dqStmt, 2, q.device);
+    bind(dqStmt, 3, q.folder);
+    bind(dqStmt, 4, q.path);
+    bind(dqStmt, 5, q.created_at);
+    bind(dqStmt, 6, q.sync_status);
+    bind(dqStmt, 7, q.absPath);
+    bindOpt(dqStmt, 8, q.old_path);
+    bind(dqStmt, 9, q.inode);
+    ok = step(dqStmt);
+  }
+  if (!ok)
+    std::cerr << "[Bench] Load failed: " << sqlite3_errmsg(db) << std::endl;
+
+  sqlite3_finalize(dirStmt);
+  sqlite3_finalize(fileStmt);
+  sqlite3_finalize(fqStmt);
+  sqlite3_finalize(dqStmt);
+  ok = exec(ok ? "COMMIT" : "ROLLBACK") && ok;
+  sqlite3_close(db);
+  return ok;
+}
+
+// A cloud listing alone, without the DB, queue and scan state generate()
+// builds around it
+sync::CloudMetadataTable generateListing(const BenchConfig &config) {
+  std::mt19937_64 rng(config.seed);
+  sync::CloudMetadataTable cloud;
+  size_t dirCount = std::max(
+      config.devices, config.files / std::max<size_t>(1, config.filesPerDir));
+  std::vector<std::string> dirs;
+  for (size_t i = 0; i < dirCount; ++i) {
+    std::string device = "device" + std::to_string(i % config.devices);
+    std::string path = "/" + device;
+    if (i >= config.devices)
+      path += "/dir" + std::to_string(i);
+    cloud.addFolder({randomUuid(rng), device,
+                     path.substr(path.rfind('/') + 1), path,
+                     std::to_string(1700000000 + rng() % 10000000)});
+    dirs.push_back(path);
+  }
+  for (size_t i = 0; i < config.files; ++i) {
+    std::string uuid = randomUuid(rng);
+    cloud.addFile({uuid, dirs[rng() % dirs.size()],
+                   "file" + std::to_string(i) + ".dat",
+                   std::to_string(1700000000 + rng() % 10000000),
+                   randomHex(rng, 64),
+                   static_cast<int64_t>(rng() % (1 << 20)) + 1, uuid, "", 1,
+                   std::nullopt});
+  }
+  return cloud;
+}
+
+// The table as a /getSyncItems response body
+std::string encodeListing(const sync::CloudMetadataTable &cloud) {
+  std::string body = "{\"items\":[";
+  for (size_t i = 0; i < cloud.fileCount(); ++i) {
+    sync::CloudFileMetadata f = cloud.file(i);
+    // The client rebuilds the path as /device/directory
+    size_t slash = f.path.find('/', 1);
+    std::string device = f.path.substr(1, slash - 1);
+    std::string directory =
+        slash == std::string::npos ? "/" : f.path.substr(slash + 1);
+    json item = {{"type", "file"},         {"uuid", f.uuid},
+                 {"filename", f.filename}, {"device", device},
+                 {"directory", directory}, {"origin", f.origin},
+                 {"checksum", f.hashvalue}, {"size", f.size},
+                 {"mtime", f.last_modified}, {"version", f.versions}};
+    body += item.dump();
+    body += ',';
+  }
+  for (const auto &d : cloud.folders()) {
+    json item = {{"type", "folder"}, {"uuid", d.uuid},
+                 {"device", d.device}, {"folder", d.folder},
+                 {"path", d.path},     {"created_at", d.created_at}};
+    body += item.dump();
+    body += ',';
+  }
+  if (body.back() == ',')
+    body.pop_back();
+  body += "]}";
+  return body;
+}
+
+bool parseArgs(int argc, char **argv, BenchConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--files")
+      config.files = std::stoull(value());
+    else if (arg == "--files-per-dir")
+      config.filesPerDir = std::stoull(value());
+    else if (arg == "--devices")
+      config.devices = std::max<size_t>(1, std::stoull(value()));
+    else if (arg == "--depth")
+      config.depth = std::max<size_t>(2, std::stoull(value()));
+    else if (arg == "--churn")
+      config.churn = std::stod(value());
+    else if (arg == "--renames")
+      config.renameRatio = std::stod(value());
+    else if (arg == "--conflicts")
+      config.conflictRatio = std::stod(value());
+    else if (arg == "--dir-renames")
+      config.dirRenameRatio = std::stod(value());
+    else if (arg == "--seed")
+      config.seed = std::stoull(value());
+    else if (arg == "--db")
+      config.dbPath = value();
+    else if (arg == "--json")
+      config.jsonPath = value();
+    else if (arg == "--keep-db")
+      config.keepDb = true;
+    else if (arg == "--verbose")
+      config.verbose = true;
+    else if (arg == "--listing-only")
+      config.listingOnly = true;
+    else {
+      std::cerr << "Usage: sync_bench [--files N] [--files-per-dir N] "
+                   "[--devices N] [--depth N] [--churn R] [--renames R] "
+                   "[--conflicts R] [--dir-renames R] [--seed N] [--db PATH] "
+                   "[--json PATH|-] [--keep-db] [--verbose] [--listing-only]"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+namespace sync {
+
+// Runs the phases in order and records one JSON entry per phase
+class SyncBench {
+public:
+  explicit SyncBench(BenchConfig config) : m_config(std::move(config)) {}
+
+  int run() {
+    if (m_config.listingOnly) {
+      CloudMetadataTable cloud;
+      phase("generate_listing", [&] { cloud = generateListing(m_config); },
+            [&](json &p) { p["items"] = cloud.fileCount(); });
+      benchListing(cloud);
+      report();
+      return 0;
+    }
+    const std::string root = "/bench_root";
+    if (m_config.dbPath.empty())
+      m_config.dbPath =
+          (fs::temp_directory_path() / "sync_bench.db").string();
+    fs::remove(m_config.dbPath);
+
+    SyntheticState state;
+    phase("generate", [&] { state = generate(m_config, root); },
+          [&](json &p) {
+            p["files"] = state.files.size();
+            p["directories"] = state.dirs.size();
+          });
+
+    DatabaseManager db(m_config.dbPath, root);
+    bool loaded = false;
+    phase("load_db", [&] {
+      QuietScope quiet(m_config.verbose);
+      db.initializeSchema();
+      loaded = loadDatabase(m_config.dbPath, state);
+    });
+    if (!loaded)
+      return 1;
+
+    ReconciliationService service(db, root);
+
+    CloudMetadataTable cloud;
+    phase(
+        "build_cloud_table",
+        [&] {
+          for (const auto &f : state.cloudFiles)
+            cloud.addFile(f);
+          for (const auto &d : state.cloudDirs)
+            cloud.addFolder(d);
+          cloud.sortByKey();
+        },
+        [&](json &p) {
+          p["items"] = cloud.fileCount();
+          p["tableBytes"] = cloud.memoryUsage();
+        });
+
+    std::optional<std::vector<FileMetadata>> dbFiles;
+    std::optional<std::vector<DirectoryMetadata>> dbDirs;
+    phase("read_db_state", [&] {
+      dbFiles = db.getAllFiles();
+      dbDirs = db.getAllDirectories();
+    });
+    if (!dbFiles || !dbDirs)
+      return 1;
+
+    ReconciliationResult plan;
+    phase(
+        "reconcile",
+        [&] {
+          QuietScope quiet(m_config.verbose);
+          plan = service.reconcile(cloud, *dbFiles, *dbDirs);
+        },
+        [&](json &p) {
+          p["downloads"] = plan.filesToDownload.size();
+          p["updates"] = plan.filesToUpdate.size();
+          p["renames"] = plan.filesToRename.size();
+          p["conflicts"] = plan.filesInConflict.size();
+          p["localDeletes"] = plan.filesToDeleteLocal.size();
+        });
+    dbFiles.reset();
+    dbDirs.reset();
+
+    std::vector<RenameInfo> renames;
+    phase(
+        "detect_dir_renames",
+        [&] { renames = service.detectDirRenames(state.dirQueue); },
+        [&](json &p) { p["renames"] = renames.size(); });
+
+    std::vector<RenameInfo> collapsed;
+    phase(
+        "collapse_dir_renames",
+        [&] { collapsed = service.collapseDirRenames(renames); },
+        [&](json &p) { p["collapsed"] = collapsed.size(); });
+
+    LocalScanTable scan(root);
+    phase(
+        "build_scan_table",
+        [&] {
+          for (const auto &f : state.scannedFiles)
+            scan.addFile(f);
+          for (const auto &d : state.scannedDirs)
+            scan.addDirectory(d);
+          scan.sortByKey();
+        },
+        [&](json &p) {
+          p["items"] = scan.fileCount();
+          p["tableBytes"] = scan.memoryUsage();
+        });
+
+    state = SyntheticState();
+    phase("reconcile_local_state", [&] {
+      QuietScope quiet(m_config.verbose);
+      service.reconcileLocalState(scan);
+    });
+
+    // The largest subtree: a whole device folder, re-rooted in one go
+    bool moved = false;
+    phase(
+        "move_directory",
+        [&] {
+          QuietScope quiet(m_config.verbose);
+          auto top = db.getDirectoryByPath("device0", "device0", "/device0");
+          if (!top)
+            return;
+          DirectoryQueueEntry dq(*top);
+          dq.sync_status = "rename";
+          dq.old_path = top->path;
+          dq.path = "/device0_moved";
+          dq.folder = "device0_moved";
+          dq.device = "device0_moved";
+          moved = db.moveDirectory(dq.path, top->path, dq);
+        },
+        [&](json &p) { p["moved"] = moved; });
+
+    benchListing(cloud);
+    report();
+    if (!m_config.keepDb)
+      fs::remove(m_config.dbPath);
+    return 0;
+  }
+
+private:
+  BenchConfig m_config;
+  json m_phases = json::array();
+
+  // getMetadata used to parse the whole body into a DOM and copy items out
+  // of it; it now streams it through SyncItemsParser. Streaming runs first
+  // so the DOM's peak does not hide its own.
+  void benchListing(const CloudMetadataTable &cloud) {
+    std::string body;
+    phase("encode_listing", [&] { body = encodeListing(cloud); },
+          [&](json &p) { p["bytes"] = body.size(); });
+    auto throughput = [&](json &p, size_t items) {
+      p["items"] = items;
+      p["mbPerSec"] = body.size() / 1e3 / p["ms"].get<double>();
+    };
+
+    size_t streamed = 0;
+    phase(
+        "parse_listing_stream",
+        [&] {
+          CloudMetadataTable table;
+          SyncItemsParser parser(
+              [&](CloudFileMetadata &&file) { table.addFile(file); },
+              [&](CloudFolderMetadata &&folder) {
+                table.addFolder(std::move(folder));
+              });
+          // httplib hands the receiver at most 16 KiB at a time
+          constexpr size_t kChunk = 16 * 1024;
+          for (size_t pos = 0; pos < body.size(); pos += kChunk)
+            parser.feed(body.data() + pos,
+                        std::min(kChunk, body.size() - pos));
+          if (parser.finish())
+            streamed = parser.itemCount();
+          else
+            std::cerr << "[Bench] " << parser.error() << std::endl;
+        },
+        [&](json &p) { throughput(p, streamed); });
+
+    size_t parsed = 0;
+    phase(
+        "parse_listing_dom",
+        [&] {
+          CloudMetadataTable table;
+          json data = json::parse(body);
+          for (const auto &item : data["items"]) {
+            if (item["type"] == "file") {
+              CloudFileMetadata file;
+              file.uuid = item["uuid"];
+              file.filename = item["filename"];
+              std::string directory = item["directory"];
+              file.path = "/" + item["device"].get<std::string>() +
+                          (directory == "/" ? "" : "/" + directory);
+              file.origin = item["origin"];
+              file.hashvalue = item["checksum"];
+              file.size = item["size"];
+              file.last_modified = item["mtime"];
+              file.versions = item["version"];
+              table.addFile(file);
+            } else {
+              table.addFolder({item["uuid"], item["device"], item["folder"],
+                               item["path"], item["created_at"]});
+            }
+            parsed++;
+          }
+        },
+        [&](json &p) { throughput(p, parsed); });
+  }
+
+  void phase(const std::string &name, const std::function<void()> &body,
+             const std::function<void(json &)> &details = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    auto end = std::chrono::steady_clock::now();
+    MemorySample memory = sampleMemory();
+
+    json p;
+    p["name"] = name;
+    p["ms"] = std::chrono::duration<double, std::milli>(end - start).count();
+    p["rssKb"] = memory.rssKb;
+    p["peakRssKb"] = memory.peakRssKb;
+    if (details)
+      details(p);
+    m_phases.push_back(p);
+
+    std::printf("[Bench] %-24s %10.2f ms  rss %8lld KiB  peak %8lld KiB\n",
+                name.c_str(), p["ms"].get<double>(),
+                static_cast<long long>(memory.rssKb),
+                static_cast<long long>(memory.peakRssKb));
+  }
+
+  void report() {
+    if (m_config.jsonPath.empty())
+      return;
+    json out;
+    out["config"] = {{"files", m_config.files},
+                     {"filesPerDir", m_config.filesPerDir},
+                     {"devices", m_config.devices},
+                     {"depth", m_config.depth},
+                     {"churn", m_config.churn},
+                     {"renameRatio", m_config.renameRatio},
+                     {"conflictRatio", m_config.conflictRatio},
+                     {"dirRenameRatio", m_config.dirRenameRatio},
+                     {"seed", m_config.seed}};
+    out["phases"] = m_phases;
+    if (m_config.jsonPath == "-") {
+      std::cout << out.dump(2) << std::endl;
+      return;
+    }
+    std::ofstream file(m_config.jsonPath);
+    file << out.dump(2) << std::endl;
+    std::cout << "[Bench] Wrote " << m_config.jsonPath << std::endl;
+  }
+};
+
+} // namespace sync
+
+int main(int argc, char **argv) {
+  BenchConfig config;
+  try {
+    if (!parseArgs(argc, argv, config))
+      return 2;
+  } catch (const std::exception &e) {
+    std::cerr << "[Bench] Bad argument: " << e.what() << std::endl;
+    return 2;
+  }
+  return sync::SyncBench(config).run();
+}
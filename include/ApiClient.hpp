@@ -1,9 +1,16 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <optional>
 #include <memory>
+#include <span>
+#include "Compression.hpp"
+#include "DeltaEncoder.hpp"
+#include "MetadataTable.hpp"
+#include "RetryPolicy.hpp"
+#include "TransferScheduler.hpp"
 #include "types.hpp"
 
 namespace sync {
@@ -11,26 +18,92 @@ namespace sync {
     /**
      * ApiClient handles communication with the sync server.
      * Uses cpp-httplib for networking and nlohmann/json for serialization.
+     *
+     * Thread safe. Requests share a pool of keep-alive connections handed
+     * out by a TransferScheduler, so concurrent callers (plan workers,
+     * upload parts) run in parallel, metadata calls and small files first.
+     *
+     * Failed requests are retried under a RetryPolicy when the failure
+     * looks temporary (no connection, timeouts, 429 and 5xx). Requests
+     * that change server state are only repeated when the server cannot
+     * have acted on them. File data goes through upload and download
+     * bandwidth limits shared by all transfers.
      */
     class ApiClient {
     public:
-        ApiClient(const std::string& baseUrl, const std::string& userEmail);
+        ApiClient(const std::string& baseUrl, const std::string& userEmail,
+                  TransferSchedulerOptions transfers = {},
+                  RetryOptions retry = {});
         ~ApiClient();
 
+        // Requests waiting for a connection, on the wire and finished
+        TransferStats transferStats() const;
+
+        // Caps in bytes per second for file content, 0 for none. Applies
+        // to transfers already running as well.
+        void setBandwidthLimits(int64_t uploadBytesPerSecond, int64_t downloadBytesPerSecond);
+        // False while requests are refused because the server looks down
+        bool serverReachable() const;
+
         // Metadata fetching
         std::optional<CloudMetadataResult> getMetadata();
+        // Same listing in a compact table, sorted by (path, filename)
+        std::optional<CloudMetadataTable> getMetadataCompact();
 
         // File operations
         bool downloadFile(const CloudFileMetadata& file, const std::string& localAbsPath);
         std::optional<std::string> uploadFile(const FileQueueEntry& file, const std::vector<std::string>& pathIds);
+
+        // Sends a modified file as a delta against the server's copy. Falls
+        // short (nullopt) when the server has no signatures for it.
+        std::optional<BlockSignatures> getBlockSignatures(const FileQueueEntry& file, size_t blockSize);
+        std::optional<std::string> uploadDelta(const FileQueueEntry& file, const std::vector<std::string>& pathIds);
+
+        // Coding for the file's upload: the best one both sides support
+        // (the server lists its own in Accept-Encoding), or Identity for
+        // content that does not compress
+        ContentCoding uploadCoding(const FileQueueEntry& file);
+
+        // Chunked upload protocol, driven by ChunkedUploader. startUpload
+        // yields nullopt too when the server does not offer it. Parts are
+        // numbered from 0 and may be sent in any order, concurrently;
+        // each is encoded on its own with the coding given at start.
+        std::optional<std::string> startUpload(const FileQueueEntry& file, const std::vector<std::string>& pathIds, int64_t partSize, ContentCoding coding);
+        bool uploadPart(const std::string& uploadId, int64_t partNumber, const char* data, size_t size, const std::string& sha256, ContentCoding coding);
+        // Yields the file id once the server assembled and verified the file.
+        // rejected tells a refusal (bad checksum, parts or upload missing)
+        // from a request that failed on the way.
+        std::optional<std::string> commitUpload(const std::string& uploadId, int64_t partCount, const std::string& checksum, bool* rejected = nullptr);
+
+        // Content addressed uploads. haveContent tells for each SHA-256
+        // whether the server already stores that content, or nullopt if it
+        // cannot say (no such endpoint, failed request). linkFile then
+        // lists the file against that content without sending its bytes;
+        // nullopt if the server no longer has it.
+        std::optional<std::vector<bool>> haveContent(std::span<const std::string> hashes);
+        std::optional<std::string> linkFile(const FileQueueEntry& file, const std::vector<std::string>& pathIds);
         bool deleteFile(const FileQueueEntry& file);
         bool renameFile(const FileQueueEntry& file);
+        // Server side move/copy for content the server already holds;
+        // old_path/old_filename name the source file
+        bool moveFile(const FileQueueEntry& file);
+        bool copyFile(const FileQueueEntry& file);
 
         // Directory operations
         bool createFolder(const DirectoryMetadata& dir);
         bool deleteFolder(const DirectoryMetadata& dir);
         bool renameFolder(const DirectoryQueueEntry& dir);
 
+        // Batch variants: as few requests as the server allows, falling
+        // back to one call per item where it has no batch endpoint. The
+        // result for items[i] is at [i], so callers can settle each queue
+        // row on its own.
+        std::vector<bool> deleteFiles(std::span<const FileQueueEntry> files);
+        std::vector<bool> renameFiles(std::span<const FileQueueEntry> files);
+        std::vector<bool> createFolders(std::span<const DirectoryMetadata> dirs);
+        std::vector<bool> deleteFolders(std::span<const DirectoryMetadata> dirs);
+        std::vector<bool> renameFolders(std::span<const DirectoryQueueEntry> dirs);
+
     private:
         struct Impl;
         std::unique_ptr<Impl> m_impl;
@@ -43,6 +116,13 @@ namespace sync {
             std::string directory;
         };
         PathParts parsePath(const std::string& path);
+
+        // Fetches /getSyncItems and hands each parsed item to a callback.
+        // onRestart is called before a retry, to drop what an attempt cut
+        // short has handed out.
+        bool fetchSyncItems(const std::function<void(CloudFileMetadata&&)>& onFile,
+                            const std::function<void(CloudFolderMetadata&&)>& onFolder,
+                            const std::function<void()>& onRestart);
     };
 
 } // namespace sync
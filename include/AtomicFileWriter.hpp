@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace sync {
+
+/**
+ * AtomicFileWriter writes a download next to its destination and only
+ * moves it into place once it is complete and matches the expected
+ * SHA-256, so a failed transfer never leaves a torn file in the sync
+ * folder for the watcher to upload.
+ *
+ * The temp file is preallocated to the announced size where the platform
+ * allows (fallocate on Linux), hashed as data arrives and flushed to disk
+ * every few MiB so the final fsync before the rename has little left to
+ * write. A writer that is never committed removes its temp file.
+ */
+class AtomicFileWriter {
+public:
+  explicit AtomicFileWriter(std::string finalPath);
+  ~AtomicFileWriter();
+  AtomicFileWriter(const AtomicFileWriter &) = delete;
+  AtomicFileWriter &operator=(const AtomicFileWriter &) = delete;
+
+  // expectedSize preallocates; pass a negative size if unknown. Opening
+  // again starts the file over.
+  bool open(int64_t expectedSize);
+  bool write(const char *data, size_t len);
+  // Renames into place if the content hashes to expectedHash (hex SHA-256;
+  // empty skips the check). The temp file is gone either way.
+  bool commit(const std::string &expectedHash);
+  void abort();
+
+  int64_t bytesWritten() const;
+
+  // Temp files of unfinished downloads; the scanner and the watcher never
+  // sync them
+  static std::string tempPathFor(const std::string &finalPath);
+  static bool isTempPath(const std::string &path);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace sync
@@ -0,0 +1,44 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace sync {
+
+/**
+ * BandwidthLimiter is a token bucket shared by every transfer in one
+ * direction. Senders call consume() before putting bytes on the wire and
+ * are held back until the bucket has refilled, so all transfers together
+ * stay at the rate however many connections they use. The bucket holds
+ * one second of tokens, which bounds the burst after an idle period.
+ *
+ * The rate can be changed at any time; waiting senders pick up the new
+ * rate at once. A rate of 0 means unlimited.
+ */
+class BandwidthLimiter {
+public:
+  explicit BandwidthLimiter(int64_t bytesPerSecond = 0);
+
+  void setRate(int64_t bytesPerSecond);
+  int64_t rate() const;
+
+  // Blocks until len bytes may be sent. Any request goes through while
+  // the bucket is not in debt; what it overdraws holds back the next.
+  void consume(size_t len);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  int64_t m_rate;
+  // Bytes that may be sent right now; negative while in debt
+  double m_tokens;
+  Clock::time_point m_refilled;
+
+  void refillLocked(Clock::time_point now);
+};
+
+} // namespace sync
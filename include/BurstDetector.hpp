@@ -0,0 +1,72 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace sync {
+
+struct BurstOptions {
+  // Events under one directory within `window` that start a burst
+  size_t threshold = 200;
+  std::chrono::milliseconds window{1000};
+  // A burst is rescanned once no event has hit it for this long
+  std::chrono::milliseconds quietPeriod{2000};
+  // ...or after this long regardless, so a constant writer still syncs
+  std::chrono::milliseconds maxDelay{30000};
+};
+
+struct SettledBurst {
+  std::string root;
+  size_t absorbed;
+};
+
+/**
+ * BurstDetector spots event storms (checkouts, unzips, recursive copies).
+ * Every event counts towards its directory and each ancestor. Once one of
+ * them crosses the threshold, the burst root is the deepest directory that
+ * still holds most of those events. Later events below a root are absorbed,
+ * and once the root goes quiet it is handed back for a single subtree
+ * rescan.
+ *
+ * Paths are absolute and '/' separated. Not thread safe; the owner locks.
+ */
+class BurstDetector {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  BurstDetector(std::string rootPath, BurstOptions options = {});
+
+  // The burst root covering path, counting the event towards it; nullopt
+  // when the event should be delivered on its own
+  std::optional<std::string> absorb(const std::string &path,
+                                    Clock::time_point now);
+  // Roots that went quiet (or hit maxDelay), removed from the active set
+  std::vector<SettledBurst> takeSettled(Clock::time_point now);
+  std::optional<Clock::time_point> nextDeadline() const;
+  bool active() const { return !m_bursts.empty(); }
+
+private:
+  struct Window {
+    Clock::time_point start;
+    size_t count = 0;
+  };
+  struct Burst {
+    Clock::time_point started;
+    Clock::time_point lastEvent;
+    size_t absorbed = 0;
+  };
+
+  std::string m_root;
+  BurstOptions m_options;
+  std::map<std::string, Window> m_windows;
+  std::map<std::string, Burst> m_bursts;
+
+  std::string parentOf(const std::string &path) const;
+  std::map<std::string, Burst>::iterator coveringBurst(const std::string &dir);
+  void startBurst(const std::string &dir, Clock::time_point now);
+  Clock::time_point deadlineOf(const Burst &burst) const;
+};
+
+} // namespace sync
@@ -0,0 +1,83 @@
+#pragma once
+#include "ApiClient.hpp"
+#include "DatabaseManager.hpp"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace sync {
+
+struct ChunkedUploadOptions {
+  int64_t partSize = 8 * 1024 * 1024;
+  // Parts in flight at once, each on its own connection
+  size_t parallelParts = 4;
+  // Smaller files go up in a single /syncUpFile request
+  int64_t minSize = 16 * 1024 * 1024;
+  // Modified files from this size are first offered as a delta
+  int64_t deltaMinSize = 64 * 1024;
+  // Files from this size that prefetch() did not cover ask the server
+  // for their content on their own; a smaller one costs less to send
+  int64_t dedupMinSize = 64 * 1024;
+  // Older sessions are started afresh; keep below the server's expiry
+  std::chrono::hours sessionMaxAge{12};
+};
+
+/**
+ * ChunkedUploader sends large files as numbered parts over several
+ * connections and has the server assemble them on commit. Each finished
+ * part is recorded in the database, so an upload cut short by a crash or
+ * a lost connection resumes with the first missing part instead of byte
+ * zero. Servers without the chunked protocol get a plain uploadFile.
+ * Modified files are first tried as a delta against the server's copy
+ * (ApiClient::uploadDelta), which sends only the changed blocks.
+ *
+ * Before any of that, content the server already stores under another
+ * path, device or version is linked instead of sent (ApiClient::linkFile),
+ * so re-syncing a restored backup moves no file data. prefetch() asks
+ * about a whole queue in a few requests up front.
+ *
+ * Every part carries its own SHA-256 and the commit carries the file's,
+ * so a file that changed mid-upload fails the commit rather than being
+ * stored torn. Sessions are keyed by content hash, so the re-hashed file
+ * starts a new one.
+ */
+class ChunkedUploader {
+public:
+  ChunkedUploader(ApiClient &api, DatabaseManager &db,
+                  ChunkedUploadOptions options = {});
+
+  // Learns which of the files' contents the server already holds
+  void prefetch(std::span<const FileQueueEntry> files);
+
+  std::optional<std::string> upload(const FileQueueEntry &file,
+                                    const std::vector<std::string> &pathIds);
+
+private:
+  ApiClient &m_api;
+  DatabaseManager &m_db;
+  ChunkedUploadOptions m_options;
+
+  // Hashes the server was asked about, and those it holds
+  std::mutex m_contentMtx;
+  std::unordered_set<std::string> m_asked;
+  std::unordered_set<std::string> m_held;
+
+  std::optional<std::string>
+  linkExisting(const FileQueueEntry &file,
+               const std::vector<std::string> &pathIds);
+  std::optional<std::string>
+  sendContent(const FileQueueEntry &file,
+              const std::vector<std::string> &pathIds);
+  std::optional<UploadSession>
+  resumeOrStart(const FileQueueEntry &file,
+                const std::vector<std::string> &pathIds);
+  bool sendParts(const FileQueueEntry &file, const UploadSession &session,
+                 const std::vector<int64_t> &missing);
+};
+
+} // namespace sync
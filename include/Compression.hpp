@@ -0,0 +1,45 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace sync {
+
+/**
+ * Transfer compression. Which codings exist depends on the build:
+ * CPPHTTPLIB_ZSTD_SUPPORT and CPPHTTPLIB_ZLIB_SUPPORT (set by CMake when
+ * the libraries are found) also turn on httplib's own decoding of
+ * downloads.
+ */
+enum class ContentCoding { Identity, Gzip, Zstd };
+
+// HTTP token for a coding ("identity", "gzip", "zstd")
+std::string codingName(ContentCoding coding);
+std::optional<ContentCoding> parseCoding(const std::string &name);
+// Codings this build can encode and decode, best first
+std::vector<ContentCoding> supportedCodings();
+// Comma separated supportedCodings(), for Accept-Encoding
+std::string acceptEncoding();
+
+// False for formats that are compressed already (by extension) and for
+// files whose first block looks random. Reads at most 64 KiB.
+bool isCompressible(const std::string &absPath);
+
+/**
+ * One direction of a streaming coder. Output is appended piece by piece,
+ * so whole files are never held in memory.
+ */
+class StreamCodec {
+public:
+  static std::unique_ptr<StreamCodec> encoder(ContentCoding coding);
+  static std::unique_ptr<StreamCodec> decoder(ContentCoding coding);
+  virtual ~StreamCodec() = default;
+
+  // Appends the output for data to out; last ends the stream. False on
+  // corrupt input or a library error.
+  virtual bool process(const char *data, size_t len, bool last,
+                       std::string &out) = 0;
+};
+
+} // namespace sync
@@ -0,0 +1,44 @@
+#pragma once
+#include "types.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sync {
+
+struct ContentHashEntry {
+  std::string path;
+  std::string filename;
+  std::string uuid;
+  std::string origin;
+  int32_t versions;
+  std::string lastSyncedHashValue;
+  // Source only survives as a pending "delete" row in the FileQueue
+  bool queuedDelete;
+};
+
+/**
+ * ContentHashIndex maps content hashes to files the server already holds,
+ * so a new local file with known content can be recorded as a server side
+ * copy or move instead of a full upload.
+ *
+ * Entries are keyed on lastSyncedHashValue, the content last uploaded.
+ * Files with pending local changes must not be added: the server does not
+ * have their content yet.
+ */
+class ContentHashIndex {
+public:
+  void add(const FileMetadata &file);
+  void addQueuedDelete(const FileQueueEntry &entry);
+
+  // Candidates in a fixed order: those named like the new file first (a
+  // moved file usually keeps its name), then by path and filename
+  std::vector<ContentHashEntry> find(const std::string &hash,
+                                     const std::string &filename = "") const;
+  size_t size() const { return m_byHash.size(); }
+
+private:
+  std::unordered_multimap<std::string, ContentHashEntry> m_byHash;
+};
+
+} // namespace sync
@@ -11,6 +11,53 @@ struct pathParts {
   std::string device;
   std::string folder;
 };
+
+/**
+ * Forward-only cursor over a table in path key order, for merge-joins that
+ * must not load the whole table. Keeps the connection open until destroyed.
+ */
+template <typename T> class OrderedCursor {
+public:
+  struct Impl;
+  explicit OrderedCursor(std::unique_ptr<Impl> impl);
+  ~OrderedCursor();
+
+  // False at the end of the rows or after a read error
+  bool next(T &row);
+  bool failed() const { return m_failed; }
+
+private:
+  std::unique_ptr<Impl> m_impl;
+  bool m_failed = false;
+};
+
+// Files ordered by (path, filename), directories by (path, device, folder)
+using FileCursor = OrderedCursor<FileMetadata>;
+using DirectoryCursor = OrderedCursor<DirectoryMetadata>;
+
+/**
+ * One buffered write, replayed by applyBatch with the same statements as
+ * the matching single-row method.
+ */
+struct BatchOp {
+  enum class Kind {
+    InsertFile,
+    UpdateFile,
+    DeleteFile,
+    ForgetFile,
+    MoveFile,
+    InsertDirectory
+  };
+  Kind kind{};
+  FileMetadata file{};
+  FileQueueEntry fileQueue{};
+  // MoveFile source; DeleteFile and ForgetFile use file.path/file.filename
+  std::string oldPath{};
+  std::string oldFilename{};
+  DirectoryMetadata dir{};
+  DirectoryQueueEntry dirQueue{};
+};
+
 class DatabaseManager {
 public:
   DatabaseManager(const std::string &dbPath, const std::string &syncPath);
@@ -28,6 +75,18 @@ public:
   std::optional<FileMetadata> getFileByOrigin(const std::string &origin);
   std::optional<FileMetadata> getFileByPath(const std::string &path,
                                             const std::string &filename);
+  // Lookups by the content the server holds (lastSyncedHashValue), in
+  // key order. Files with a pending FileQueue entry are left out: their
+  // content may not have reached the server yet.
+  std::optional<std::vector<FileMetadata>>
+  getSyncedFilesByHash(const std::string &hash);
+  std::optional<std::vector<FileQueueEntry>>
+  getQueuedDeletesByHash(const std::string &hash);
+  // The same for many hashes at once, a few statements per thousand
+  std::optional<std::vector<FileMetadata>>
+  getSyncedFilesByHashes(const std::vector<std::string> &hashes);
+  std::optional<std::vector<FileQueueEntry>>
+  getQueuedDeletesByHashes(const std::vector<std::string> &hashes);
   std::optional<FileQueueEntry> getFileQueueByPath(const std::string &path,
                                                    const std::string &filename);
   std::optional<std::vector<FileMetadata>>
@@ -36,8 +95,18 @@ public:
   bool updateFile(const FileMetadata &file);
   bool deleteFile(const std::string &path, const std::string &filename,
                   const FileQueueEntry &fq);
+  // Drops the File and FileQueue rows of a file the server never got, so
+  // no delete is queued for it
+  bool forgetFile(const std::string &path, const std::string &filename);
+  // Replaces the File/FileQueue rows at the old location with the moved file
+  bool moveFile(const std::string &oldPath, const std::string &oldFilename,
+                const FileMetadata &file, const FileQueueEntry &fileQueue);
+  bool removeFile(const std::string &path, const std::string &filename);
   bool deleteFilesByPath(const std::string &path);
   bool upsertFile(const FileMetadata &file);
+  // subtree narrows the rows to a path range that may include siblings
+  // sharing the prefix ("/a" also yields "/a-b"); "/" reads everything
+  std::unique_ptr<FileCursor> openFileCursor(const std::string &subtree = "/");
 
   // Directory operations
   std::optional<std::vector<DirectoryMetadata>> getAllDirectories();
@@ -53,6 +122,8 @@ public:
   bool deleteFolderWithTransaction(const std::string &path,
                                    const DirectoryQueueEntry &dq);
   bool upsertDirectory(const DirectoryMetadata &dir);
+  std::unique_ptr<DirectoryCursor>
+  openDirectoryCursor(const std::string &subtree = "/");
 
   // File Queue operations
   std::optional<std::vector<FileQueueEntry>> getFileQueue();
@@ -60,6 +131,9 @@ public:
   bool updateFileQueue(const FileQueueEntry &entry);
   bool deleteFileQueue(const std::string &path, const std::string &filename);
   bool upsertFileQueue(const FileQueueEntry &entry);
+  // True when local changes below path, path included, still wait to be
+  // uploaded (any queued status but "delete")
+  std::optional<bool> hasPendingFilesUnder(const std::string &path);
 
   // Directory Queue operations
   std::optional<std::vector<DirectoryQueueEntry>> getDirectoryQueue();
@@ -69,6 +143,19 @@ public:
   bool upsertDirectoryQueue(const DirectoryQueueEntry &entry);
   bool moveDirectoryQueue(const std::string &path, const std::string &oldPath);
 
+  // Commits ops in order in one transaction. If that fails they are
+  // retried one by one, so a single bad row only loses itself.
+  bool applyBatch(const std::vector<BatchOp> &ops);
+
+  // Chunked upload state, one session per file origin. Inserting a session
+  // drops any older one for the same origin along with its parts.
+  std::optional<UploadSession> getUploadSession(const std::string &origin);
+  bool insertUploadSession(const UploadSession &session);
+  bool markUploadPart(const std::string &uploadId, int64_t partNumber);
+  std::optional<std::vector<int64_t>>
+  getUploadParts(const std::string &uploadId);
+  bool deleteUploadSession(const std::string &uploadId);
+
   pathParts getFolderDevice(const std::filesystem::path &path);
 
 private:
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sync {
+
+/**
+ * rsync-style delta transfer. The server describes its copy of a file as
+ * one signature per fixed-size block; the client slides a rolling
+ * checksum over the new content and sends copy instructions for blocks the
+ * server already holds and literal bytes for everything else.
+ *
+ * Wire format, integers little-endian:
+ *   "DLT1" u32 blockSize
+ *   'C' u32 firstBlock u32 blockCount   copy blocks of the base file
+ *   'L' u32 length <length bytes>       literal data
+ */
+namespace delta {
+constexpr char kMagic[4] = {'D', 'L', 'T', '1'};
+constexpr char kCopy = 'C';
+constexpr char kLiteral = 'L';
+} // namespace delta
+
+struct BlockSignature {
+  uint32_t weak;
+  std::string strong;
+};
+
+struct BlockSignatures {
+  // Checksum of the whole base file the blocks were taken from
+  std::string checksum;
+  size_t blockSize = 0;
+  std::vector<BlockSignature> blocks;
+};
+
+/** rsync's weak checksum: two 16-bit sums that roll in O(1) per byte. */
+class RollingChecksum {
+public:
+  void reset(const char *data, size_t len);
+  void roll(unsigned char out, unsigned char in) {
+    m_a = (m_a - out + in) & 0xffff;
+    m_b = (m_b - static_cast<uint32_t>(m_len) * out + m_a) & 0xffff;
+  }
+  uint32_t value() const { return (m_b << 16) | m_a; }
+
+private:
+  uint32_t m_a = 0;
+  uint32_t m_b = 0;
+  size_t m_len = 0;
+};
+
+// First 128 bits of the block's SHA-256, hex encoded
+std::string strongChecksum(const char *data, size_t len);
+// About sqrt(size), so signatures and per-block overhead stay balanced
+size_t deltaBlockSize(int64_t fileSize);
+// Signatures of every whole block; a short tail is always sent literally
+std::vector<BlockSignature> computeSignatures(std::istream &in,
+                                              size_t blockSize);
+
+/**
+ * DeltaEncoder turns a stream into delta ops against a set of block
+ * signatures, a piece at a time, so it can feed a chunked request body.
+ * Memory stays at a few MiB whatever the file size. The content is hashed
+ * as it is read so the caller can check it against the announced checksum.
+ */
+class DeltaEncoder {
+public:
+  DeltaEncoder(std::istream &in, size_t blockSize,
+               const std::vector<BlockSignature> &base);
+  ~DeltaEncoder();
+
+  // Appends the next ops (and the header on the first call) to out
+  void next(std::string &out);
+  bool done() const { return m_done; }
+  bool failed() const { return m_failed; }
+
+  int64_t bytesRead() const { return m_read; }
+  int64_t literalBytes() const { return m_literalTotal; }
+  // Valid once done()
+  const std::string &sha256() const { return m_sha256; }
+
+private:
+  std::istream &m_in;
+  size_t m_blockSize;
+  const std::vector<BlockSignature> &m_base;
+  std::unordered_map<uint32_t, std::vector<uint32_t>> m_byWeak;
+  // One bit per 16-bit tag of a weak checksum, checked before m_byWeak
+  std::vector<bool> m_tags;
+
+  std::vector<char> m_buf;
+  size_t m_start = 0;
+  size_t m_end = 0;
+  bool m_eof = false;
+  RollingChecksum m_sum;
+  bool m_sumValid = false;
+
+  std::string m_literal;
+  uint32_t m_copyFirst = 0;
+  uint32_t m_copyCount = 0;
+
+  bool m_headerSent = false;
+  bool m_done = false;
+  bool m_failed = false;
+  int64_t m_read = 0;
+  int64_t m_literalTotal = 0;
+  std::string m_sha256;
+  struct Hasher;
+  std::unique_ptr<Hasher> m_hasher;
+
+  void fill();
+  bool findBlock(uint32_t &index);
+  void flushLiteral(std::string &out);
+  void flushCopy(std::string &out);
+};
+
+} // namespace sync
@@ -0,0 +1,72 @@
+#pragma once
+#include "FileSystemScanner.hpp"
+#include "FilesystemWatcher.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace sync {
+
+/**
+ * EchoRegistry records filesystem changes the client makes itself
+ * (downloads, renames, deletes) so the watcher events they cause can be
+ * dropped before they are hashed, queued and uploaded again.
+ *
+ * A written file is an echo while the write is in flight, and afterwards
+ * only while it still has the size, mtime and inode we left it with; a user
+ * edit right after a download is still synced. Entries expire after a TTL.
+ */
+class EchoRegistry {
+public:
+  explicit EchoRegistry(const std::string &syncPath,
+                        std::chrono::milliseconds ttl = std::chrono::seconds(
+                            10));
+
+  // Call around every write to absPath
+  void beginWrite(const std::string &absPath);
+  void endWrite(const std::string &absPath);
+  void expectDirectory(const std::string &absPath);
+  // recursive also covers every path below absPath (folder deletes)
+  void expectRemoval(const std::string &absPath, bool recursive = false);
+
+  bool isEcho(const std::string &path, const std::string &oldPath,
+              WatchEvent event);
+  uint64_t suppressedCount() const { return m_suppressed; }
+
+private:
+  enum class Kind { Write, Directory, Removal };
+  struct FileState {
+    uintmax_t size;
+    std::filesystem::file_time_type mtime;
+    std::string inode;
+    bool operator==(const FileState &o) const {
+      return size == o.size && mtime == o.mtime && inode == o.inode;
+    }
+  };
+  struct Entry {
+    Kind kind = Kind::Write;
+    int inFlight = 0;
+    bool recursive = false;
+    std::optional<FileState> state;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  FileSystemScanner m_scanner;
+  std::chrono::milliseconds m_ttl;
+  std::mutex m_mtx;
+  std::unordered_map<std::string, Entry> m_entries;
+  std::chrono::steady_clock::time_point m_nextPrune;
+  std::atomic<uint64_t> m_suppressed{0};
+
+  std::string normalize(const std::string &path) const;
+  std::optional<FileState> readState(const std::string &path);
+  std::optional<Entry> find(const std::string &path, Kind kind);
+  bool isWriteEcho(const std::string &path);
+  void pruneLocked(std::chrono::steady_clock::time_point now);
+};
+
+} // namespace sync
@@ -0,0 +1,111 @@
+#pragma once
+#include "FilesystemWatcher.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sync {
+
+struct PipelineEvent {
+  std::string path;
+  std::string oldPath;
+  WatchEvent type;
+  std::chrono::steady_clock::time_point enqueuedAt;
+};
+
+struct EventPipelineOptions {
+  size_t workerCount = 4;
+  // Queued events across all shards; beyond this new events are dropped
+  size_t queueCapacity = 8192;
+};
+
+struct EventPipelineStats {
+  uint64_t submitted = 0;
+  uint64_t processed = 0;
+  uint64_t dropped = 0;
+  size_t queued = 0;
+  size_t highWatermark = 0;
+  double avgQueueDelayMs = 0;
+  double maxQueueDelayMs = 0;
+  std::vector<size_t> shardDepths;
+};
+
+/**
+ * EventPipeline moves watcher events off the watcher threads. submit() only
+ * appends to a bounded queue; each worker owns one shard and runs the
+ * handler. Events hash to a shard by path, so events for one path are
+ * handled in order. A move touches two paths and runs once both of its
+ * shards reach it. A Rescan or a directory move covers a whole subtree, so
+ * it is a barrier: it runs once every shard has drained the events queued
+ * before it, and events for paths inside it wait until it has run.
+ *
+ * A full shard drops the event; the overflow handler then runs once on an
+ * idle worker so the owner can rescan instead of losing the change.
+ */
+class EventPipeline {
+public:
+  using Handler = std::function<void(const PipelineEvent &)>;
+  using OverflowHandler = std::function<void()>;
+
+  EventPipeline(Handler handler, EventPipelineOptions options = {});
+  ~EventPipeline();
+
+  void setOverflowHandler(OverflowHandler handler);
+  void start();
+  void stop();
+
+  // Never waits on handler work; false when the event was dropped
+  bool submit(const std::string &path, const std::string &oldPath,
+              WatchEvent type);
+  EventPipelineStats stats() const;
+
+private:
+  struct Join;
+  struct Job {
+    PipelineEvent event;
+    std::shared_ptr<Join> join;
+  };
+  struct Shard {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    size_t capacity = 0;
+    std::thread worker;
+  };
+
+  Handler m_handler;
+  OverflowHandler m_overflowHandler;
+  EventPipelineOptions m_options;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  // Gives moves one global order across shards so joins cannot deadlock
+  std::mutex m_submitMutex;
+  std::atomic<bool> m_running{false};
+  std::atomic<bool> m_overflowPending{false};
+
+  std::atomic<uint64_t> m_submitted{0};
+  std::atomic<uint64_t> m_processed{0};
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<size_t> m_queued{0};
+  std::atomic<size_t> m_highWatermark{0};
+  mutable std::mutex m_statsMutex;
+  double m_totalDelayMs = 0;
+  double m_maxDelayMs = 0;
+  uint64_t m_delaySamples = 0;
+
+  size_t shardFor(const std::string &path) const;
+  void enqueued(Shard &shard, size_t count);
+  bool submitBarrier(PipelineEvent event);
+  void workerLoop(Shard &shard);
+  bool arriveAtJoin(Join &join);
+  void runHandler(const PipelineEvent &event);
+};
+
+} // namespace sync
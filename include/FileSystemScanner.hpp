@@ -1,8 +1,10 @@
 #ifndef FILESYSTEMSCANNER_HPP
 #define FILESYSTEMSCANNER_HPP
 
+#include "MetadataTable.hpp"
 #include "types.hpp"
 #include <filesystem>
+#include <functional>
 #include <string>
 namespace sync {
 class FileSystemScanner {
@@ -11,6 +13,8 @@ public:
   ~FileSystemScanner();
 
   ScanResult scanSyncPath(std::string path);
+  // Same walk as scanSyncPath, collected into a sorted compact table
+  LocalScanTable scanSyncPathCompact(std::string path);
   std::string getInode(const std::string &absPath);
   std::string toRelativePath(const std::string &absPath);
   std::int64_t getUnixTimeStamp(const std::filesystem::file_time_type &ftime);
@@ -19,6 +23,10 @@ public:
 private:
   std::string m_syncPath;
   std::string calculateHash(const std::string &absPath);
+  void visitSyncPath(
+      const std::string &path,
+      const std::function<void(const ScannedFile &)> &onFile,
+      const std::function<void(const ScannedDirectory &)> &onDirectory);
 };
 
 } // namespace sync
@@ -1,4 +1,6 @@
 #pragma once
+#include <chrono>
+#include <cstddef>
 #include <efsw/efsw.hpp>
 #include <functional>
 #include <memory>
@@ -7,9 +9,25 @@
 namespace sync {
 
 /**
- * FilesystemEvent represents a change in the filesystem.
+ * FilesystemEvent represents a change in the filesystem. Rescan stands in
+ * for a burst of events under a directory that were coalesced; its path is
+ * the directory to rescan.
  */
-enum class WatchEvent { Added, Modified, Deleted, Moved };
+enum class WatchEvent { Added, Modified, Deleted, Moved, Rescan };
+
+/**
+ * How changes are detected. Auto polls on network and FUSE mounts, whose
+ * change notifications are missing or unreliable, and uses native
+ * notifications everywhere else.
+ */
+enum class WatchMode { Auto, Native, Polling };
+
+struct PollingOptions {
+  std::chrono::milliseconds interval{5000};
+  // Work allowed per cycle; a cycle that runs out resumes where it stopped
+  size_t maxStatsPerCycle = 20000;
+  std::chrono::milliseconds maxCycleTime{1000};
+};
 
 /**
  * FilesystemWatcher monitors a directory for changes.
@@ -19,7 +37,9 @@ public:
   using Callback = std::function<void(
       const std::string &path, const std::string &oldPath, WatchEvent event)>;
 
-  FilesystemWatcher(const std::string &path, Callback callback);
+  FilesystemWatcher(const std::string &path, Callback callback,
+                    WatchMode mode = WatchMode::Auto,
+                    PollingOptions polling = {});
   ~FilesystemWatcher();
 
   void start();
@@ -30,6 +50,8 @@ private:
   std::unique_ptr<Impl> m_impl;
   std::string m_path;
   Callback m_callback;
+  WatchMode m_mode;
+  PollingOptions m_polling;
 };
 
 } // namespace sync
@@ -0,0 +1,40 @@
+#pragma once
+#ifdef __linux__
+#include "FilesystemWatcher.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace sync {
+
+/**
+ * InotifyBackend watches a tree with inotify directly instead of through
+ * efsw. It keeps one watch per directory, adds watches for directories as
+ * they appear and pairs IN_MOVED_FROM/IN_MOVED_TO by cookie so a rename
+ * arrives as one Moved event. IN_CLOSE_WRITE is reported as a Modified with
+ * closed set, so the watcher can skip most of its settle wait; IN_MODIFY
+ * as a plain Modified, for files that stay open.
+ *
+ * On IN_Q_OVERFLOW it emits WatchEvent::Rescan for the directories that
+ * were active just before, then always for the root.
+ */
+class InotifyBackend {
+public:
+  using Sink = std::function<void(const std::string &path,
+                                  const std::string &oldPath, WatchEvent event,
+                                  bool closed)>;
+
+  InotifyBackend(const std::string &rootPath, Sink sink);
+  ~InotifyBackend();
+
+  // False when inotify is unavailable; the caller falls back to efsw
+  bool start();
+  void stop();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace sync
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+#include "types.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sync {
+
+/**
+ * Compact in-memory tables for bulk metadata (scan results, reconcile
+ * inputs, cloud listings). Rows are stored as struct-of-arrays columns with
+ * fixed-width hashes, UUIDs and timestamps; directory paths are interned and
+ * file names live in a shared arena. Values that have no fixed-width form
+ * (a non-canonical UUID, an empty hash, ...) are kept in small sparse maps
+ * keyed by row so that every value round-trips exactly.
+ *
+ * The ORM structs in types.hpp are only materialized at the DB boundary via
+ * file()/directory()/folder().
+ */
+
+using Hash256 = std::array<uint8_t, 32>;
+using Uuid128 = std::array<uint8_t, 16>;
+
+// Accept only the canonical lowercase text forms so formatting round-trips
+bool parseHash256(std::string_view hex, Hash256 &out);
+std::string formatHash256(const Hash256 &hash);
+bool parseUuid128(std::string_view text, Uuid128 &out);
+std::string formatUuid128(const Uuid128 &uuid);
+bool parseInt64(std::string_view text, int64_t &out);
+
+struct StrRef {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+};
+
+// Append-only byte arena. Blocks never move, so views stay valid.
+class StringArena {
+public:
+  StrRef append(std::string_view s);
+  std::string_view view(StrRef ref) const;
+  size_t memoryUsage() const;
+
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    uint32_t base;
+    uint32_t capacity;
+    uint32_t used;
+  };
+  std::vector<Block> m_blocks;
+  uint32_t m_nextBase = 0;
+};
+
+// Interned directory paths; every file in a directory shares one id
+class PathTable {
+public:
+  using Id = uint32_t;
+
+  Id intern(std::string_view path);
+  std::optional<Id> find(std::string_view path) const;
+  std::string_view view(Id id) const { return m_arena.view(m_refs[id]); }
+  size_t size() const { return m_refs.size(); }
+  size_t memoryUsage() const;
+
+private:
+  StringArena m_arena;
+  std::vector<StrRef> m_refs;
+  std::unordered_map<std::string_view, Id> m_lookup;
+};
+
+using SparseText = std::unordered_map<uint32_t, std::string>;
+
+/**
+ * LocalScanTable holds one filesystem scan. Lookups binary search the
+ * (path, filename) order established by sortByKey().
+ */
+class LocalScanTable {
+public:
+  explicit LocalScanTable(std::string syncPath = "");
+
+  void addFile(const ScannedFile &file);
+  void addDirectory(const ScannedDirectory &dir);
+  void sortByKey();
+  bool isSorted() const { return m_sorted; }
+
+  size_t fileCount() const { return m_fileDir.size(); }
+  size_t directoryCount() const { return m_dirPath.size(); }
+
+  std::string_view filePath(size_t i) const {
+    return m_paths.view(m_fileDir[i]);
+  }
+  std::string_view fileName(size_t i) const {
+    return m_names.view(m_fileName[i]);
+  }
+  int64_t fileSize(size_t i) const { return m_fileSize[i]; }
+  int64_t fileMTime(size_t i) const { return m_fileMTime[i]; }
+  bool fileHashEquals(size_t i, const std::string &hex) const;
+  std::string_view directoryPath(size_t i) const {
+    return m_paths.view(m_dirPath[i]);
+  }
+
+  std::optional<size_t> findFile(std::string_view path,
+                                 std::string_view filename) const;
+  std::optional<size_t> findDirectory(std::string_view path) const;
+
+  ScannedFile file(size_t i) const;
+  ScannedDirectory directory(size_t i) const;
+
+  size_t memoryUsage() const;
+
+private:
+  std::string m_syncPath;
+  PathTable m_paths;
+  StringArena m_names;
+  bool m_sorted = true;
+
+  // File columns
+  std::vector<PathTable::Id> m_fileDir;
+  std::vector<StrRef> m_fileName;
+  std::vector<int64_t> m_fileSize;
+  std::vector<int64_t> m_fileMTime;
+  std::vector<uint64_t> m_fileInode;
+  std::vector<Hash256> m_fileHash;
+  SparseText m_fileInodeText;
+  SparseText m_fileHashText;
+
+  // Directory columns
+  std::vector<PathTable::Id> m_dirPath;
+  std::vector<StrRef> m_dirName;
+  std::vector<uint64_t> m_dirInode;
+  std::vector<int64_t> m_dirMTime;
+  SparseText m_dirInodeText;
+
+  std::string absPathOf(std::string_view path, std::string_view name) const;
+};
+
+/**
+ * CloudMetadataTable holds a getSyncItems listing. Folders are far fewer
+ * than files and stay as plain structs.
+ */
+class CloudMetadataTable {
+public:
+  void addFile(const CloudFileMetadata &file);
+  void addFolder(const CloudFolderMetadata &folder);
+  void sortByKey();
+  bool isSorted() const { return m_sorted; }
+
+  size_t fileCount() const { return m_dir.size(); }
+  std::string_view filePath(size_t i) const { return m_paths.view(m_dir[i]); }
+  std::string_view fileName(size_t i) const {
+    return m_names.view(m_name[i]);
+  }
+  std::string fileUuid(size_t i) const;
+  std::string fileOrigin(size_t i) const;
+  bool fileHashEquals(size_t i, const std::string &hex) const;
+  std::optional<size_t> findFile(std::string_view path,
+                                 std::string_view filename) const;
+
+  CloudFileMetadata file(size_t i) const;
+  const std::vector<CloudFolderMetadata> &folders() const { return m_folders; }
+
+  size_t memoryUsage() const;
+
+private:
+  PathTable m_paths;
+  StringArena m_names;
+  bool m_sorted = true;
+
+  std::vector<Uuid128> m_uuid;
+  std::vector<Uuid128> m_origin;
+  std::vector<PathTable::Id> m_dir;
+  std::vector<StrRef> m_name;
+  std::vector<Hash256> m_hash;
+  std::vector<int64_t> m_size;
+  std::vector<int64_t> m_mtime;
+  std::vector<int32_t> m_versions;
+  std::vector<bool> m_lastSyncedIsHash;
+  SparseText m_uuidText;
+  SparseText m_originText;
+  SparseText m_hashText;
+  SparseText m_mtimeText;
+  SparseText m_lastSyncedText;
+  SparseText m_conflictIds;
+
+  std::vector<CloudFolderMetadata> m_folders;
+};
+
+} // namespace sync
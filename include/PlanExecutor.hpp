@@ -0,0 +1,139 @@
+#pragma once
+#include "ApiClient.hpp"
+#include "DatabaseManager.hpp"
+#include "EchoRegistry.hpp"
+#include "FileSystemScanner.hpp"
+#include "types.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sync {
+
+enum class PlanOpType {
+  CreateFolder,
+  RenameFile,
+  UpdateFile,
+  DownloadFile,
+  DeleteFile,
+  DeleteFolder,
+  Barrier // no work, only orders other operations
+};
+
+struct PlanProgress {
+  size_t total = 0;
+  size_t completed = 0;
+  size_t failed = 0;
+  size_t skipped = 0;
+  size_t inFlight = 0;
+};
+
+struct PlanExecutorOptions {
+  size_t workerCount = 16;
+  // Attempts per operation before it is marked failed within one pass
+  int maxAttempts = 3;
+  // Wait before the second attempt, doubled before each one after it
+  std::chrono::milliseconds retryDelay{500};
+  // Extra passes that re-run only the failed operations and their dependents
+  int retryPasses = 1;
+  std::map<PlanOpType, size_t> concurrencyLimits = {
+      {PlanOpType::CreateFolder, 4}, {PlanOpType::RenameFile, 4},
+      {PlanOpType::UpdateFile, 8},   {PlanOpType::DownloadFile, 16},
+      {PlanOpType::DeleteFile, 8},   {PlanOpType::DeleteFolder, 2},
+      {PlanOpType::Barrier, 1}};
+};
+
+struct PlanExecutionReport {
+  size_t completed = 0;
+  size_t failed = 0;
+  size_t skipped = 0;
+  std::vector<std::string> failures;
+};
+
+/**
+ * PlanExecutor applies a ReconciliationResult to the local sync folder.
+ * The plan is turned into a dependency graph (folder creates before the
+ * files inside them, renames before updates, deletes after every move) and
+ * run on a bounded worker pool with per-operation concurrency limits.
+ */
+class PlanExecutor {
+public:
+  using ProgressCallback = std::function<void(const PlanProgress &)>;
+
+  PlanExecutor(ApiClient &apiClient, DatabaseManager &dbManager,
+               const std::string &syncPath,
+               PlanExecutorOptions options = PlanExecutorOptions());
+  ~PlanExecutor();
+
+  // Local writes are announced here so the watcher drops their echoes
+  void setEchoRegistry(EchoRegistry *echoes) { m_echoes = echoes; }
+
+  // Blocks until every operation has completed, failed or been skipped.
+  // The progress callback may be invoked from worker threads.
+  PlanExecutionReport execute(const ReconciliationResult &plan,
+                              ProgressCallback progress = nullptr);
+
+private:
+  enum class NodeState { Pending, Ready, Running, Done, Failed, Skipped };
+
+  struct PlanNode {
+    PlanOpType type;
+    std::string label;
+    size_t payload = 0; // index into the matching vector of the plan
+    std::vector<size_t> dependents;
+    size_t depCount = 0;
+    size_t remainingDeps = 0;
+    int attempts = 0;
+    NodeState state = NodeState::Pending;
+    // A failed attempt is not retried before this
+    std::chrono::steady_clock::time_point notBefore;
+  };
+
+  ApiClient &m_apiClient;
+  DatabaseManager &m_dbManager;
+  std::string m_syncPath;
+  PlanExecutorOptions m_options;
+  FileSystemScanner m_scanner;
+  EchoRegistry *m_echoes = nullptr;
+
+  const ReconciliationResult *m_plan = nullptr;
+  std::vector<PlanNode> m_nodes;
+  std::map<PlanOpType, std::deque<size_t>> m_ready;
+  // Ready nodes backing off after a failed attempt
+  std::vector<size_t> m_delayed;
+  std::map<PlanOpType, size_t> m_running;
+  size_t m_unfinished = 0;
+  PlanProgress m_progress;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::mutex m_progressMutex;
+  ProgressCallback m_progressCallback;
+
+  void buildGraph(const ReconciliationResult &plan);
+  void addEdge(size_t from, size_t to);
+  void runPass();
+  void workerLoop();
+  bool takeReadyNode(size_t &index);
+  void finishNode(size_t index, bool success);
+  void skipDependents(size_t index);
+  void resetFailedSubgraph();
+  void reportProgress();
+
+  bool runNode(const PlanNode &node);
+  bool createFolder(const LocalFolderCreateMetadata &dir);
+  bool downloadFile(const CloudFileMetadata &file);
+  bool renameFile(const LocalFileRenameMetadata &rename);
+  bool deleteFile(const FileMetadata &file);
+  bool deleteFolder(const LocalFolderDeleteMetadata &dir);
+
+  std::string toAbsPath(const std::string &path,
+                        const std::string &filename = "");
+};
+
+} // namespace sync
@@ -0,0 +1,37 @@
+#pragma once
+#include "FilesystemWatcher.hpp"
+#include <memory>
+#include <string>
+
+namespace sync {
+
+/**
+ * PollingBackend finds changes by rescanning the tree periodically, for
+ * filesystems that deliver no change notifications (NFS, SMB, FUSE).
+ *
+ * Each cycle stats every known directory and lists only those whose mtime
+ * or inode moved; entries that appeared and vanished in one cycle are
+ * paired by inode into Moved events. Content edits leave the directory
+ * alone, so the remaining budget re-stats known files in a rolling window
+ * and reports Modified when size, mtime or inode changed. Hashing is left
+ * to the sync worker as for every other backend.
+ *
+ * The first cycle only records a baseline. A cycle stops once it used up
+ * its stat or time budget and the next one resumes from there.
+ */
+class PollingBackend {
+public:
+  PollingBackend(const std::string &rootPath,
+                 FilesystemWatcher::Callback sink,
+                 PollingOptions options = {});
+  ~PollingBackend();
+
+  void start();
+  void stop();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace sync
@@ -0,0 +1,12 @@
+#pragma once
+
+// <unistd.h> declares ::sync(), which collides with our namespace of the
+// same name, and in C++20 even <memory> pulls it in. The build includes
+// this ahead of every source file so the function is declared under
+// another name; the include guard keeps later includes from declaring it
+// again.
+#ifndef _WIN32
+#define sync posix_sync
+#include <unistd.h>
+#undef sync
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 #include "DatabaseManager.hpp"
 #include "FileSystemScanner.hpp"
+#include "MetadataTable.hpp"
 #include "types.hpp"
 #include <map>
 #include <optional>
@@ -32,11 +33,25 @@ public:
             const std::vector<CloudFolderMetadata> &cloudDirs,
             const std::vector<FileMetadata> &dbFiles,
             const std::vector<DirectoryMetadata> &dbDirs);
+  // Core implementation; the cloud table must be sorted by key
+  ReconciliationResult reconcile(const CloudMetadataTable &cloud,
+                                 const std::vector<FileMetadata> &dbFiles,
+                                 const std::vector<DirectoryMetadata> &dbDirs);
 
   void reconcileLocalState(const std::vector<ScannedFile> &scannedFiles,
                            const std::vector<ScannedDirectory> &scannedDirs);
+  // Merge-joins the sorted scan against ordered DB cursors in one pass.
+  // With a subtree ("/a/b") only DB rows below it are compared, so the scan
+  // need only cover that directory.
+  void reconcileLocalState(const LocalScanTable &scan,
+                           const std::string &subtree = "/");
+  // Rescans one directory (absolute path) and reconciles just that subtree
+  void reconcileSubtree(const std::string &absDir);
 
 private:
+  // Benchmarks time the rename helpers directly
+  friend class SyncBench;
+
   DatabaseManager &m_dbManager;
   std::string m_syncPath;
   FileSystemScanner m_scanner;
@@ -56,8 +71,9 @@ private:
   std::string getUniqueKey(const std::string &dir, const std::string &filename);
 
   // Internal state management helpers
-  std::optional<FileQueueEntry> localInQueueByAnyPath(
-      const CloudFileMetadata &cloudFile,
+  bool localInQueueByAnyPath(
+      const std::string &origin, const std::string &uuid,
+      const std::string &pathKey,
       const std::map<std::string, FileQueueEntry> &localQueueByOrigin,
       const std::map<std::string, std::vector<FileQueueEntry>>
           &localQueueByUuid,
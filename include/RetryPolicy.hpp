@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+
+namespace sync {
+
+struct RetryOptions {
+  // Tries per request, the first included
+  int maxAttempts = 5;
+  // Backoff before retry n is drawn from [0, baseDelay * 2^n], capped
+  std::chrono::milliseconds baseDelay{250};
+  std::chrono::milliseconds maxDelay{30000};
+  // Failed attempts in a row, across all requests, that open the circuit
+  int breakerThreshold = 8;
+  // How long an open circuit refuses requests before a probe goes out
+  std::chrono::milliseconds breakerCooldown{30000};
+};
+
+/**
+ * RetryPolicy holds the retry schedule and the circuit breaker shared by
+ * every request of one ApiClient. Retries back off exponentially with full
+ * jitter, so clients that failed together do not come back together.
+ *
+ * Once breakerThreshold attempts in a row failed the way a down server
+ * fails (no connection, 5xx), the circuit opens: requests are refused
+ * without touching the network for breakerCooldown, then a single probe
+ * is let through. Its success closes the circuit, its failure opens it
+ * for another cooldown. Any answer from the server, even a 404, counts as
+ * a success here. A request we canceled ourselves tells nothing either
+ * way; a canceled probe leaves the circuit half-open for the next one.
+ */
+class RetryPolicy {
+public:
+  explicit RetryPolicy(RetryOptions options = {});
+
+  const RetryOptions &options() const { return m_options; }
+
+  // Statuses worth another try
+  static bool isRetryableStatus(int status);
+  // Statuses with which the server refused the request before acting on
+  // it, so even a request that is not idempotent may be repeated
+  static bool isUnprocessedStatus(int status);
+
+  // Wait before retry number `retry` (0 for the first); at least
+  // retryAfter, the server's Retry-After, within maxDelay
+  std::chrono::milliseconds backoff(int retry,
+                                    std::chrono::milliseconds retryAfter = {});
+
+  // False while the circuit is open. Every allowed request must report
+  // its outcome through recordSuccess, recordFailure or recordCanceled.
+  bool allowRequest();
+  void recordSuccess();
+  void recordFailure();
+  void recordCanceled();
+  bool circuitOpen() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  RetryOptions m_options;
+  mutable std::mutex m_mtx;
+  std::mt19937_64 m_rng;
+  int m_failures = 0;
+  bool m_open = false;
+  bool m_probing = false;
+  Clock::time_point m_openUntil;
+};
+
+} // namespace sync
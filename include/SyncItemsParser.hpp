@@ -0,0 +1,62 @@
+#pragma once
+#include "types.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace sync {
+
+/**
+ * SyncItemsParser reads a /getSyncItems body while it streams in and hands
+ * out every item once its closing brace has arrived, so a listing of any
+ * length costs one item of memory and no JSON DOM.
+ *
+ * The body is {"items": [item, ...]}. A scanner that only follows strings
+ * and nesting cuts each item out of the stream; nlohmann's SAX parser then
+ * reads it straight into CloudFileMetadata or CloudFolderMetadata. Other
+ * top level keys and unknown item fields are skipped.
+ *
+ * Items are handed out as they are read, so the sinks may already have
+ * seen part of a listing that later turns out truncated or malformed.
+ */
+class SyncItemsParser {
+public:
+  using FileSink = std::function<void(CloudFileMetadata &&)>;
+  using FolderSink = std::function<void(CloudFolderMetadata &&)>;
+
+  SyncItemsParser(FileSink onFile, FolderSink onFolder);
+
+  // Takes the next piece of the body; false once it is known to be bad
+  bool feed(const char *data, size_t len);
+  // True if the body was complete and every item well formed
+  bool finish();
+
+  size_t itemCount() const { return m_items; }
+  const std::string &error() const { return m_error; }
+
+private:
+  FileSink m_onFile;
+  FolderSink m_onFolder;
+
+  // Scanner state, carried across feed() calls
+  int m_depth = 0;
+  bool m_inString = false;
+  bool m_escape = false;
+  bool m_inItems = false;
+  bool m_started = false;
+  bool m_done = false;
+  // Strings of the top level object, to spot the "items" key
+  std::string m_key;
+  std::string m_lastKey;
+  // The item being cut out, while m_capturing
+  std::string m_item;
+  bool m_capturing = false;
+
+  size_t m_items = 0;
+  std::string m_error;
+
+  bool fail(std::string error);
+  bool parseItem();
+};
+
+} // namespace sync
@@ -1,6 +1,7 @@
 #pragma once
 #include "DatabaseManager.hpp"
 #include "FileSystemScanner.hpp"
+#include "WriteBatch.hpp"
 #include <string>
 #ifndef SYNC_WORKER_HPP
 #define SYNC_WORKER_HPP
@@ -16,11 +17,14 @@ public:
   void handleDeleted(const std::string &path);
   void handleRenamed(const std::string &path, const std::string &oldPath);
   void handleModified(const std::string &path);
+  // Handlers batch their writes; commit them before reading the DB directly
+  bool flush();
 
 private:
   DatabaseManager &m_dbManager;
   FileSystemScanner &m_scanner;
   std::string m_syncPath;
+  WriteBatch m_batch;
 };
 
 } // namespace sync
@@ -0,0 +1,96 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace sync {
+
+// Metadata calls are served before any content transfer
+enum class TransferClass { Metadata, Content };
+
+struct TransferRequest {
+  TransferClass cls = TransferClass::Metadata;
+  // Bytes to move; smaller content goes first
+  int64_t size = 0;
+  // Endpoint path, the key for per-endpoint caps
+  std::string endpoint;
+};
+
+struct TransferStats {
+  size_t queued = 0;
+  size_t inFlight = 0;
+  uint64_t completed = 0;
+};
+
+struct TransferSchedulerOptions {
+  size_t connections = 8;
+  // Most requests one endpoint may have in flight; others are unlimited
+  std::map<std::string, size_t> endpointCaps = {
+      {"/syncUpFile", 4}, {"/syncDeltaFile", 4}, {"/uploads/parts", 6}};
+};
+
+/**
+ * TransferScheduler hands out a fixed set of connection slots. Callers
+ * already run on their own threads (plan workers, upload part workers), so
+ * a request blocks in acquire() until a slot is free. Waiting requests are
+ * served metadata first, then by size, then in arrival order, skipping any
+ * whose endpoint is at its cap.
+ */
+class TransferScheduler {
+public:
+  /** A held slot; released when destroyed. */
+  class Lease {
+  public:
+    Lease(TransferScheduler *owner, size_t slot, std::string endpoint)
+        : m_owner(owner), m_slot(slot), m_endpoint(std::move(endpoint)) {}
+    Lease(Lease &&other) noexcept;
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+    ~Lease();
+
+    size_t slot() const { return m_slot; }
+
+  private:
+    TransferScheduler *m_owner;
+    size_t m_slot;
+    std::string m_endpoint;
+  };
+
+  explicit TransferScheduler(TransferSchedulerOptions options = {});
+
+  Lease acquire(const TransferRequest &request);
+  TransferStats stats() const;
+  size_t connections() const { return m_options.connections; }
+
+private:
+  struct Waiter {
+    TransferRequest request;
+    uint64_t seq;
+    // Set by dispatch once the waiter may run
+    bool granted = false;
+    size_t slot = 0;
+  };
+  // (class, size, seq) order over the waiting requests
+  struct WaiterOrder {
+    bool operator()(const Waiter *a, const Waiter *b) const;
+  };
+
+  TransferSchedulerOptions m_options;
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::vector<size_t> m_freeSlots;
+  std::set<Waiter *, WaiterOrder> m_waiting;
+  std::map<std::string, size_t> m_running;
+  uint64_t m_nextSeq = 0;
+  uint64_t m_completed = 0;
+
+  void release(size_t slot, const std::string &endpoint);
+  void dispatchLocked();
+};
+
+} // namespace sync
@@ -0,0 +1,93 @@
+#pragma once
+#include "DatabaseManager.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace sync {
+
+struct WriteBatchOptions {
+  // A batch commits once it holds this many writes...
+  size_t maxOps = 256;
+  // ...or this long after its first write
+  std::chrono::milliseconds maxDelay{50};
+};
+
+/**
+ * WriteBatch buffers SyncWorker's writes and commits them in one
+ * transaction per batch instead of one per event. Lookups go through the
+ * batch and see its pending writes first, so a folder created earlier in
+ * the batch is found rather than inserted twice.
+ *
+ * Thread safe. Callers that read the DB directly (reconcile, subtree
+ * moves and deletes) flush() first.
+ */
+class WriteBatch {
+public:
+  explicit WriteBatch(DatabaseManager &db, WriteBatchOptions options = {});
+  ~WriteBatch();
+
+  std::optional<FileMetadata> getFileByPath(const std::string &path,
+                                            const std::string &filename);
+  std::optional<DirectoryMetadata>
+  getDirectoryByPath(const std::string &device, const std::string &folder,
+                     const std::string &path);
+  std::optional<std::vector<FileMetadata>>
+  getSyncedFilesByHash(const std::string &hash);
+  std::optional<std::vector<FileQueueEntry>>
+  getQueuedDeletesByHash(const std::string &hash);
+  std::optional<FileQueueEntry> getFileQueueByPath(const std::string &path,
+                                                   const std::string &filename);
+
+  void insertFile(const FileMetadata &file, const FileQueueEntry &fileQueue);
+  // Rewrites the File row alone, queueing nothing
+  void updateFile(const FileMetadata &file);
+  void deleteFile(const std::string &path, const std::string &filename,
+                  const FileQueueEntry &fq);
+  void forgetFile(const std::string &path, const std::string &filename);
+  void moveFile(const std::string &oldPath, const std::string &oldFilename,
+                const FileMetadata &file, const FileQueueEntry &fileQueue);
+  void insertDirectory(const DirectoryMetadata &dir,
+                       const DirectoryQueueEntry &dirQueue);
+  // Inserts dir unless a row with its (device, folder, path) exists, in
+  // one step so concurrent callers cannot both insert. Returns the row
+  // that is now current and whether it was inserted.
+  std::pair<DirectoryMetadata, bool>
+  getOrInsertDirectory(const DirectoryMetadata &dir,
+                       const DirectoryQueueEntry &dirQueue);
+
+  // Commits whatever is pending now
+  bool flush();
+
+private:
+  using FileKey = std::pair<std::string, std::string>;
+  using DirKey = std::tuple<std::string, std::string, std::string>;
+
+  DatabaseManager &m_db;
+  WriteBatchOptions m_options;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::thread m_flusher;
+  bool m_running = true;
+
+  std::vector<BatchOp> m_ops;
+  std::chrono::steady_clock::time_point m_firstOp;
+  // Pending state by key; nullopt marks a row the batch removes
+  std::map<FileKey, std::optional<FileMetadata>> m_files;
+  std::map<FileKey, std::optional<FileQueueEntry>> m_fileQueue;
+  std::map<DirKey, DirectoryMetadata> m_dirs;
+
+  void add(BatchOp op);
+  void addLocked(BatchOp op);
+  bool flushLocked();
+  void flusherLoop();
+};
+
+} // namespace sync
@@ -74,6 +74,12 @@ struct FileQueueEntry : public FileMetadata {
   FileQueueEntry(const FileMetadata &f)
       : FileMetadata(f), uuid(f.uuid), path(f.path), dirID(f.dirID),
         filename(f.filename), origin(f.origin) {}
+
+  // A pending "new" or "copy" row: the server has nothing at this path
+  // yet, so the file can be dropped rather than deleted or renamed there
+  bool notYetUploaded() const {
+    return sync_status == "new" || sync_status == "copy";
+  }
 };
 
 struct DirectoryQueueEntry : public DirectoryMetadata {
@@ -157,4 +163,22 @@ struct FileUploadMetadata {
   std::string hashvalue;
 };
 
+// A chunked upload the server has accepted but not yet committed. Kept
+// in the database so an interrupted upload resumes where it stopped.
+struct UploadSession {
+  std::string uploadId;
+  std::string origin;
+  std::string hashvalue;
+  int64_t size;
+  int64_t partSize;
+  // Content coding of every part ("identity", "gzip", "zstd")
+  std::string encoding;
+  std::string created_at;
+};
+
+struct UploadPart {
+  std::string uploadId;
+  int64_t partNumber;
+};
+
 } // namespace sync
@@ -1,15 +1,32 @@
 #include "ApiClient.hpp"
+#include "AtomicFileWriter.hpp"
+#include "BandwidthLimiter.hpp"
+#include "SyncItemsParser.hpp"
 #include "httplib.h"
+#include "picosha2.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include <set>
 #include <sstream>
+#include <thread>
 
 using json = nlohmann::json;
 
 namespace sync {
 
+// Read size for streamed uploads; memory per upload stays at this
+constexpr size_t kUploadChunkSize = 256 * 1024;
+// Items per batch request, to bound request bodies and server transactions
+constexpr size_t kMaxBatchItems = 500;
+// Hashes per /haveContent request; they cost the server a lookup each
+constexpr size_t kMaxHaveHashes = 2000;
+
 // Helper for URL encoding
 std::string urlEncode(const std::string &value) {
   std::ostringstream escaped;
@@ -32,77 +49,414 @@ std::string urlEncode(const std::string &value) {
   return escaped.str();
 }
 
+namespace {
+
+struct Verdict {
+  bool retry;
+  // Counts towards opening the circuit
+  bool serverFailed;
+};
+
+// What one attempt's outcome means for the next. Transport errors after
+// the request went out may hide a request the server did act on.
+Verdict judge(const httplib::Result &res, bool idempotent) {
+  if (res) {
+    bool retryable = RetryPolicy::isRetryableStatus(res->status);
+    return {retryable && (idempotent ||
+                          RetryPolicy::isUnprocessedStatus(res->status)),
+            retryable};
+  }
+  switch (res.error()) {
+  case httplib::Error::Connection:
+  case httplib::Error::ConnectionTimeout:
+  case httplib::Error::ProxyConnection:
+    return {true, true};
+  case httplib::Error::Read:
+  case httplib::Error::Write:
+  case httplib::Error::Timeout:
+  case httplib::Error::ConnectionClosed:
+  case httplib::Error::SSLConnection:
+  case httplib::Error::Unknown:
+    return {idempotent, true};
+  default:
+    // Canceled by our own callbacks, or nothing another try would fix
+    return {false, false};
+  }
+}
+
+// The server's Retry-After in seconds, if any
+std::chrono::milliseconds retryAfter(const httplib::Result &res) {
+  if (!res || !res->has_header("Retry-After"))
+    return {};
+  long seconds = std::strtol(res->get_header_value("Retry-After").c_str(),
+                             nullptr, 10);
+  return std::chrono::seconds(std::max(seconds, 0L));
+}
+
+std::string describe(const httplib::Result &res) {
+  return res ? "answered " + std::to_string(res->status)
+             : "failed: " + httplib::to_string(res.error());
+}
+
+} // namespace
+
 struct ApiClient::Impl {
-  httplib::Client client;
-  Impl(const std::string &baseUrl) : client(baseUrl) {
-    client.set_connection_timeout(30, 0);
-    client.set_read_timeout(30, 0);
-    client.set_write_timeout(30, 0);
-    client.set_follow_location(true);
+  // One persistent client per scheduler slot; a slot's client is only
+  // used by the request holding its lease
+  TransferScheduler scheduler;
+  std::vector<std::unique_ptr<httplib::Client>> clients;
+  RetryPolicy retry;
+  // File content only; metadata requests are not held back
+  BandwidthLimiter upload;
+  BandwidthLimiter download;
+
+  Impl(const std::string &baseUrl, TransferSchedulerOptions options,
+       RetryOptions retryOptions)
+      : scheduler(std::move(options)), retry(retryOptions) {
+#ifndef _WIN32
+    // A server that answers before reading the whole body (a 503 to an
+    // upload) closes on a socket we still write to; that must fail the
+    // attempt, not kill the process. httplib only does this for servers.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    for (size_t i = 0; i < scheduler.connections(); ++i) {
+      auto client = std::make_unique<httplib::Client>(baseUrl);
+      client->set_connection_timeout(30, 0);
+      client->set_read_timeout(30, 0);
+      client->set_write_timeout(30, 0);
+      client->set_follow_location(true);
+      client->set_keep_alive(true);
+      // Small requests would otherwise wait on delayed ACKs
+      client->set_tcp_nodelay(true);
+      clients.push_back(std::move(client));
+    }
+  }
+
+  using Request = std::function<httplib::Result(httplib::Client &)>;
+
+  // Runs request on a pooled client, and again after a backoff while it
+  // fails in a way worth retrying. A request that is not idempotent is
+  // only repeated when the server cannot have acted on it. The connection
+  // is given back between attempts.
+  httplib::Result send(TransferClass cls, const std::string &endpoint,
+                       int64_t size, bool idempotent,
+                       const Request &request) {
+    httplib::Result res;
+    for (int attempt = 1;; ++attempt) {
+      if (!retry.allowRequest()) {
+        if (attempt == 1)
+          res = httplib::Result(nullptr, httplib::Error::Connection);
+        return res;
+      }
+      {
+        auto lease = scheduler.acquire({cls, size, endpoint});
+        res = request(*clients[lease.slot()]);
+      }
+      Verdict verdict = judge(res, idempotent);
+      if (!res && res.error() == httplib::Error::Canceled)
+        retry.recordCanceled();
+      else if (verdict.serverFailed)
+        retry.recordFailure();
+      else
+        retry.recordSuccess();
+      if (!verdict.retry || attempt >= retry.options().maxAttempts)
+        return res;
+      auto delay = retry.backoff(attempt - 1, retryAfter(res));
+      std::cerr << "[API] " << endpoint << " " << describe(res)
+                << ", retrying in " << delay.count() << " ms" << std::endl;
+      std::this_thread::sleep_for(delay);
+    }
+  }
+
+  // Request codings the server accepts, from its Accept-Encoding header
+  std::mutex codingsMtx;
+  std::vector<ContentCoding> serverCodings;
+
+  void learnCodings(const httplib::Result &res) {
+    if (!res || !res->has_header("Accept-Encoding"))
+      return;
+    std::vector<ContentCoding> codings;
+    std::stringstream ss(res->get_header_value("Accept-Encoding"));
+    std::string token;
+    while (std::getline(ss, token, ',')) {
+      token.erase(0, token.find_first_not_of(' '));
+      token.erase(token.find_last_not_of(' ') + 1);
+      if (auto coding = parseCoding(token))
+        codings.push_back(*coding);
+    }
+    std::lock_guard<std::mutex> lock(codingsMtx);
+    serverCodings = std::move(codings);
+  }
+
+  // Optional endpoints (batches, /haveContent) the server answered 404 for
+  std::mutex batchMtx;
+  std::set<std::string> missingBatch;
+
+  bool hasEndpoint(const std::string &endpoint) {
+    std::lock_guard<std::mutex> lock(batchMtx);
+    return missingBatch.count(endpoint) == 0;
+  }
+
+  void markMissing(const std::string &endpoint) {
+    std::lock_guard<std::mutex> lock(batchMtx);
+    missingBatch.insert(endpoint);
+  }
+
+  // Sends items as body[key] in requests of up to kMaxBatchItems and
+  // returns one result per item. The server may answer {"results": [{"ok":
+  // bool, "error": ...}]} in item order; a plain 200 (empty body or an
+  // object without results) means all went through. Any other reply is
+  // taken as all failed, so nothing is settled on a guess. nullopt when
+  // the first request found no such endpoint.
+  std::optional<std::vector<bool>> sendBatch(const std::string &endpoint,
+                                             bool isDelete, json body,
+                                             const std::string &key,
+                                             std::vector<json> items) {
+    std::vector<bool> results;
+    results.reserve(items.size());
+    for (size_t begin = 0; begin < items.size(); begin += kMaxBatchItems) {
+      size_t end = std::min(items.size(), begin + kMaxBatchItems);
+      body[key] = json::array();
+      for (size_t i = begin; i < end; ++i)
+        body[key].push_back(std::move(items[i]));
+      std::string payload = body.dump();
+      auto res = send(TransferClass::Metadata, endpoint, 0, false,
+                      [&](httplib::Client &client) {
+                        return isDelete ? client.Delete(endpoint, payload,
+                                                        "application/json")
+                                        : client.Post(endpoint, payload,
+                                                      "application/json");
+                      });
+      if (begin == 0 && res && res->status == 404)
+        return std::nullopt;
+      if (!res || res->status != 200) {
+        std::cerr << "[API] " << endpoint << " failed for " << end - begin
+                  << " items" << std::endl;
+        results.insert(results.end(), end - begin, false);
+        continue;
+      }
+      bool bare =
+          res->body.find_first_not_of(" \t\r\n") == std::string::npos;
+      json reply =
+          bare ? json::object() : json::parse(res->body, nullptr, false);
+      if (reply.is_object() && !reply.contains("results")) {
+        results.insert(results.end(), end - begin, true);
+        continue;
+      }
+      if (!reply.is_object() || !reply["results"].is_array() ||
+          reply["results"].size() != end - begin) {
+        std::cerr << "[API] " << endpoint << " gave an unreadable reply for "
+                  << end - begin << " items" << std::endl;
+        results.insert(results.end(), end - begin, false);
+        continue;
+      }
+      for (const auto &item : reply["results"]) {
+        bool ok = item.is_object() && item.value("ok", false);
+        if (!ok && item.is_object() && item.contains("error"))
+          std::cerr << "[API] " << endpoint << ": " << item["error"].dump()
+                    << std::endl;
+        results.push_back(ok);
+      }
+    }
+    return results;
+  }
+
+  // Uses the batch endpoint while the server has it, otherwise one call
+  // per item through each(i)
+  std::vector<bool> batchOrEach(const std::string &endpoint, json body,
+                                const std::string &key,
+                                std::vector<json> items,
+                                const std::function<bool(size_t)> &each) {
+    size_t count = items.size();
+    if (hasEndpoint(endpoint)) {
+      if (auto results = sendBatch(endpoint, false, std::move(body), key,
+                                   std::move(items)))
+        return *results;
+      std::cout << "[API] Server has no " << endpoint
+                << ", sending items one by one" << std::endl;
+      markMissing(endpoint);
+    }
+    std::vector<bool> results(count);
+    for (size_t i = 0; i < count; ++i)
+      results[i] = each(i);
+    return results;
   }
 };
 
-ApiClient::ApiClient(const std::string &baseUrl, const std::string &userEmail)
+namespace {
+
+// Entry of the fileIds array of /deleteFiles
+json fileIdJson(const FileQueueEntry &file, const std::string &device,
+                const std::string &directory) {
+  json fileId;
+  fileId["id"] = file.uuid;
+  fileId["origin"] = file.uuid;
+  fileId["dir"] = directory;
+  fileId["versions"] = 1;
+  fileId["path"] = "device=" + urlEncode(device) +
+                   "&dir=" + urlEncode(directory) +
+                   "&file=" + urlEncode(file.filename);
+  return fileId;
+}
+
+// Body of /renameFile, one item of /renameFiles
+json renameJson(const FileQueueEntry &file, const std::string &device,
+                const std::string &directory, const std::string &username) {
+  json data;
+  data["type"] = "fi";
+  data["dir"] = directory;
+  data["device"] = device;
+  data["filename"] = file.old_filename.value_or("");
+  data["to"] = file.filename;
+  data["origin"] = file.origin;
+  data["username"] = username;
+  return data;
+}
+
+bool isMove(const FileQueueEntry &file) {
+  return file.old_path.has_value() && *file.old_path != file.path;
+}
+
+} // namespace
+
+// Writes a streamed body part through the upload's encoder, if any, and
+// the upload bandwidth limit
+class EncodingSink {
+public:
+  EncodingSink(ContentCoding coding, BandwidthLimiter &limiter)
+      : m_coding(coding), m_limiter(limiter),
+        m_codec(StreamCodec::encoder(coding)) {}
+
+  // Starts a fresh body, for another attempt
+  void restart() { m_codec = StreamCodec::encoder(m_coding); }
+
+  // last flushes the encoder; call it once after the final data. False
+  // only if the encoder fails: a write the connection refused is left for
+  // httplib to report as a write error, which may be retried, where a
+  // failed provider would read as the upload cancelling itself.
+  bool write(httplib::DataSink &sink, const char *data, size_t len,
+             bool last) {
+    if (!m_codec) {
+      if (len > 0)
+        send(sink, data, len);
+      return true;
+    }
+    m_out.clear();
+    if (!m_codec->process(data, len, last, m_out))
+      return false;
+    if (!m_out.empty())
+      send(sink, m_out.data(), m_out.size());
+    return true;
+  }
+
+private:
+  ContentCoding m_coding;
+  BandwidthLimiter &m_limiter;
+  std::unique_ptr<StreamCodec> m_codec;
+  std::string m_out;
+
+  void send(httplib::DataSink &sink, const char *data, size_t len) {
+    m_limiter.consume(len);
+    sink.write(data, len);
+  }
+};
+
+ApiClient::ApiClient(const std::string &baseUrl, const std::string &userEmail,
+                     TransferSchedulerOptions transfers, RetryOptions retry)
     : m_baseUrl(baseUrl), m_userEmail(userEmail),
-      m_impl(std::make_unique<Impl>(baseUrl)) {}
+      m_impl(std::make_unique<Impl>(baseUrl, std::move(transfers), retry)) {}
 
 ApiClient::~ApiClient() = default;
 
-std::optional<CloudMetadataResult> ApiClient::getMetadata() {
+TransferStats ApiClient::transferStats() const {
+  return m_impl->scheduler.stats();
+}
+
+void ApiClient::setBandwidthLimits(int64_t uploadBytesPerSecond,
+                                   int64_t downloadBytesPerSecond) {
+  m_impl->upload.setRate(uploadBytesPerSecond);
+  m_impl->download.setRate(downloadBytesPerSecond);
+}
+
+bool ApiClient::serverReachable() const { return !m_impl->retry.circuitOpen(); }
+
+bool ApiClient::fetchSyncItems(
+    const std::function<void(CloudFileMetadata &&)> &onFile,
+    const std::function<void(CloudFolderMetadata &&)> &onFolder,
+    const std::function<void()> &onRestart) {
   std::string path = "/getSyncItems?username=" + urlEncode(m_userEmail);
-  auto res = m_impl->client.Get(path.c_str());
+  // Items are parsed as the body arrives; the listing is never held whole.
+  // httplib only offers its codings by itself when it buffers the body.
+  httplib::Headers headers;
+  if (!acceptEncoding().empty())
+    headers.emplace("Accept-Encoding", acceptEncoding());
+  std::optional<SyncItemsParser> parser;
+  int status = -1;
+  auto res = m_impl->send(
+      TransferClass::Metadata, "/getSyncItems", 0, true,
+      [&](httplib::Client &client) {
+        if (parser && parser->itemCount() > 0)
+          onRestart();
+        parser.emplace(onFile, onFolder);
+        status = -1;
+        // An error body is not fed to the parser, so it cannot end the
+        // request before the status has been seen
+        return client.Get(
+            path, headers,
+            [&](const httplib::Response &response) {
+              status = response.status;
+              return true;
+            },
+            [&](const char *data, size_t data_length) {
+              return status != 200 || parser->feed(data, data_length);
+            });
+      });
+  m_impl->learnCodings(res);
 
-  if (res && res->status == 200) {
-    try {
-      auto data = json::parse(res->body);
-      CloudMetadataResult result;
-      result.success = true;
-
-      for (const auto &item : data["items"]) {
-        if (item["type"] == "file") {
-          CloudFileMetadata file;
-          file.uuid = item["uuid"];
-          file.filename = item["filename"];
-          file.path = "/"; // Fallback
-          if (item.contains("device") && item.contains("directory")) {
-            std::string device = item["device"];
-            std::string directory = item["directory"];
-            if (device == "/")
-              file.path = "/";
-            else if (directory == "/")
-              file.path = "/" + device;
-            else
-              file.path = "/" + device + "/" + directory;
-          }
-          file.origin = item["origin"];
-          file.hashvalue = item["checksum"];
-          file.size = item["size"];
-          file.last_modified = item["mtime"];
-          file.versions = item["version"];
-          if (item.contains("conflictId") && !item["conflictId"].is_null()) {
-            file.conflictId = item["conflictId"].get<std::string>();
-          }
-          result.files.push_back(file);
-        } else {
-          CloudFolderMetadata folder;
-          folder.uuid = item["uuid"];
-          folder.device = item["device"];
-          folder.folder = item["folder"];
-          folder.path = item["path"];
-          if (item.contains("created_at"))
-            folder.created_at = item["created_at"];
-          result.directories.push_back(folder);
-        }
-      }
-      return result;
-    } catch (const std::exception &e) {
-      std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
-    }
-  } else {
-    std::cerr << "[API] Request failed with status: "
-              << (res ? res->status : -1) << std::endl;
+  if (!res && res.error() != httplib::Error::Canceled) {
+    std::cerr << "[API] Listing failed: " << httplib::to_string(res.error())
+              << std::endl;
+    return false;
   }
-  return std::nullopt;
+  if (status != 200) {
+    std::cerr << "[API] Request failed with status: " << status << std::endl;
+    return false;
+  }
+  if (!parser->finish()) {
+    std::cerr << "[API] JSON Parse Error: " << parser->error() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::optional<CloudMetadataResult> ApiClient::getMetadata() {
+  CloudMetadataResult result;
+  result.success = fetchSyncItems(
+      [&](CloudFileMetadata &&file) { result.files.push_back(std::move(file)); },
+      [&](CloudFolderMetadata &&folder) {
+        result.directories.push_back(std::move(folder));
+      },
+      [&] {
+        result.files.clear();
+        result.directories.clear();
+      });
+  if (!result.success)
+    return std::nullopt;
+  return result;
+}
+
+std::optional<CloudMetadataTable> ApiClient::getMetadataCompact() {
+  CloudMetadataTable table;
+  bool ok = fetchSyncItems(
+      [&](CloudFileMetadata &&file) { table.addFile(file); },
+      [&](CloudFolderMetadata &&folder) {
+        table.addFolder(std::move(folder));
+      },
+      [&] { table = CloudMetadataTable(); });
+  if (!ok)
+    return std::nullopt;
+  table.sortByKey();
+  return table;
 }
 
 bool ApiClient::downloadFile(const CloudFileMetadata &file,
@@ -115,98 +469,549 @@ bool ApiClient::downloadFile(const CloudFileMetadata &file,
                       "&uuid=" + urlEncode(file.uuid) +
                       "&db=file&username=" + urlEncode(m_userEmail);
 
-  std::ofstream ofs(localAbsPath, std::ios::binary);
-  if (!ofs)
+  // Written beside the destination and moved into place only once it
+  // hashes to what the listing promised
+  AtomicFileWriter out(localAbsPath);
+  if (!out.open(file.size))
     return false;
 
-  auto res = m_impl->client.Get(query.c_str(),
-                                [&](const char *data, size_t data_length) {
-                                  ofs.write(data, data_length);
-                                  return true;
-                                });
-
-  return res && res->status == 200;
+  // httplib only offers its codings by itself when it buffers the body;
+  // it still decodes a compressed reply for the receiver below
+  httplib::Headers headers;
+  if (!acceptEncoding().empty())
+    headers.emplace("Accept-Encoding", acceptEncoding());
+  // The limit counts decoded bytes, which a compressed reply keeps below
+  // what actually crosses the wire
+  int status = 0;
+  auto res = m_impl->send(
+      TransferClass::Content, "/syncDownFile", file.size, true,
+      [&](httplib::Client &client) {
+        // Every attempt starts the file over
+        status = 0;
+        if (out.bytesWritten() > 0 && !out.open(file.size))
+          return httplib::Result(nullptr, httplib::Error::Canceled);
+        return client.Get(
+            query, headers,
+            [&](const httplib::Response &response) {
+              status = response.status;
+              return true;
+            },
+            [&](const char *data, size_t data_length) {
+              if (status != 200)
+                return true;
+              m_impl->download.consume(data_length);
+              return out.write(data, data_length);
+            });
+      });
+  if (!res || res->status != 200) {
+    std::cerr << "[API] Download of " << file.filename << " failed"
+              << (res ? " with status " + std::to_string(res->status)
+                      : ": " + httplib::to_string(res.error()))
+              << std::endl;
+    out.abort();
+    return false;
+  }
+  return out.commit(file.hashvalue);
 }
 
-std::optional<std::string>
-ApiClient::uploadFile(const FileQueueEntry &file,
-                      const std::vector<std::string> &pathIds) {
-  std::ifstream ifs(file.absPath, std::ios::binary);
-  if (!ifs)
-    return std::nullopt;
-
-  std::string content((std::istreambuf_iterator<char>(ifs)),
-                      (std::istreambuf_iterator<char>()));
-
-  auto parts = parsePath(file.path);
+// Upload description the server stores with the file
+static json makeFilestat(const FileQueueEntry &file,
+                         const std::vector<std::string> &pathIds,
+                         const std::string &device,
+                         const std::string &directory,
+                         const std::string &userEmail) {
   json filestat;
   filestat["filename"] = file.filename;
-  filestat["directory"] = parts.directory;
-  filestat["device"] = parts.device;
+  filestat["directory"] = directory;
+  filestat["device"] = device;
   filestat["uuid"] = file.uuid;
   filestat["origin"] = file.origin;
   filestat["checksum"] = file.hashvalue;
   filestat["size"] = file.size;
   filestat["mtime"] = file.last_modified;
-  filestat["username"] = m_userEmail;
+  filestat["username"] = userEmail;
   filestat["version"] = file.versions;
   filestat["isModified"] = (file.sync_status == "modified");
   filestat["pathids"] = pathIds;
   filestat["type"] = file.filename.substr(file.filename.find_last_of(".") + 1);
+  return filestat;
+}
+
+std::optional<std::string>
+ApiClient::uploadFile(const FileQueueEntry &file,
+                      const std::vector<std::string> &pathIds) {
+  std::ifstream ifs(file.absPath, std::ios::binary);
+  if (!ifs)
+    return std::nullopt;
+
+  auto parts = parsePath(file.path);
+  json filestat = makeFilestat(file, pathIds, parts.device, parts.directory,
+                               m_userEmail);
+  ContentCoding coding = uploadCoding(file);
+  if (coding != ContentCoding::Identity)
+    filestat["encoding"] = codingName(coding);
+  EncodingSink out(coding, m_impl->upload);
+
+  // The file part is streamed from disk and hashed as it goes. If the
+  // bytes no longer match the checksum we announced, the body is cut off
+  // before its end so the server never stores a torn upload. Without a
+  // checksum only the size is checked.
+  std::vector<char> buffer(kUploadChunkSize);
+  picosha2::hash256_one_by_one hasher;
+  bool hashing = !file.hashvalue.empty();
+  int64_t sent = 0;
+  bool changed = false;
+  auto provider = [&](size_t, httplib::DataSink &sink) {
+    ifs.read(buffer.data(), buffer.size());
+    std::streamsize n = ifs.gcount();
+    if (n > 0) {
+      if (hashing)
+        hasher.process(buffer.begin(), buffer.begin() + n);
+      sent += n;
+      if (!out.write(sink, buffer.data(), static_cast<size_t>(n), false))
+        return false;
+    }
+    if (!ifs.eof())
+      return static_cast<bool>(ifs);
+    if (hashing)
+      hasher.finish();
+    changed = sent != file.size ||
+              (hashing &&
+               picosha2::get_hash_hex_string(hasher) != file.hashvalue);
+    if (changed || !out.write(sink, nullptr, 0, true))
+      return false;
+    sink.done();
+    return true;
+  };
 
   httplib::UploadFormDataItems items = {
-      {"file", content, file.filename, "application/octet-stream"},
       {"filestat", filestat.dump(), "", "application/json"}};
+  httplib::FormDataProviderItems providers = {
+      {"file", provider, file.filename, "application/octet-stream"}};
 
-  auto res = m_impl->client.Post("/syncUpFile", items);
+  // Uploads are stored by uuid, so sending one twice is harmless
+  auto res = m_impl->send(
+      TransferClass::Content, "/syncUpFile", file.size, true,
+      [&](httplib::Client &client) {
+        ifs.clear();
+        ifs.seekg(0);
+        hasher.init();
+        sent = 0;
+        out.restart();
+        return client.Post("/syncUpFile", httplib::Headers(), items,
+                           providers);
+      });
+  if (changed) {
+    std::cerr << "[ApiClient] " << file.absPath
+              << " changed during upload, aborted" << std::endl;
+    return std::nullopt;
+  }
   if (res && res->status == 200) {
     auto resJson = json::parse(res->body);
     return resJson["id"].get<std::string>();
   }
-
+  std::cerr << "[API] Upload of " << file.filename << " " << describe(res)
+            << std::endl;
   return std::nullopt;
 }
 
-bool ApiClient::deleteFile(const FileQueueEntry &file) {
+std::optional<BlockSignatures>
+ApiClient::getBlockSignatures(const FileQueueEntry &file, size_t blockSize) {
+  std::string query = "/fileSignatures?uuid=" + urlEncode(file.uuid) +
+                      "&blockSize=" + std::to_string(blockSize) +
+                      "&username=" + urlEncode(m_userEmail);
+  auto res = m_impl->send(
+      TransferClass::Metadata, "/fileSignatures", 0, true,
+      [&](httplib::Client &client) { return client.Get(query); });
+  m_impl->learnCodings(res);
+  if (!res || res->status != 200)
+    return std::nullopt;
+  try {
+    auto data = json::parse(res->body);
+    BlockSignatures sigs;
+    sigs.checksum = data["checksum"];
+    sigs.blockSize = data["blockSize"];
+    if (sigs.blockSize != blockSize)
+      return std::nullopt;
+    for (const auto &block : data["blocks"])
+      sigs.blocks.push_back({block["weak"], block["strong"]});
+    return sigs;
+  } catch (const std::exception &e) {
+    std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
+
+std::optional<std::string>
+ApiClient::uploadDelta(const FileQueueEntry &file,
+                       const std::vector<std::string> &pathIds) {
+  size_t blockSize = deltaBlockSize(file.size);
+  auto sigs = getBlockSignatures(file, blockSize);
+  if (!sigs)
+    return std::nullopt;
+  std::ifstream ifs(file.absPath, std::ios::binary);
+  if (!ifs)
+    return std::nullopt;
+
   auto parts = parsePath(file.path);
-  json data;
-  data["username"] = m_userEmail;
-  data["directories"] = json::array();
+  json filestat = makeFilestat(file, pathIds, parts.device, parts.directory,
+                               m_userEmail);
+  // The server applies the delta only to the version it signed
+  filestat["baseChecksum"] = sigs->checksum;
+  ContentCoding coding = uploadCoding(file);
+  if (coding != ContentCoding::Identity)
+    filestat["encoding"] = codingName(coding);
+  EncodingSink out(coding, m_impl->upload);
 
-  json fileId;
-  fileId["id"] = file.uuid;
-  fileId["origin"] = file.uuid;
-  fileId["dir"] = parts.directory;
-  fileId["versions"] = 1;
+  // Same torn-upload guard as uploadFile: the body is cut off if the
+  // content no longer hashes to the checksum we announced
+  std::optional<DeltaEncoder> encoder;
+  std::string chunk;
+  bool changed = false;
+  auto provider = [&](size_t, httplib::DataSink &sink) {
+    chunk.clear();
+    encoder->next(chunk);
+    if (encoder->failed())
+      return false;
+    if (!out.write(sink, chunk.data(), chunk.size(), false))
+      return false;
+    if (!encoder->done())
+      return true;
+    changed = encoder->bytesRead() != file.size ||
+              (!file.hashvalue.empty() && encoder->sha256() != file.hashvalue);
+    if (changed || !out.write(sink, nullptr, 0, true))
+      return false;
+    sink.done();
+    return true;
+  };
 
-  std::string pathInfo = "device=" + urlEncode(parts.device) +
-                         "&dir=" + urlEncode(parts.directory) +
-                         "&file=" + urlEncode(file.filename);
-  fileId["path"] = pathInfo;
+  httplib::UploadFormDataItems items = {
+      {"filestat", filestat.dump(), "", "application/json"}};
+  httplib::FormDataProviderItems providers = {
+      {"delta", provider, file.filename, "application/octet-stream"}};
 
-  data["fileIds"] = json::array({fileId});
+  // A delta the server already applied no longer matches its base and
+  // is refused, so a repeat cannot apply it twice
+  auto res = m_impl->send(
+      TransferClass::Content, "/syncDeltaFile", file.size, true,
+      [&](httplib::Client &client) {
+        ifs.clear();
+        ifs.seekg(0);
+        encoder.emplace(ifs, blockSize, sigs->blocks);
+        out.restart();
+        return client.Post("/syncDeltaFile", httplib::Headers(), items,
+                           providers);
+      });
+  if (changed) {
+    std::cerr << "[ApiClient] " << file.absPath
+              << " changed during upload, aborted" << std::endl;
+    return std::nullopt;
+  }
+  if (!res || res->status != 200)
+    return std::nullopt;
+  std::cout << "[API] Delta upload of " << file.filename << " sent "
+            << encoder->literalBytes() << " of " << file.size
+            << " bytes as data" << std::endl;
+  try {
+    return json::parse(res->body)["id"].get<std::string>();
+  } catch (const std::exception &e) {
+    std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
 
-  auto res =
-      m_impl->client.Delete("/deleteFiles", data.dump(), "application/json");
+ContentCoding ApiClient::uploadCoding(const FileQueueEntry &file) {
+  std::vector<ContentCoding> server;
+  {
+    std::lock_guard<std::mutex> lock(m_impl->codingsMtx);
+    server = m_impl->serverCodings;
+  }
+  for (ContentCoding coding : supportedCodings()) {
+    if (std::find(server.begin(), server.end(), coding) != server.end())
+      return isCompressible(file.absPath) ? coding : ContentCoding::Identity;
+  }
+  return ContentCoding::Identity;
+}
+
+std::optional<std::string>
+ApiClient::startUpload(const FileQueueEntry &file,
+                       const std::vector<std::string> &pathIds,
+                       int64_t partSize, ContentCoding coding) {
+  auto parts = parsePath(file.path);
+  json data;
+  data["filestat"] = makeFilestat(file, pathIds, parts.device,
+                                  parts.directory, m_userEmail);
+  data["partSize"] = partSize;
+  if (coding != ContentCoding::Identity)
+    data["filestat"]["encoding"] = codingName(coding);
+
+  // A session started twice leaves one unused until the server expires it
+  std::string body = data.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/uploads", 0, true,
+                          [&](httplib::Client &client) {
+                            return client.Post("/uploads", body,
+                                               "application/json");
+                          });
+  if (!res || res->status != 200)
+    return std::nullopt;
+  try {
+    return json::parse(res->body)["uploadId"].get<std::string>();
+  } catch (const std::exception &e) {
+    std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
+
+bool ApiClient::uploadPart(const std::string &uploadId, int64_t partNumber,
+                           const char *data, size_t size,
+                           const std::string &sha256, ContentCoding coding) {
+  // The checksum covers the raw part; the server checks it after decoding
+  std::string encoded;
+  if (auto codec = StreamCodec::encoder(coding)) {
+    if (!codec->process(data, size, true, encoded))
+      return false;
+    data = encoded.data();
+    size = encoded.size();
+  }
+
+  std::string path = "/uploads/" + urlEncode(uploadId) + "/parts/" +
+                     std::to_string(partNumber);
+  httplib::Headers headers = {{"X-Content-Sha256", sha256}};
+  auto res = m_impl->send(
+      TransferClass::Content, "/uploads/parts", static_cast<int64_t>(size),
+      true, [&](httplib::Client &client) {
+        // Progress is reported as the body goes out, so the limit paces
+        // it rather than the part as a whole
+        size_t paid = 0;
+        return client.Put(path, headers, data, size,
+                          "application/octet-stream",
+                          [&](size_t current, size_t) {
+                            m_impl->upload.consume(current - paid);
+                            paid = current;
+                            return true;
+                          });
+      });
   return res && res->status == 200;
 }
 
+std::optional<std::string>
+ApiClient::commitUpload(const std::string &uploadId, int64_t partCount,
+                        const std::string &checksum, bool *rejected) {
+  json data;
+  data["parts"] = partCount;
+  data["checksum"] = checksum;
+  std::string path = "/uploads/" + urlEncode(uploadId) + "/commit";
+  std::string body = data.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/uploads/commit", 0,
+                          false, [&](httplib::Client &client) {
+                            return client.Post(path, body,
+                                               "application/json");
+                          });
+  if (!res || res->status != 200) {
+    std::cerr << "[API] Commit of upload " << uploadId
+              << " failed with status: " << (res ? res->status : -1)
+              << std::endl;
+    if (rejected && res)
+      *rejected = !RetryPolicy::isRetryableStatus(res->status);
+    return std::nullopt;
+  }
+  try {
+    return json::parse(res->body)["id"].get<std::string>();
+  } catch (const std::exception &e) {
+    std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
+
+std::optional<std::vector<bool>>
+ApiClient::haveContent(std::span<const std::string> hashes) {
+  if (!m_impl->hasEndpoint("/haveContent"))
+    return std::nullopt;
+  std::vector<bool> have;
+  have.reserve(hashes.size());
+  for (size_t begin = 0; begin < hashes.size(); begin += kMaxHaveHashes) {
+    auto chunk = hashes.subspan(
+        begin, std::min(kMaxHaveHashes, hashes.size() - begin));
+    json data;
+    data["username"] = m_userEmail;
+    data["hashes"] = std::vector<std::string>(chunk.begin(), chunk.end());
+    std::string body = data.dump();
+    auto res = m_impl->send(TransferClass::Metadata, "/haveContent", 0, true,
+                            [&](httplib::Client &client) {
+                              return client.Post("/haveContent", body,
+                                                 "application/json");
+                            });
+    if (res && res->status == 404) {
+      std::cout << "[API] Server has no /haveContent, uploads always send "
+                << "their content" << std::endl;
+      m_impl->markMissing("/haveContent");
+      return std::nullopt;
+    }
+    if (!res || res->status != 200) {
+      std::cerr << "[API] /haveContent " << describe(res) << std::endl;
+      return std::nullopt;
+    }
+    // The answer lists the hashes the server holds, in any order
+    json reply = json::parse(res->body, nullptr, false);
+    if (!reply.is_object() || !reply.contains("have") ||
+        !reply["have"].is_array()) {
+      std::cerr << "[API] /haveContent answered without a have list"
+                << std::endl;
+      return std::nullopt;
+    }
+    std::set<std::string> held;
+    for (const auto &hash : reply["have"]) {
+      if (hash.is_string())
+        held.insert(hash.get<std::string>());
+    }
+    for (const auto &hash : chunk)
+      have.push_back(held.count(hash) > 0);
+  }
+  return have;
+}
+
+std::optional<std::string>
+ApiClient::linkFile(const FileQueueEntry &file,
+                    const std::vector<std::string> &pathIds) {
+  // Both endpoints come together
+  if (!m_impl->hasEndpoint("/haveContent"))
+    return std::nullopt;
+  auto parts = parsePath(file.path);
+  json data;
+  data["filestat"] = makeFilestat(file, pathIds, parts.device,
+                                  parts.directory, m_userEmail);
+  // Stored by uuid like an upload, so repeating it is harmless
+  std::string body = data.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/linkFile", 0, true,
+                          [&](httplib::Client &client) {
+                            return client.Post("/linkFile", body,
+                                               "application/json");
+                          });
+  if (!res || res->status != 200)
+    return std::nullopt;
+  try {
+    return json::parse(res->body)["id"].get<std::string>();
+  } catch (const std::exception &e) {
+    std::cerr << "[API] JSON Parse Error: " << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
+
+bool ApiClient::deleteFile(const FileQueueEntry &file) {
+  return deleteFiles({&file, 1}).front();
+}
+
+std::vector<bool>
+ApiClient::deleteFiles(std::span<const FileQueueEntry> files) {
+  std::vector<json> fileIds;
+  fileIds.reserve(files.size());
+  for (const auto &file : files) {
+    auto parts = parsePath(file.path);
+    fileIds.push_back(fileIdJson(file, parts.device, parts.directory));
+  }
+  json data;
+  data["username"] = m_userEmail;
+  data["directories"] = json::array();
+  return m_impl
+      ->sendBatch("/deleteFiles", true, std::move(data), "fileIds",
+                  std::move(fileIds))
+      .value_or(std::vector<bool>(files.size(), false));
+}
+
 bool ApiClient::renameFile(const FileQueueEntry &file) {
+  if (isMove(file))
+    return moveFile(file);
+
   auto parts = parsePath(file.path);
+  json outerData;
+  outerData["data"] =
+      renameJson(file, parts.device, parts.directory, m_userEmail);
+
+  std::string body = outerData.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/renameFile", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Post("/renameFile", body,
+                                               "application/json");
+                          });
+  return res && res->status == 200;
+}
+
+std::vector<bool>
+ApiClient::renameFiles(std::span<const FileQueueEntry> files) {
+  std::vector<bool> results(files.size(), false);
+  // Moves have no batch form and go one by one
+  std::vector<size_t> renames;
+  std::vector<json> items;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (isMove(files[i])) {
+      results[i] = moveFile(files[i]);
+      continue;
+    }
+    auto parts = parsePath(files[i].path);
+    renames.push_back(i);
+    items.push_back(
+        renameJson(files[i], parts.device, parts.directory, m_userEmail));
+  }
+  json data;
+  data["username"] = m_userEmail;
+  auto renamed = m_impl->batchOrEach(
+      "/renameFiles", std::move(data), "items", std::move(items),
+      [&](size_t i) { return renameFile(files[renames[i]]); });
+  for (size_t i = 0; i < renames.size(); ++i)
+    results[renames[i]] = renamed[i];
+  return results;
+}
+
+bool ApiClient::moveFile(const FileQueueEntry &file) {
+  auto from = parsePath(file.old_path.value_or(file.path));
+  auto to = parsePath(file.path);
   json innerData;
   innerData["type"] = "fi";
-  innerData["dir"] = parts.directory;
-  innerData["device"] = parts.device;
-  innerData["filename"] = file.old_filename.value_or("");
-  innerData["to"] = file.filename;
   innerData["origin"] = file.origin;
+  innerData["fromDevice"] = from.device;
+  innerData["fromDir"] = from.directory;
+  innerData["filename"] = file.old_filename.value_or(file.filename);
+  innerData["toDevice"] = to.device;
+  innerData["toDir"] = to.directory;
+  innerData["to"] = file.filename;
   innerData["username"] = m_userEmail;
 
   json outerData;
   outerData["data"] = innerData;
 
-  auto res =
-      m_impl->client.Post("/renameFile", outerData.dump(), "application/json");
+  std::string body = outerData.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/moveFile", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Post("/moveFile", body,
+                                               "application/json");
+                          });
+  return res && res->status == 200;
+}
+
+bool ApiClient::copyFile(const FileQueueEntry &file) {
+  auto from = parsePath(file.old_path.value_or(file.path));
+  auto to = parsePath(file.path);
+  json data;
+  data["fromDevice"] = from.device;
+  data["fromDir"] = from.directory;
+  data["fromFilename"] = file.old_filename.value_or(file.filename);
+  data["device"] = to.device;
+  data["directory"] = to.directory;
+  data["filename"] = file.filename;
+  data["uuid"] = file.uuid;
+  data["origin"] = file.origin;
+  data["checksum"] = file.hashvalue;
+  data["size"] = file.size;
+  data["mtime"] = file.last_modified;
+  data["version"] = file.versions;
+  data["username"] = m_userEmail;
+
+  std::string body = data.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/copyFile", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Post("/copyFile", body,
+                                               "application/json");
+                          });
   return res && res->status == 200;
 }
 
@@ -217,7 +1022,10 @@ bool ApiClient::createFolder(const DirectoryMetadata &dir) {
                       "&uuid=" + urlEncode(dir.uuid) +
                       "&folder=" + urlEncode(dir.folder);
 
-  auto res = m_impl->client.Post(query.c_str());
+  auto res = m_impl->send(TransferClass::Metadata, "/createFolder", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Post(query);
+                          });
   return res && res->status == 200;
 }
 
@@ -229,7 +1037,10 @@ bool ApiClient::deleteFolder(const DirectoryMetadata &dir) {
                       "&username=" + urlEncode(m_userEmail) +
                       "&device=" + urlEncode(dir.device);
 
-  auto res = m_impl->client.Delete(query.c_str());
+  auto res = m_impl->send(TransferClass::Metadata, "/deleteFolder", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Delete(query);
+                          });
   return res && res->status == 200;
 }
 
@@ -239,11 +1050,67 @@ bool ApiClient::renameFolder(const DirectoryQueueEntry &dir) {
   data["newPath"] = dir.path;
   data["username"] = m_userEmail;
 
-  auto res =
-      m_impl->client.Post("/renameFolder", data.dump(), "application/json");
+  std::string body = data.dump();
+  auto res = m_impl->send(TransferClass::Metadata, "/renameFolder", 0, false,
+                          [&](httplib::Client &client) {
+                            return client.Post("/renameFolder", body,
+                                               "application/json");
+                          });
   return res && res->status == 200;
 }
 
+// Servers apply batch items in order, so parents listed before their
+// children are created first
+std::vector<bool>
+ApiClient::createFolders(std::span<const DirectoryMetadata> dirs) {
+  std::vector<json> folders;
+  folders.reserve(dirs.size());
+  for (const auto &dir : dirs)
+    folders.push_back({{"path", dir.path},
+                       {"device", dir.device},
+                       {"uuid", dir.uuid},
+                       {"folder", dir.folder}});
+  json data;
+  data["username"] = m_userEmail;
+  return m_impl->batchOrEach("/createFolders", std::move(data), "folders",
+                             std::move(folders),
+                             [&](size_t i) { return createFolder(dirs[i]); });
+}
+
+// The directories array of /deleteFiles takes the same fields as
+// /deleteFolder
+std::vector<bool>
+ApiClient::deleteFolders(std::span<const DirectoryMetadata> dirs) {
+  std::vector<json> directories;
+  directories.reserve(dirs.size());
+  for (const auto &dir : dirs)
+    directories.push_back({{"path", dir.path},
+                           {"folder", dir.folder},
+                           {"directory", parsePath(dir.path).directory},
+                           {"device", dir.device}});
+  json data;
+  data["username"] = m_userEmail;
+  data["fileIds"] = json::array();
+  return m_impl
+      ->sendBatch("/deleteFiles", true, std::move(data), "directories",
+                  std::move(directories))
+      .value_or(std::vector<bool>(dirs.size(), false));
+}
+
+std::vector<bool>
+ApiClient::renameFolders(std::span<const DirectoryQueueEntry> dirs) {
+  std::vector<json> folders;
+  folders.reserve(dirs.size());
+  for (const auto &dir : dirs)
+    folders.push_back(
+        {{"oldPath", dir.old_path.value_or("")}, {"newPath", dir.path}});
+  json data;
+  data["username"] = m_userEmail;
+  return m_impl->batchOrEach("/renameFolders", std::move(data), "folders",
+                             std::move(folders),
+                             [&](size_t i) { return renameFolder(dirs[i]); });
+}
+
 ApiClient::PathParts ApiClient::parsePath(const std::string &path) {
   if (path.empty() || path == "/")
     return {"/", "/"};
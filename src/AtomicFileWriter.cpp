@@ -0,0 +1,193 @@
+#include "AtomicFileWriter.hpp"
+#include "picosha2.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace sync {
+
+namespace {
+
+constexpr const char *kTempSuffix = ".syncpart";
+// Written data is flushed to disk in batches of this size
+constexpr int64_t kSyncInterval = 8 * 1024 * 1024;
+
+bool syncFile(std::FILE *file) {
+  if (std::fflush(file) != 0)
+    return false;
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+  return fdatasync(fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes the rename itself survive a crash
+void syncDirectory(const fs::path &dir) {
+#ifndef _WIN32
+  int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+#endif
+}
+
+bool sameHash(const std::string &a, const std::string &b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+} // namespace
+
+struct AtomicFileWriter::Impl {
+  std::string finalPath;
+  std::string tempPath;
+  std::FILE *file = nullptr;
+  picosha2::hash256_one_by_one hasher;
+  int64_t written = 0;
+  int64_t unsynced = 0;
+  bool failed = false;
+
+  void discard() {
+    if (file)
+      std::fclose(file);
+    file = nullptr;
+    std::error_code ec;
+    fs::remove(tempPath, ec);
+  }
+};
+
+AtomicFileWriter::AtomicFileWriter(std::string finalPath)
+    : m_impl(std::make_unique<Impl>()) {
+  m_impl->tempPath = tempPathFor(finalPath);
+  m_impl->finalPath = std::move(finalPath);
+}
+
+AtomicFileWriter::~AtomicFileWriter() {
+  if (m_impl->file)
+    m_impl->discard();
+}
+
+std::string AtomicFileWriter::tempPathFor(const std::string &finalPath) {
+  fs::path path(finalPath);
+  return (path.parent_path() /
+          ("." + path.filename().string() + kTempSuffix))
+      .string();
+}
+
+bool AtomicFileWriter::isTempPath(const std::string &path) {
+  size_t slash = path.find_last_of("/\\");
+  std::string_view name(path);
+  name.remove_prefix(slash == std::string::npos ? 0 : slash + 1);
+  size_t suffix = std::strlen(kTempSuffix);
+  return name.size() > suffix + 1 && name.front() == '.' &&
+         name.substr(name.size() - suffix) == kTempSuffix;
+}
+
+bool AtomicFileWriter::open(int64_t expectedSize) {
+  if (m_impl->file)
+    std::fclose(m_impl->file);
+  m_impl->hasher.init();
+  m_impl->written = 0;
+  m_impl->unsynced = 0;
+  m_impl->failed = false;
+  // A leftover from an earlier attempt is simply overwritten
+  m_impl->file = std::fopen(m_impl->tempPath.c_str(), "wb");
+  if (!m_impl->file) {
+    std::cerr << "[Download] Cannot create " << m_impl->tempPath << ": "
+              << std::strerror(errno) << std::endl;
+    return false;
+  }
+#ifdef __linux__
+  // KEEP_SIZE reserves the blocks without growing the file, so a short
+  // download still looks short. Only a full disk is worth failing for.
+  int fd = fileno(m_impl->file);
+  if (expectedSize > 0 &&
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, expectedSize) != 0 &&
+      errno == ENOSPC) {
+    std::cerr << "[Download] No space for " << m_impl->finalPath << " ("
+              << expectedSize << " bytes)" << std::endl;
+    m_impl->discard();
+    return false;
+  }
+#else
+  (void)expectedSize;
+#endif
+  return true;
+}
+
+bool AtomicFileWriter::write(const char *data, size_t len) {
+  if (!m_impl->file || m_impl->failed)
+    return false;
+  if (std::fwrite(data, 1, len, m_impl->file) != len) {
+    m_impl->failed = true;
+    return false;
+  }
+  m_impl->hasher.process(data, data + len);
+  m_impl->written += static_cast<int64_t>(len);
+  m_impl->unsynced += static_cast<int64_t>(len);
+  if (m_impl->unsynced >= kSyncInterval) {
+    m_impl->failed = !syncFile(m_impl->file);
+    m_impl->unsynced = 0;
+  }
+  return !m_impl->failed;
+}
+
+bool AtomicFileWriter::commit(const std::string &expectedHash) {
+  if (!m_impl->file)
+    return false;
+  bool ok = !m_impl->failed && syncFile(m_impl->file);
+  ok = std::fclose(m_impl->file) == 0 && ok;
+  m_impl->file = nullptr;
+  if (!ok) {
+    std::cerr << "[Download] Writing " << m_impl->tempPath
+              << " failed: " << std::strerror(errno) << std::endl;
+    m_impl->discard();
+    return false;
+  }
+
+  m_impl->hasher.finish();
+  std::string hash = picosha2::get_hash_hex_string(m_impl->hasher);
+  if (!expectedHash.empty() && !sameHash(hash, expectedHash)) {
+    std::cerr << "[Download] " << m_impl->finalPath << " does not match its "
+              << "checksum (got " << hash << "), discarded" << std::endl;
+    m_impl->discard();
+    return false;
+  }
+
+  std::error_code ec;
+  fs::rename(m_impl->tempPath, m_impl->finalPath, ec);
+  if (ec) {
+    std::cerr << "[Download] Cannot move " << m_impl->tempPath << " into "
+              << "place: " << ec.message() << std::endl;
+    m_impl->discard();
+    return false;
+  }
+  syncDirectory(fs::path(m_impl->finalPath).parent_path());
+  return true;
+}
+
+void AtomicFileWriter::abort() { m_impl->discard(); }
+
+int64_t AtomicFileWriter::bytesWritten() const { return m_impl->written; }
+
+} // namespace sync
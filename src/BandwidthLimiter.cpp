@@ -0,0 +1,48 @@
+#include "BandwidthLimiter.hpp"
+#include <algorithm>
+
+namespace sync {
+
+BandwidthLimiter::BandwidthLimiter(int64_t bytesPerSecond)
+    : m_rate(std::max<int64_t>(bytesPerSecond, 0)),
+      m_tokens(static_cast<double>(m_rate)), m_refilled(Clock::now()) {}
+
+void BandwidthLimiter::refillLocked(Clock::time_point now) {
+  std::chrono::duration<double> elapsed = now - m_refilled;
+  m_refilled = now;
+  m_tokens = std::min(m_tokens + elapsed.count() * static_cast<double>(m_rate),
+                      static_cast<double>(m_rate));
+}
+
+void BandwidthLimiter::setRate(int64_t bytesPerSecond) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    // Time so far is paid for at the old rate
+    refillLocked(Clock::now());
+    m_rate = std::max<int64_t>(bytesPerSecond, 0);
+    m_tokens = std::min(m_tokens, static_cast<double>(m_rate));
+  }
+  m_cv.notify_all();
+}
+
+int64_t BandwidthLimiter::rate() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_rate;
+}
+
+void BandwidthLimiter::consume(size_t len) {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (m_rate > 0) {
+    refillLocked(Clock::now());
+    if (m_tokens >= 0) {
+      m_tokens -= static_cast<double>(len);
+      return;
+    }
+    // Sleep until the debt is paid, or until the rate changes
+    std::chrono::duration<double> wait(-m_tokens /
+                                       static_cast<double>(m_rate));
+    m_cv.wait_for(lock, wait);
+  }
+}
+
+} // namespace sync
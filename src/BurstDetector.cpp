@@ -0,0 +1,150 @@
+#include "BurstDetector.hpp"
+#include <algorithm>
+#include <filesystem>
+
+namespace sync {
+
+namespace {
+
+bool hasPrefix(const std::string &s, const std::string &prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+BurstDetector::BurstDetector(std::string rootPath, BurstOptions options)
+    : m_options(options) {
+  m_root =
+      std::filesystem::path(rootPath).lexically_normal().generic_string();
+  if (m_root.size() > 1 && m_root.back() == '/')
+    m_root.pop_back();
+}
+
+std::string BurstDetector::parentOf(const std::string &path) const {
+  if (path.size() <= m_root.size())
+    return m_root;
+  auto pos = path.find_last_of('/');
+  if (pos == std::string::npos || pos < m_root.size())
+    return m_root;
+  return path.substr(0, pos);
+}
+
+std::map<std::string, BurstDetector::Burst>::iterator
+BurstDetector::coveringBurst(const std::string &dir) {
+  if (m_bursts.empty())
+    return m_bursts.end();
+  std::string d = dir;
+  while (true) {
+    auto it = m_bursts.find(d);
+    if (it != m_bursts.end() || d == m_root)
+      return it;
+    d = parentOf(d);
+  }
+}
+
+BurstDetector::Clock::time_point
+BurstDetector::deadlineOf(const Burst &burst) const {
+  return std::min(burst.lastEvent + m_options.quietPeriod,
+                  burst.started + m_options.maxDelay);
+}
+
+void BurstDetector::startBurst(const std::string &dir, Clock::time_point now) {
+  // A new root swallows any bursts and counters already running below it
+  std::string prefix = dir == "/" ? dir : dir + "/";
+  auto b = m_bursts.lower_bound(prefix);
+  while (b != m_bursts.end() && hasPrefix(b->first, prefix))
+    b = m_bursts.erase(b);
+  auto w = m_windows.lower_bound(prefix);
+  while (w != m_windows.end() && hasPrefix(w->first, prefix))
+    w = m_windows.erase(w);
+  // Its events no longer count towards ancestors, or a busy subtree would
+  // escalate into a rescan of its parent on the next unrelated event
+  auto own = m_windows.find(dir);
+  if (own != m_windows.end()) {
+    size_t count = own->second.count;
+    m_windows.erase(own);
+    for (std::string d = dir; d != m_root;) {
+      d = parentOf(d);
+      auto parent = m_windows.find(d);
+      if (parent != m_windows.end())
+        parent->second.count -= std::min(parent->second.count, count);
+    }
+  }
+  m_bursts[dir] = Burst{now, now, 1};
+}
+
+std::optional<std::string> BurstDetector::absorb(const std::string &path,
+                                                 Clock::time_point now) {
+  if (!hasPrefix(path, m_root))
+    return std::nullopt;
+
+  auto burst = coveringBurst(path);
+  if (burst != m_bursts.end()) {
+    burst->second.lastEvent = now;
+    burst->second.absorbed++;
+    return burst->first;
+  }
+
+  // Count towards the parent and every ancestor. Ancestors always cross the
+  // threshold first, so from the deepest one that did, descend while a
+  // single child holds most of its events: that is the smallest subtree
+  // containing the storm.
+  std::vector<Window *> chain;
+  std::vector<std::string> dirs;
+  std::string dir = parentOf(path);
+  while (true) {
+    Window &w = m_windows[dir];
+    if (w.count == 0 || now - w.start > m_options.window) {
+      w.start = now;
+      w.count = 0;
+    }
+    ++w.count;
+    chain.push_back(&w);
+    dirs.push_back(dir);
+    if (dir == m_root)
+      break;
+    dir = parentOf(dir);
+  }
+  for (size_t i = 0; i < chain.size(); ++i) {
+    if (chain[i]->count < m_options.threshold)
+      continue;
+    while (i > 0 && chain[i - 1]->count * 2 >= chain[i]->count)
+      --i;
+    startBurst(dirs[i], now);
+    return dirs[i];
+  }
+  return std::nullopt;
+}
+
+std::vector<SettledBurst>
+BurstDetector::takeSettled(Clock::time_point now) {
+  std::vector<SettledBurst> settled;
+  for (auto it = m_bursts.begin(); it != m_bursts.end();) {
+    if (now >= deadlineOf(it->second)) {
+      settled.push_back({it->first, it->second.absorbed});
+      it = m_bursts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = m_windows.begin(); it != m_windows.end();) {
+    if (now - it->second.start > m_options.window)
+      it = m_windows.erase(it);
+    else
+      ++it;
+  }
+  return settled;
+}
+
+std::optional<BurstDetector::Clock::time_point>
+BurstDetector::nextDeadline() const {
+  std::optional<Clock::time_point> next;
+  for (const auto &[dir, burst] : m_bursts) {
+    auto deadline = deadlineOf(burst);
+    if (!next || deadline < *next)
+      next = deadline;
+  }
+  return next;
+}
+
+} // namespace sync
@@ -0,0 +1,238 @@
+#include "ChunkedUploader.hpp"
+#include "picosha2.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace sync {
+
+ChunkedUploader::ChunkedUploader(ApiClient &api, DatabaseManager &db,
+                                 ChunkedUploadOptions options)
+    : m_api(api), m_db(db), m_options(options) {}
+
+std::optional<UploadSession>
+ChunkedUploader::resumeOrStart(const FileQueueEntry &file,
+                               const std::vector<std::string> &pathIds) {
+  auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  auto existing = m_db.getUploadSession(file.origin);
+  if (existing && existing->hashvalue == file.hashvalue &&
+      existing->size == file.size &&
+      existing->partSize == m_options.partSize) {
+    // Past this age the server may have dropped the parts
+    std::chrono::seconds created(std::atoll(existing->created_at.c_str()));
+    if (now - created < m_options.sessionMaxAge)
+      return existing;
+  }
+
+  ContentCoding coding = m_api.uploadCoding(file);
+  auto uploadId =
+      m_api.startUpload(file, pathIds, m_options.partSize, coding);
+  if (!uploadId)
+    return std::nullopt;
+  UploadSession session;
+  session.uploadId = *uploadId;
+  session.origin = file.origin;
+  session.hashvalue = file.hashvalue;
+  session.size = file.size;
+  session.partSize = m_options.partSize;
+  session.encoding = codingName(coding);
+  session.created_at = std::to_string(now.count());
+  // Replaces the session of an older version or an expired one
+  if (!m_db.insertUploadSession(session))
+    return std::nullopt;
+  return session;
+}
+
+bool ChunkedUploader::sendParts(const FileQueueEntry &file,
+                                const UploadSession &session,
+                                const std::vector<int64_t> &missing) {
+  // Resumed sessions keep the coding they were started with
+  ContentCoding coding =
+      parseCoding(session.encoding).value_or(ContentCoding::Identity);
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto worker = [&]() {
+    // Each worker reads through its own stream into one reused buffer, so
+    // memory stays at parallelParts * partSize
+    std::ifstream ifs(file.absPath, std::ios::binary);
+    std::vector<char> buffer(static_cast<size_t>(session.partSize));
+    while (!failed) {
+      size_t i = next++;
+      if (i >= missing.size())
+        return;
+      int64_t part = missing[i];
+      int64_t offset = part * session.partSize;
+      auto len = static_cast<size_t>(
+          std::min<int64_t>(session.partSize, session.size - offset));
+      ifs.clear();
+      ifs.seekg(offset);
+      ifs.read(buffer.data(), static_cast<std::streamsize>(len));
+      if (!ifs || static_cast<size_t>(ifs.gcount()) != len) {
+        // Shrunk since it was hashed; the caller starts over next time
+        failed = true;
+        return;
+      }
+      std::string sha;
+      picosha2::hash256_hex_string(buffer.begin(), buffer.begin() + len, sha);
+      // ApiClient already retried it as often as its policy allows
+      if (!m_api.uploadPart(session.uploadId, part, buffer.data(), len, sha,
+                            coding)) {
+        std::cerr << "[Upload] Part " << part << " of " << file.absPath
+                  << " failed" << std::endl;
+        failed = true;
+        return;
+      }
+      m_db.markUploadPart(session.uploadId, part);
+    }
+  };
+
+  size_t workers = std::min(std::max<size_t>(m_options.parallelParts, 1),
+                            missing.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers; ++i)
+    threads.emplace_back(worker);
+  for (auto &t : threads)
+    t.join();
+  return !failed;
+}
+
+void ChunkedUploader::prefetch(std::span<const FileQueueEntry> files) {
+  std::vector<std::string> hashes;
+  {
+    std::lock_guard<std::mutex> lock(m_contentMtx);
+    std::unordered_set<std::string> queued;
+    for (const auto &file : files) {
+      if (file.size > 0 && !file.hashvalue.empty() &&
+          !m_asked.count(file.hashvalue) &&
+          queued.insert(file.hashvalue).second)
+        hashes.push_back(file.hashvalue);
+    }
+  }
+  if (hashes.empty())
+    return;
+  auto have = m_api.haveContent(hashes);
+  if (!have)
+    return;
+  size_t held = 0;
+  std::lock_guard<std::mutex> lock(m_contentMtx);
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    m_asked.insert(hashes[i]);
+    if ((*have)[i]) {
+      m_held.insert(hashes[i]);
+      held++;
+    }
+  }
+  std::cout << "[Upload] Server already holds " << held << " of "
+            << hashes.size() << " contents" << std::endl;
+}
+
+std::optional<std::string>
+ChunkedUploader::linkExisting(const FileQueueEntry &file,
+                              const std::vector<std::string> &pathIds) {
+  if (file.size <= 0 || file.hashvalue.empty())
+    return std::nullopt;
+  bool asked, held;
+  {
+    std::lock_guard<std::mutex> lock(m_contentMtx);
+    asked = m_asked.count(file.hashvalue) > 0;
+    held = m_held.count(file.hashvalue) > 0;
+  }
+  if (!asked) {
+    if (file.size < m_options.dedupMinSize)
+      return std::nullopt;
+    auto have = m_api.haveContent({&file.hashvalue, 1});
+    if (!have)
+      return std::nullopt;
+    held = have->front();
+    std::lock_guard<std::mutex> lock(m_contentMtx);
+    m_asked.insert(file.hashvalue);
+    if (held)
+      m_held.insert(file.hashvalue);
+  }
+  if (!held)
+    return std::nullopt;
+
+  // Nothing is read, so at least make sure the file was not rewritten
+  // since it was hashed; a changed one is queued again by the watcher
+  std::error_code ec;
+  auto size = std::filesystem::file_size(file.absPath, ec);
+  if (ec || static_cast<int64_t>(size) != file.size)
+    return std::nullopt;
+
+  auto fileId = m_api.linkFile(file, pathIds);
+  if (fileId) {
+    std::cout << "[Upload] " << file.absPath
+              << " is already on the server, linked" << std::endl;
+  } else {
+    // Deleted on the server since; upload() sends it after all
+    std::lock_guard<std::mutex> lock(m_contentMtx);
+    m_held.erase(file.hashvalue);
+  }
+  return fileId;
+}
+
+std::optional<std::string>
+ChunkedUploader::upload(const FileQueueEntry &file,
+                        const std::vector<std::string> &pathIds) {
+  if (auto fileId = linkExisting(file, pathIds))
+    return fileId;
+  auto fileId = sendContent(file, pathIds);
+  // Further copies of it in the queue are linked to this one. Only for
+  // hashes the server answered about, which proves it can link.
+  if (fileId) {
+    std::lock_guard<std::mutex> lock(m_contentMtx);
+    if (m_asked.count(file.hashvalue))
+      m_held.insert(file.hashvalue);
+  }
+  return fileId;
+}
+
+std::optional<std::string>
+ChunkedUploader::sendContent(const FileQueueEntry &file,
+                             const std::vector<std::string> &pathIds) {
+  // Edits of a file the server already has usually touch a few blocks
+  if (file.sync_status == "modified" && file.size >= m_options.deltaMinSize) {
+    if (auto fileId = m_api.uploadDelta(file, pathIds))
+      return fileId;
+  }
+  if (file.size < m_options.minSize || m_options.partSize <= 0)
+    return m_api.uploadFile(file, pathIds);
+
+  auto session = resumeOrStart(file, pathIds);
+  if (!session)
+    return m_api.uploadFile(file, pathIds);
+
+  int64_t partCount = (file.size + session->partSize - 1) / session->partSize;
+  auto done = m_db.getUploadParts(session->uploadId);
+  if (!done)
+    return std::nullopt;
+  std::vector<int64_t> missing;
+  for (int64_t part = 0; part < partCount; ++part)
+    if (!std::binary_search(done->begin(), done->end(), part))
+      missing.push_back(part);
+  if (!done->empty())
+    std::cout << "[Upload] Resuming " << file.absPath << " at part "
+              << (missing.empty() ? partCount : missing.front()) << " of "
+              << partCount << std::endl;
+
+  // A failed part leaves the session in place for the next attempt
+  if (!missing.empty() && !sendParts(file, *session, missing))
+    return std::nullopt;
+
+  bool rejected = false;
+  auto fileId = m_api.commitUpload(session->uploadId, partCount,
+                                   file.hashvalue, &rejected);
+  // A refused commit would be refused again with the same parts, so the
+  // next attempt starts a new session
+  if (fileId || rejected)
+    m_db.deleteUploadSession(session->uploadId);
+  return fileId;
+}
+
+} // namespace sync
@@ -0,0 +1,226 @@
+#include "Compression.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+#ifdef CPPHTTPLIB_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+namespace sync {
+
+namespace {
+
+constexpr size_t kProbeSize = 64 * 1024;
+// Bits per byte above which a sample is treated as already compressed;
+// text sits around 4-5, deflate and JPEG output close to 8
+constexpr double kMaxEntropy = 7.5;
+constexpr size_t kCodecBuffer = 64 * 1024;
+
+const std::unordered_set<std::string> kCompressedExtensions = {
+    "7z",  "aac", "apk",  "avi",  "br",   "bz2", "docx", "epub", "flac",
+    "gif", "gz",  "heic", "jar",  "jpeg", "jpg", "m4a",  "m4v",  "mkv",
+    "mov", "mp3", "mp4",  "odt",  "ogg",  "pdf", "png",  "pptx", "rar",
+    "tgz", "webm", "webp", "xlsx", "xz",   "zip", "zst"};
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+class GzipCodec : public StreamCodec {
+public:
+  explicit GzipCodec(bool encode) : m_encode(encode) {
+    // 15 + 16 writes a gzip wrapper, 15 + 32 reads gzip or zlib
+    m_ok = encode ? deflateInit2(&m_zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK
+                  : inflateInit2(&m_zs, 15 + 32) == Z_OK;
+  }
+  ~GzipCodec() override {
+    if (m_encode)
+      deflateEnd(&m_zs);
+    else
+      inflateEnd(&m_zs);
+  }
+
+  bool process(const char *data, size_t len, bool last,
+               std::string &out) override {
+    if (!m_ok)
+      return false;
+    m_zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    m_zs.avail_in = static_cast<uInt>(len);
+    char buf[kCodecBuffer];
+    int ret;
+    do {
+      m_zs.next_out = reinterpret_cast<Bytef *>(buf);
+      m_zs.avail_out = sizeof(buf);
+      ret = m_encode ? deflate(&m_zs, last ? Z_FINISH : Z_NO_FLUSH)
+                     : inflate(&m_zs, Z_NO_FLUSH);
+      if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR ||
+          ret == Z_MEM_ERROR || ret == Z_NEED_DICT)
+        return m_ok = false;
+      out.append(buf, sizeof(buf) - m_zs.avail_out);
+    } while (m_zs.avail_out == 0 || (m_encode && last && ret != Z_STREAM_END));
+    // A decoder must have seen the whole stream by the last piece
+    return m_encode || !last || ret == Z_STREAM_END;
+  }
+
+private:
+  z_stream m_zs{};
+  bool m_encode;
+  bool m_ok = false;
+};
+#endif
+
+#ifdef CPPHTTPLIB_ZSTD_SUPPORT
+class ZstdCodec : public StreamCodec {
+public:
+  explicit ZstdCodec(bool encode) : m_encode(encode) {
+    if (encode)
+      m_cctx = ZSTD_createCCtx();
+    else
+      m_dctx = ZSTD_createDCtx();
+  }
+  ~ZstdCodec() override {
+    ZSTD_freeCCtx(m_cctx);
+    ZSTD_freeDCtx(m_dctx);
+  }
+
+  bool process(const char *data, size_t len, bool last,
+               std::string &out) override {
+    if (!m_cctx && !m_dctx)
+      return false;
+    ZSTD_inBuffer in{data, len, 0};
+    char buf[kCodecBuffer];
+    size_t ret;
+    bool more;
+    do {
+      ZSTD_outBuffer output{buf, sizeof(buf), 0};
+      ret = m_encode ? ZSTD_compressStream2(m_cctx, &output, &in,
+                                            last ? ZSTD_e_end
+                                                 : ZSTD_e_continue)
+                     : ZSTD_decompressStream(m_dctx, &output, &in);
+      if (ZSTD_isError(ret))
+        return false;
+      out.append(buf, output.pos);
+      // An encoder reports what it still has to flush; a decoder that
+      // filled the buffer may hold more output
+      if (m_encode)
+        more = last ? ret != 0 : in.pos < in.size;
+      else
+        more = in.pos < in.size || output.pos == output.size;
+    } while (more);
+    return m_encode || !last || ret == 0;
+  }
+
+private:
+  bool m_encode;
+  ZSTD_CCtx *m_cctx = nullptr;
+  ZSTD_DCtx *m_dctx = nullptr;
+};
+#endif
+
+// encode goes unused when neither library is built in
+std::unique_ptr<StreamCodec> makeCodec(ContentCoding coding,
+                                       [[maybe_unused]] bool encode) {
+  switch (coding) {
+  case ContentCoding::Gzip:
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+    return std::make_unique<GzipCodec>(encode);
+#else
+    break;
+#endif
+  case ContentCoding::Zstd:
+#ifdef CPPHTTPLIB_ZSTD_SUPPORT
+    return std::make_unique<ZstdCodec>(encode);
+#else
+    break;
+#endif
+  case ContentCoding::Identity:
+    break;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+std::string codingName(ContentCoding coding) {
+  switch (coding) {
+  case ContentCoding::Gzip:
+    return "gzip";
+  case ContentCoding::Zstd:
+    return "zstd";
+  case ContentCoding::Identity:
+    break;
+  }
+  return "identity";
+}
+
+std::optional<ContentCoding> parseCoding(const std::string &name) {
+  if (name == "gzip")
+    return ContentCoding::Gzip;
+  if (name == "zstd")
+    return ContentCoding::Zstd;
+  if (name == "identity" || name.empty())
+    return ContentCoding::Identity;
+  return std::nullopt;
+}
+
+std::vector<ContentCoding> supportedCodings() {
+  std::vector<ContentCoding> codings;
+#ifdef CPPHTTPLIB_ZSTD_SUPPORT
+  codings.push_back(ContentCoding::Zstd);
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+  codings.push_back(ContentCoding::Gzip);
+#endif
+  return codings;
+}
+
+std::string acceptEncoding() {
+  std::string value;
+  for (ContentCoding coding : supportedCodings())
+    value += (value.empty() ? "" : ", ") + codingName(coding);
+  return value;
+}
+
+bool isCompressible(const std::string &absPath) {
+  std::string ext = std::filesystem::path(absPath).extension().string();
+  if (!ext.empty())
+    ext.erase(0, 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (kCompressedExtensions.count(ext))
+    return false;
+
+  // Shannon entropy of the byte histogram of the first block
+  std::ifstream in(absPath, std::ios::binary);
+  std::vector<char> sample(kProbeSize);
+  in.read(sample.data(), static_cast<std::streamsize>(sample.size()));
+  auto n = static_cast<size_t>(in.gcount());
+  if (n == 0)
+    return false;
+  std::array<size_t, 256> counts{};
+  for (size_t i = 0; i < n; ++i)
+    counts[static_cast<unsigned char>(sample[i])]++;
+  double entropy = 0;
+  for (size_t count : counts) {
+    if (count == 0)
+      continue;
+    double p = static_cast<double>(count) / static_cast<double>(n);
+    entropy -= p * std::log2(p);
+  }
+  return entropy < kMaxEntropy;
+}
+
+std::unique_ptr<StreamCodec> StreamCodec::encoder(ContentCoding coding) {
+  return makeCodec(coding, true);
+}
+
+std::unique_ptr<StreamCodec> StreamCodec::decoder(ContentCoding coding) {
+  return makeCodec(coding, false);
+}
+
+} // namespace sync
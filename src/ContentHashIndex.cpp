@@ -0,0 +1,46 @@
+#include "ContentHashIndex.hpp"
+#include <algorithm>
+#include <functional>
+#include <tuple>
+
+namespace sync {
+
+void ContentHashIndex::add(const FileMetadata &file) {
+  // Empty files share one hash and cost nothing to upload
+  if (file.lastSyncedHashValue.empty() || file.size <= 0)
+    return;
+  m_byHash.emplace(file.lastSyncedHashValue,
+                   ContentHashEntry{file.path, file.filename, file.uuid,
+                                    file.origin, file.versions,
+                                    file.lastSyncedHashValue, false});
+}
+
+void ContentHashIndex::addQueuedDelete(const FileQueueEntry &entry) {
+  if (entry.sync_status != "delete" || entry.lastSyncedHashValue.empty() ||
+      entry.size <= 0)
+    return;
+  m_byHash.emplace(entry.lastSyncedHashValue,
+                   ContentHashEntry{entry.path, entry.filename, entry.uuid,
+                                    entry.origin, entry.versions,
+                                    entry.lastSyncedHashValue, true});
+}
+
+std::vector<ContentHashEntry>
+ContentHashIndex::find(const std::string &hash,
+                       const std::string &filename) const {
+  std::vector<ContentHashEntry> matches;
+  auto range = m_byHash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it)
+    matches.push_back(it->second);
+  auto rank = [&](const ContentHashEntry &e) {
+    return std::make_tuple(e.filename != filename, std::cref(e.path),
+                           std::cref(e.filename));
+  };
+  std::sort(matches.begin(), matches.end(),
+            [&](const ContentHashEntry &a, const ContentHashEntry &b) {
+              return rank(a) < rank(b);
+            });
+  return matches;
+}
+
+} // namespace sync
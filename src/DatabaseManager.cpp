@@ -1,6 +1,9 @@
 #include "DatabaseManager.hpp"
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <sqlite3.h>
 #include <sqlite_orm/sqlite_orm.h>
 using namespace sqlite_orm;
@@ -12,6 +15,11 @@ namespace sync {
 inline auto create_storage_impl(const std::string &path) {
   return make_storage(
       path,
+      make_index("idx_file_lastsynced", &FileMetadata::lastSyncedHashValue),
+      make_index<FileQueueEntry>("idx_filequeue_lastsynced",
+                                 &FileQueueEntry::lastSyncedHashValue),
+      make_index("idx_directory_path", &DirectoryMetadata::path,
+                 &DirectoryMetadata::device, &DirectoryMetadata::folder),
       make_table<FileMetadata>(
           "File", make_column("uuid", &FileMetadata::uuid),
           make_column("path", &FileMetadata::path),
@@ -73,7 +81,20 @@ inline auto create_storage_impl(const std::string &path) {
           make_column("inode", &DirectoryQueueEntry::inode),
           primary_key(&DirectoryQueueEntry::device,
                       &DirectoryQueueEntry::folder,
-                      &DirectoryQueueEntry::path)));
+                      &DirectoryQueueEntry::path)),
+      make_table<UploadSession>(
+          "UploadSession",
+          make_column("uploadId", &UploadSession::uploadId, primary_key()),
+          make_column("origin", &UploadSession::origin, unique()),
+          make_column("hashvalue", &UploadSession::hashvalue),
+          make_column("size", &UploadSession::size),
+          make_column("partSize", &UploadSession::partSize),
+          make_column("encoding", &UploadSession::encoding),
+          make_column("created_at", &UploadSession::created_at)),
+      make_table<UploadPart>(
+          "UploadPart", make_column("uploadId", &UploadPart::uploadId),
+          make_column("partNumber", &UploadPart::partNumber),
+          primary_key(&UploadPart::uploadId, &UploadPart::partNumber)));
 }
 
 // Typedef for easier access within the Impl
@@ -81,9 +102,168 @@ using Storage = decltype(create_storage_impl(""));
 
 struct DatabaseManager::Impl {
   Storage storage;
+  // Serializes every storage call; recursive so methods may nest
+  std::recursive_mutex mtx;
   Impl(const std::string &path) : storage(create_storage_impl(path)) {}
 };
 
+// Path range [lo, hi) covering a subtree. "/x/..." sorts below "/x0", but
+// so do siblings like "/x-y"; callers filter those out. UTF-8 never
+// contains 0xFF, so "\xff" bounds the whole tree.
+struct PathRange {
+  std::string lo;
+  std::string hi;
+};
+
+inline PathRange subtreeRange(const std::string &subtree) {
+  if (subtree.empty() || subtree == "/")
+    return {"", "\xff"};
+  return {subtree, subtree + "0"};
+}
+
+// Both orders follow an index, so the cursors step without a sort
+inline auto iterateFilesByKey(Storage &storage, const PathRange &range) {
+  return storage.iterate<FileMetadata>(
+      where(c(&FileMetadata::path) >= range.lo and
+            c(&FileMetadata::path) < range.hi),
+      multi_order_by(order_by(&FileMetadata::path),
+                     order_by(&FileMetadata::filename)));
+}
+
+inline auto iterateDirectoriesByKey(Storage &storage, const PathRange &range) {
+  return storage.iterate<DirectoryMetadata>(
+      where(c(&DirectoryMetadata::path) >= range.lo and
+            c(&DirectoryMetadata::path) < range.hi),
+      multi_order_by(order_by(&DirectoryMetadata::path),
+                     order_by(&DirectoryMetadata::device),
+                     order_by(&DirectoryMetadata::folder)));
+}
+
+// True for dir itself or anything below it. Unlike LIKE 'dir/%' this is
+// exact for names holding '_' or '%', and it can use the path indexes.
+template <typename Column>
+inline auto atOrBelow(Column column, const std::string &dir) {
+  return c(column) == dir ||
+         (c(column) >= dir + "/" and c(column) < dir + "0");
+}
+
+// Re-roots every row at or below oldPath onto newPath with set-based
+// UPDATEs, so moving a folder costs a few statements however many files
+// it holds. Descendants keep their folder name but take the device of the
+// new top level. Stale rows already at the target are dropped first, as
+// the row-by-row replace used to overwrite them. Runs inside the caller's
+// transaction.
+inline void rerootSubtree(Storage &storage, const std::string &syncPath,
+                          const std::string &oldPath,
+                          const std::string &newPath, const pathParts &top) {
+  // SUBSTR is 1-based; this keeps "" or "/rest" after the old prefix
+  int tail = int(oldPath.size()) + 1;
+  storage.remove_all<FileMetadata>(
+      where(atOrBelow(&FileMetadata::path, newPath)));
+  storage.remove_all<DirectoryMetadata>(
+      where(atOrBelow(&DirectoryMetadata::path, newPath)));
+  storage.update_all(
+      set(c(&FileMetadata::path) =
+              conc(newPath, substr(&FileMetadata::path, tail)),
+          c(&FileMetadata::absPath) =
+              conc(conc(conc(syncPath + newPath,
+                             substr(&FileMetadata::path, tail)),
+                        "/"),
+                   &FileMetadata::filename)),
+      where(atOrBelow(&FileMetadata::path, oldPath)));
+  storage.update_all(
+      set(c(&DirectoryMetadata::path) =
+              conc(newPath, substr(&DirectoryMetadata::path, tail)),
+          c(&DirectoryMetadata::absPath) =
+              conc(syncPath + newPath, substr(&DirectoryMetadata::path, tail)),
+          c(&DirectoryMetadata::device) = top.device),
+      where(atOrBelow(&DirectoryMetadata::path, oldPath)));
+  storage.update_all(set(c(&DirectoryMetadata::folder) = top.folder),
+                     where(c(&DirectoryMetadata::path) == newPath));
+}
+
+// The statements behind the WriteBatch writes (insertFile, updateFile,
+// deleteFile, ...); the caller owns the transaction
+inline void applyOp(Storage &storage, const BatchOp &op) {
+  switch (op.kind) {
+  case BatchOp::Kind::InsertFile:
+    storage.replace<FileMetadata>(op.file);
+    storage.replace<FileQueueEntry>(op.fileQueue);
+    break;
+  case BatchOp::Kind::UpdateFile:
+    storage.update<FileMetadata>(op.file);
+    break;
+  case BatchOp::Kind::DeleteFile:
+    storage.remove<FileMetadata>(op.file.path, op.file.filename);
+    storage.replace<FileQueueEntry>(op.fileQueue);
+    break;
+  case BatchOp::Kind::ForgetFile:
+    storage.remove<FileMetadata>(op.file.path, op.file.filename);
+    storage.remove_all<FileQueueEntry>(
+        where(c(&FileQueueEntry::path) == op.file.path &&
+              c(&FileQueueEntry::filename) == op.file.filename));
+    break;
+  case BatchOp::Kind::MoveFile:
+    storage.remove_all<FileMetadata>(
+        where(c(&FileMetadata::path) == op.oldPath &&
+              c(&FileMetadata::filename) == op.oldFilename));
+    storage.remove_all<FileQueueEntry>(
+        where(c(&FileQueueEntry::path) == op.oldPath &&
+              c(&FileQueueEntry::filename) == op.oldFilename));
+    storage.replace<FileMetadata>(op.file);
+    storage.replace<FileQueueEntry>(op.fileQueue);
+    break;
+  case BatchOp::Kind::InsertDirectory:
+    storage.replace<DirectoryMetadata>(op.dir);
+    storage.replace<DirectoryQueueEntry>(op.dirQueue);
+    break;
+  }
+}
+
+// A cursor holds the storage lock for its lifetime, so a merge-join reads
+// one consistent snapshot
+template <> struct OrderedCursor<FileMetadata>::Impl {
+  std::unique_lock<std::recursive_mutex> lock;
+  decltype(iterateFilesByKey(std::declval<Storage &>(), PathRange{})) view;
+  decltype(view.begin()) it;
+  Impl(Storage &storage, std::recursive_mutex &mtx, const PathRange &range)
+      : lock(mtx), view(iterateFilesByKey(storage, range)),
+        it(view.begin()) {}
+};
+
+template <> struct OrderedCursor<DirectoryMetadata>::Impl {
+  std::unique_lock<std::recursive_mutex> lock;
+  decltype(iterateDirectoriesByKey(std::declval<Storage &>(),
+                                   PathRange{})) view;
+  decltype(view.begin()) it;
+  Impl(Storage &storage, std::recursive_mutex &mtx, const PathRange &range)
+      : lock(mtx), view(iterateDirectoriesByKey(storage, range)),
+        it(view.begin()) {}
+};
+
+template <typename T>
+OrderedCursor<T>::OrderedCursor(std::unique_ptr<Impl> impl)
+    : m_impl(std::move(impl)) {}
+
+template <typename T> OrderedCursor<T>::~OrderedCursor() = default;
+
+template <typename T> bool OrderedCursor<T>::next(T &row) {
+  if (m_failed || m_impl->it == m_impl->view.end())
+    return false;
+  try {
+    row = *m_impl->it;
+    ++m_impl->it;
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error reading cursor: " << e.what() << std::endl;
+    m_failed = true;
+    return false;
+  }
+}
+
+template class OrderedCursor<FileMetadata>;
+template class OrderedCursor<DirectoryMetadata>;
+
 DatabaseManager::DatabaseManager(const std::string &dbPath,
                                  const std::string &syncPath)
     : m_dbPath(dbPath), m_syncPath(syncPath),
@@ -92,6 +272,7 @@ DatabaseManager::DatabaseManager(const std::string &dbPath,
 DatabaseManager::~DatabaseManager() = default;
 
 bool DatabaseManager::open() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.get_all<FileMetadata>(limit(1));
     std::cout << "[DB] Database connection verified: " << m_dbPath << std::endl;
@@ -105,6 +286,7 @@ bool DatabaseManager::open() {
 void DatabaseManager::close() {}
 
 void DatabaseManager::initializeSchema() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   std::cout << "[DB] Synchronizing schema via sqlite_orm..." << std::endl;
   m_impl->storage.sync_schema();
   std::cout << "[DB] Schema synchronized successfully." << std::endl;
@@ -134,6 +316,7 @@ pathParts DatabaseManager::getFolderDevice(const std::filesystem::path &path) {
 
 // File operations
 std::optional<std::vector<FileMetadata>> DatabaseManager::getAllFiles() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get_all<FileMetadata>();
   } catch (const std::exception &e) {
@@ -142,6 +325,7 @@ std::optional<std::vector<FileMetadata>> DatabaseManager::getAllFiles() {
 }
 
 std::optional<std::vector<FileQueueEntry>> DatabaseManager::getAllQueueFiles() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get_all<FileQueueEntry>();
   } catch (std::exception &e) {
@@ -152,6 +336,7 @@ std::optional<std::vector<FileQueueEntry>> DatabaseManager::getAllQueueFiles() {
 
 std::optional<FileMetadata>
 DatabaseManager::getFileByOrigin(const std::string &origin) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     auto results = m_impl->storage.get_all<FileMetadata>(
         where(c(&FileMetadata::origin) == origin));
@@ -167,6 +352,7 @@ DatabaseManager::getFileByOrigin(const std::string &origin) {
 std::optional<FileMetadata>
 DatabaseManager::getFileByPath(const std::string &path,
                                const std::string &filename) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get<FileMetadata>(path, filename);
   } catch (const std::exception &e) {
@@ -175,9 +361,107 @@ DatabaseManager::getFileByPath(const std::string &path,
   }
 }
 
+std::unique_ptr<FileCursor>
+DatabaseManager::openFileCursor(const std::string &subtree) {
+  try {
+    return std::make_unique<FileCursor>(std::make_unique<FileCursor::Impl>(
+        m_impl->storage, m_impl->mtx, subtreeRange(subtree)));
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error opening FileCursor: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+std::optional<std::vector<FileMetadata>>
+DatabaseManager::getSyncedFilesByHash(const std::string &hash) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.get_all<FileMetadata>(
+        where(c(&FileMetadata::lastSyncedHashValue) == hash &&
+              not_in(&FileMetadata::origin, select(&FileQueueEntry::origin))),
+        multi_order_by(order_by(&FileMetadata::path),
+                       order_by(&FileMetadata::filename)));
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching SyncedFilesByHash :" << e.what()
+              << "\n";
+    return std::nullopt;
+  }
+}
+
+std::optional<std::vector<FileQueueEntry>>
+DatabaseManager::getQueuedDeletesByHash(const std::string &hash) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.get_all<FileQueueEntry>(
+        where(c(column<FileQueueEntry>(
+                  &FileQueueEntry::lastSyncedHashValue)) == hash &&
+              c(&FileQueueEntry::sync_status) == "delete"),
+        multi_order_by(order_by(&FileQueueEntry::path),
+                       order_by(&FileQueueEntry::filename)));
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching QueuedDeletesByHash :" << e.what()
+              << "\n";
+    return std::nullopt;
+  }
+}
+
+// Stays below SQLite's default limit on bound parameters
+constexpr size_t kMaxHashesPerQuery = 500;
+
+std::optional<std::vector<FileMetadata>>
+DatabaseManager::getSyncedFilesByHashes(
+    const std::vector<std::string> &hashes) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    std::vector<FileMetadata> rows;
+    for (size_t i = 0; i < hashes.size(); i += kMaxHashesPerQuery) {
+      std::vector<std::string> chunk(
+          hashes.begin() + i,
+          hashes.begin() + std::min(hashes.size(), i + kMaxHashesPerQuery));
+      auto part = m_impl->storage.get_all<FileMetadata>(
+          where(in(&FileMetadata::lastSyncedHashValue, chunk) &&
+                not_in(&FileMetadata::origin,
+                       select(&FileQueueEntry::origin))));
+      rows.insert(rows.end(), std::make_move_iterator(part.begin()),
+                  std::make_move_iterator(part.end()));
+    }
+    return rows;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching SyncedFilesByHashes :" << e.what()
+              << "\n";
+    return std::nullopt;
+  }
+}
+
+std::optional<std::vector<FileQueueEntry>>
+DatabaseManager::getQueuedDeletesByHashes(
+    const std::vector<std::string> &hashes) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    std::vector<FileQueueEntry> rows;
+    for (size_t i = 0; i < hashes.size(); i += kMaxHashesPerQuery) {
+      std::vector<std::string> chunk(
+          hashes.begin() + i,
+          hashes.begin() + std::min(hashes.size(), i + kMaxHashesPerQuery));
+      auto part = m_impl->storage.get_all<FileQueueEntry>(
+          where(in(column<FileQueueEntry>(&FileQueueEntry::lastSyncedHashValue),
+                   chunk) &&
+                c(&FileQueueEntry::sync_status) == "delete"));
+      rows.insert(rows.end(), std::make_move_iterator(part.begin()),
+                  std::make_move_iterator(part.end()));
+    }
+    return rows;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching QueuedDeletesByHashes :" << e.what()
+              << "\n";
+    return std::nullopt;
+  }
+}
+
 std::optional<FileQueueEntry>
 DatabaseManager::getFileQueueByPath(const std::string &path,
                                     const std::string &filename) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     auto results = m_impl->storage.get_all<FileQueueEntry>(
         where(c(&FileQueueEntry::path) == path &&
@@ -193,10 +477,13 @@ DatabaseManager::getFileQueueByPath(const std::string &path,
 
 bool DatabaseManager::insertFile(const FileMetadata &file,
                                  const FileQueueEntry &fileQueue) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
+    BatchOp op{.kind = BatchOp::Kind::InsertFile,
+               .file = file,
+               .fileQueue = fileQueue};
     return m_impl->storage.transaction([&]() {
-      m_impl->storage.replace<FileMetadata>(file);
-      m_impl->storage.replace<FileQueueEntry>(fileQueue);
+      applyOp(m_impl->storage, op);
       return true;
     });
   } catch (const std::exception &e) {
@@ -207,6 +494,7 @@ bool DatabaseManager::insertFile(const FileMetadata &file,
 }
 
 bool DatabaseManager::updateFile(const FileMetadata &file) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     auto existingFile = m_impl->storage.count<FileMetadata>(
         where(c(&FileMetadata::path) == file.path &&
@@ -226,10 +514,13 @@ bool DatabaseManager::updateFile(const FileMetadata &file) {
 bool DatabaseManager::deleteFile(const std::string &path,
                                  const std::string &filename,
                                  const FileQueueEntry &fq) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
+    BatchOp op{.kind = BatchOp::Kind::DeleteFile, .fileQueue = fq};
+    op.file.path = path;
+    op.file.filename = filename;
     return m_impl->storage.transaction([&] {
-      m_impl->storage.remove<FileMetadata>(path, filename);
-      m_impl->storage.replace<FileQueueEntry>(fq);
+      applyOp(m_impl->storage, op);
       return true;
     });
   } catch (const std::exception &e) {
@@ -239,7 +530,61 @@ bool DatabaseManager::deleteFile(const std::string &path,
   }
 }
 
+bool DatabaseManager::forgetFile(const std::string &path,
+                                 const std::string &filename) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    BatchOp op{.kind = BatchOp::Kind::ForgetFile};
+    op.file.path = path;
+    op.file.filename = filename;
+    return m_impl->storage.transaction([&] {
+      applyOp(m_impl->storage, op);
+      return true;
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Forgetting ->" << path << "/" << filename
+              << " =>" << e.what() << std::endl;
+    return false;
+  }
+}
+
+bool DatabaseManager::moveFile(const std::string &oldPath,
+                               const std::string &oldFilename,
+                               const FileMetadata &file,
+                               const FileQueueEntry &fileQueue) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    BatchOp op{.kind = BatchOp::Kind::MoveFile,
+               .file = file,
+               .fileQueue = fileQueue,
+               .oldPath = oldPath,
+               .oldFilename = oldFilename};
+    return m_impl->storage.transaction([&]() {
+      applyOp(m_impl->storage, op);
+      return true;
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Moving ->" << oldPath << "/" << oldFilename
+              << " to " << file.absPath << " =>" << e.what() << std::endl;
+    return false;
+  }
+}
+
+bool DatabaseManager::removeFile(const std::string &path,
+                                 const std::string &filename) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    m_impl->storage.remove<FileMetadata>(path, filename);
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Removing ->" << path << "/" << filename
+              << " from File Table =>" << e.what() << std::endl;
+    return false;
+  }
+}
+
 bool DatabaseManager::upsertFile(const FileMetadata &file) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.replace<FileMetadata>(file);
     return true;
@@ -251,6 +596,7 @@ bool DatabaseManager::upsertFile(const FileMetadata &file) {
 }
 
 bool DatabaseManager::deleteFilesByPath(const std::string &path) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
 
     m_impl->storage.remove_all<FileMetadata>(
@@ -267,6 +613,7 @@ bool DatabaseManager::deleteFilesByPath(const std::string &path) {
 // folder/New folder"y operations
 std::optional<std::vector<DirectoryMetadata>>
 DatabaseManager::getAllDirectories() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get_all<DirectoryMetadata>();
   } catch (const std::exception &e) {
@@ -274,10 +621,24 @@ DatabaseManager::getAllDirectories() {
   }
 }
 
+std::unique_ptr<DirectoryCursor>
+DatabaseManager::openDirectoryCursor(const std::string &subtree) {
+  try {
+    return std::make_unique<DirectoryCursor>(
+        std::make_unique<DirectoryCursor::Impl>(m_impl->storage, m_impl->mtx,
+                                                 subtreeRange(subtree)));
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error opening DirectoryCursor: " << e.what()
+              << std::endl;
+    return nullptr;
+  }
+}
+
 std::optional<DirectoryMetadata>
 DatabaseManager::getDirectoryByPath(const std::string &device,
                                     const std::string &folder,
                                     const std::string &path) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
 
     auto results = m_impl->storage.get_all<DirectoryMetadata>(
@@ -296,6 +657,7 @@ DatabaseManager::getDirectoryByPath(const std::string &device,
 
 std::optional<std::vector<FileMetadata>>
 DatabaseManager::getAllFilesInDirectory(const std::string &path) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
 
     return m_impl->storage.get_all<FileMetadata>(
@@ -310,10 +672,13 @@ DatabaseManager::getAllFilesInDirectory(const std::string &path) {
 
 bool DatabaseManager::insertDirectory(const DirectoryMetadata &dir,
                                       const DirectoryQueueEntry &dirQueue) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
+    BatchOp op{.kind = BatchOp::Kind::InsertDirectory,
+               .dir = dir,
+               .dirQueue = dirQueue};
     return m_impl->storage.transaction([&] {
-      m_impl->storage.replace<DirectoryMetadata>(dir);
-      m_impl->storage.replace<DirectoryQueueEntry>(dirQueue);
+      applyOp(m_impl->storage, op);
       return true;
     });
   } catch (const std::exception &e) {
@@ -324,6 +689,7 @@ bool DatabaseManager::insertDirectory(const DirectoryMetadata &dir,
 }
 
 bool DatabaseManager::updateDirectory(const DirectoryMetadata &dir) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.update<DirectoryMetadata>(dir);
     return true;
@@ -335,6 +701,7 @@ bool DatabaseManager::updateDirectory(const DirectoryMetadata &dir) {
 }
 
 bool DatabaseManager::deleteDirectory(const std::string &path) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.remove_all<DirectoryMetadata>(
         where(c(&DirectoryMetadata::path) == path ||
@@ -349,6 +716,7 @@ bool DatabaseManager::deleteDirectory(const std::string &path) {
 
 bool DatabaseManager::deleteFolderWithTransaction(
     const std::string &path, const DirectoryQueueEntry &dq) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.transaction([&]() {
       m_impl->storage.remove_all<FileMetadata>(
@@ -382,53 +750,18 @@ bool DatabaseManager::deleteFolderWithTransaction(
 bool DatabaseManager::moveDirectory(const std::string &path,
                                     const std::string &oldPath,
                                     const DirectoryQueueEntry &dq) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.transaction([&]() {
-      auto subDirs = m_impl->storage.get_all<DirectoryMetadata>(
-          where(c(&DirectoryMetadata::path) == oldPath ||
-                like(&DirectoryMetadata::path, oldPath + "/%")));
-      for (auto &dir : subDirs) {
-        auto dirFiles = m_impl->storage.get_all<FileMetadata>(
-            where(c(&FileMetadata::dirID) == dir.uuid));
-        std::string movedSegment(
-            std::filesystem::relative(dir.path, oldPath).generic_string());
-        DirectoryMetadata d(dir);
-        std::string newPath;
-        if (movedSegment != ".") {
-          newPath = path + "/" + movedSegment;
-        } else {
-          newPath = path;
-        }
-        pathParts p = getFolderDevice(newPath);
-        std::string absPath = m_syncPath + newPath;
-        d.absPath = absPath;
-        d.path = newPath;
-        d.folder = p.folder;
-        d.device = p.device;
-        if (dirFiles.size() > 0) {
-          // update the files
-          for (auto &file : dirFiles) {
-            FileMetadata f(file);
-            f.absPath = absPath == "/" ? "/" + file.filename
-                                       : absPath + "/" + file.filename;
-            f.path = newPath;
-            m_impl->storage.replace<FileMetadata>(f);
-          }
-        }
-        // update directory
-        m_impl->storage.replace<DirectoryMetadata>(d);
-      }
-      std::vector<DirectoryQueueEntry> queueDirs =
-          m_impl->storage.get_all<DirectoryQueueEntry>(
-              where(c(&DirectoryQueueEntry::path) == oldPath ||
-                    like(&DirectoryQueueEntry::path, oldPath + "/%")));
-      if (queueDirs.size() > 0) {
+      rerootSubtree(m_impl->storage, m_syncPath, oldPath, path,
+                    getFolderDevice(path));
+      // Pending folder work under the old path is superseded by the rename
+      if (m_impl->storage.count<DirectoryQueueEntry>(
+              where(atOrBelow(&DirectoryQueueEntry::path, oldPath))) > 0) {
         m_impl->storage.remove_all<FileQueueEntry>(
-            where(c(&FileQueueEntry::path) == oldPath ||
-                  like(&FileQueueEntry::path, oldPath + "/%")));
+            where(atOrBelow(&FileQueueEntry::path, oldPath)));
         m_impl->storage.remove_all<DirectoryQueueEntry>(
-            where(c(&DirectoryQueueEntry::path) == oldPath ||
-                  like(&DirectoryQueueEntry::path, oldPath + "/%")));
+            where(atOrBelow(&DirectoryQueueEntry::path, oldPath)));
       }
       m_impl->storage.replace<DirectoryQueueEntry>(dq);
       return true;
@@ -440,6 +773,7 @@ bool DatabaseManager::moveDirectory(const std::string &path,
 }
 
 bool DatabaseManager::upsertDirectory(const DirectoryMetadata &dir) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     // Optimized check by (device, folder, path) using where clause
     m_impl->storage.replace<DirectoryMetadata>(dir);
@@ -451,6 +785,7 @@ bool DatabaseManager::upsertDirectory(const DirectoryMetadata &dir) {
 }
 
 bool DatabaseManager::upsertFileQueue(const FileQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.replace<FileQueueEntry>(entry);
     return true;
@@ -463,7 +798,22 @@ bool DatabaseManager::upsertFileQueue(const FileQueueEntry &entry) {
   }
 }
 
+std::optional<bool>
+DatabaseManager::hasPendingFilesUnder(const std::string &path) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.count<FileQueueEntry>(
+               where(atOrBelow(&FileQueueEntry::path, path) &&
+                     c(&FileQueueEntry::sync_status) != "delete")) > 0;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error checking pending files under " << path << ": "
+              << e.what() << std::endl;
+    return std::nullopt;
+  }
+}
+
 bool DatabaseManager::upsertDirectoryQueue(const DirectoryQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     // Optimized check by (device, folder, path) using where clause
     m_impl->storage.replace<DirectoryQueueEntry>(entry);
@@ -475,42 +825,11 @@ bool DatabaseManager::upsertDirectoryQueue(const DirectoryQueueEntry &entry) {
 }
 bool DatabaseManager::moveDirectoryQueue(const std::string &path,
                                          const std::string &oldPath) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.transaction([&]() {
-      auto subDirs = m_impl->storage.get_all<DirectoryMetadata>(
-          where(c(&DirectoryMetadata::path) == oldPath ||
-                like(&DirectoryMetadata::path, oldPath + "/%")));
-      for (auto &dir : subDirs) {
-        auto dirFiles = m_impl->storage.get_all<FileMetadata>(
-            where(c(&FileMetadata::dirID) == dir.uuid));
-        std::string movedSegment(
-            std::filesystem::relative(dir.path, oldPath).generic_string());
-        DirectoryMetadata d(dir);
-        std::string newPath;
-        if (movedSegment != ".") {
-          newPath = path + "/" + movedSegment;
-        } else {
-          newPath = path;
-        }
-        pathParts p = getFolderDevice(newPath);
-        std::string absPath = m_syncPath + newPath;
-        d.absPath = absPath;
-        d.path = newPath;
-        d.folder = p.folder;
-        d.device = p.device;
-        if (dirFiles.size() > 0) {
-          // update the files
-          for (auto &file : dirFiles) {
-            FileMetadata f(file);
-            f.absPath = absPath == "/" ? "/" + file.filename
-                                       : absPath + "/" + file.filename;
-            f.path = newPath;
-            m_impl->storage.update<FileMetadata>(f);
-          }
-        }
-        // update directory
-        m_impl->storage.update<DirectoryMetadata>(d);
-      }
+      rerootSubtree(m_impl->storage, m_syncPath, oldPath, path,
+                    getFolderDevice(path));
       return true;
     });
   } catch (const std::exception &e) {
@@ -519,8 +838,43 @@ bool DatabaseManager::moveDirectoryQueue(const std::string &path,
   }
 }
 
+bool DatabaseManager::applyBatch(const std::vector<BatchOp> &ops) {
+  if (ops.empty())
+    return true;
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.transaction([&]() {
+      for (const auto &op : ops)
+        applyOp(m_impl->storage, op);
+      return true;
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Batch of " << ops.size()
+              << " writes failed, retrying one by one =>" << e.what()
+              << std::endl;
+  }
+  bool ok = true;
+  for (const auto &op : ops) {
+    try {
+      m_impl->storage.transaction([&]() {
+        applyOp(m_impl->storage, op);
+        return true;
+      });
+    } catch (const std::exception &e) {
+      std::string target = op.kind == BatchOp::Kind::InsertDirectory
+                               ? op.dir.path
+                               : op.file.path + "/" + op.file.filename;
+      std::cerr << "[DB] Error applying batched write ->" << target << " =>"
+                << e.what() << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
 // File Queue operations
 std::optional<std::vector<FileQueueEntry>> DatabaseManager::getFileQueue() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get_all<FileQueueEntry>();
   } catch (const std::exception &e) {
@@ -529,6 +883,7 @@ std::optional<std::vector<FileQueueEntry>> DatabaseManager::getFileQueue() {
 }
 
 bool DatabaseManager::insertFileQueue(const FileQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.replace<FileQueueEntry>(entry);
     return true;
@@ -540,6 +895,7 @@ bool DatabaseManager::insertFileQueue(const FileQueueEntry &entry) {
 }
 
 bool DatabaseManager::updateFileQueue(const FileQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.update<FileQueueEntry>(entry);
     return true;
@@ -552,6 +908,7 @@ bool DatabaseManager::updateFileQueue(const FileQueueEntry &entry) {
 
 std::optional<std::vector<DirectoryQueueEntry>>
 DatabaseManager::getAllQueueDirectories() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     return m_impl->storage.get_all<DirectoryQueueEntry>();
   } catch (const std::exception &e) {
@@ -562,6 +919,7 @@ DatabaseManager::getAllQueueDirectories() {
 
 bool DatabaseManager::deleteFileQueue(const std::string &path,
                                       const std::string &filename) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.remove<FileQueueEntry>(path, filename);
     return true;
@@ -575,6 +933,7 @@ bool DatabaseManager::deleteFileQueue(const std::string &path,
 // Directory Queue operations
 std::optional<std::vector<DirectoryQueueEntry>>
 DatabaseManager::getDirectoryQueue() {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
 
     return m_impl->storage.get_all<DirectoryQueueEntry>();
@@ -588,6 +947,7 @@ DatabaseManager::getDirectoryQueue() {
 }
 
 bool DatabaseManager::insertDirectoryQueue(const DirectoryQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.replace<DirectoryQueueEntry>(entry);
     return true;
@@ -599,6 +959,7 @@ bool DatabaseManager::insertDirectoryQueue(const DirectoryQueueEntry &entry) {
 }
 
 bool DatabaseManager::updateDirectoryQueue(const DirectoryQueueEntry &entry) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.update<DirectoryQueueEntry>(entry);
     return true;
@@ -610,6 +971,7 @@ bool DatabaseManager::updateDirectoryQueue(const DirectoryQueueEntry &entry) {
 }
 
 bool DatabaseManager::deleteDirectoryQueue(const std::string &uuid) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
   try {
     m_impl->storage.remove<DirectoryQueueEntry>(
         where(c(&DirectoryQueueEntry::uuid) == uuid));
@@ -621,4 +983,87 @@ bool DatabaseManager::deleteDirectoryQueue(const std::string &uuid) {
   }
 }
 
+std::optional<UploadSession>
+DatabaseManager::getUploadSession(const std::string &origin) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    auto results = m_impl->storage.get_all<UploadSession>(
+        where(c(&UploadSession::origin) == origin));
+    if (results.empty())
+      return std::nullopt;
+    return results[0];
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching UploadSession : " << e.what()
+              << std::endl;
+    return std::nullopt;
+  }
+}
+
+bool DatabaseManager::insertUploadSession(const UploadSession &session) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.transaction([&]() {
+      // One session per file; an older one for other content is dead
+      auto stale = m_impl->storage.select(
+          &UploadSession::uploadId,
+          where(c(&UploadSession::origin) == session.origin));
+      for (const auto &id : stale)
+        m_impl->storage.remove_all<UploadPart>(
+            where(c(&UploadPart::uploadId) == id));
+      m_impl->storage.remove_all<UploadSession>(
+          where(c(&UploadSession::origin) == session.origin));
+      m_impl->storage.replace(session);
+      return true;
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Inserting UploadSession ->" << session.origin
+              << " =>" << e.what() << std::endl;
+    return false;
+  }
+}
+
+bool DatabaseManager::markUploadPart(const std::string &uploadId,
+                                     int64_t partNumber) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    m_impl->storage.replace(UploadPart{uploadId, partNumber});
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Marking UploadPart ->" << uploadId << "#"
+              << partNumber << " =>" << e.what() << std::endl;
+    return false;
+  }
+}
+
+std::optional<std::vector<int64_t>>
+DatabaseManager::getUploadParts(const std::string &uploadId) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.select(&UploadPart::partNumber,
+                                  where(c(&UploadPart::uploadId) == uploadId),
+                                  order_by(&UploadPart::partNumber));
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error Fetching UploadParts : " << e.what()
+              << std::endl;
+    return std::nullopt;
+  }
+}
+
+bool DatabaseManager::deleteUploadSession(const std::string &uploadId) {
+  std::lock_guard<std::recursive_mutex> lock(m_impl->mtx);
+  try {
+    return m_impl->storage.transaction([&]() {
+      m_impl->storage.remove_all<UploadPart>(
+          where(c(&UploadPart::uploadId) == uploadId));
+      m_impl->storage.remove_all<UploadSession>(
+          where(c(&UploadSession::uploadId) == uploadId));
+      return true;
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "[DB] Error deleting UploadSession ->" << uploadId << " =>"
+              << e.what() << std::endl;
+    return false;
+  }
+}
+
 } // namespace sync
@@ -0,0 +1,204 @@
+#include "DeltaEncoder.hpp"
+#include "picosha2.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace sync {
+
+namespace {
+
+// Encoded output handed out per next() call
+constexpr size_t kOutputChunk = 256 * 1024;
+// Pending literal data is sent once it reaches this
+constexpr size_t kMaxLiteral = 64 * 1024;
+constexpr size_t kReadSize = 4 * 1024 * 1024;
+
+uint32_t tagOf(uint32_t weak) { return (weak ^ (weak >> 16)) & 0xffff; }
+
+void putU32(std::string &out, uint32_t v) {
+  for (int i = 0; i < 4; ++i)
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+} // namespace
+
+void RollingChecksum::reset(const char *data, size_t len) {
+  m_a = 0;
+  m_b = 0;
+  m_len = len;
+  for (size_t i = 0; i < len; ++i) {
+    m_a += static_cast<unsigned char>(data[i]);
+    m_b += static_cast<uint32_t>(len - i) * static_cast<unsigned char>(data[i]);
+  }
+  m_a &= 0xffff;
+  m_b &= 0xffff;
+}
+
+std::string strongChecksum(const char *data, size_t len) {
+  std::vector<unsigned char> digest(picosha2::k_digest_size);
+  picosha2::hash256(data, data + len, digest.begin(), digest.end());
+  return picosha2::bytes_to_hex_string(digest.begin(), digest.begin() + 16);
+}
+
+size_t deltaBlockSize(int64_t fileSize) {
+  auto root = static_cast<size_t>(std::sqrt(static_cast<double>(fileSize)));
+  // Round to whole KiB between 2 KiB and 128 KiB
+  size_t kib = std::clamp<size_t>((root + 1023) / 1024, 2, 128);
+  return kib * 1024;
+}
+
+std::vector<BlockSignature> computeSignatures(std::istream &in,
+                                              size_t blockSize) {
+  std::vector<BlockSignature> blocks;
+  std::vector<char> buf(blockSize);
+  RollingChecksum sum;
+  while (in.read(buf.data(), static_cast<std::streamsize>(blockSize))) {
+    sum.reset(buf.data(), blockSize);
+    blocks.push_back({sum.value(), strongChecksum(buf.data(), blockSize)});
+  }
+  return blocks;
+}
+
+struct DeltaEncoder::Hasher {
+  picosha2::hash256_one_by_one sha;
+};
+
+DeltaEncoder::DeltaEncoder(std::istream &in, size_t blockSize,
+                           const std::vector<BlockSignature> &base)
+    : m_in(in), m_blockSize(blockSize), m_base(base), m_tags(1 << 16),
+      m_buf(std::max(kReadSize, 2 * blockSize)),
+      m_hasher(std::make_unique<Hasher>()) {
+  for (uint32_t i = 0; i < base.size(); ++i) {
+    m_byWeak[base[i].weak].push_back(i);
+    m_tags[tagOf(base[i].weak)] = true;
+  }
+}
+
+DeltaEncoder::~DeltaEncoder() = default;
+
+void DeltaEncoder::fill() {
+  // Keep the unconsumed window and read behind it
+  if (m_start > 0) {
+    std::memmove(m_buf.data(), m_buf.data() + m_start, m_end - m_start);
+    m_end -= m_start;
+    m_start = 0;
+  }
+  while (!m_eof && m_end < m_buf.size()) {
+    m_in.read(m_buf.data() + m_end,
+              static_cast<std::streamsize>(m_buf.size() - m_end));
+    auto n = static_cast<size_t>(m_in.gcount());
+    m_hasher->sha.process(m_buf.begin() + m_end, m_buf.begin() + m_end + n);
+    m_end += n;
+    m_read += static_cast<int64_t>(n);
+    if (!m_in) {
+      m_eof = true;
+      m_failed = !m_in.eof();
+    }
+  }
+}
+
+bool DeltaEncoder::findBlock(uint32_t &index) {
+  uint32_t weak = m_sum.value();
+  if (!m_tags[tagOf(weak)])
+    return false;
+  auto it = m_byWeak.find(weak);
+  if (it == m_byWeak.end())
+    return false;
+  std::string strong = strongChecksum(m_buf.data() + m_start, m_blockSize);
+  // Prefer the block right after the last copy so copies coalesce
+  const std::vector<uint32_t> &candidates = it->second;
+  uint32_t follow = m_copyFirst + m_copyCount;
+  if (m_copyCount > 0 &&
+      std::find(candidates.begin(), candidates.end(), follow) !=
+          candidates.end() &&
+      m_base[follow].strong == strong) {
+    index = follow;
+    return true;
+  }
+  for (uint32_t candidate : candidates) {
+    if (m_base[candidate].strong == strong) {
+      index = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DeltaEncoder::flushLiteral(std::string &out) {
+  if (m_literal.empty())
+    return;
+  out.push_back(delta::kLiteral);
+  putU32(out, static_cast<uint32_t>(m_literal.size()));
+  out += m_literal;
+  m_literalTotal += static_cast<int64_t>(m_literal.size());
+  m_literal.clear();
+}
+
+void DeltaEncoder::flushCopy(std::string &out) {
+  if (m_copyCount == 0)
+    return;
+  out.push_back(delta::kCopy);
+  putU32(out, m_copyFirst);
+  putU32(out, m_copyCount);
+  m_copyCount = 0;
+}
+
+void DeltaEncoder::next(std::string &out) {
+  if (!m_headerSent) {
+    out.append(delta::kMagic, sizeof(delta::kMagic));
+    putU32(out, static_cast<uint32_t>(m_blockSize));
+    m_headerSent = true;
+  }
+  while (!m_done && out.size() < kOutputChunk) {
+    if (m_end - m_start < m_blockSize && !m_eof) {
+      fill();
+      if (m_failed) {
+        m_done = true;
+        return;
+      }
+    }
+    if (m_end - m_start < m_blockSize || m_base.empty()) {
+      // The tail is shorter than a block and cannot match
+      flushCopy(out);
+      m_literal.append(m_buf.data() + m_start, m_end - m_start);
+      m_start = m_end;
+      flushLiteral(out);
+      if (!m_eof)
+        continue;
+      m_hasher->sha.finish();
+      m_sha256 = picosha2::get_hash_hex_string(m_hasher->sha);
+      m_done = true;
+      return;
+    }
+    if (!m_sumValid) {
+      m_sum.reset(m_buf.data() + m_start, m_blockSize);
+      m_sumValid = true;
+    }
+    uint32_t index;
+    if (findBlock(index)) {
+      flushLiteral(out);
+      if (m_copyCount > 0 && index != m_copyFirst + m_copyCount)
+        flushCopy(out);
+      if (m_copyCount == 0)
+        m_copyFirst = index;
+      m_copyCount++;
+      m_start += m_blockSize;
+      m_sumValid = false;
+      continue;
+    }
+    flushCopy(out);
+    auto leaving = static_cast<unsigned char>(m_buf[m_start]);
+    m_literal.push_back(static_cast<char>(leaving));
+    if (m_start + m_blockSize < m_end)
+      m_sum.roll(leaving,
+                 static_cast<unsigned char>(m_buf[m_start + m_blockSize]));
+    else
+      m_sumValid = false;
+    m_start++;
+    if (m_literal.size() >= kMaxLiteral)
+      flushLiteral(out);
+  }
+}
+
+} // namespace sync
@@ -0,0 +1,159 @@
+#include "EchoRegistry.hpp"
+#include "AtomicFileWriter.hpp"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace sync {
+
+EchoRegistry::EchoRegistry(const std::string &syncPath,
+                           std::chrono::milliseconds ttl)
+    : m_scanner(syncPath), m_ttl(ttl) {}
+
+std::string EchoRegistry::normalize(const std::string &path) const {
+  std::string p = fs::path(path).lexically_normal().generic_string();
+  if (p.size() > 1 && p.back() == '/')
+    p.pop_back();
+  return p;
+}
+
+std::optional<EchoRegistry::FileState>
+EchoRegistry::readState(const std::string &path) {
+  std::error_code ec;
+  FileState state;
+  state.size = fs::file_size(path, ec);
+  if (ec)
+    return std::nullopt;
+  state.mtime = fs::last_write_time(path, ec);
+  if (ec)
+    return std::nullopt;
+  state.inode = m_scanner.getInode(path);
+  return state;
+}
+
+void EchoRegistry::pruneLocked(std::chrono::steady_clock::time_point now) {
+  if (now < m_nextPrune)
+    return;
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    if (it->second.inFlight == 0 && it->second.expires < now)
+      it = m_entries.erase(it);
+    else
+      ++it;
+  }
+  m_nextPrune = now + m_ttl;
+}
+
+void EchoRegistry::beginWrite(const std::string &absPath) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  pruneLocked(std::chrono::steady_clock::now());
+  Entry &entry = m_entries[normalize(absPath)];
+  if (entry.kind != Kind::Write) {
+    entry = Entry{};
+    entry.kind = Kind::Write;
+  }
+  entry.inFlight++;
+}
+
+void EchoRegistry::endWrite(const std::string &absPath) {
+  std::string key = normalize(absPath);
+  auto state = readState(key);
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_entries.find(key);
+  if (it == m_entries.end() || it->second.kind != Kind::Write)
+    return;
+  Entry &entry = it->second;
+  if (entry.inFlight > 0)
+    entry.inFlight--;
+  entry.state = state;
+  entry.expires = std::chrono::steady_clock::now() + m_ttl;
+}
+
+void EchoRegistry::expectDirectory(const std::string &absPath) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mtx);
+  pruneLocked(now);
+  Entry &entry = m_entries[normalize(absPath)];
+  entry = Entry{};
+  entry.kind = Kind::Directory;
+  entry.expires = now + m_ttl;
+}
+
+void EchoRegistry::expectRemoval(const std::string &absPath, bool recursive) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mtx);
+  pruneLocked(now);
+  Entry &entry = m_entries[normalize(absPath)];
+  entry = Entry{};
+  entry.kind = Kind::Removal;
+  entry.recursive = recursive;
+  entry.expires = now + m_ttl;
+}
+
+std::optional<EchoRegistry::Entry> EchoRegistry::find(const std::string &path,
+                                                      Kind kind) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto live = [&](const Entry &e) {
+    return e.kind == kind && (e.inFlight > 0 || e.expires >= now);
+  };
+  auto it = m_entries.find(path);
+  if (it != m_entries.end() && live(it->second))
+    return it->second;
+  if (kind != Kind::Removal)
+    return std::nullopt;
+  // Files inside a folder we removed
+  fs::path p(path);
+  while (p.has_parent_path() && p.parent_path() != p) {
+    p = p.parent_path();
+    it = m_entries.find(p.generic_string());
+    if (it != m_entries.end() && it->second.recursive && live(it->second))
+      return it->second;
+  }
+  return std::nullopt;
+}
+
+bool EchoRegistry::isWriteEcho(const std::string &path) {
+  auto entry = find(path, Kind::Write);
+  if (!entry)
+    return false;
+  if (entry->inFlight > 0)
+    return true;
+  // Stat outside the lock; a changed file means someone edited it after us
+  return entry->state && readState(path) == entry->state;
+}
+
+bool EchoRegistry::isEcho(const std::string &path, const std::string &oldPath,
+                          WatchEvent event) {
+  std::string key = normalize(path);
+  bool echo = false;
+  // Partial downloads are ours alone; moving one into place is the write
+  if (AtomicFileWriter::isTempPath(key)) {
+    m_suppressed++;
+    return true;
+  }
+  if (event == WatchEvent::Moved && AtomicFileWriter::isTempPath(oldPath))
+    event = WatchEvent::Added;
+  switch (event) {
+  case WatchEvent::Added:
+    echo = find(key, Kind::Directory).has_value() || isWriteEcho(key);
+    break;
+  case WatchEvent::Modified:
+    echo = isWriteEcho(key);
+    break;
+  case WatchEvent::Deleted:
+    echo = find(key, Kind::Removal).has_value();
+    break;
+  case WatchEvent::Moved:
+    // Our renames register the target as a write and the source as removed
+    echo = (oldPath.empty() || find(normalize(oldPath), Kind::Removal)) &&
+           isWriteEcho(key);
+    break;
+  case WatchEvent::Rescan:
+    break;
+  }
+  if (echo)
+    m_suppressed++;
+  return echo;
+}
+
+} // namespace sync
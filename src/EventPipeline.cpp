@@ -0,0 +1,251 @@
+#include "EventPipeline.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+namespace sync {
+
+// Every shard an event was queued on holds a reference; the last to arrive
+// runs it
+struct EventPipeline::Join {
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t expected = 0;
+  size_t arrived = 0;
+  bool done = false;
+};
+
+EventPipeline::EventPipeline(Handler handler, EventPipelineOptions options)
+    : m_handler(std::move(handler)), m_options(options) {
+  size_t workers = std::max<size_t>(1, m_options.workerCount);
+  size_t perShard = std::max<size_t>(1, m_options.queueCapacity / workers);
+  for (size_t i = 0; i < workers; ++i) {
+    m_shards.push_back(std::make_unique<Shard>());
+    m_shards.back()->capacity = perShard;
+  }
+}
+
+EventPipeline::~EventPipeline() { stop(); }
+
+void EventPipeline::setOverflowHandler(OverflowHandler handler) {
+  m_overflowHandler = std::move(handler);
+}
+
+void EventPipeline::start() {
+  if (m_running.exchange(true))
+    return;
+  for (auto &shard : m_shards)
+    shard->worker = std::thread(&EventPipeline::workerLoop, this,
+                                std::ref(*shard));
+  std::cout << "[Pipeline] Started " << m_shards.size() << " workers"
+            << std::endl;
+}
+
+void EventPipeline::stop() {
+  if (!m_running.exchange(false))
+    return;
+  size_t discarded = 0;
+  for (auto &shard : m_shards) {
+    {
+      std::lock_guard<std::mutex> lock(shard->mtx);
+      discarded += shard->queue.size();
+      shard->queue.clear();
+    }
+    shard->cv.notify_all();
+  }
+  for (auto &shard : m_shards) {
+    if (shard->worker.joinable())
+      shard->worker.join();
+  }
+  m_queued = 0;
+  std::cout << "[Pipeline] Stopped, " << discarded
+            << " queued events discarded" << std::endl;
+}
+
+size_t EventPipeline::shardFor(const std::string &path) const {
+  return std::hash<std::string>{}(path) % m_shards.size();
+}
+
+void EventPipeline::enqueued(Shard &shard, size_t count) {
+  m_submitted++;
+  size_t queued = m_queued += count;
+  size_t high = m_highWatermark.load();
+  while (queued > high && !m_highWatermark.compare_exchange_weak(high, queued))
+    ;
+  if (shard.queue.size() == shard.capacity * 3 / 4)
+    std::cerr << "[Pipeline] Shard queue at 75% (" << shard.queue.size()
+              << "/" << shard.capacity << "), workers falling behind"
+              << std::endl;
+}
+
+bool EventPipeline::submit(const std::string &path, const std::string &oldPath,
+                           WatchEvent type) {
+  if (!m_running)
+    return false;
+  PipelineEvent event{path, oldPath, type, std::chrono::steady_clock::now()};
+  size_t first = shardFor(path);
+  size_t second = oldPath.empty() ? first : shardFor(oldPath);
+  // Children of a moved directory hash anywhere; they must not run against
+  // the DB before it is re-rooted
+  std::error_code ec;
+  bool subtree = type == WatchEvent::Rescan ||
+                 (type == WatchEvent::Moved &&
+                  std::filesystem::is_directory(path, ec));
+
+  std::lock_guard<std::mutex> order(m_submitMutex);
+  if (subtree && m_shards.size() > 1)
+    return submitBarrier(std::move(event));
+  if (first == second) {
+    Shard &shard = *m_shards[first];
+    {
+      std::lock_guard<std::mutex> lock(shard.mtx);
+      if (shard.queue.size() >= shard.capacity) {
+        m_overflowPending = true;
+        m_dropped++;
+        return false;
+      }
+      shard.queue.push_back({std::move(event), nullptr});
+      enqueued(shard, 1);
+    }
+    shard.cv.notify_one();
+    return true;
+  }
+
+  // Both shards need room so a move is never queued on one side only
+  Shard &a = *m_shards[std::min(first, second)];
+  Shard &b = *m_shards[std::max(first, second)];
+  {
+    std::scoped_lock lock(a.mtx, b.mtx);
+    bool aFull = a.queue.size() >= a.capacity;
+    bool bFull = b.queue.size() >= b.capacity;
+    if (aFull || bFull) {
+      m_overflowPending = true;
+      m_dropped++;
+      return false;
+    }
+    auto join = std::make_shared<Join>();
+    join->expected = 2;
+    a.queue.push_back({event, join});
+    b.queue.push_back({std::move(event), join});
+    enqueued(a, 2);
+  }
+  a.cv.notify_one();
+  b.cv.notify_one();
+  return true;
+}
+
+bool EventPipeline::submitBarrier(PipelineEvent event) {
+  std::vector<std::unique_lock<std::mutex>> locks;
+  for (auto &shard : m_shards) {
+    locks.emplace_back(shard->mtx);
+    if (shard->queue.size() >= shard->capacity) {
+      m_overflowPending = true;
+      m_dropped++;
+      return false;
+    }
+  }
+  auto join = std::make_shared<Join>();
+  join->expected = m_shards.size();
+  for (auto &shard : m_shards)
+    shard->queue.push_back({event, join});
+  enqueued(*m_shards.front(), m_shards.size());
+  locks.clear();
+  for (auto &shard : m_shards)
+    shard->cv.notify_one();
+  return true;
+}
+
+bool EventPipeline::arriveAtJoin(Join &join) {
+  std::unique_lock<std::mutex> lock(join.mtx);
+  if (++join.arrived == join.expected)
+    return true;
+  // Hold this shard until the last side has run the event. Joined events
+  // reach every shard in submit order, so no side waits on a later one.
+  while (!join.done && m_running)
+    join.cv.wait_for(lock, std::chrono::milliseconds(100));
+  return false;
+}
+
+void EventPipeline::runHandler(const PipelineEvent &event) {
+  try {
+    m_handler(event);
+  } catch (const std::exception &e) {
+    std::cerr << "[Pipeline] Handler error on " << event.path << ": "
+              << e.what() << std::endl;
+  }
+  m_processed++;
+}
+
+void EventPipeline::workerLoop(Shard &shard) {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(shard.mtx);
+      shard.cv.wait(lock, [&] { return !m_running || !shard.queue.empty(); });
+      if (!m_running)
+        return;
+      job = std::move(shard.queue.front());
+      shard.queue.pop_front();
+    }
+    m_queued--;
+
+    double delayMs = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() -
+                         job.event.enqueuedAt)
+                         .count();
+    {
+      std::lock_guard<std::mutex> lock(m_statsMutex);
+      m_totalDelayMs += delayMs;
+      m_maxDelayMs = std::max(m_maxDelayMs, delayMs);
+      m_delaySamples++;
+    }
+
+    if (!job.join) {
+      runHandler(job.event);
+    } else if (arriveAtJoin(*job.join)) {
+      runHandler(job.event);
+      {
+        std::lock_guard<std::mutex> lock(job.join->mtx);
+        job.join->done = true;
+      }
+      job.join->cv.notify_all();
+    }
+
+    // One worker recovers dropped events once its own shard is idle
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(shard.mtx);
+      idle = shard.queue.empty();
+    }
+    if (idle && m_overflowPending.exchange(false) && m_overflowHandler) {
+      std::cerr << "[Pipeline] Events were dropped, running overflow handler"
+                << std::endl;
+      try {
+        m_overflowHandler();
+      } catch (const std::exception &e) {
+        std::cerr << "[Pipeline] Overflow handler error: " << e.what()
+                  << std::endl;
+      }
+    }
+  }
+}
+
+EventPipelineStats EventPipeline::stats() const {
+  EventPipelineStats s;
+  s.submitted = m_submitted;
+  s.processed = m_processed;
+  s.dropped = m_dropped;
+  s.queued = m_queued;
+  s.highWatermark = m_highWatermark;
+  for (const auto &shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    s.shardDepths.push_back(shard->queue.size());
+  }
+  std::lock_guard<std::mutex> lock(m_statsMutex);
+  if (m_delaySamples > 0)
+    s.avgQueueDelayMs = m_totalDelayMs / m_delaySamples;
+  s.maxQueueDelayMs = m_maxDelayMs;
+  return s;
+}
+
+} // namespace sync
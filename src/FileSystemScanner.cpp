@@ -1,7 +1,9 @@
 #include "FileSystemScanner.hpp"
+#include "AtomicFileWriter.hpp"
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <vector>
 
@@ -98,17 +100,22 @@ FileSystemScanner::getUnixTimeStamp(const fs::file_time_type &ftime) {
       .count();
 }
 
-ScanResult FileSystemScanner::scanSyncPath(std::string path) {
-  ScanResult result;
+void FileSystemScanner::visitSyncPath(
+    const std::string &path,
+    const std::function<void(const ScannedFile &)> &onFile,
+    const std::function<void(const ScannedDirectory &)> &onDirectory) {
   fs::directory_options opts = fs::directory_options::skip_permission_denied;
 
   try {
     if (!fs::exists(path))
-      return result;
+      return;
 
     for (const auto &entry : fs::recursive_directory_iterator(path, opts)) {
       try {
         if (entry.is_regular_file()) {
+          // Left behind by an interrupted download
+          if (AtomicFileWriter::isTempPath(entry.path().string()))
+            continue;
           ScannedFile file;
           file.absPath = entry.path().string();
           file.path = toRelativePath(file.absPath);
@@ -117,7 +124,7 @@ ScanResult FileSystemScanner::scanSyncPath(std::string path) {
           file.mtime = getUnixTimeStamp(fs::last_write_time(file.absPath));
           file.inode = getInode(file.absPath);
           file.hash = calculateHash(file.absPath);
-          result.files.push_back(file);
+          onFile(file);
 
         } else if (entry.is_directory()) {
           ScannedDirectory dir;
@@ -126,7 +133,7 @@ ScanResult FileSystemScanner::scanSyncPath(std::string path) {
           dir.name = entry.path().filename().string();
           dir.inode = getInode(dir.absPath);
           dir.mtime = getUnixTimeStamp(fs::last_write_time(dir.absPath));
-          result.directories.push_back(dir);
+          onDirectory(dir);
         }
       } catch (const std::exception &e) {
         std::cerr << "Error scanning item: " << entry.path() << " - "
@@ -136,8 +143,23 @@ ScanResult FileSystemScanner::scanSyncPath(std::string path) {
   } catch (const std::exception &e) {
     std::cerr << "FileSystem Error: " << e.what() << std::endl;
   }
+}
 
+ScanResult FileSystemScanner::scanSyncPath(std::string path) {
+  ScanResult result;
+  visitSyncPath(
+      path, [&](const ScannedFile &file) { result.files.push_back(file); },
+      [&](const ScannedDirectory &dir) { result.directories.push_back(dir); });
   return result;
 }
 
+LocalScanTable FileSystemScanner::scanSyncPathCompact(std::string path) {
+  LocalScanTable table(m_syncPath);
+  visitSyncPath(
+      path, [&](const ScannedFile &file) { table.addFile(file); },
+      [&](const ScannedDirectory &dir) { table.addDirectory(dir); });
+  table.sortByKey();
+  return table;
+}
+
 } // namespace sync
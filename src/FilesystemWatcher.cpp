@@ -1,28 +1,71 @@
 #include "FilesystemWatcher.hpp"
+#include "BurstDetector.hpp"
+#include "InotifyBackend.hpp"
+#include "PollingBackend.hpp"
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <optional>
+#include <queue>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/mount.h>
+#include <sys/param.h>
 #endif
 
 namespace fs = std::filesystem;
 
 namespace sync {
 
-enum class SettleState { Polling, Settling };
+// Closed: the writer closed the file; dispatch if nothing changed since
+enum class SettleState { Polling, Settling, Closed };
 
 struct PendingEvent {
   WatchEvent type;
   fs::file_time_type lastMTime;
   std::chrono::steady_clock::time_point nextCheck;
   SettleState state;
+  // Bumped whenever the event is replaced, so older timers are ignored
+  uint64_t generation;
+  // When a probe last saw the mtime move; feeds the write cadence
+  std::optional<std::chrono::steady_clock::time_point> lastChange;
+  // Since when the settled file has been found held open by a writer
+  std::optional<std::chrono::steady_clock::time_point> heldSince{};
+};
+
+// One scheduled check of a pending path; the earliest sits on top
+struct DebounceTimer {
+  std::chrono::steady_clock::time_point due;
+  uint64_t generation;
+  std::string path;
+  bool operator>(const DebounceTimer &other) const { return due > other.due; }
+};
+
+// Filesystem state of a pending path, read without holding the lock
+struct PathProbe {
+  bool exists = false;
+  bool failed = false;
+  fs::file_time_type mtime;
+  bool accessible = false;
 };
 
 // Helper to check if file is locked on Windows
@@ -36,134 +79,395 @@ bool isFileAccessible(const std::string &path) {
     return false;
   }
   CloseHandle(hFile);
+#elif defined(__linux__)
+  // A read lease is refused while any process has the file open for
+  // writing. Leases need ownership of the file; without it assume free.
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return true;
+  bool writers = fcntl(fd, F_SETLEASE, F_RDLCK) < 0 && errno == EAGAIN;
+  if (!writers)
+    fcntl(fd, F_SETLEASE, F_UNLCK);
+  close(fd);
+  return !writers;
 #endif
   return true;
 }
 
+// Network and FUSE mounts deliver no (or only local) change notifications
+bool isRemoteFilesystem(const std::string &path) {
+#ifdef _WIN32
+  std::string rootPath = fs::path(path).root_path().string();
+  return GetDriveTypeA(rootPath.c_str()) == DRIVE_REMOTE;
+#elif defined(__linux__)
+  struct statfs info;
+  if (statfs(path.c_str(), &info) != 0)
+    return false;
+  switch (static_cast<unsigned long>(info.f_type)) {
+  case 0x6969UL:     // NFS
+  case 0x517BUL:     // SMB
+  case 0xFF534D42UL: // CIFS
+  case 0xFE534D42UL: // SMB2
+  case 0x65735546UL: // FUSE (sshfs, rclone, ...)
+  case 0x01021997UL: // 9p
+    return true;
+  default:
+    return false;
+  }
+#elif defined(__APPLE__)
+  struct statfs info;
+  if (statfs(path.c_str(), &info) != 0)
+    return false;
+  for (const char *type : {"nfs", "smbfs", "afpfs", "webdav", "macfuse"}) {
+    if (std::strcmp(info.f_fstypename, type) == 0)
+      return true;
+  }
+  return false;
+#else
+  return false;
+#endif
+}
+
+PathProbe probePath(const std::string &path, bool checkAccess) {
+  PathProbe probe;
+  try {
+    probe.exists = fs::exists(path);
+    if (probe.exists) {
+      probe.mtime = fs::last_write_time(path);
+      probe.accessible = !checkAccess || isFileAccessible(path);
+    }
+  } catch (const fs::filesystem_error &e) {
+    // Errors like permission denied while checking mtime
+    probe.failed = true;
+  }
+  return probe;
+}
+
 struct FilesystemWatcher::Impl : public efsw::FileWatchListener {
   efsw::FileWatcher watcher;
   efsw::WatchID watchId = 0;
   bool running = false;
 
-  // Debouncing members
+  // Debouncing members. Every pending path has one live timer in the heap;
+  // the worker sleeps until the earliest one is due.
   std::map<std::string, PendingEvent> pendingEvents;
+  std::priority_queue<DebounceTimer, std::vector<DebounceTimer>,
+                      std::greater<DebounceTimer>>
+      timers;
+  uint64_t nextGeneration = 0;
   std::mutex mtx;
+  std::condition_variable cv;
   std::thread workerThread;
   std::atomic<bool> workerRunning{false};
   FilesystemWatcher::Callback callback;
 
-  // Configurable intervals
+  // Configurable intervals. The settle window per path is learned from
+  // its write cadence and clamped to [minSettleTime, maxSettleTime].
   std::chrono::milliseconds pollInterval{100};
-  std::chrono::milliseconds settleTime{2000};
+  std::chrono::milliseconds minSettleTime{300};
+  std::chrono::milliseconds maxSettleTime{30000};
+  // Delay before a closed file is re-checked and dispatched
+  std::chrono::milliseconds closeConfirmTime{25};
+
+  // Smoothed interval between observed writes, per path. Kept after
+  // dispatch so files written periodically start with a learned window.
+  std::unordered_map<std::string, double> writeCadenceMs;
+  static constexpr size_t kMaxCadenceEntries = 4096;
+
+  // Event storms are coalesced into one rescan per subtree
+  BurstDetector bursts;
+
+  // Sources of recent directory moves. Some backends follow a folder move
+  // with a Deleted per child; the DB re-root already covers those.
+  struct MovedDir {
+    std::string from;
+    std::chrono::steady_clock::time_point until;
+  };
+  std::vector<MovedDir> movedDirs;
+  static constexpr std::chrono::seconds kMoveEchoWindow{2};
+
+  // Set in polling mode, which replaces the notification backends
+  std::unique_ptr<PollingBackend> poller;
+
+#ifdef __linux__
+  // Preferred over efsw on Linux; null when inotify could not start
+  std::unique_ptr<InotifyBackend> native;
+#endif
+
+  explicit Impl(const std::string &rootPath) : bursts(rootPath) {}
+
+  void schedule(const std::string &path, PendingEvent &pending,
+                std::chrono::steady_clock::time_point due) {
+    pending.nextCheck = due;
+    timers.push({due, pending.generation, path});
+  }
+
+  std::optional<std::chrono::steady_clock::time_point> nextDeadline() const {
+    auto next = bursts.nextDeadline();
+    if (!timers.empty() && (!next || timers.top().due < *next))
+      next = timers.top().due;
+    return next;
+  }
 
   void workerLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
     while (workerRunning) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      std::unique_lock<std::mutex> lock(mtx);
+      if (auto deadline = nextDeadline())
+        cv.wait_until(lock, *deadline);
+      else
+        cv.wait(lock);
+      if (!workerRunning)
+        break;
       auto now = std::chrono::steady_clock::now();
 
-      for (auto it = pendingEvents.begin(); it != pendingEvents.end();) {
-        if (now < it->second.nextCheck) {
-          ++it;
-          continue;
-        }
+      // Settled events are delivered after the lock is released so a slow
+      // callback never blocks pushEvent on the efsw thread
+      std::vector<std::pair<std::string, WatchEvent>> settled;
+      for (const auto &burst : bursts.takeSettled(now)) {
+        std::cout << "[Watcher] Coalesced " << burst.absorbed
+                  << " events under " << burst.root << " into one rescan"
+                  << std::endl;
+        settled.emplace_back(burst.root, WatchEvent::Rescan);
+      }
 
-        const std::string &path = it->first;
+      // Only expired timers are touched; stale ones belong to events that
+      // were replaced or dropped since
+      std::vector<std::pair<DebounceTimer, SettleState>> due;
+      while (!timers.empty() && timers.top().due <= now) {
+        DebounceTimer timer = timers.top();
+        timers.pop();
+        auto it = pendingEvents.find(timer.path);
+        if (it != pendingEvents.end() &&
+            it->second.generation == timer.generation)
+          due.emplace_back(std::move(timer), it->second.state);
+      }
 
-        // 1. Check if file still exists
-        try {
-          if (!fs::exists(path)) {
-            it = pendingEvents.erase(it);
-            continue;
-          }
+      // Stat outside the lock so pushEvent never waits on filesystem I/O
+      std::vector<PathProbe> probes;
+      if (!due.empty()) {
+        lock.unlock();
+        probes.reserve(due.size());
+        for (const auto &[timer, state] : due)
+          probes.push_back(
+              probePath(timer.path, state != SettleState::Polling));
+        lock.lock();
+        now = std::chrono::steady_clock::now();
+      }
 
-          auto currentMTime = fs::last_write_time(path);
+      for (size_t i = 0; i < due.size(); ++i) {
+        const std::string &path = due[i].first.path;
+        const PathProbe &probe = probes[i];
+        auto it = pendingEvents.find(path);
+        if (it == pendingEvents.end() ||
+            it->second.generation != due[i].first.generation)
+          continue; // Replaced while we were probing
+        PendingEvent &pending = it->second;
 
+        // 1. Check if file still exists
+        if (probe.failed) {
+          schedule(path, pending, now + pollInterval);
+        } else if (!probe.exists) {
+          pendingEvents.erase(it);
+        } else if (probe.mtime != pending.lastMTime) {
           // 2. State Machine Logic
-          if (currentMTime != it->second.lastMTime) {
-            // File is changing! Reset to polling state
-            it->second.lastMTime = currentMTime;
-            it->second.nextCheck = now + pollInterval;
-            it->second.state = SettleState::Polling;
-            ++it;
-          } else if (it->second.state == SettleState::Polling) {
-            // MTime is stable for 'pollInterval', move to 'settleTime'
-            it->second.state = SettleState::Settling;
-            it->second.nextCheck = now + settleTime;
-            ++it;
-          } else if (it->second.state == SettleState::Settling) {
-            // MTime has been stable for full 'settleTime'.
-            // Final Check: Is it locked by another process?
-            if (isFileAccessible(path)) {
-              if (callback) {
-                callback(path, "", it->second.type);
-              }
-              it = pendingEvents.erase(it);
-            } else {
-              // Still locked! Stay in Settling state and check again soon
-              it->second.nextCheck = now + pollInterval;
-              ++it;
-            }
+          // File is changing! Reset to polling state
+          noteWrite(path, pending, now);
+          pending.lastMTime = probe.mtime;
+          pending.state = SettleState::Polling;
+          pending.heldSince.reset();
+          schedule(path, pending, now + pollInterval);
+        } else if (pending.state == SettleState::Polling) {
+          // MTime is stable for 'pollInterval', wait out this path's
+          // settle window
+          pending.state = SettleState::Settling;
+          schedule(path, pending, now + settleWindow(path));
+        } else if (probe.accessible) {
+          // Closed and untouched since, or stable for the whole settle
+          // window, and no other process holds it open
+          settled.emplace_back(path, pending.type);
+          pendingEvents.erase(it);
+        } else {
+          // Still locked. Editors and databases may hold it open for
+          // good, so once it has sat unchanged for maxSettleTime it is
+          // dispatched anyway.
+          if (!pending.heldSince)
+            pending.heldSince = now;
+          if (now - *pending.heldSince >= maxSettleTime) {
+            std::cout << "[Watcher] Still open for writing, syncing anyway: "
+                      << path << std::endl;
+            settled.emplace_back(path, pending.type);
+            pendingEvents.erase(it);
+          } else {
+            schedule(path, pending, now + pollInterval);
           }
-        } catch (const fs::filesystem_error &e) {
-          // Errors like permission denied while checking mtime
-          it->second.nextCheck = now + pollInterval;
-          ++it;
         }
       }
+
+      if (callback && !settled.empty()) {
+        lock.unlock();
+        for (const auto &[path, type] : settled)
+          callback(path, "", type);
+        lock.lock();
+      }
+    }
+  }
+
+  // Settle for a few write intervals so a writer that pauses between
+  // chunks is not caught mid-file
+  std::chrono::milliseconds settleWindow(const std::string &path) const {
+    auto cadence = writeCadenceMs.find(path);
+    if (cadence == writeCadenceMs.end())
+      return minSettleTime;
+    auto window = std::chrono::milliseconds(
+        static_cast<int64_t>(cadence->second * 4));
+    return std::clamp(window, minSettleTime, maxSettleTime);
+  }
+
+  void noteWrite(const std::string &path, PendingEvent &pending,
+                 std::chrono::steady_clock::time_point now) {
+    if (pending.lastChange) {
+      double interval = std::chrono::duration<double, std::milli>(
+                            now - *pending.lastChange)
+                            .count();
+      if (writeCadenceMs.size() >= kMaxCadenceEntries &&
+          !writeCadenceMs.count(path))
+        writeCadenceMs.clear();
+      auto [it, inserted] = writeCadenceMs.try_emplace(path, interval);
+      if (!inserted)
+        it->second = 0.3 * interval + 0.7 * it->second;
     }
+    pending.lastChange = now;
   }
 
-  void pushEvent(const std::string &path, WatchEvent event) {
+  // True when the event falls inside a burst and must not be delivered on
+  // its own. Pending events under the burst are dropped with it.
+  bool absorbIntoBurst(const std::string &path, const std::string &oldPath) {
     std::lock_guard<std::mutex> lock(mtx);
     auto now = std::chrono::steady_clock::now();
+    auto before = bursts.nextDeadline();
+    // A move is only absorbed when both ends are covered by the rescan
+    if (!oldPath.empty() && !bursts.absorb(oldPath, now))
+      return false;
+    auto root = bursts.absorb(path, now);
+    if (!root)
+      return false;
+    std::string prefix = *root == "/" ? *root : *root + "/";
+    auto it = pendingEvents.lower_bound(prefix);
+    while (it != pendingEvents.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0)
+      it = pendingEvents.erase(it);
+    // A new burst may be due before whatever the worker is sleeping on
+    if (!before || bursts.nextDeadline() < before)
+      cv.notify_one();
+    return true;
+  }
 
-    // Requirement: ignore Modified if Add is already pending
-    if (event == WatchEvent::Modified) {
-      auto existing = pendingEvents.find(path);
-      if (existing != pendingEvents.end() &&
-          existing->second.type == WatchEvent::Added) {
-        return;
+  // Pending events under a moved directory follow it, so an edit made
+  // just before the move is still delivered, under the new path
+  void moveSubtree(const std::string &from, const std::string &to) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+    std::string prefix = from + "/";
+    std::vector<std::pair<std::string, PendingEvent>> moved;
+    auto it = pendingEvents.lower_bound(prefix);
+    while (it != pendingEvents.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+      moved.emplace_back(to + it->first.substr(from.size()), it->second);
+      it = pendingEvents.erase(it);
+    }
+    for (auto &[path, pending] : moved) {
+      PendingEvent &entry = pendingEvents[path];
+      entry = pending;
+      entry.generation = ++nextGeneration;
+      schedule(path, entry, pending.nextCheck);
+    }
+    std::erase_if(movedDirs, [&](const MovedDir &m) { return m.until < now; });
+    movedDirs.push_back({from, now + kMoveEchoWindow});
+    if (!moved.empty())
+      cv.notify_one();
+  }
+
+  // A child Deleted trailing a folder move, while the old folder is gone
+  bool isMoveEcho(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+    for (const auto &m : movedDirs) {
+      if (m.until >= now && path.size() > m.from.size() &&
+          path.compare(0, m.from.size(), m.from) == 0 &&
+          path[m.from.size()] == '/') {
+        std::error_code ec;
+        return !fs::exists(m.from, ec);
       }
     }
+    return false;
+  }
 
+  // closed: the backend saw the writer close the file, so it can be
+  // dispatched as soon as a quick re-check shows it unchanged
+  void pushEvent(const std::string &path, WatchEvent event,
+                 bool closed = false) {
+    fs::file_time_type mtime = (fs::file_time_type::min)();
     try {
-      fs::file_time_type mtime;
       if (fs::exists(path)) {
         mtime = fs::last_write_time(path);
       }
-      pendingEvents[path] =
-          PendingEvent{event, mtime, now + pollInterval, SettleState::Polling};
     } catch (...) {
-      pendingEvents[path] =
-          PendingEvent{event, (fs::file_time_type::min)(), now + pollInterval,
-                       SettleState::Polling};
     }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+
+    // Requirement: ignore Modified if Add is already pending. A close
+    // still completes the pending Add.
+    auto existing = pendingEvents.find(path);
+    if (event == WatchEvent::Modified && existing != pendingEvents.end() &&
+        existing->second.type == WatchEvent::Added) {
+      if (!closed)
+        return;
+      event = WatchEvent::Added;
+    }
+
+    // A repeat event is another write; keep the cadence history
+    std::optional<std::chrono::steady_clock::time_point> lastChange;
+    if (existing != pendingEvents.end()) {
+      noteWrite(path, existing->second, now);
+      lastChange = existing->second.lastChange;
+    }
+
+    auto delay = closed ? closeConfirmTime : pollInterval;
+    bool wakeWorker = timers.empty() || now + delay < timers.top().due;
+    PendingEvent &pending = pendingEvents[path];
+    pending = PendingEvent{event,
+                           mtime,
+                           now,
+                           closed ? SettleState::Closed : SettleState::Polling,
+                           ++nextGeneration,
+                           lastChange};
+    schedule(path, pending, now + delay);
+    if (wakeWorker)
+      cv.notify_one();
   }
 
-  // Implement FileWatchListener
-  void handleFileAction(efsw::WatchID watchid, const std::string &dir,
-                        const std::string &filename, efsw::Action action,
-                        std::string oldFilename) override {
-    std::string fullPath = dir + filename;
-    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
-      fullPath = dir + "/" + filename;
-    fullPath =
-        std::filesystem::path(fullPath).lexically_normal().generic_string();
-    switch (action) {
-    case efsw::Actions::Add:
+  // Entry point for every backend; paths are absolute and normalized
+  void onEvent(const std::string &fullPath, const std::string &fullOldPath,
+               WatchEvent event, bool closed = false) {
+    if (event != WatchEvent::Rescan && absorbIntoBurst(fullPath, fullOldPath))
+      return;
+    switch (event) {
+    case WatchEvent::Added:
       if (fs::is_directory(fullPath)) {
         if (callback) {
-          callback(fullPath, oldFilename, WatchEvent::Added);
+          callback(fullPath, "", WatchEvent::Added);
         }
       } else {
         pushEvent(fullPath, WatchEvent::Added);
       }
       break;
-    case efsw::Actions::Delete:
+    case WatchEvent::Deleted:
+      if (isMoveEcho(fullPath))
+        break;
       if (callback) {
-        callback(fullPath, oldFilename, WatchEvent::Deleted);
+        callback(fullPath, "", WatchEvent::Deleted);
       }
       /*      if (fs::is_directory(fullPath)) {
               std::cout << "[Watcher] folder deletion Detected on path: " <<
@@ -183,32 +487,74 @@ struct FilesystemWatcher::Impl : public efsw::FileWatchListener {
               }
              }*/
       break;
-    case efsw::Actions::Modified:
+    case WatchEvent::Modified:
       if (!fs::is_directory(fullPath)) {
-        pushEvent(fullPath, WatchEvent::Modified);
+        pushEvent(fullPath, WatchEvent::Modified, closed);
       }
       break;
-    case efsw::Actions::Moved:
-      if (!oldFilename.empty()) {
-        std::string fullOldPath = dir + oldFilename;
-        if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
-          fullOldPath = dir + "/" + oldFilename;
-        fullOldPath = std::filesystem::path(fullOldPath)
-                          .lexically_normal()
-                          .generic_string();
+    case WatchEvent::Moved:
+      if (!fullOldPath.empty() && fs::is_directory(fullPath)) {
+        // One rename for the whole subtree; nothing to settle
+        moveSubtree(fullOldPath, fullPath);
+        if (callback)
+          callback(fullPath, fullOldPath, WatchEvent::Moved);
+        break;
+      }
+      if (!fullOldPath.empty()) {
         if (callback)
           callback(fullPath, fullOldPath, WatchEvent::Moved);
       }
       pushEvent(fullPath, WatchEvent::Moved);
       break;
+    case WatchEvent::Rescan:
+      // Backends ask for a rescan when they may have lost events
+      if (callback)
+        callback(fullPath, "", WatchEvent::Rescan);
+      break;
+    }
+  }
+
+  // Implement FileWatchListener
+  void handleFileAction(efsw::WatchID watchid, const std::string &dir,
+                        const std::string &filename, efsw::Action action,
+                        std::string oldFilename) override {
+    std::string fullPath = dir + filename;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+      fullPath = dir + "/" + filename;
+    fullPath =
+        std::filesystem::path(fullPath).lexically_normal().generic_string();
+    std::string fullOldPath;
+    if (action == efsw::Actions::Moved && !oldFilename.empty()) {
+      fullOldPath = dir + oldFilename;
+      if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        fullOldPath = dir + "/" + oldFilename;
+      fullOldPath = std::filesystem::path(fullOldPath)
+                        .lexically_normal()
+                        .generic_string();
+    }
+    switch (action) {
+    case efsw::Actions::Add:
+      onEvent(fullPath, "", WatchEvent::Added);
+      break;
+    case efsw::Actions::Delete:
+      onEvent(fullPath, "", WatchEvent::Deleted);
+      break;
+    case efsw::Actions::Modified:
+      onEvent(fullPath, "", WatchEvent::Modified);
+      break;
+    case efsw::Actions::Moved:
+      onEvent(fullPath, fullOldPath, WatchEvent::Moved);
+      break;
     default:
       break;
     }
   }
 };
 
-FilesystemWatcher::FilesystemWatcher(const std::string &path, Callback callback)
-    : m_path(path), m_callback(callback), m_impl(std::make_unique<Impl>()) {
+FilesystemWatcher::FilesystemWatcher(const std::string &path, Callback callback,
+                                     WatchMode mode, PollingOptions polling)
+    : m_impl(std::make_unique<Impl>(path)), m_path(path),
+      m_callback(callback), m_mode(mode), m_polling(polling) {
   m_impl->callback = m_callback;
 }
 
@@ -220,6 +566,39 @@ void FilesystemWatcher::start() {
 
   m_impl->workerRunning = true;
   m_impl->workerThread = std::thread(&Impl::workerLoop, m_impl.get());
+  Impl *impl = m_impl.get();
+
+  bool poll = m_mode == WatchMode::Polling;
+  if (m_mode == WatchMode::Auto && isRemoteFilesystem(m_path)) {
+    std::cout << "[Watcher] " << m_path
+              << " is on a network filesystem, using polling" << std::endl;
+    poll = true;
+  }
+  if (poll) {
+    m_impl->poller = std::make_unique<PollingBackend>(
+        m_path,
+        [impl](const std::string &path, const std::string &oldPath,
+               WatchEvent event) { impl->onEvent(path, oldPath, event); },
+        m_polling);
+    m_impl->poller->start();
+    m_impl->running = true;
+    return;
+  }
+
+#ifdef __linux__
+  m_impl->native = std::make_unique<InotifyBackend>(
+      m_path, [impl](const std::string &path, const std::string &oldPath,
+                     WatchEvent event, bool closed) {
+        impl->onEvent(path, oldPath, event, closed);
+      });
+  if (m_impl->native->start()) {
+    m_impl->running = true;
+    std::cout << "[Watcher] Started monitoring (inotify, with debouncing): "
+              << m_path << std::endl;
+    return;
+  }
+  m_impl->native.reset();
+#endif
 
   try {
     m_impl->watchId = m_impl->watcher.addWatch(m_path, m_impl.get(), true);
@@ -241,9 +620,25 @@ void FilesystemWatcher::stop() {
   if (!m_impl->running)
     return;
 
-  m_impl->watcher.removeWatch(m_impl->watchId);
+  if (m_impl->poller) {
+    m_impl->poller->stop();
+    m_impl->poller.reset();
+  } else {
+#ifdef __linux__
+    if (m_impl->native)
+      m_impl->native->stop();
+    else
+      m_impl->watcher.removeWatch(m_impl->watchId);
+#else
+    m_impl->watcher.removeWatch(m_impl->watchId);
+#endif
+  }
 
-  m_impl->workerRunning = false;
+  {
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    m_impl->workerRunning = false;
+  }
+  m_impl->cv.notify_all();
   if (m_impl->workerThread.joinable()) {
     m_impl->workerThread.join();
   }
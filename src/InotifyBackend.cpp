@@ -0,0 +1,351 @@
+#ifdef __linux__
+#include "InotifyBackend.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace sync {
+
+namespace {
+
+// IN_MODIFY covers files kept open (logs, databases, mmap'd files), which
+// never get an IN_CLOSE_WRITE while they change
+constexpr uint32_t kWatchMask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE |
+                                IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+// An IN_MOVED_FROM still unpaired after this moved out of the tree
+constexpr std::chrono::milliseconds kMovePairTimeout{100};
+// Directories with events this recent are rescanned first after an
+// overflow, ahead of the whole tree
+constexpr std::chrono::seconds kRecentWindow{5};
+constexpr size_t kMaxOverflowRescans = 64;
+const char *kMaxWatchesPath = "/proc/sys/fs/inotify/max_user_watches";
+
+bool isUnder(const std::string &path, const std::string &dir) {
+  return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+         path[dir.size()] == '/';
+}
+
+} // namespace
+
+struct InotifyBackend::Impl {
+  using Clock = std::chrono::steady_clock;
+  struct MoveFrom {
+    std::string path;
+    bool isDir;
+    Clock::time_point at;
+  };
+
+  std::string root;
+  InotifyBackend::Sink sink;
+  int fd = -1;
+  int wakeFd = -1;
+  std::thread reader;
+  std::atomic<bool> running{false};
+  bool limitReported = false;
+
+  // Only the reader thread touches these once started
+  std::unordered_map<int, std::string> dirsByWd;
+  std::map<std::string, int> wdsByDir;
+  std::unordered_map<uint32_t, MoveFrom> movesFrom;
+  std::map<std::string, Clock::time_point> recentDirs;
+
+  void emit(const std::string &path, const std::string &oldPath,
+            WatchEvent event, bool closed = false) {
+    if (sink)
+      sink(path, oldPath, event, closed);
+  }
+
+  // Doubles the per-user watch limit when we are allowed to (root or a
+  // writable sysctl); otherwise says once how to raise it
+  bool raiseWatchLimit() {
+    long current = 0;
+    std::ifstream(kMaxWatchesPath) >> current;
+    std::ofstream out(kMaxWatchesPath);
+    if (current > 0 && out && (out << current * 2).flush()) {
+      std::cout << "[Watcher] Raised inotify watch limit to " << current * 2
+                << std::endl;
+      return true;
+    }
+    if (!limitReported) {
+      std::cerr << "[Watcher] inotify watch limit (" << current
+                << ") reached; raise fs.inotify.max_user_watches. Changes "
+                   "in unwatched directories are only seen by rescans."
+                << std::endl;
+      limitReported = true;
+    }
+    return false;
+  }
+
+  bool addWatch(const std::string &dir) {
+    int wd = inotify_add_watch(fd, dir.c_str(), kWatchMask);
+    if (wd < 0 && errno == ENOSPC && raiseWatchLimit())
+      wd = inotify_add_watch(fd, dir.c_str(), kWatchMask);
+    if (wd < 0) {
+      if (errno != ENOSPC && errno != ENOENT && errno != ENOTDIR)
+        std::cerr << "[Watcher] inotify_add_watch failed on " << dir << ": "
+                  << std::strerror(errno) << std::endl;
+      return false;
+    }
+    dirsByWd[wd] = dir;
+    wdsByDir[dir] = wd;
+    return true;
+  }
+
+  // Watches dir and everything below it. A directory that appeared after
+  // the fact may already hold entries we got no events for, so announce
+  // reports them as added.
+  void addTree(const std::string &dir, bool announce) {
+    if (!addWatch(dir))
+      return;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(
+        dir, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      std::string path = it->path().generic_string();
+      std::error_code typeEc;
+      if (it->is_directory(typeEc)) {
+        addWatch(path);
+        if (announce)
+          emit(path, "", WatchEvent::Added);
+      } else if (announce && it->is_regular_file(typeEc)) {
+        emit(path, "", WatchEvent::Added);
+      }
+    }
+  }
+
+  // Watches follow the inode, so only our path bookkeeping needs moving
+  void renameTree(const std::string &from, const std::string &to) {
+    std::vector<std::pair<std::string, int>> moved;
+    for (auto it = wdsByDir.lower_bound(from); it != wdsByDir.end();) {
+      if (it->first != from && !isUnder(it->first, from))
+        break;
+      moved.emplace_back(to + it->first.substr(from.size()), it->second);
+      it = wdsByDir.erase(it);
+    }
+    for (const auto &[dir, wd] : moved) {
+      dirsByWd[wd] = dir;
+      wdsByDir[dir] = wd;
+    }
+  }
+
+  void removeTree(const std::string &dir) {
+    for (auto it = wdsByDir.lower_bound(dir); it != wdsByDir.end();) {
+      if (it->first != dir && !isUnder(it->first, dir))
+        break;
+      // The IN_IGNORED this queues finds nothing left to forget
+      inotify_rm_watch(fd, it->second);
+      dirsByWd.erase(it->second);
+      it = wdsByDir.erase(it);
+    }
+  }
+
+  void forgetWatch(int wd) {
+    auto it = dirsByWd.find(wd);
+    if (it == dirsByWd.end())
+      return;
+    auto byDir = wdsByDir.find(it->second);
+    if (byDir != wdsByDir.end() && byDir->second == wd)
+      wdsByDir.erase(byDir);
+    dirsByWd.erase(it);
+  }
+
+  void flushMoves(Clock::time_point now, bool all) {
+    for (auto it = movesFrom.begin(); it != movesFrom.end();) {
+      if (!all && now - it->second.at < kMovePairTimeout) {
+        ++it;
+        continue;
+      }
+      // Moved out of the tree. Its watches stay live and would keep
+      // reporting under the old paths, so drop them
+      if (it->second.isDir)
+        removeTree(it->second.path);
+      emit(it->second.path, "", WatchEvent::Deleted);
+      it = movesFrom.erase(it);
+    }
+  }
+
+  void overflow(Clock::time_point now) {
+    std::cerr << "[Watcher] inotify queue overflowed, rescanning the tree"
+              << std::endl;
+    flushMoves(now, true);
+    // The dropped events were never read, so they may be anywhere and the
+    // whole tree is rescanned. The topmost active directories go first:
+    // they are the likeliest to have changed and come back quicker.
+    std::vector<std::string> dirs;
+    for (const auto &[dir, at] : recentDirs) {
+      if (now - at > kRecentWindow || dir == root)
+        continue;
+      if (!dirs.empty() && isUnder(dir, dirs.back()))
+        continue;
+      dirs.push_back(dir);
+    }
+    recentDirs.clear();
+    if (dirs.size() > kMaxOverflowRescans)
+      dirs.clear();
+    dirs.push_back(root);
+    for (const auto &dir : dirs) {
+      // Directories created during the overflow have no watch yet
+      addTree(dir, false);
+      emit(dir, "", WatchEvent::Rescan);
+    }
+  }
+
+  void handle(const inotify_event &ev, Clock::time_point now) {
+    if (ev.mask & IN_Q_OVERFLOW) {
+      overflow(now);
+      return;
+    }
+    if (ev.mask & IN_IGNORED) {
+      forgetWatch(ev.wd);
+      return;
+    }
+    auto dirIt = dirsByWd.find(ev.wd);
+    if (dirIt == dirsByWd.end())
+      return;
+    const std::string dir = dirIt->second;
+    if (ev.mask & IN_DELETE_SELF) {
+      if (dir == root)
+        std::cerr << "[Watcher] Sync folder was removed: " << root
+                  << std::endl;
+      return;
+    }
+    if (ev.len == 0)
+      return;
+    std::string path = dir + "/" + ev.name;
+    bool isDir = ev.mask & IN_ISDIR;
+    recentDirs[dir] = now;
+
+    if (ev.mask & IN_CREATE) {
+      emit(path, "", WatchEvent::Added);
+      if (isDir)
+        addTree(path, true);
+    } else if (ev.mask & IN_CLOSE_WRITE) {
+      emit(path, "", WatchEvent::Modified, true);
+    } else if (ev.mask & IN_MODIFY) {
+      // Still open for writing; settles like any other change
+      emit(path, "", WatchEvent::Modified);
+    } else if (ev.mask & IN_DELETE) {
+      emit(path, "", WatchEvent::Deleted);
+    } else if (ev.mask & IN_MOVED_FROM) {
+      movesFrom[ev.cookie] = {path, isDir, now};
+    } else if (ev.mask & IN_MOVED_TO) {
+      auto from = movesFrom.find(ev.cookie);
+      if (from != movesFrom.end()) {
+        if (isDir)
+          renameTree(from->second.path, path);
+        emit(path, from->second.path, WatchEvent::Moved);
+        movesFrom.erase(from);
+      } else {
+        // Moved in from outside the tree
+        emit(path, "", WatchEvent::Added);
+        if (isDir)
+          addTree(path, true);
+      }
+    }
+  }
+
+  void readLoop() {
+    alignas(inotify_event) char buf[64 * 1024];
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    while (running) {
+      // Wake up in time to expire unpaired moves
+      int timeout = movesFrom.empty() ? -1 : int(kMovePairTimeout.count());
+      int ready = poll(fds, 2, timeout);
+      if (ready < 0) {
+        if (errno == EINTR)
+          continue;
+        std::cerr << "[Watcher] poll failed: " << std::strerror(errno)
+                  << std::endl;
+        break;
+      }
+      if (fds[1].revents & POLLIN)
+        break;
+      auto now = Clock::now();
+      if (fds[0].revents & POLLIN) {
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+          for (char *p = buf; p < buf + len;) {
+            auto *ev = reinterpret_cast<inotify_event *>(p);
+            handle(*ev, now);
+            p += sizeof(inotify_event) + ev->len;
+          }
+        }
+      }
+      flushMoves(now, false);
+      for (auto it = recentDirs.begin(); it != recentDirs.end();) {
+        if (now - it->second > kRecentWindow)
+          it = recentDirs.erase(it);
+        else
+          ++it;
+      }
+    }
+  }
+};
+
+InotifyBackend::InotifyBackend(const std::string &rootPath, Sink sink)
+    : m_impl(std::make_unique<Impl>()) {
+  m_impl->root = fs::path(rootPath).lexically_normal().generic_string();
+  if (m_impl->root.size() > 1 && m_impl->root.back() == '/')
+    m_impl->root.pop_back();
+  m_impl->sink = std::move(sink);
+}
+
+InotifyBackend::~InotifyBackend() { stop(); }
+
+bool InotifyBackend::start() {
+  if (m_impl->running)
+    return true;
+  m_impl->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  m_impl->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_impl->fd < 0 || m_impl->wakeFd < 0) {
+    std::cerr << "[Watcher] inotify unavailable: " << std::strerror(errno)
+              << std::endl;
+    stop();
+    return false;
+  }
+  m_impl->addTree(m_impl->root, false);
+  if (m_impl->dirsByWd.empty()) {
+    stop();
+    return false;
+  }
+  std::cout << "[Watcher] inotify watching " << m_impl->dirsByWd.size()
+            << " directories" << std::endl;
+  m_impl->running = true;
+  m_impl->reader = std::thread(&Impl::readLoop, m_impl.get());
+  return true;
+}
+
+void InotifyBackend::stop() {
+  m_impl->running = false;
+  if (m_impl->wakeFd >= 0) {
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(m_impl->wakeFd, &one, sizeof(one));
+  }
+  if (m_impl->reader.joinable())
+    m_impl->reader.join();
+  if (m_impl->fd >= 0)
+    close(m_impl->fd);
+  if (m_impl->wakeFd >= 0)
+    close(m_impl->wakeFd);
+  m_impl->fd = -1;
+  m_impl->wakeFd = -1;
+  m_impl->dirsByWd.clear();
+  m_impl->wdsByDir.clear();
+}
+
+} // namespace sync
+#endif
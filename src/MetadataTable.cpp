@@ -0,0 +1,571 @@
+#include "MetadataTable.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <numeric>
+
+namespace sync {
+
+namespace {
+
+constexpr uint32_t kArenaBlockSize = 64 * 1024;
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+bool parseHex(std::string_view hex, uint8_t *out, size_t bytes) {
+  if (hex.size() != bytes * 2)
+    return false;
+  for (size_t i = 0; i < bytes; ++i) {
+    int hi = hexValue(hex[2 * i]);
+    int lo = hexValue(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    out[i] = static_cast<uint8_t>((hi << 4) | lo);
+  }
+  return true;
+}
+
+void appendHex(std::string &out, const uint8_t *bytes, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    out += kHexDigits[bytes[i] >> 4];
+    out += kHexDigits[bytes[i] & 0x0f];
+  }
+}
+
+// Inode strings come from FileSystemScanner::getInode: "<high>-<low>" on
+// Windows, the decimal st_ino elsewhere.
+bool parseInode(std::string_view text, uint64_t &out) {
+#ifdef _WIN32
+  auto dash = text.find('-');
+  if (dash == std::string_view::npos)
+    return false;
+  int64_t high, low;
+  if (!parseInt64(text.substr(0, dash), high) ||
+      !parseInt64(text.substr(dash + 1), low) || high < 0 ||
+      high > 0xffffffffLL || low < 0 || low > 0xffffffffLL)
+    return false;
+  out = (static_cast<uint64_t>(high) << 32) | static_cast<uint64_t>(low);
+  return true;
+#else
+  if (text.empty() || text.front() == '0')
+    return false;
+  auto res = std::from_chars(text.data(), text.data() + text.size(), out);
+  return res.ec == std::errc() && res.ptr == text.data() + text.size();
+#endif
+}
+
+std::string formatInode(uint64_t inode) {
+#ifdef _WIN32
+  return std::to_string(inode >> 32) + "-" +
+         std::to_string(inode & 0xffffffffULL);
+#else
+  return std::to_string(inode);
+#endif
+}
+
+// Stores value in a fixed-width column when it round-trips, otherwise keeps
+// the text in the sparse map
+void storeInode(std::vector<uint64_t> &column, SparseText &fallback,
+                const std::string &text) {
+  uint64_t inode = 0;
+  if (!parseInode(text, inode))
+    fallback[static_cast<uint32_t>(column.size())] = text;
+  column.push_back(inode);
+}
+
+void storeHash(std::vector<Hash256> &column, SparseText &fallback,
+               const std::string &text) {
+  Hash256 hash{};
+  if (!parseHash256(text, hash))
+    fallback[static_cast<uint32_t>(column.size())] = text;
+  column.push_back(hash);
+}
+
+void storeUuid(std::vector<Uuid128> &column, SparseText &fallback,
+               const std::string &text) {
+  Uuid128 uuid{};
+  if (!parseUuid128(text, uuid))
+    fallback[static_cast<uint32_t>(column.size())] = text;
+  column.push_back(uuid);
+}
+
+template <typename T>
+void applyPermutation(std::vector<T> &column,
+                      const std::vector<uint32_t> &order) {
+  std::vector<T> sorted;
+  sorted.reserve(column.size());
+  for (uint32_t row : order)
+    sorted.push_back(column[row]);
+  column.swap(sorted);
+}
+
+void applyPermutation(std::vector<bool> &column,
+                      const std::vector<uint32_t> &order) {
+  std::vector<bool> sorted(column.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    sorted[i] = column[order[i]];
+  column.swap(sorted);
+}
+
+void remapSparse(SparseText &sparse, const std::vector<uint32_t> &newIndex) {
+  if (sparse.empty())
+    return;
+  SparseText remapped;
+  remapped.reserve(sparse.size());
+  for (auto &[row, text] : sparse)
+    remapped.emplace(newIndex[row], std::move(text));
+  sparse.swap(remapped);
+}
+
+std::vector<uint32_t> inverse(const std::vector<uint32_t> &order) {
+  std::vector<uint32_t> newIndex(order.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    newIndex[order[i]] = static_cast<uint32_t>(i);
+  return newIndex;
+}
+
+size_t sparseMemory(const SparseText &sparse) {
+  size_t bytes = sparse.bucket_count() * sizeof(void *);
+  for (const auto &[row, text] : sparse)
+    bytes += sizeof(std::pair<const uint32_t, std::string>) + 2 * sizeof(void *) +
+             (text.capacity() > 15 ? text.capacity() : 0);
+  return bytes;
+}
+
+template <typename T> size_t columnMemory(const std::vector<T> &column) {
+  return column.capacity() * sizeof(T);
+}
+
+size_t columnMemory(const std::vector<bool> &column) {
+  return column.capacity() / 8;
+}
+
+const std::string *sparseFind(const SparseText &sparse, size_t row) {
+  auto it = sparse.find(static_cast<uint32_t>(row));
+  return it != sparse.end() ? &it->second : nullptr;
+}
+
+} // namespace
+
+bool parseHash256(std::string_view hex, Hash256 &out) {
+  return parseHex(hex, out.data(), out.size());
+}
+
+std::string formatHash256(const Hash256 &hash) {
+  std::string out;
+  out.reserve(hash.size() * 2);
+  appendHex(out, hash.data(), hash.size());
+  return out;
+}
+
+bool parseUuid128(std::string_view text, Uuid128 &out) {
+  // 8-4-4-4-12
+  if (text.size() != 36 || text[8] != '-' || text[13] != '-' ||
+      text[18] != '-' || text[23] != '-')
+    return false;
+  return parseHex(text.substr(0, 8), out.data(), 4) &&
+         parseHex(text.substr(9, 4), out.data() + 4, 2) &&
+         parseHex(text.substr(14, 4), out.data() + 6, 2) &&
+         parseHex(text.substr(19, 4), out.data() + 8, 2) &&
+         parseHex(text.substr(24, 12), out.data() + 10, 6);
+}
+
+std::string formatUuid128(const Uuid128 &uuid) {
+  std::string out;
+  out.reserve(36);
+  appendHex(out, uuid.data(), 4);
+  out += '-';
+  appendHex(out, uuid.data() + 4, 2);
+  out += '-';
+  appendHex(out, uuid.data() + 6, 2);
+  out += '-';
+  appendHex(out, uuid.data() + 8, 2);
+  out += '-';
+  appendHex(out, uuid.data() + 10, 6);
+  return out;
+}
+
+bool parseInt64(std::string_view text, int64_t &out) {
+  if (text.empty() || text.front() == '+')
+    return false;
+  auto res = std::from_chars(text.data(), text.data() + text.size(), out);
+  if (res.ec != std::errc() || res.ptr != text.data() + text.size())
+    return false;
+  // Reject forms that would not format back identically ("007", "-0")
+  return std::to_string(out).size() == text.size();
+}
+
+// StringArena
+
+StrRef StringArena::append(std::string_view s) {
+  uint32_t length = static_cast<uint32_t>(s.size());
+  if (m_blocks.empty() ||
+      m_blocks.back().capacity - m_blocks.back().used < length) {
+    uint32_t capacity = std::max(kArenaBlockSize, length);
+    m_blocks.push_back(
+        Block{std::make_unique<char[]>(capacity), m_nextBase, capacity, 0});
+    m_nextBase += capacity;
+  }
+  Block &block = m_blocks.back();
+  if (length > 0)
+    std::memcpy(block.data.get() + block.used, s.data(), length);
+  StrRef ref{block.base + block.used, length};
+  block.used += length;
+  return ref;
+}
+
+std::string_view StringArena::view(StrRef ref) const {
+  if (ref.length == 0)
+    return std::string_view();
+  auto it = std::upper_bound(
+      m_blocks.begin(), m_blocks.end(), ref.offset,
+      [](uint32_t offset, const Block &block) { return offset < block.base; });
+  const Block &block = *(it - 1);
+  return std::string_view(block.data.get() + (ref.offset - block.base),
+                          ref.length);
+}
+
+size_t StringArena::memoryUsage() const {
+  size_t bytes = m_blocks.capacity() * sizeof(Block);
+  for (const auto &block : m_blocks)
+    bytes += block.capacity;
+  return bytes;
+}
+
+// PathTable
+
+PathTable::Id PathTable::intern(std::string_view path) {
+  auto it = m_lookup.find(path);
+  if (it != m_lookup.end())
+    return it->second;
+  StrRef ref = m_arena.append(path);
+  Id id = static_cast<Id>(m_refs.size());
+  m_refs.push_back(ref);
+  m_lookup.emplace(m_arena.view(ref), id);
+  return id;
+}
+
+std::optional<PathTable::Id> PathTable::find(std::string_view path) const {
+  auto it = m_lookup.find(path);
+  if (it == m_lookup.end())
+    return std::nullopt;
+  return it->second;
+}
+
+size_t PathTable::memoryUsage() const {
+  return m_arena.memoryUsage() + m_refs.capacity() * sizeof(StrRef) +
+         m_lookup.bucket_count() * sizeof(void *) +
+         m_lookup.size() * (sizeof(std::pair<const std::string_view, Id>) +
+                            2 * sizeof(void *));
+}
+
+// LocalScanTable
+
+LocalScanTable::LocalScanTable(std::string syncPath)
+    : m_syncPath(std::move(syncPath)) {}
+
+void LocalScanTable::addFile(const ScannedFile &file) {
+  PathTable::Id dir = m_paths.intern(file.path);
+  StrRef name = m_names.append(file.filename);
+  if (m_sorted && !m_fileDir.empty()) {
+    auto lastPath = filePath(m_fileDir.size() - 1);
+    auto lastName = fileName(m_fileDir.size() - 1);
+    std::string_view path = m_paths.view(dir);
+    if (path < lastPath || (path == lastPath && file.filename < lastName))
+      m_sorted = false;
+  }
+
+  m_fileDir.push_back(dir);
+  m_fileName.push_back(name);
+  m_fileSize.push_back(file.size);
+  m_fileMTime.push_back(file.mtime);
+  storeInode(m_fileInode, m_fileInodeText, file.inode);
+  storeHash(m_fileHash, m_fileHashText, file.hash);
+}
+
+void LocalScanTable::addDirectory(const ScannedDirectory &dir) {
+  PathTable::Id path = m_paths.intern(dir.path);
+  if (m_sorted && !m_dirPath.empty() &&
+      m_paths.view(path) < directoryPath(m_dirPath.size() - 1))
+    m_sorted = false;
+
+  m_dirPath.push_back(path);
+  m_dirName.push_back(m_names.append(dir.name));
+  storeInode(m_dirInode, m_dirInodeText, dir.inode);
+  m_dirMTime.push_back(dir.mtime);
+}
+
+void LocalScanTable::sortByKey() {
+  if (m_sorted)
+    return;
+
+  std::vector<uint32_t> order(m_fileDir.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    auto pathA = filePath(a);
+    auto pathB = filePath(b);
+    if (pathA != pathB)
+      return pathA < pathB;
+    return fileName(a) < fileName(b);
+  });
+  auto newIndex = inverse(order);
+  applyPermutation(m_fileDir, order);
+  applyPermutation(m_fileName, order);
+  applyPermutation(m_fileSize, order);
+  applyPermutation(m_fileMTime, order);
+  applyPermutation(m_fileInode, order);
+  applyPermutation(m_fileHash, order);
+  remapSparse(m_fileInodeText, newIndex);
+  remapSparse(m_fileHashText, newIndex);
+
+  std::vector<uint32_t> dirOrder(m_dirPath.size());
+  std::iota(dirOrder.begin(), dirOrder.end(), 0);
+  std::sort(dirOrder.begin(), dirOrder.end(), [&](uint32_t a, uint32_t b) {
+    return directoryPath(a) < directoryPath(b);
+  });
+  auto newDirIndex = inverse(dirOrder);
+  applyPermutation(m_dirPath, dirOrder);
+  applyPermutation(m_dirName, dirOrder);
+  applyPermutation(m_dirInode, dirOrder);
+  applyPermutation(m_dirMTime, dirOrder);
+  remapSparse(m_dirInodeText, newDirIndex);
+
+  m_sorted = true;
+}
+
+bool LocalScanTable::fileHashEquals(size_t i, const std::string &hex) const {
+  if (auto text = sparseFind(m_fileHashText, i))
+    return *text == hex;
+  Hash256 hash;
+  return parseHash256(hex, hash) && hash == m_fileHash[i];
+}
+
+std::optional<size_t>
+LocalScanTable::findFile(std::string_view path,
+                         std::string_view filename) const {
+  size_t lo = 0, hi = m_fileDir.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    auto midPath = filePath(mid);
+    if (midPath < path || (midPath == path && fileName(mid) < filename))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < m_fileDir.size() && filePath(lo) == path && fileName(lo) == filename)
+    return lo;
+  return std::nullopt;
+}
+
+std::optional<size_t>
+LocalScanTable::findDirectory(std::string_view path) const {
+  size_t lo = 0, hi = m_dirPath.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (directoryPath(mid) < path)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < m_dirPath.size() && directoryPath(lo) == path)
+    return lo;
+  return std::nullopt;
+}
+
+std::string LocalScanTable::absPathOf(std::string_view path,
+                                      std::string_view name) const {
+  std::string absPath = m_syncPath;
+  if (path != "/")
+    absPath += path;
+  if (!name.empty()) {
+    absPath += '/';
+    absPath += name;
+  }
+  return absPath;
+}
+
+ScannedFile LocalScanTable::file(size_t i) const {
+  ScannedFile f;
+  f.path = std::string(filePath(i));
+  f.filename = std::string(fileName(i));
+  f.absPath = absPathOf(f.path, f.filename);
+  auto inodeText = sparseFind(m_fileInodeText, i);
+  f.inode = inodeText ? *inodeText : formatInode(m_fileInode[i]);
+  auto hashText = sparseFind(m_fileHashText, i);
+  f.hash = hashText ? *hashText : formatHash256(m_fileHash[i]);
+  f.size = m_fileSize[i];
+  f.mtime = m_fileMTime[i];
+  return f;
+}
+
+ScannedDirectory LocalScanTable::directory(size_t i) const {
+  ScannedDirectory d;
+  d.path = std::string(directoryPath(i));
+  d.name = std::string(m_names.view(m_dirName[i]));
+  d.absPath = absPathOf(d.path, "");
+  auto inodeText = sparseFind(m_dirInodeText, i);
+  d.inode = inodeText ? *inodeText : formatInode(m_dirInode[i]);
+  d.mtime = m_dirMTime[i];
+  return d;
+}
+
+size_t LocalScanTable::memoryUsage() const {
+  return sizeof(*this) + m_paths.memoryUsage() + m_names.memoryUsage() +
+         columnMemory(m_fileDir) + columnMemory(m_fileName) +
+         columnMemory(m_fileSize) + columnMemory(m_fileMTime) +
+         columnMemory(m_fileInode) + columnMemory(m_fileHash) +
+         sparseMemory(m_fileInodeText) + sparseMemory(m_fileHashText) +
+         columnMemory(m_dirPath) + columnMemory(m_dirName) +
+         columnMemory(m_dirInode) + columnMemory(m_dirMTime) +
+         sparseMemory(m_dirInodeText);
+}
+
+// CloudMetadataTable
+
+void CloudMetadataTable::addFile(const CloudFileMetadata &file) {
+  PathTable::Id dir = m_paths.intern(file.path);
+  StrRef name = m_names.append(file.filename);
+  if (m_sorted && !m_dir.empty()) {
+    auto lastPath = filePath(m_dir.size() - 1);
+    auto lastName = fileName(m_dir.size() - 1);
+    std::string_view path = m_paths.view(dir);
+    if (path < lastPath || (path == lastPath && file.filename < lastName))
+      m_sorted = false;
+  }
+
+  uint32_t row = static_cast<uint32_t>(m_dir.size());
+  storeUuid(m_uuid, m_uuidText, file.uuid);
+  storeUuid(m_origin, m_originText, file.origin);
+  m_dir.push_back(dir);
+  m_name.push_back(name);
+  storeHash(m_hash, m_hashText, file.hashvalue);
+  m_size.push_back(file.size);
+  int64_t mtime = 0;
+  if (!parseInt64(file.last_modified, mtime))
+    m_mtimeText[row] = file.last_modified;
+  m_mtime.push_back(mtime);
+  m_versions.push_back(file.versions);
+  bool lastSyncedIsHash = !file.lastSyncedHashValue.empty() &&
+                          file.lastSyncedHashValue == file.hashvalue;
+  if (!lastSyncedIsHash && !file.lastSyncedHashValue.empty())
+    m_lastSyncedText[row] = file.lastSyncedHashValue;
+  m_lastSyncedIsHash.push_back(lastSyncedIsHash);
+  if (file.conflictId)
+    m_conflictIds[row] = *file.conflictId;
+}
+
+void CloudMetadataTable::addFolder(const CloudFolderMetadata &folder) {
+  m_folders.push_back(folder);
+}
+
+void CloudMetadataTable::sortByKey() {
+  if (m_sorted)
+    return;
+
+  std::vector<uint32_t> order(m_dir.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    auto pathA = filePath(a);
+    auto pathB = filePath(b);
+    if (pathA != pathB)
+      return pathA < pathB;
+    return fileName(a) < fileName(b);
+  });
+  auto newIndex = inverse(order);
+  applyPermutation(m_uuid, order);
+  applyPermutation(m_origin, order);
+  applyPermutation(m_dir, order);
+  applyPermutation(m_name, order);
+  applyPermutation(m_hash, order);
+  applyPermutation(m_size, order);
+  applyPermutation(m_mtime, order);
+  applyPermutation(m_versions, order);
+  applyPermutation(m_lastSyncedIsHash, order);
+  remapSparse(m_uuidText, newIndex);
+  remapSparse(m_originText, newIndex);
+  remapSparse(m_hashText, newIndex);
+  remapSparse(m_mtimeText, newIndex);
+  remapSparse(m_lastSyncedText, newIndex);
+  remapSparse(m_conflictIds, newIndex);
+
+  m_sorted = true;
+}
+
+std::optional<size_t>
+CloudMetadataTable::findFile(std::string_view path,
+                             std::string_view filename) const {
+  size_t lo = 0, hi = m_dir.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    auto midPath = filePath(mid);
+    if (midPath < path || (midPath == path && fileName(mid) < filename))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < m_dir.size() && filePath(lo) == path && fileName(lo) == filename)
+    return lo;
+  return std::nullopt;
+}
+
+std::string CloudMetadataTable::fileUuid(size_t i) const {
+  auto text = sparseFind(m_uuidText, i);
+  return text ? *text : formatUuid128(m_uuid[i]);
+}
+
+std::string CloudMetadataTable::fileOrigin(size_t i) const {
+  auto text = sparseFind(m_originText, i);
+  return text ? *text : formatUuid128(m_origin[i]);
+}
+
+bool CloudMetadataTable::fileHashEquals(size_t i,
+                                        const std::string &hex) const {
+  if (auto text = sparseFind(m_hashText, i))
+    return *text == hex;
+  Hash256 hash;
+  return parseHash256(hex, hash) && hash == m_hash[i];
+}
+
+CloudFileMetadata CloudMetadataTable::file(size_t i) const {
+  CloudFileMetadata f;
+  f.uuid = fileUuid(i);
+  f.origin = fileOrigin(i);
+  f.path = std::string(filePath(i));
+  f.filename = std::string(fileName(i));
+  auto hashText = sparseFind(m_hashText, i);
+  f.hashvalue = hashText ? *hashText : formatHash256(m_hash[i]);
+  f.size = m_size[i];
+  auto mtimeText = sparseFind(m_mtimeText, i);
+  f.last_modified = mtimeText ? *mtimeText : std::to_string(m_mtime[i]);
+  f.versions = m_versions[i];
+  if (m_lastSyncedIsHash[i])
+    f.lastSyncedHashValue = f.hashvalue;
+  else if (auto lastSynced = sparseFind(m_lastSyncedText, i))
+    f.lastSyncedHashValue = *lastSynced;
+  if (auto conflictId = sparseFind(m_conflictIds, i))
+    f.conflictId = *conflictId;
+  return f;
+}
+
+size_t CloudMetadataTable::memoryUsage() const {
+  size_t bytes = sizeof(*this) + m_paths.memoryUsage() +
+                 m_names.memoryUsage() + columnMemory(m_uuid) +
+                 columnMemory(m_origin) + columnMemory(m_dir) +
+                 columnMemory(m_name) + columnMemory(m_hash) +
+                 columnMemory(m_size) + columnMemory(m_mtime) +
+                 columnMemory(m_versions) + columnMemory(m_lastSyncedIsHash) +
+                 sparseMemory(m_uuidText) + sparseMemory(m_originText) +
+                 sparseMemory(m_hashText) + sparseMemory(m_mtimeText) +
+                 sparseMemory(m_lastSyncedText) + sparseMemory(m_conflictIds);
+  bytes += m_folders.capacity() * sizeof(CloudFolderMetadata);
+  return bytes;
+}
+
+} // namespace sync
@@ -0,0 +1,605 @@
+#include "PlanExecutor.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace sync {
+
+namespace {
+
+// True when path is subtree or below it
+bool inSubtree(const std::string &path, const std::string &subtree) {
+  return path.compare(0, subtree.size(), subtree) == 0 &&
+         (path.size() == subtree.size() || path[subtree.size()] == '/');
+}
+
+} // namespace
+
+PlanExecutor::PlanExecutor(ApiClient &apiClient, DatabaseManager &dbManager,
+                           const std::string &syncPath,
+                           PlanExecutorOptions options)
+    : m_apiClient(apiClient), m_dbManager(dbManager), m_syncPath(syncPath),
+      m_options(std::move(options)), m_scanner(syncPath) {}
+
+PlanExecutor::~PlanExecutor() = default;
+
+std::string PlanExecutor::toAbsPath(const std::string &path,
+                                    const std::string &filename) {
+  std::string absPath = m_syncPath;
+  if (!path.empty() && path != "/")
+    absPath += path;
+  if (!filename.empty())
+    absPath += "/" + filename;
+  return absPath;
+}
+
+void PlanExecutor::addEdge(size_t from, size_t to) {
+  m_nodes[from].dependents.push_back(to);
+  m_nodes[to].depCount++;
+}
+
+void PlanExecutor::buildGraph(const ReconciliationResult &plan) {
+  m_nodes.clear();
+  auto addNode = [&](PlanOpType type, size_t payload, std::string label) {
+    PlanNode node;
+    node.type = type;
+    node.payload = payload;
+    node.label = std::move(label);
+    m_nodes.push_back(std::move(node));
+    return m_nodes.size() - 1;
+  };
+
+  // Walks up from path and returns the closest entry of the given map
+  auto nearestAncestor =
+      [](const std::map<std::string, size_t> &nodesByPath,
+         std::string path) -> std::optional<size_t> {
+    while (!path.empty() && path != "/") {
+      auto it = nodesByPath.find(path);
+      if (it != nodesByPath.end())
+        return it->second;
+      auto pos = path.find_last_of('/');
+      if (pos == std::string::npos || pos == 0)
+        break;
+      path.resize(pos);
+    }
+    return std::nullopt;
+  };
+  auto parentOf = [](const std::string &path) {
+    auto pos = path.find_last_of('/');
+    if (pos == std::string::npos || pos == 0)
+      return std::string("/");
+    return path.substr(0, pos);
+  };
+
+  // 1. Folder creates, parents before children
+  std::map<std::string, size_t> folderCreates;
+  for (size_t i = 0; i < plan.foldersToCreateLocal.size(); ++i) {
+    const auto &dir = plan.foldersToCreateLocal[i];
+    folderCreates[dir.path] =
+        addNode(PlanOpType::CreateFolder, i, "create folder " + dir.path);
+  }
+  for (const auto &[path, node] : folderCreates) {
+    auto parent = nearestAncestor(folderCreates, parentOf(path));
+    if (parent)
+      addEdge(*parent, node);
+  }
+
+  // 2. Renames wait for their destination folder
+  std::map<std::string, size_t> renamesByOrigin;
+  for (size_t i = 0; i < plan.filesToRename.size(); ++i) {
+    const auto &newFile = plan.filesToRename[i].newFile;
+    size_t node = addNode(PlanOpType::RenameFile, i,
+                          "rename " + plan.filesToRename[i].oldFile.filename +
+                              " -> " + newFile.filename);
+    renamesByOrigin[newFile.origin] = node;
+    if (auto folder = nearestAncestor(folderCreates, newFile.path))
+      addEdge(*folder, node);
+  }
+
+  // 3. Updates run after a rename of the same file
+  for (size_t i = 0; i < plan.filesToUpdate.size(); ++i) {
+    const auto &file = plan.filesToUpdate[i];
+    size_t node = addNode(PlanOpType::UpdateFile, i,
+                          "update " + file.path + "/" + file.filename);
+    if (auto folder = nearestAncestor(folderCreates, file.path))
+      addEdge(*folder, node);
+    auto itRename = renamesByOrigin.find(file.origin);
+    if (itRename != renamesByOrigin.end())
+      addEdge(itRename->second, node);
+  }
+
+  // 4. Downloads only need their folder
+  for (size_t i = 0; i < plan.filesToDownload.size(); ++i) {
+    const auto &file = plan.filesToDownload[i];
+    size_t node = addNode(PlanOpType::DownloadFile, i,
+                          "download " + file.path + "/" + file.filename);
+    if (auto folder = nearestAncestor(folderCreates, file.path))
+      addEdge(*folder, node);
+  }
+
+  // 5. Deletes run after every move. A single barrier node keeps the edge
+  // count linear instead of renames x deletes.
+  std::optional<size_t> renameBarrier;
+  if (!renamesByOrigin.empty() &&
+      (!plan.filesToDeleteLocal.empty() || !plan.foldersToDeleteLocal.empty())) {
+    renameBarrier = addNode(PlanOpType::Barrier, 0, "renames complete");
+    for (const auto &[origin, node] : renamesByOrigin)
+      addEdge(node, *renameBarrier);
+  }
+
+  std::map<std::string, size_t> folderDeletes;
+  for (size_t i = 0; i < plan.foldersToDeleteLocal.size(); ++i) {
+    const auto &dir = plan.foldersToDeleteLocal[i];
+    size_t node =
+        addNode(PlanOpType::DeleteFolder, i, "delete folder " + dir.path);
+    folderDeletes[dir.path] = node;
+    if (renameBarrier)
+      addEdge(*renameBarrier, node);
+  }
+  // Children are removed before their parent folder
+  for (const auto &[path, node] : folderDeletes) {
+    auto parent = nearestAncestor(folderDeletes, parentOf(path));
+    if (parent)
+      addEdge(node, *parent);
+  }
+
+  for (size_t i = 0; i < plan.filesToDeleteLocal.size(); ++i) {
+    const auto &file = plan.filesToDeleteLocal[i];
+    size_t node = addNode(PlanOpType::DeleteFile, i,
+                          "delete " + file.path + "/" + file.filename);
+    if (renameBarrier)
+      addEdge(*renameBarrier, node);
+    if (auto folder = nearestAncestor(folderDeletes, file.path))
+      addEdge(node, *folder);
+  }
+}
+
+PlanExecutionReport PlanExecutor::execute(const ReconciliationResult &plan,
+                                          ProgressCallback progress) {
+  m_plan = &plan;
+  m_progressCallback = std::move(progress);
+  buildGraph(plan);
+
+  m_progress = PlanProgress();
+  for (const auto &node : m_nodes) {
+    if (node.type != PlanOpType::Barrier)
+      m_progress.total++;
+  }
+  std::cout << "[Executor] Executing plan with " << m_progress.total
+            << " operations" << std::endl;
+  if (!plan.filesInConflict.empty()) {
+    std::cout << "[Executor] " << plan.filesInConflict.size()
+              << " conflicting files left for conflict resolution"
+              << std::endl;
+  }
+
+  runPass();
+  for (int pass = 0; pass < m_options.retryPasses && m_progress.failed > 0;
+       ++pass) {
+    std::cout << "[Executor] Retrying " << m_progress.failed
+              << " failed operations and their dependents" << std::endl;
+    resetFailedSubgraph();
+    runPass();
+  }
+
+  PlanExecutionReport report;
+  for (const auto &node : m_nodes) {
+    if (node.type == PlanOpType::Barrier)
+      continue;
+    if (node.state == NodeState::Done)
+      report.completed++;
+    else if (node.state == NodeState::Failed) {
+      report.failed++;
+      report.failures.push_back(node.label);
+    } else if (node.state == NodeState::Skipped)
+      report.skipped++;
+  }
+  std::cout << "[Executor] Plan finished: " << report.completed
+            << " completed, " << report.failed << " failed, "
+            << report.skipped << " skipped" << std::endl;
+
+  m_plan = nullptr;
+  m_progressCallback = nullptr;
+  return report;
+}
+
+void PlanExecutor::runPass() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_ready.clear();
+    m_delayed.clear();
+    m_running.clear();
+    m_unfinished = 0;
+
+    // Only edges from unfinished predecessors block a node. On a retry pass
+    // this restricts the work to the failed subgraph.
+    for (auto &node : m_nodes) {
+      if (node.state == NodeState::Pending) {
+        node.remainingDeps = 0;
+        m_unfinished++;
+      }
+    }
+    for (const auto &node : m_nodes) {
+      if (node.state == NodeState::Done)
+        continue;
+      for (size_t dep : node.dependents) {
+        if (m_nodes[dep].state == NodeState::Pending)
+          m_nodes[dep].remainingDeps++;
+      }
+    }
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+      if (m_nodes[i].state == NodeState::Pending &&
+          m_nodes[i].remainingDeps == 0) {
+        m_nodes[i].state = NodeState::Ready;
+        m_ready[m_nodes[i].type].push_back(i);
+      }
+    }
+  }
+
+  if (m_unfinished == 0)
+    return;
+
+  size_t workerCount = std::max<size_t>(
+      1, std::min(m_options.workerCount, m_unfinished));
+  std::vector<std::thread> workers;
+  workers.reserve(workerCount);
+  for (size_t i = 0; i < workerCount; ++i)
+    workers.emplace_back(&PlanExecutor::workerLoop, this);
+  for (auto &worker : workers)
+    worker.join();
+}
+
+void PlanExecutor::workerLoop() {
+  size_t index;
+  while (takeReadyNode(index)) {
+    bool success = false;
+    try {
+      success = runNode(m_nodes[index]);
+    } catch (const std::exception &e) {
+      std::cerr << "[Executor] " << m_nodes[index].label
+                << " threw: " << e.what() << std::endl;
+    }
+    finishNode(index, success);
+  }
+}
+
+bool PlanExecutor::takeReadyNode(size_t &index) {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (true) {
+    if (m_unfinished == 0)
+      return false;
+
+    auto now = std::chrono::steady_clock::now();
+    std::optional<std::chrono::steady_clock::time_point> wakeAt;
+    for (auto it = m_delayed.begin(); it != m_delayed.end();) {
+      const PlanNode &node = m_nodes[*it];
+      if (node.notBefore <= now) {
+        m_ready[node.type].push_back(*it);
+        it = m_delayed.erase(it);
+      } else {
+        wakeAt = wakeAt ? std::min(*wakeAt, node.notBefore) : node.notBefore;
+        ++it;
+      }
+    }
+
+    for (auto &[type, queue] : m_ready) {
+      if (queue.empty())
+        continue;
+      auto itLimit = m_options.concurrencyLimits.find(type);
+      size_t limit = itLimit != m_options.concurrencyLimits.end()
+                         ? itLimit->second
+                         : m_options.workerCount;
+      if (m_running[type] >= std::max<size_t>(limit, 1))
+        continue;
+
+      index = queue.front();
+      queue.pop_front();
+      m_nodes[index].state = NodeState::Running;
+      m_running[type]++;
+      m_progress.inFlight++;
+      return true;
+    }
+    if (wakeAt)
+      m_cv.wait_until(lock, *wakeAt);
+    else
+      m_cv.wait(lock);
+  }
+}
+
+void PlanExecutor::finishNode(size_t index, bool success) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    PlanNode &node = m_nodes[index];
+    m_running[node.type]--;
+    m_progress.inFlight--;
+
+    if (success) {
+      node.state = NodeState::Done;
+      if (node.type != PlanOpType::Barrier)
+        m_progress.completed++;
+      m_unfinished--;
+      for (size_t dep : node.dependents) {
+        PlanNode &next = m_nodes[dep];
+        if (next.state == NodeState::Pending && --next.remainingDeps == 0) {
+          next.state = NodeState::Ready;
+          m_ready[next.type].push_back(dep);
+        }
+      }
+    } else if (++node.attempts < m_options.maxAttempts) {
+      node.state = NodeState::Ready;
+      node.notBefore = std::chrono::steady_clock::now() +
+                       m_options.retryDelay * (1 << (node.attempts - 1));
+      m_delayed.push_back(index);
+    } else {
+      std::cerr << "[Executor] Failed: " << node.label << std::endl;
+      node.state = NodeState::Failed;
+      m_progress.failed++;
+      m_unfinished--;
+      skipDependents(index);
+    }
+  }
+  m_cv.notify_all();
+  reportProgress();
+}
+
+void PlanExecutor::skipDependents(size_t index) {
+  std::vector<size_t> stack(m_nodes[index].dependents);
+  while (!stack.empty()) {
+    size_t dep = stack.back();
+    stack.pop_back();
+    PlanNode &node = m_nodes[dep];
+    if (node.state != NodeState::Pending)
+      continue;
+    node.state = NodeState::Skipped;
+    if (node.type != PlanOpType::Barrier)
+      m_progress.skipped++;
+    m_unfinished--;
+    stack.insert(stack.end(), node.dependents.begin(), node.dependents.end());
+  }
+}
+
+void PlanExecutor::resetFailedSubgraph() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  for (auto &node : m_nodes) {
+    if (node.state == NodeState::Failed || node.state == NodeState::Skipped) {
+      node.state = NodeState::Pending;
+      node.attempts = 0;
+    }
+  }
+  m_progress.failed = 0;
+  m_progress.skipped = 0;
+}
+
+void PlanExecutor::reportProgress() {
+  if (!m_progressCallback)
+    return;
+  PlanProgress snapshot;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    snapshot = m_progress;
+  }
+  std::lock_guard<std::mutex> lock(m_progressMutex);
+  m_progressCallback(snapshot);
+}
+
+bool PlanExecutor::runNode(const PlanNode &node) {
+  switch (node.type) {
+  case PlanOpType::CreateFolder:
+    return createFolder(m_plan->foldersToCreateLocal[node.payload]);
+  case PlanOpType::RenameFile:
+    return renameFile(m_plan->filesToRename[node.payload]);
+  case PlanOpType::UpdateFile:
+    return downloadFile(m_plan->filesToUpdate[node.payload]);
+  case PlanOpType::DownloadFile:
+    return downloadFile(m_plan->filesToDownload[node.payload]);
+  case PlanOpType::DeleteFile:
+    return deleteFile(m_plan->filesToDeleteLocal[node.payload]);
+  case PlanOpType::DeleteFolder:
+    return deleteFolder(m_plan->foldersToDeleteLocal[node.payload]);
+  case PlanOpType::Barrier:
+    return true;
+  }
+  return false;
+}
+
+bool PlanExecutor::createFolder(const LocalFolderCreateMetadata &dir) {
+  std::string absPath = toAbsPath(dir.path);
+  if (m_echoes)
+    m_echoes->expectDirectory(absPath);
+  std::error_code ec;
+  fs::create_directories(absPath, ec);
+  if (ec) {
+    std::cerr << "[Executor] Unable to create folder " << absPath << ": "
+              << ec.message() << std::endl;
+    return false;
+  }
+
+  DirectoryMetadata d;
+  d.uuid = dir.uuid;
+  d.device = dir.device;
+  d.folder = dir.folder;
+  d.path = dir.path;
+  d.created_at = dir.created_at;
+  d.absPath = absPath;
+  d.inode = m_scanner.getInode(absPath);
+
+  return m_dbManager.upsertDirectory(d);
+}
+
+bool PlanExecutor::downloadFile(const CloudFileMetadata &file) {
+  std::string absPath = toAbsPath(file.path, file.filename);
+  std::string parent = fs::path(absPath).parent_path().string();
+  if (m_echoes && !fs::exists(parent))
+    m_echoes->expectDirectory(parent);
+  std::error_code ec;
+  fs::create_directories(parent, ec);
+  if (ec) {
+    std::cerr << "[Executor] Unable to create parent folder for " << absPath
+              << ": " << ec.message() << std::endl;
+    return false;
+  }
+
+  if (m_echoes)
+    m_echoes->beginWrite(absPath);
+  bool downloaded = m_apiClient.downloadFile(file, absPath);
+  if (m_echoes)
+    m_echoes->endWrite(absPath);
+  if (!downloaded)
+    return false;
+
+  FileMetadata f;
+  f.uuid = file.uuid;
+  f.path = file.path;
+  f.filename = file.filename;
+  f.last_modified = file.last_modified;
+  f.hashvalue = file.hashvalue;
+  f.size = file.size;
+  f.inode = m_scanner.getInode(absPath);
+  f.absPath = absPath;
+  f.versions = file.versions;
+  f.origin = file.origin;
+  f.lastSyncedHashValue = file.hashvalue;
+  f.conflictId = file.conflictId;
+
+  pathParts part = m_dbManager.getFolderDevice(fs::path(file.path));
+  auto dir = m_dbManager.getDirectoryByPath(part.device, part.folder, f.path);
+  if (dir.has_value())
+    f.dirID = dir->uuid;
+  return m_dbManager.upsertFile(f);
+}
+
+bool PlanExecutor::renameFile(const LocalFileRenameMetadata &rename) {
+  const FileMetadata &oldFile = rename.oldFile;
+  const CloudFileMetadata &newFile = rename.newFile;
+  std::string oldAbsPath = oldFile.absPath.empty()
+                               ? toAbsPath(oldFile.path, oldFile.filename)
+                               : oldFile.absPath;
+  std::string newAbsPath = toAbsPath(newFile.path, newFile.filename);
+
+  std::error_code ec;
+  fs::create_directories(fs::path(newAbsPath).parent_path(), ec);
+  if (!fs::exists(oldAbsPath) && fs::exists(newAbsPath)) {
+    // Already moved by an earlier attempt
+  } else {
+    if (m_echoes) {
+      m_echoes->expectRemoval(oldAbsPath);
+      m_echoes->beginWrite(newAbsPath);
+    }
+    fs::rename(oldAbsPath, newAbsPath, ec);
+    if (m_echoes)
+      m_echoes->endWrite(newAbsPath);
+    if (ec) {
+      std::cerr << "[Executor] Unable to rename " << oldAbsPath << " -> "
+                << newAbsPath << ": " << ec.message() << std::endl;
+      return false;
+    }
+  }
+
+  FileMetadata f(oldFile);
+  f.uuid = newFile.uuid;
+  f.path = newFile.path;
+  f.filename = newFile.filename;
+  f.absPath = newAbsPath;
+  f.versions = newFile.versions;
+  f.inode = m_scanner.getInode(newAbsPath);
+
+  pathParts part = m_dbManager.getFolderDevice(fs::path(newFile.path));
+  auto dir = m_dbManager.getDirectoryByPath(part.device, part.folder, f.path);
+  if (dir.has_value())
+    f.dirID = dir->uuid;
+  return m_dbManager.removeFile(oldFile.path, oldFile.filename) &&
+         m_dbManager.upsertFile(f);
+}
+
+bool PlanExecutor::deleteFile(const FileMetadata &file) {
+  std::string absPath = file.absPath.empty()
+                            ? toAbsPath(file.path, file.filename)
+                            : file.absPath;
+  if (m_echoes)
+    m_echoes->expectRemoval(absPath);
+  std::error_code ec;
+  fs::remove(absPath, ec);
+  if (ec) {
+    std::cerr << "[Executor] Unable to delete " << absPath << ": "
+              << ec.message() << std::endl;
+    return false;
+  }
+
+  return m_dbManager.removeFile(file.path, file.filename);
+}
+
+bool PlanExecutor::deleteFolder(const LocalFolderDeleteMetadata &dir) {
+  std::string absPath = dir.absPath.empty() ? toAbsPath(dir.path) : dir.absPath;
+  // Local changes not yet uploaded keep the folder; it is deleted on a
+  // later pass once they are synced, or recreated in the cloud by them
+  auto pending = m_dbManager.hasPendingFilesUnder(dir.path);
+  if (!pending)
+    return false;
+  if (*pending) {
+    std::cout << "[Executor] Keeping " << absPath
+              << ", it holds changes not yet uploaded" << std::endl;
+    return true;
+  }
+
+  // Only what the database tracks is removed. A file it never saw stays,
+  // and so do the folders holding one.
+  std::vector<std::string> files;
+  std::vector<std::string> folders;
+  {
+    auto fileCursor = m_dbManager.openFileCursor(dir.path);
+    auto dirCursor = m_dbManager.openDirectoryCursor(dir.path);
+    if (!fileCursor || !dirCursor)
+      return false;
+    FileMetadata file;
+    while (fileCursor->next(file)) {
+      if (inSubtree(file.path, dir.path))
+        files.push_back(file.absPath.empty()
+                            ? toAbsPath(file.path, file.filename)
+                            : file.absPath);
+    }
+    DirectoryMetadata folder;
+    while (dirCursor->next(folder)) {
+      if (inSubtree(folder.path, dir.path))
+        folders.push_back(toAbsPath(folder.path));
+    }
+    if (fileCursor->failed() || dirCursor->failed())
+      return false;
+  }
+
+  std::error_code ec;
+  for (const auto &path : files) {
+    if (m_echoes)
+      m_echoes->expectRemoval(path);
+    if (!fs::remove(path, ec) && ec) {
+      std::cerr << "[Executor] Unable to delete " << path << ": "
+                << ec.message() << std::endl;
+      return false;
+    }
+  }
+  // Deepest first, so emptied children no longer hold up their parent
+  std::sort(folders.rbegin(), folders.rend());
+  size_t kept = 0;
+  for (const auto &path : folders) {
+    if (!fs::exists(path, ec))
+      continue;
+    if (!fs::is_empty(path, ec)) {
+      kept++;
+      continue;
+    }
+    if (m_echoes)
+      m_echoes->expectRemoval(path);
+    fs::remove(path, ec);
+  }
+  if (kept > 0)
+    std::cout << "[Executor] Kept " << kept << " folders under " << absPath
+              << " that hold files never synced" << std::endl;
+
+  return m_dbManager.deleteFilesByPath(dir.path) &&
+         m_dbManager.deleteDirectory(dir.path);
+}
+
+} // namespace sync
@@ -0,0 +1,422 @@
+#include "PollingBackend.hpp"
+#include "FileSystemScanner.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace sync {
+
+namespace {
+
+bool isUnder(const std::string &path, const std::string &dir) {
+  return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+         path[dir.size()] == '/';
+}
+
+} // namespace
+
+struct PollingBackend::Impl {
+  using Clock = std::chrono::steady_clock;
+  enum class Kind { File, Directory, Other };
+
+  struct Stat {
+    Kind kind = Kind::Other;
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+    std::string inode;
+  };
+  struct FileState {
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+    std::string inode;
+    bool operator==(const FileState &o) const {
+      return size == o.size && mtime == o.mtime && inode == o.inode;
+    }
+  };
+  struct DirState {
+    int64_t mtime = 0;
+    std::string inode;
+    std::set<std::string> children;
+    bool listed = false;
+  };
+  // An entry that appeared in or vanished from a listing this cycle
+  struct Change {
+    std::string path;
+    bool isDir;
+    FileState state;
+  };
+  struct Budget {
+    size_t stats;
+    Clock::time_point deadline;
+    bool spent() const { return stats == 0 || Clock::now() >= deadline; }
+    void charge() {
+      if (stats > 0)
+        stats--;
+    }
+  };
+
+  std::string root;
+  FilesystemWatcher::Callback sink;
+  PollingOptions options;
+  FileSystemScanner scanner;
+  std::thread thread;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool running = false;
+
+  // Only the polling thread touches these once started
+  std::map<std::string, DirState> dirs;
+  std::map<std::string, FileState> files;
+  bool baselineDone = false;
+  std::string dirCursor;
+  std::string fileCursor;
+
+  Impl(const std::string &rootPath) : scanner(rootPath) {}
+
+  void emit(const std::string &path, const std::string &oldPath,
+            WatchEvent event) {
+    if (sink)
+      sink(path, oldPath, event);
+  }
+
+  std::optional<Stat> statPath(const std::string &path) {
+    Stat st;
+#ifdef _WIN32
+    std::error_code ec;
+    auto status = fs::status(path, ec);
+    if (ec || !fs::exists(status))
+      return std::nullopt;
+    if (fs::is_directory(status))
+      st.kind = Kind::Directory;
+    else if (fs::is_regular_file(status))
+      st.kind = Kind::File;
+    if (st.kind == Kind::File)
+      st.size = fs::file_size(path, ec);
+    st.mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    if (ec)
+      return std::nullopt;
+    st.inode = scanner.getInode(path);
+#else
+    // One stat call per entry; this is what a cycle costs on a network
+    // mount
+    struct stat raw;
+    if (::stat(path.c_str(), &raw) != 0)
+      return std::nullopt;
+    if (S_ISDIR(raw.st_mode))
+      st.kind = Kind::Directory;
+    else if (S_ISREG(raw.st_mode))
+      st.kind = Kind::File;
+    st.size = uintmax_t(raw.st_size);
+#ifdef __APPLE__
+    st.mtime = int64_t(raw.st_mtimespec.tv_sec) * 1000000000 +
+               raw.st_mtimespec.tv_nsec;
+#else
+    st.mtime = int64_t(raw.st_mtim.tv_sec) * 1000000000 + raw.st_mtim.tv_nsec;
+#endif
+    st.inode = std::to_string(raw.st_ino);
+#endif
+    return st;
+  }
+
+  // Reads dir and diffs it against what we knew. Changed files are
+  // reported straight away; new and vanished entries are handed back so
+  // the caller can pair them into moves.
+  bool listDir(const std::string &dir, DirState &state, const Stat &dirStat,
+               Budget &budget, std::vector<Change> &gone,
+               std::vector<Change> &appeared) {
+    std::vector<std::string> names;
+    std::error_code ec;
+    fs::directory_iterator it(
+        dir, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec))
+      names.push_back(it->path().filename().generic_string());
+    if (ec) {
+      // Keep the old listing; the next cycle tries again
+      std::cerr << "[Watcher] Could not list " << dir << ": " << ec.message()
+                << std::endl;
+      return false;
+    }
+
+    std::set<std::string> children;
+    for (const auto &name : names) {
+      std::string path = dir + "/" + name;
+      budget.charge();
+      auto st = statPath(path);
+      if (!st || st->kind == Kind::Other)
+        continue;
+      children.insert(name);
+      FileState now{st->size, st->mtime, st->inode};
+      auto file = files.find(path);
+      bool knownDir = dirs.count(path) > 0;
+      if (st->kind == Kind::Directory) {
+        if (file != files.end())
+          gone.push_back({path, false, file->second});
+        if (!knownDir)
+          appeared.push_back({path, true, now});
+        continue;
+      }
+      if (knownDir)
+        gone.push_back({path, true, {0, 0, dirs[path].inode}});
+      if (file == files.end()) {
+        appeared.push_back({path, false, now});
+      } else if (!(file->second == now)) {
+        file->second = now;
+        emit(path, "", WatchEvent::Modified);
+      }
+    }
+    for (const auto &name : state.children) {
+      if (children.count(name))
+        continue;
+      std::string path = dir + "/" + name;
+      if (auto file = files.find(path); file != files.end())
+        gone.push_back({path, false, file->second});
+      else if (auto sub = dirs.find(path); sub != dirs.end())
+        gone.push_back({path, true, {0, 0, sub->second.inode}});
+    }
+
+    state.children = std::move(children);
+    state.mtime = dirStat.mtime;
+    state.inode = dirStat.inode;
+    state.listed = true;
+    return true;
+  }
+
+  void adopt(const Change &change) {
+    if (change.isDir)
+      dirs[change.path];
+    else
+      files[change.path] = change.state;
+  }
+
+  void forgetTree(const std::string &path) {
+    dirs.erase(path);
+    files.erase(path);
+    std::string prefix = path + "/";
+    auto dir = dirs.lower_bound(prefix);
+    while (dir != dirs.end() && isUnder(dir->first, path))
+      dir = dirs.erase(dir);
+    auto file = files.lower_bound(prefix);
+    while (file != files.end() && isUnder(file->first, path))
+      file = files.erase(file);
+  }
+
+  template <typename Map>
+  void renameKeys(Map &map, const std::string &from, const std::string &to) {
+    std::vector<std::pair<std::string, typename Map::mapped_type>> moved;
+    if (auto it = map.find(from); it != map.end()) {
+      moved.emplace_back(to, std::move(it->second));
+      map.erase(it);
+    }
+    for (auto it = map.lower_bound(from + "/");
+         it != map.end() && isUnder(it->first, from);) {
+      moved.emplace_back(to + it->first.substr(from.size()),
+                         std::move(it->second));
+      it = map.erase(it);
+    }
+    for (auto &[key, value] : moved)
+      map[key] = std::move(value);
+  }
+
+  // Lists every directory that showed up this cycle, appending what they
+  // hold, so moves into a new directory still pair up. New trees are
+  // walked in full regardless of the budget, since nothing else would ever
+  // announce their contents.
+  void expandNewDirs(std::vector<Change> &appeared,
+                     std::map<std::string, DirState> &fresh, Budget &budget) {
+    for (size_t i = 0; i < appeared.size(); ++i) {
+      if (!appeared[i].isDir)
+        continue;
+      std::string dir = appeared[i].path;
+      auto st = statPath(dir);
+      if (!st || st->kind != Kind::Directory)
+        continue;
+      std::vector<Change> gone;
+      listDir(dir, fresh[dir], *st, budget, gone, appeared);
+    }
+  }
+
+  void pollOnce() {
+    Budget budget{options.maxStatsPerCycle,
+                  Clock::now() + options.maxCycleTime};
+    std::vector<Change> gone, appeared;
+
+    // 1. Directories: only those whose mtime or inode moved are listed
+    auto it = dirs.lower_bound(dirCursor);
+    for (; it != dirs.end() && !budget.spent(); ++it) {
+      budget.charge();
+      auto st = statPath(it->first);
+      // A vanished directory is reported by its parent's listing
+      if (!st || st->kind != Kind::Directory)
+        continue;
+      DirState &state = it->second;
+      if (state.listed && st->mtime == state.mtime && st->inode == state.inode)
+        continue;
+      listDir(it->first, state, *st, budget, gone, appeared);
+      if (!baselineDone) {
+        // Still learning the tree; new subdirectories sort after this one
+        // and are listed later in the same pass
+        for (const auto &change : appeared)
+          adopt(change);
+        appeared.clear();
+        gone.clear();
+      }
+    }
+    bool wrapped = it == dirs.end();
+    dirCursor = wrapped ? std::string() : it->first;
+
+    // 2. Pair what vanished with what appeared by inode, so renames arrive
+    // as one Moved event. Deletes go out first, then the rest parents
+    // first.
+    std::map<std::string, DirState> fresh;
+    expandNewDirs(appeared, fresh, budget);
+    auto key = [](const Change &c) {
+      return (c.isDir ? "d" : "f") + c.state.inode;
+    };
+    std::unordered_map<std::string, size_t> appearedByInode;
+    for (size_t i = 0; i < appeared.size(); ++i) {
+      if (!appeared[i].state.inode.empty())
+        appearedByInode.emplace(key(appeared[i]), i);
+    }
+    std::map<std::string, std::string> movedFrom;
+    for (const auto &change : gone) {
+      auto match = appearedByInode.find(key(change));
+      if (change.state.inode.empty() || match == appearedByInode.end() ||
+          movedFrom.count(appeared[match->second].path)) {
+        forgetTree(change.path);
+        emit(change.path, "", WatchEvent::Deleted);
+        continue;
+      }
+      movedFrom[appeared[match->second].path] = change.path;
+    }
+    std::sort(appeared.begin(), appeared.end(),
+              [](const Change &a, const Change &b) { return a.path < b.path; });
+    std::vector<std::string> movedDirs;
+    auto underMovedDir = [&](const std::string &path) {
+      return std::any_of(movedDirs.begin(), movedDirs.end(),
+                         [&](const auto &dir) { return isUnder(path, dir); });
+    };
+    for (const auto &change : appeared) {
+      if (underMovedDir(change.path)) {
+        // Came along with a moved directory; only report content changes
+        auto file = files.find(change.path);
+        if (change.isDir) {
+          dirs[change.path];
+        } else if (file == files.end() || !(file->second == change.state)) {
+          files[change.path] = change.state;
+          emit(change.path, "", WatchEvent::Modified);
+        }
+        continue;
+      }
+      auto from = movedFrom.find(change.path);
+      if (from != movedFrom.end()) {
+        renameKeys(dirs, from->second, change.path);
+        renameKeys(files, from->second, change.path);
+        adopt(change);
+        if (change.isDir)
+          movedDirs.push_back(change.path);
+        emit(change.path, from->second, WatchEvent::Moved);
+      } else {
+        adopt(change);
+        emit(change.path, "", WatchEvent::Added);
+      }
+    }
+    for (auto &[dir, state] : fresh)
+      dirs[dir] = std::move(state);
+
+    if (!baselineDone) {
+      if (!wrapped)
+        return;
+      baselineDone = true;
+      std::cout << "[Watcher] Polling baseline: " << dirs.size()
+                << " directories, " << files.size() << " files" << std::endl;
+      return;
+    }
+
+    // 3. In-place edits leave the directory mtime alone; re-stat known
+    // files with whatever budget is left, continuing from last cycle
+    size_t remaining = files.size();
+    auto file = files.lower_bound(fileCursor);
+    for (; remaining > 0 && !budget.spent(); --remaining) {
+      if (file == files.end())
+        file = files.begin();
+      budget.charge();
+      // Missing files are left to the directory pass
+      auto st = statPath(file->first);
+      if (st && st->kind == Kind::File) {
+        FileState now{st->size, st->mtime, st->inode};
+        if (!(file->second == now)) {
+          file->second = now;
+          emit(file->first, "", WatchEvent::Modified);
+        }
+      }
+      ++file;
+    }
+    fileCursor = file == files.end() ? std::string() : file->first;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running) {
+      lock.unlock();
+      auto started = Clock::now();
+      pollOnce();
+      lock.lock();
+      cv.wait_until(lock, started + options.interval,
+                    [this] { return !running; });
+    }
+  }
+};
+
+PollingBackend::PollingBackend(const std::string &rootPath,
+                               FilesystemWatcher::Callback sink,
+                               PollingOptions options)
+    : m_impl(std::make_unique<Impl>(rootPath)) {
+  m_impl->root = fs::path(rootPath).lexically_normal().generic_string();
+  if (m_impl->root.size() > 1 && m_impl->root.back() == '/')
+    m_impl->root.pop_back();
+  m_impl->sink = std::move(sink);
+  m_impl->options = options;
+  m_impl->dirs[m_impl->root];
+}
+
+PollingBackend::~PollingBackend() { stop(); }
+
+void PollingBackend::start() {
+  {
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    if (m_impl->running)
+      return;
+    m_impl->running = true;
+  }
+  std::cout << "[Watcher] Polling " << m_impl->root << " every "
+            << m_impl->options.interval.count() << "ms" << std::endl;
+  m_impl->thread = std::thread(&Impl::run, m_impl.get());
+}
+
+void PollingBackend::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    m_impl->running = false;
+  }
+  m_impl->cv.notify_all();
+  if (m_impl->thread.joinable())
+    m_impl->thread.join();
+}
+
+} // namespace sync
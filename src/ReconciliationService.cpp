@@ -1,12 +1,70 @@
 #include "ReconciliationService.hpp"
+#include "ContentHashIndex.hpp"
 #include "UuidUtils.hpp"
 #include <algorithm>
 #include <filesystem>
 #include <iostream>
+#include <numeric>
+#include <set>
 #include <sstream>
 
 namespace sync {
 
+namespace {
+
+int compareFileKey(std::string_view pathA, std::string_view nameA,
+                   std::string_view pathB, std::string_view nameB) {
+  int cmp = pathA.compare(pathB);
+  return cmp != 0 ? cmp : nameA.compare(nameB);
+}
+
+// True when path is subtree or below it; "/" contains everything
+bool inSubtree(std::string_view path, std::string_view subtree) {
+  if (subtree == "/")
+    return true;
+  return path.substr(0, subtree.size()) == subtree &&
+         (path.size() == subtree.size() || path[subtree.size()] == '/');
+}
+
+// Resolves Directory rows for a non-decreasing sequence of paths by
+// stepping one ordered cursor forward
+class DirectoryLookup {
+public:
+  explicit DirectoryLookup(DirectoryCursor &cursor) : m_cursor(cursor) {
+    m_hasRow = m_cursor.next(m_row);
+  }
+
+  std::optional<std::string> find(std::string_view path,
+                                  const pathParts &part) {
+    if (!m_hasGroup || path != m_groupPath) {
+      m_group.clear();
+      m_groupPath = std::string(path);
+      m_hasGroup = true;
+      while (m_hasRow && m_row.path < path)
+        m_hasRow = m_cursor.next(m_row);
+      while (m_hasRow && m_row.path == path) {
+        m_group.push_back(m_row);
+        m_hasRow = m_cursor.next(m_row);
+      }
+    }
+    for (const auto &dir : m_group) {
+      if (dir.device == part.device && dir.folder == part.folder)
+        return dir.uuid;
+    }
+    return std::nullopt;
+  }
+
+private:
+  DirectoryCursor &m_cursor;
+  DirectoryMetadata m_row;
+  bool m_hasRow = false;
+  std::string m_groupPath;
+  bool m_hasGroup = false;
+  std::vector<DirectoryMetadata> m_group;
+};
+
+} // namespace
+
 ReconciliationService::ReconciliationService(DatabaseManager &dbManager,
                                              const std::string &syncPath)
     : m_dbManager(dbManager), m_syncPath(syncPath), m_scanner(syncPath) {}
@@ -64,30 +122,62 @@ ReconciliationResult ReconciliationService::reconcile(
     const std::vector<CloudFolderMetadata> &cloudDirs,
     const std::vector<FileMetadata> &dbFiles,
     const std::vector<DirectoryMetadata> &dbDirs) {
+  CloudMetadataTable cloud;
+  for (const auto &f : cloudFiles)
+    cloud.addFile(f);
+  for (const auto &d : cloudDirs)
+    cloud.addFolder(d);
+  cloud.sortByKey();
+  return reconcile(cloud, dbFiles, dbDirs);
+}
+
+ReconciliationResult
+ReconciliationService::reconcile(const CloudMetadataTable &cloud,
+                                 const std::vector<FileMetadata> &dbFiles,
+                                 const std::vector<DirectoryMetadata> &dbDirs) {
   std::cout << "[Reconcile] Starting reconciliation loop..." << std::endl;
   ReconciliationResult result;
-
-  // 1. Indexing Cloud State
-  std::map<std::string, CloudFileMetadata> cloudByOrigin;
-  std::map<std::string, std::vector<CloudFileMetadata>> cloudByUuid;
-  std::map<std::string, CloudFileMetadata> cloudPathMap;
-
-  for (const auto &f : cloudFiles) {
-    cloudByOrigin[f.origin] = f;
-    cloudByUuid[f.uuid].push_back(f);
-    cloudPathMap[getUniqueKey(f.path, f.filename)] = f;
+  if (!cloud.isSorted()) {
+    std::cerr << "[Reconcile] Cloud table must be sorted" << std::endl;
+    return result;
   }
 
-  // 2. Indexing DB State
-  std::map<std::string, FileMetadata> dbByOrigin;
-  std::map<std::string, std::vector<FileMetadata>> dbByUuid;
-  std::map<std::string, FileMetadata> dbPathMap;
-
-  for (const auto &f : dbFiles) {
-    dbByOrigin[f.origin] = f;
-    dbByUuid[f.uuid].push_back(f);
-    dbPathMap[getUniqueKey(f.path, f.filename)] = f;
-  }
+  // 1. Cloud state is indexed by the table itself (sorted by path)
+
+  // 2. Indexing DB State: row numbers sorted for binary search, so no row
+  // is copied
+  std::vector<size_t> dbByOrigin(dbFiles.size());
+  std::iota(dbByOrigin.begin(), dbByOrigin.end(), 0);
+  std::vector<size_t> dbByPath(dbByOrigin);
+  std::sort(dbByOrigin.begin(), dbByOrigin.end(), [&](size_t a, size_t b) {
+    return dbFiles[a].origin < dbFiles[b].origin;
+  });
+  std::sort(dbByPath.begin(), dbByPath.end(), [&](size_t a, size_t b) {
+    return compareFileKey(dbFiles[a].path, dbFiles[a].filename,
+                          dbFiles[b].path, dbFiles[b].filename) < 0;
+  });
+  auto findDbByOrigin = [&](const std::string &origin) -> const FileMetadata * {
+    auto it = std::lower_bound(dbByOrigin.begin(), dbByOrigin.end(), origin,
+                               [&](size_t row, const std::string &o) {
+                                 return dbFiles[row].origin < o;
+                               });
+    return it != dbByOrigin.end() && dbFiles[*it].origin == origin
+               ? &dbFiles[*it]
+               : nullptr;
+  };
+  auto findDbByPath = [&](std::string_view path,
+                          std::string_view filename) -> const FileMetadata * {
+    auto it = std::lower_bound(
+        dbByPath.begin(), dbByPath.end(), 0, [&](size_t row, int) {
+          return compareFileKey(dbFiles[row].path, dbFiles[row].filename, path,
+                                filename) < 0;
+        });
+    return it != dbByPath.end() &&
+                   compareFileKey(dbFiles[*it].path, dbFiles[*it].filename,
+                                  path, filename) == 0
+               ? &dbFiles[*it]
+               : nullptr;
+  };
 
   // 3. Load Local Queue (Mocking prisma retrieval via dbManager)
   auto localFileQueue = m_dbManager.getFileQueue();
@@ -104,20 +194,22 @@ ReconciliationResult ReconciliationService::reconcile(
     localQueueByPath[getUniqueKey(q.path, q.filename)] = q;
   }
 
-  // 4. Process Cloud Files
-  for (const auto &cloudFile : cloudFiles) {
-    std::string pathKey = getUniqueKey(cloudFile.path, cloudFile.filename);
+  // 4. Process Cloud Files. Rows are read column by column; a full record
+  // is only built for rows that go into the plan.
+  for (size_t i = 0; i < cloud.fileCount(); ++i) {
+    std::string_view path = cloud.filePath(i);
+    std::string_view filename = cloud.fileName(i);
+    std::string origin = cloud.fileOrigin(i);
+    std::string pathKey =
+        getUniqueKey(std::string(path), std::string(filename));
 
-    auto itOrigin = dbByOrigin.find(cloudFile.origin);
-    auto itPath = dbPathMap.find(pathKey);
+    const FileMetadata *localFileByOrigin = findDbByOrigin(origin);
+    const FileMetadata *localFileByPath = findDbByPath(path, filename);
 
-    FileMetadata *localFileByOrigin =
-        (itOrigin != dbByOrigin.end()) ? &itOrigin->second : nullptr;
-    FileMetadata *localFileByPath =
-        (itPath != dbPathMap.end()) ? &itPath->second : nullptr;
-
-    auto localInQueue = localInQueueByAnyPath(
-        cloudFile, localQueueByOrigin, localQueueByUuid, localQueueByPath);
+    auto localInQueue =
+        localInQueueByAnyPath(origin, cloud.fileUuid(i), pathKey,
+                              localQueueByOrigin, localQueueByUuid,
+                              localQueueByPath);
 
     bool isLocalModified = false;
     auto itLocalQ = localQueueByPath.find(pathKey);
@@ -126,31 +218,31 @@ ReconciliationResult ReconciliationService::reconcile(
     }
 
     bool isLocalRenamed = false;
-    auto itLocalOR = localQueueByOrigin.find(cloudFile.origin);
+    auto itLocalOR = localQueueByOrigin.find(origin);
     if (itLocalOR != localQueueByOrigin.end()) {
       isLocalRenamed = (itLocalOR->second.sync_status == "rename");
     }
 
     bool isCloudModified =
         localFileByPath
-            ? (cloudFile.hashvalue != localFileByPath->lastSyncedHashValue)
+            ? !cloud.fileHashEquals(i, localFileByPath->lastSyncedHashValue)
             : false;
     bool isCloudRenamed = false;
 
     if (isLocalRenamed) {
-      auto qEntry = localQueueByOrigin[cloudFile.origin];
+      const auto &qEntry = itLocalOR->second;
       isCloudRenamed =
-          qEntry.old_filename && (*qEntry.old_filename != cloudFile.filename);
+          qEntry.old_filename && (*qEntry.old_filename != filename);
     } else {
       isCloudRenamed = localFileByOrigin
-                           ? (localFileByOrigin->filename != cloudFile.filename)
+                           ? (localFileByOrigin->filename != filename)
                            : false;
     }
 
     // New file in cloud
     if (!localFileByPath && !localFileByOrigin) {
       if (!localInQueue) {
-        result.filesToDownload.push_back(cloudFile);
+        result.filesToDownload.push_back(cloud.file(i));
         continue;
       }
     }
@@ -159,16 +251,16 @@ ReconciliationResult ReconciliationService::reconcile(
     if (localFileByOrigin) {
       if (isCloudModified && !isCloudRenamed && !isLocalModified &&
           !isLocalRenamed) {
-        result.filesToUpdate.push_back(cloudFile);
+        result.filesToUpdate.push_back(cloud.file(i));
       }
       if (!isCloudModified && isCloudRenamed && !isLocalModified &&
           !isLocalRenamed) {
-        result.filesToRename.push_back({*localFileByOrigin, cloudFile});
+        result.filesToRename.push_back({*localFileByOrigin, cloud.file(i)});
       }
       // Conflict detection
       if (isCloudModified && !isCloudRenamed && isLocalModified &&
           !isLocalRenamed) {
-        result.filesInConflict.push_back(cloudFile);
+        result.filesInConflict.push_back(cloud.file(i));
       }
     }
 
@@ -179,10 +271,11 @@ ReconciliationResult ReconciliationService::reconcile(
   }
 
   // 5. Deletions (Cloud -> Local)
-  std::map<std::string, FileMetadata> filesToDeleteMap;
-  for (const auto &dbFile : dbFiles) {
+  std::map<std::string, size_t> filesToDeleteMap;
+  for (size_t row = 0; row < dbFiles.size(); ++row) {
+    const FileMetadata &dbFile = dbFiles[row];
     std::string key = getUniqueKey(dbFile.path, dbFile.filename);
-    if (cloudPathMap.find(key) == cloudPathMap.end()) {
+    if (!cloud.findFile(dbFile.path, dbFile.filename)) {
       auto itLQ = localQueueByOrigin.find(dbFile.origin);
       if (itLQ != localQueueByOrigin.end()) {
         const auto &status = itLQ->second.sync_status;
@@ -190,7 +283,7 @@ ReconciliationResult ReconciliationService::reconcile(
           continue; // Skip if local work pending
         }
       }
-      filesToDeleteMap[key] = dbFile;
+      filesToDeleteMap[key] = row;
     }
   }
 
@@ -201,13 +294,13 @@ ReconciliationResult ReconciliationService::reconcile(
     filesToDeleteMap.erase(oldKey);
   }
 
-  for (auto const &[key, val] : filesToDeleteMap) {
-    result.filesToDeleteLocal.push_back(val);
+  for (auto const &[key, row] : filesToDeleteMap) {
+    result.filesToDeleteLocal.push_back(dbFiles[row]);
   }
 
   // 7. Directory Reconciliation (Paths are authoritative)
   std::map<std::string, CloudFolderMetadata> cloudDirMap;
-  for (const auto &d : cloudDirs) {
+  for (const auto &d : cloud.folders()) {
     if (d.path != "/")
       cloudDirMap[d.path] = d;
   }
@@ -242,6 +335,20 @@ ReconciliationResult ReconciliationService::reconcile(
     }
   }
 
+  // Folders holding local changes not yet uploaded are never deleted
+  std::set<std::string> pendingPaths;
+  for (const auto &q : *localFileQueue) {
+    if (q.sync_status != "delete")
+      pendingPaths.insert(q.path);
+  }
+  auto holdsPending = [&](const std::string &path) {
+    if (pendingPaths.count(path))
+      return true;
+    // Siblings like "/a-b" sort between "/a" and "/a/...", so seek past them
+    auto it = pendingPaths.lower_bound(path + "/");
+    return it != pendingPaths.end() && inSubtree(*it, path);
+  };
+
   for (const auto &[path, dbDir] : dbDirMap) {
     if (cloudDirMap.find(path) == cloudDirMap.end()) {
       auto dirsInQ = m_dbManager.getDirectoryQueue();
@@ -249,7 +356,10 @@ ReconciliationResult ReconciliationService::reconcile(
           dirsInQ->begin(), dirsInQ->end(),
           [&](const DirectoryQueueEntry &e) { return e.path == path; });
 
-      if (!alreadyInQ) {
+      if (!alreadyInQ && holdsPending(path)) {
+        std::cout << "[Reconcile] Keeping " << path
+                  << ", it holds changes not yet uploaded" << std::endl;
+      } else if (!alreadyInQ) {
         result.foldersToDeleteLocal.push_back(
             {dbDir.absPath, dbDir.path, dbDir.folder});
       }
@@ -360,252 +470,430 @@ void ReconciliationService::reconcileDirRenamedCandidates(
   }
 }
 
-std::optional<FileQueueEntry> ReconciliationService::localInQueueByAnyPath(
-    const CloudFileMetadata &cloudFile,
+bool ReconciliationService::localInQueueByAnyPath(
+    const std::string &origin, const std::string &uuid,
+    const std::string &pathKey,
     const std::map<std::string, FileQueueEntry> &localQueueByOrigin,
     const std::map<std::string, std::vector<FileQueueEntry>> &localQueueByUuid,
     const std::map<std::string, FileQueueEntry> &localQueueByPath) {
-  auto itO = localQueueByOrigin.find(cloudFile.origin);
-  if (itO != localQueueByOrigin.end())
-    return itO->second;
-
-  auto itU = localQueueByUuid.find(cloudFile.uuid);
+  if (localQueueByOrigin.count(origin))
+    return true;
+  auto itU = localQueueByUuid.find(uuid);
   if (itU != localQueueByUuid.end() && !itU->second.empty())
-    return itU->second[0];
-
-  auto itP =
-      localQueueByPath.find(getUniqueKey(cloudFile.path, cloudFile.filename));
-  if (itP != localQueueByPath.end())
-    return itP->second;
-
-  return std::nullopt;
+    return true;
+  return localQueueByPath.count(pathKey) > 0;
 }
 
 void ReconciliationService::reconcileLocalState(
     const std::vector<ScannedFile> &scannedFiles,
     const std::vector<ScannedDirectory> &scannedDirs) {
-  std::cout << "[Reconcile] Reconciling local filesystem with database..."
-            << std::endl;
-
-  // 1. Fetch current DB state
-  auto dbFiles = m_dbManager.getAllFiles();
-  auto dbDirs = m_dbManager.getAllDirectories();
+  LocalScanTable scan(m_syncPath);
+  for (const auto &f : scannedFiles)
+    scan.addFile(f);
+  for (const auto &d : scannedDirs)
+    scan.addDirectory(d);
+  scan.sortByKey();
+  reconcileLocalState(scan);
+}
 
-  // Index DB State
-  std::map<std::string, FileMetadata> dbFilesPathMap;
-  for (const auto &f : *dbFiles) {
-    dbFilesPathMap[getUniqueKey(f.path, f.filename)] = f;
+void ReconciliationService::reconcileSubtree(const std::string &absDir) {
+  // The burst may have removed the directory itself; rescan the nearest
+  // ancestor that still exists
+  std::filesystem::path dir =
+      std::filesystem::path(absDir).lexically_normal();
+  std::filesystem::path root =
+      std::filesystem::path(m_syncPath).lexically_normal();
+  std::error_code ec;
+  while (dir != root && dir.has_parent_path() &&
+         !std::filesystem::is_directory(dir, ec))
+    dir = dir.parent_path();
+
+  std::string subtree = "/";
+  if (dir != root) {
+    auto rel = dir.lexically_relative(root);
+    if (rel.empty() || *rel.begin() == "..") {
+      std::cerr << "[Reconcile] " << absDir << " is outside the sync folder"
+                << std::endl;
+      return;
+    }
+    subtree = "/" + m_scanner.normalizePathSeparators(rel.generic_string());
   }
+  std::cout << "[Reconcile] Rescanning subtree " << subtree << std::endl;
+  reconcileLocalState(m_scanner.scanSyncPathCompact(dir.string()), subtree);
+}
 
-  std::map<std::string, DirectoryMetadata> dbDirsPathMap;
-  for (const auto &d : *dbDirs) {
-    std::string path = d.path;
-    if (path.length() > 1 && path.back() == '/')
-      path.pop_back(); // Normalize
-    if (path != "/")
-      dbDirsPathMap[path] = d;
+void ReconciliationService::reconcileLocalState(const LocalScanTable &scan,
+                                                const std::string &subtree) {
+  if (!scan.isSorted()) {
+    std::cerr << "[Reconcile] Scan table must be sorted" << std::endl;
+    return;
   }
+  std::cout << "[Reconcile] Reconciling local filesystem with database..."
+            << std::endl;
 
-  // Index Scan State
-  std::map<std::string, ScannedFile> scanFilesMap;
-  for (const auto &f : scannedFiles) {
-    scanFilesMap[getUniqueKey(f.path, f.filename)] = f;
-  }
+  // 1. Merge-join the scan against ordered DB cursors. Both sides are in
+  // (path, filename) order, so one pass finds new, modified and deleted
+  // files without loading the File table. Changes are collected first and
+  // applied once the cursors are closed.
+  struct NewFile {
+    size_t row;
+    std::optional<std::string> dirID;
+  };
+  std::vector<NewFile> newFiles;
+  std::vector<std::pair<size_t, FileMetadata>> modifiedFiles;
+  std::vector<FileMetadata> deletedFiles;
+  std::vector<size_t> newDirs;
+  std::vector<DirectoryMetadata> deletedDirs;
+  {
+    auto fileCursor = m_dbManager.openFileCursor(subtree);
+    auto lookupCursor = m_dbManager.openDirectoryCursor(subtree);
+    auto dirCursor = m_dbManager.openDirectoryCursor(subtree);
+    if (!fileCursor || !lookupCursor || !dirCursor)
+      return;
+    DirectoryLookup dirLookup(*lookupCursor);
+
+    // The cursors' path range also admits siblings sharing the prefix
+    auto nextDbFile = [&](FileMetadata &row) {
+      while (fileCursor->next(row)) {
+        if (inSubtree(row.path, subtree))
+          return true;
+      }
+      return false;
+    };
+    FileMetadata dbFile;
+    bool hasDbFile = nextDbFile(dbFile);
+    size_t i = 0;
+    while (i < scan.fileCount() || hasDbFile) {
+      int cmp = !hasDbFile                ? -1
+                : i == scan.fileCount() ? 1
+                                        : compareFileKey(scan.filePath(i),
+                                                         scan.fileName(i),
+                                                         dbFile.path,
+                                                         dbFile.filename);
+      if (cmp < 0) {
+        pathParts part = m_dbManager.getFolderDevice(
+            std::string(scan.filePath(i)));
+        newFiles.push_back({i, dirLookup.find(scan.filePath(i), part)});
+        ++i;
+      } else if (cmp > 0) {
+        deletedFiles.push_back(std::move(dbFile));
+        hasDbFile = nextDbFile(dbFile);
+      } else {
+        if (!scan.fileHashEquals(i, dbFile.hashvalue))
+          modifiedFiles.emplace_back(i, std::move(dbFile));
+        ++i;
+        hasDbFile = nextDbFile(dbFile);
+      }
+    }
+
+    // Directories join on path alone; several DB rows may share one path.
+    // The scan never lists its own root, so the subtree root is skipped.
+    auto nextDbDir = [&](DirectoryMetadata &row) {
+      while (dirCursor->next(row)) {
+        if (row.path.length() > 1 && row.path.back() == '/')
+          row.path.pop_back(); // Normalize
+        if (row.path != "/" && row.path != subtree &&
+            inSubtree(row.path, subtree))
+          return true;
+      }
+      return false;
+    };
+    DirectoryMetadata dbDir;
+    bool hasDbDir = nextDbDir(dbDir);
+    auto skipDbDirPath = [&](const std::string &path) {
+      while (hasDbDir && dbDir.path == path)
+        hasDbDir = nextDbDir(dbDir);
+    };
+    size_t d = 0;
+    while (d < scan.directoryCount() || hasDbDir) {
+      int cmp = !hasDbDir                      ? -1
+                : d == scan.directoryCount() ? 1
+                    : scan.directoryPath(d).compare(dbDir.path);
+      if (cmp < 0) {
+        newDirs.push_back(d);
+        ++d;
+      } else if (cmp > 0) {
+        deletedDirs.push_back(dbDir);
+        skipDbDirPath(deletedDirs.back().path);
+      } else {
+        skipDbDirPath(std::string(scan.directoryPath(d)));
+        ++d;
+      }
+    }
 
-  std::map<std::string, ScannedDirectory> scanDirsMap;
-  for (const auto &d : scannedDirs) {
-    scanDirsMap[d.path] = d;
+    if (fileCursor->failed() || lookupCursor->failed() ||
+        dirCursor->failed()) {
+      std::cerr << "[Reconcile] Database read failed, skipping local "
+                   "reconciliation"
+                << std::endl;
+      return;
+    }
   }
 
-  // 2. Identify File Changes
+  // 2. Apply File Changes
+  std::set<std::string> movedSources;
+  // Directories created for new files during this pass, by path
+  std::map<std::string, std::string> createdDirs;
+
+  // Known content becomes a server side move (source gone) or copy
+  // (source still present) instead of an upload. Content already on the
+  // server is synced files plus pending deletes, looked up for every new
+  // file at once.
+  ContentHashIndex hashIndex;
+  {
+    std::vector<std::string> hashes;
+    for (const auto &newFile : newFiles) {
+      if (scan.fileSize(newFile.row) > 0)
+        hashes.push_back(scan.file(newFile.row).hash);
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    if (!hashes.empty()) {
+      if (auto files = m_dbManager.getSyncedFilesByHashes(hashes)) {
+        for (const auto &f : *files)
+          hashIndex.add(f);
+      }
+      if (auto deletes = m_dbManager.getQueuedDeletesByHashes(hashes)) {
+        for (const auto &q : *deletes)
+          hashIndex.addQueuedDelete(q);
+      }
+    }
+  }
+  // Plain adds of this pass by inode, to pair with deletes below
+  std::map<std::string, FileQueueEntry> addedByInode;
+
+  // NEW files
+  for (const auto &newFile : newFiles) {
+    const ScannedFile sFile = scan.file(newFile.row);
+    std::string key = getUniqueKey(sFile.path, sFile.filename);
+
+    std::optional<ContentHashEntry> moveSource;
+    std::optional<ContentHashEntry> copySource;
+    for (const auto &candidate :
+         hashIndex.find(sFile.hash, sFile.filename)) {
+      std::string sourceKey = getUniqueKey(candidate.path, candidate.filename);
+      if (sourceKey == key || movedSources.count(sourceKey))
+        continue;
+      // Outside a subtree scan only pending deletes are known to be gone
+      bool sourcePresent =
+          inSubtree(candidate.path, subtree)
+              ? scan.findFile(candidate.path, candidate.filename).has_value()
+              : !candidate.queuedDelete;
+      if (!sourcePresent) {
+        moveSource = candidate;
+        break;
+      }
+      if (!candidate.queuedDelete && !copySource)
+        copySource = candidate;
+    }
 
-  // Check for NEW or MODIFIED files
-  for (const auto &[key, sFile] : scanFilesMap) {
-    if (dbFilesPathMap.find(key) == dbFilesPathMap.end()) {
-      // New File
+    FileMetadata f;
+    FileQueueEntry fq;
+
+    f.uuid = UuidUtils::generate();
+    f.path = sFile.path;
+    f.filename = sFile.filename;
+    f.last_modified = std::to_string(sFile.mtime);
+    f.hashvalue = sFile.hash;
+    f.size = sFile.size;
+    f.inode = sFile.inode;
+    f.absPath = sFile.absPath;
+    f.versions = 1;
+    f.origin = f.uuid;
+    f.lastSyncedHashValue = sFile.hash;
+
+    if (moveSource) {
+      std::cout << "[Reconcile] Offline MOVE detected: "
+                << getUniqueKey(moveSource->path, moveSource->filename)
+                << " -> " << key << std::endl;
+      f.uuid = moveSource->uuid;
+      f.origin = moveSource->origin;
+      f.versions = moveSource->versions;
+      f.lastSyncedHashValue = moveSource->lastSyncedHashValue;
+      movedSources.insert(getUniqueKey(moveSource->path, moveSource->filename));
+    } else if (copySource) {
+      std::cout << "[Reconcile] Offline COPY detected: "
+                << getUniqueKey(copySource->path, copySource->filename)
+                << " -> " << key << std::endl;
+    } else {
       std::cout << "[Reconcile] Offline ADD detected: " << key << std::endl;
-      FileMetadata f;
-      FileQueueEntry fq;
-
-      f.uuid = UuidUtils::generate();
-      f.path = sFile.path;
-      f.filename = sFile.filename;
-      f.last_modified = std::to_string(sFile.mtime);
-      f.hashvalue = sFile.hash;
-      f.size = sFile.size;
-      f.inode = sFile.inode;
-      f.absPath = sFile.absPath;
-      f.versions = 1;
-      f.origin = f.uuid;
-      f.lastSyncedHashValue = sFile.hash;
+    }
 
-      fq = FileMetadata(f);
+    fq = FileMetadata(f);
+    if (moveSource) {
+      fq.sync_status = "rename";
+      fq.old_filename = moveSource->filename;
+      fq.old_path = moveSource->path;
+    } else if (copySource) {
+      fq.sync_status = "copy";
+      fq.old_filename = copySource->filename;
+      fq.old_path = copySource->path;
+    } else {
       fq.sync_status = "new";
       fq.old_filename = sFile.filename;
       fq.old_path = sFile.path;
+    }
 
+    std::optional<std::string> dirID = newFile.dirID;
+    if (!dirID) {
+      auto created = createdDirs.find(f.path);
+      if (created != createdDirs.end())
+        dirID = created->second;
+    }
+    if (dirID) {
+      fq.dirID = *dirID;
+      f.dirID = *dirID;
+    } else {
+      // create the directory path
       pathParts part = m_dbManager.getFolderDevice(f.path);
-      std::cout << "[Reconcile] " << "device : " << part.device
-                << " folder: " << part.folder << " path: " << f.path
-                << std::endl;
-      auto dir =
-          m_dbManager.getDirectoryByPath(part.device, part.folder, f.path);
-      std::cout << "[Reconcile] dir value exists : " << dir.has_value()
-                << std::endl;
-      if (dir.has_value()) {
-        fq.dirID = dir->uuid;
-        f.dirID = dir->uuid;
-      } else {
-        // create the directory path
-        DirectoryQueueEntry dq;
-        DirectoryMetadata d;
-        d.path = f.path;
-        d.device = part.device;
-        d.folder = part.folder;
-        d.uuid = UuidUtils::generate();
-        if (d.path != "/")
-          d.absPath = m_syncPath + "/" + d.path;
-        else
-          d.absPath = m_syncPath;
-        try {
-          d.inode = m_scanner.getInode(d.absPath);
-          std::filesystem::path dir{d.absPath};
-          auto ftime = std::filesystem::directory_entry(dir).last_write_time();
-          d.created_at = std::to_string(m_scanner.getUnixTimeStamp(ftime));
-        } catch (const std::filesystem::filesystem_error &e) {
-          d.created_at = "";
-          d.inode = "";
-          std::cerr << "Error: " << e.what() << std::endl;
-        }
-        // Create DirectoryQueueEntry from DirectoryMetadata
-        dq = DirectoryQueueEntry(d);
-        dq.sync_status = "FILE_LINKED";
-        dq.old_path = d.path;
-        //        m_dbManager.insertDirectoryQueue(dq);
-        auto result = m_dbManager.insertDirectory(d, dq);
-        if (result) {
-          fq.dirID = d.uuid;
-          f.dirID = d.uuid;
-        } else {
-          return;
-        }
+      DirectoryQueueEntry dq;
+      DirectoryMetadata d;
+      d.path = f.path;
+      d.device = part.device;
+      d.folder = part.folder;
+      d.uuid = UuidUtils::generate();
+      if (d.path != "/")
+        d.absPath = m_syncPath + "/" + d.path;
+      else
+        d.absPath = m_syncPath;
+      try {
+        d.inode = m_scanner.getInode(d.absPath);
+        std::filesystem::path dir{d.absPath};
+        auto ftime = std::filesystem::directory_entry(dir).last_write_time();
+        d.created_at = std::to_string(m_scanner.getUnixTimeStamp(ftime));
+      } catch (const std::filesystem::filesystem_error &e) {
+        d.created_at = "";
+        d.inode = "";
+        std::cerr << "Error: " << e.what() << std::endl;
       }
-      m_dbManager.insertFile(f, fq);
-      //      m_dbManager.upsertFileQueue(fq);
-      //    m_dbManager.upsertFile(f);
-    } else {
-
-      const auto &dbFile = dbFilesPathMap[key];
-      if (dbFile.hashvalue != sFile.hash) {
-        // Modified File
-        std::cout << "[Reconcile] Offline MODIFY detected: " << key
-                  << std::endl;
-        FileQueueEntry fq;
-        FileMetadata f;
-        f.path = sFile.path;
-        f.dirID = dbFile.dirID;
-        f.filename = sFile.filename;
-        f.absPath = sFile.absPath;
-        f.inode = sFile.inode;
-        f.hashvalue = sFile.hash;
-        f.lastSyncedHashValue = dbFile.lastSyncedHashValue;
-        f.size = sFile.size;
-        f.last_modified = std::to_string(sFile.mtime);
-        f.uuid = UuidUtils::generate();
-        f.origin = dbFile.origin;
-        f.versions = dbFile.versions + 1;
-        fq = FileMetadata(f);
-        fq.sync_status = "modified";
-        m_dbManager.insertFile(f, fq);
-        //        m_dbManager.upsertFile(f);
-        //      m_dbManager.upsertFileQueue(fq);
+      // Create DirectoryQueueEntry from DirectoryMetadata
+      dq = DirectoryQueueEntry(d);
+      dq.sync_status = "FILE_LINKED";
+      dq.old_path = d.path;
+      auto result = m_dbManager.insertDirectory(d, dq);
+      if (result) {
+        fq.dirID = d.uuid;
+        f.dirID = d.uuid;
+        createdDirs[d.path] = d.uuid;
+      } else {
+        return;
       }
     }
+    if (moveSource)
+      m_dbManager.moveFile(moveSource->path, moveSource->filename, f, fq);
+    else
+      m_dbManager.insertFile(f, fq);
+    if (fq.sync_status == "new" && !fq.inode.empty())
+      addedByInode[fq.inode] = fq;
   }
-  // Check for DELETED files
-  for (const auto &[key, dbFile] : dbFilesPathMap) {
-    if (scanFilesMap.find(key) == scanFilesMap.end()) {
-      std::cout << "[Reconcile] Offline DELETE detected: " << key << std::endl;
-
-      // Create FileQueueEntry from FileMetadata
-      FileQueueEntry q(dbFile);
-      q.sync_status = "delete";
-      m_dbManager.deleteFile(dbFile.path, dbFile.filename, q);
-      //      m_dbManager.upsertFileQueue(q);
+
+  // MODIFIED files
+  for (const auto &[row, dbFile] : modifiedFiles) {
+    const ScannedFile sFile = scan.file(row);
+    std::cout << "[Reconcile] Offline MODIFY detected: "
+              << getUniqueKey(sFile.path, sFile.filename) << std::endl;
+    FileQueueEntry fq;
+    FileMetadata f;
+    f.path = sFile.path;
+    f.dirID = dbFile.dirID;
+    f.filename = sFile.filename;
+    f.absPath = sFile.absPath;
+    f.inode = sFile.inode;
+    f.hashvalue = sFile.hash;
+    f.size = sFile.size;
+    f.last_modified = std::to_string(sFile.mtime);
+    f.origin = dbFile.origin;
+    // Changed before its upload: still a new file
+    auto pending = m_dbManager.getFileQueueByPath(dbFile.path, dbFile.filename);
+    if (pending && pending->notYetUploaded()) {
+      f.lastSyncedHashValue = sFile.hash;
+      f.uuid = dbFile.uuid;
+      f.versions = dbFile.versions;
+      fq = FileMetadata(f);
+      fq.sync_status = "new";
+      fq.old_path = f.path;
+      fq.old_filename = f.filename;
+      m_dbManager.insertFile(f, fq);
+      continue;
     }
+    f.lastSyncedHashValue = dbFile.lastSyncedHashValue;
+    f.uuid = UuidUtils::generate();
+    f.versions = dbFile.versions + 1;
+    fq = FileMetadata(f);
+    fq.sync_status = "modified";
+    m_dbManager.insertFile(f, fq);
   }
 
-  // 3. Identify Directory Changes
-
-  // Check for NEW directories
-  for (const auto &[path, sDir] : scanDirsMap) {
-    if (dbDirsPathMap.find(path) == dbDirsPathMap.end()) {
-      std::cout << "[Reconcile] Offline DIR ADD detected: " << path
-                << std::endl;
-      DirectoryMetadata q;
-      DirectoryQueueEntry qd;
-      q.path = sDir.path;
-      q.folder = sDir.name;
-      q.absPath = sDir.absPath;
-      q.inode = sDir.inode;
-      q.created_at = std::to_string(sDir.mtime);
-      pathParts part = m_dbManager.getFolderDevice(sDir.path);
-      auto existingDir =
-          m_dbManager.getDirectoryByPath(part.device, sDir.name, sDir.path);
-      if (existingDir.has_value()) {
-        q.uuid = existingDir->uuid;
-      } else {
-        q.uuid = UuidUtils::generate();
-      }
-      q.device = part.device;
-      qd = DirectoryMetadata(q);
-      qd.sync_status = "new";
-      m_dbManager.insertDirectory(q, qd);
-      //      m_dbManager.upsertDirectory(q);
-      //    m_dbManager.upsertDirectoryQueue(qd);
+  // DELETED files
+  for (const auto &dbFile : deletedFiles) {
+    std::string key = getUniqueKey(dbFile.path, dbFile.filename);
+    if (movedSources.count(key))
+      continue;
+    std::cout << "[Reconcile] Offline DELETE detected: " << key << std::endl;
+
+    // Gone before it was uploaded: nothing to delete on the server, and a
+    // delete row would pose as the source of a later move. A plain add of
+    // the same inode stays one.
+    auto pending = m_dbManager.getFileQueueByPath(dbFile.path, dbFile.filename);
+    if (pending && pending->notYetUploaded()) {
+      m_dbManager.forgetFile(dbFile.path, dbFile.filename);
+      continue;
     }
-  }
 
-  // Check for DELETED directories
-  for (const auto &[path, dbDir] : dbDirsPathMap) {
-    if (scanDirsMap.find(path) == scanDirsMap.end()) {
-      std::cout << "[Reconcile] Offline DIR DELETE detected: " << path
-                << std::endl;
-      DirectoryQueueEntry q(dbDir);
-      q.sync_status = "delete";
-      m_dbManager.deleteFolderWithTransaction(dbDir.path, q);
-      // m_dbManager.deleteDirectory(dbDir.path);
-      // m_dbManager.upsertDirectoryQueue(q);
+    // Create FileQueueEntry from FileMetadata
+    FileQueueEntry q(dbFile);
+    q.sync_status = "delete";
+    m_dbManager.deleteFile(dbFile.path, dbFile.filename, q);
+
+    // Same inode and content as a file added in this pass: a rename the
+    // hash index could not see (empty files are never indexed)
+    auto added = addedByInode.find(dbFile.inode);
+    if (!dbFile.inode.empty() && added != addedByInode.end() &&
+        added->second.hashvalue == dbFile.hashvalue) {
+      FileQueueEntry renamed(added->second);
+      renamed.sync_status = "rename";
+      renamed.old_path = dbFile.path;
+      renamed.old_filename = dbFile.filename;
+      m_dbManager.deleteFileQueue(dbFile.path, dbFile.filename);
+      m_dbManager.updateFileQueue(renamed);
+      addedByInode.erase(added);
     }
   }
-  auto filesInQueue = m_dbManager.getAllQueueFiles();
-  std::map<std::string, std::vector<FileQueueEntry>> inodeGroups;
-  std::map<std::string, std::vector<FileQueueEntry>> renamedCandidates;
-  for (const FileQueueEntry &f : *filesInQueue) {
-    inodeGroups[f.inode].push_back(f);
-  }
-  for (const auto &[inode, files] : inodeGroups) {
-    if (files.size() == 2) {
-      renamedCandidates[inode] = files;
+
+  // 3. Apply Directory Changes
+
+  // NEW directories
+  for (size_t row : newDirs) {
+    const ScannedDirectory sDir = scan.directory(row);
+    std::cout << "[Reconcile] Offline DIR ADD detected: " << sDir.path
+              << std::endl;
+    DirectoryMetadata q;
+    DirectoryQueueEntry qd;
+    q.path = sDir.path;
+    q.folder = sDir.name;
+    q.absPath = sDir.absPath;
+    q.inode = sDir.inode;
+    q.created_at = std::to_string(sDir.mtime);
+    pathParts part = m_dbManager.getFolderDevice(sDir.path);
+    auto created = createdDirs.find(sDir.path);
+    if (created != createdDirs.end()) {
+      q.uuid = created->second;
+    } else {
+      q.uuid = UuidUtils::generate();
     }
+    q.device = part.device;
+    qd = DirectoryMetadata(q);
+    qd.sync_status = "new";
+    m_dbManager.insertDirectory(q, qd);
   }
-  for (const auto &[inode, files] : renamedCandidates) {
-    FileQueueEntry deleted{};
-    FileQueueEntry added{};
-    for (const auto &file : files) {
-      if (file.sync_status == "new")
-        added = file;
-      if (file.sync_status == "delete")
-        deleted = file;
-    }
-    if (!deleted.sync_status.empty() && !added.sync_status.empty() &&
-        deleted.hashvalue == added.hashvalue) {
-      FileQueueEntry q(added);
-      added.sync_status = "rename";
-      added.old_filename = deleted.filename;
-      m_dbManager.deleteFileQueue(deleted.path, deleted.filename);
-      m_dbManager.updateFileQueue(added);
-    }
+
+  // DELETED directories
+  for (const auto &dbDir : deletedDirs) {
+    std::cout << "[Reconcile] Offline DIR DELETE detected: " << dbDir.path
+              << std::endl;
+    DirectoryQueueEntry q(dbDir);
+    q.sync_status = "delete";
+    m_dbManager.deleteFolderWithTransaction(dbDir.path, q);
   }
 }
 
@@ -0,0 +1,90 @@
+#include "RetryPolicy.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace sync {
+
+RetryPolicy::RetryPolicy(RetryOptions options)
+    : m_options(options), m_rng(std::random_device{}()) {
+  m_options.maxAttempts = std::max(m_options.maxAttempts, 1);
+  m_options.breakerThreshold = std::max(m_options.breakerThreshold, 1);
+}
+
+bool RetryPolicy::isRetryableStatus(int status) {
+  switch (status) {
+  case 408: // Request Timeout
+  case 429: // Too Many Requests
+  case 500:
+  case 502:
+  case 503:
+  case 504:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool RetryPolicy::isUnprocessedStatus(int status) {
+  return status == 408 || status == 429 || status == 503;
+}
+
+std::chrono::milliseconds
+RetryPolicy::backoff(int retry, std::chrono::milliseconds retryAfter) {
+  using std::chrono::milliseconds;
+  // Doubling stops well before the shift could overflow
+  int64_t ceiling = m_options.baseDelay.count() << std::clamp(retry, 0, 20);
+  ceiling = std::min<int64_t>(ceiling, m_options.maxDelay.count());
+  int64_t delay;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    delay = std::uniform_int_distribution<int64_t>(0, ceiling)(m_rng);
+  }
+  return std::min(std::max(milliseconds(delay), retryAfter),
+                  m_options.maxDelay);
+}
+
+bool RetryPolicy::allowRequest() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (!m_open)
+    return true;
+  if (m_probing || Clock::now() < m_openUntil)
+    return false;
+  m_probing = true;
+  return true;
+}
+
+void RetryPolicy::recordSuccess() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (m_open)
+    std::cout << "[API] Server reachable again" << std::endl;
+  m_failures = 0;
+  m_open = false;
+  m_probing = false;
+}
+
+void RetryPolicy::recordFailure() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  ++m_failures;
+  if (m_open ? !m_probing : m_failures < m_options.breakerThreshold)
+    return;
+  if (!m_open)
+    std::cerr << "[API] " << m_failures << " requests in a row failed, "
+              << "pausing requests for "
+              << m_options.breakerCooldown.count() << " ms" << std::endl;
+  m_open = true;
+  m_probing = false;
+  m_openUntil = Clock::now() + m_options.breakerCooldown;
+}
+
+void RetryPolicy::recordCanceled() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  // Lets the next request probe; the circuit stays as it was
+  m_probing = false;
+}
+
+bool RetryPolicy::circuitOpen() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_open;
+}
+
+} // namespace sync
@@ -0,0 +1,417 @@
+#include "SyncItemsParser.hpp"
+#include <charconv>
+#include <cctype>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string_view>
+
+using json = nlohmann::json;
+
+namespace sync {
+
+namespace {
+
+enum class Field {
+  None,
+  Type,
+  Uuid,
+  Filename,
+  Device,
+  Directory,
+  Origin,
+  Checksum,
+  Size,
+  Mtime,
+  Version,
+  ConflictId,
+  Folder,
+  Path,
+  CreatedAt,
+};
+
+struct FieldName {
+  std::string_view name;
+  Field field;
+};
+
+constexpr FieldName kFields[] = {
+    {"type", Field::Type},
+    {"uuid", Field::Uuid},
+    {"filename", Field::Filename},
+    {"device", Field::Device},
+    {"directory", Field::Directory},
+    {"origin", Field::Origin},
+    {"checksum", Field::Checksum},
+    {"size", Field::Size},
+    {"mtime", Field::Mtime},
+    {"version", Field::Version},
+    {"conflictId", Field::ConflictId},
+    {"folder", Field::Folder},
+    {"path", Field::Path},
+    {"created_at", Field::CreatedAt},
+};
+
+constexpr uint32_t bit(Field f) { return 1u << static_cast<int>(f); }
+
+constexpr uint32_t kFileFields = bit(Field::Uuid) | bit(Field::Filename) |
+                                 bit(Field::Origin) | bit(Field::Checksum) |
+                                 bit(Field::Size) | bit(Field::Mtime) |
+                                 bit(Field::Version);
+constexpr uint32_t kFolderFields = bit(Field::Uuid) | bit(Field::Device) |
+                                   bit(Field::Folder) | bit(Field::Path);
+
+/**
+ * SAX handler for one item object. Fields we know are kept at the top
+ * level only; a null counts as absent.
+ */
+class ItemReader {
+public:
+  std::string type, uuid, filename, device, directory, origin, checksum,
+      mtime, folder, path, createdAt;
+  std::optional<std::string> conflictId;
+  int64_t size = 0;
+  int version = 0;
+  uint32_t seen = 0;
+  std::string error;
+
+  bool null() { return value(); }
+  bool boolean(bool) { return value(); }
+  bool number_integer(json::number_integer_t v) { return number(v); }
+  bool number_unsigned(json::number_unsigned_t v) {
+    return number(static_cast<int64_t>(v));
+  }
+  bool number_float(json::number_float_t, const json::string_t &) {
+    return m_field == Field::None || wrongType();
+  }
+  bool string(json::string_t &v) {
+    if (m_field == Field::ConflictId)
+      conflictId = std::move(v);
+    else if (std::string *target = textField())
+      *target = std::move(v);
+    else if (m_field != Field::None)
+      return wrongType();
+    seen |= bit(m_field);
+    return value();
+  }
+  bool binary(json::binary_t &) { return value(); }
+  bool start_object(std::size_t) { return open(); }
+  bool end_object() { return close(); }
+  bool start_array(std::size_t) { return open(); }
+  bool end_array() { return close(); }
+  bool key(json::string_t &name) {
+    m_field = Field::None;
+    if (m_depth != 1)
+      return true;
+    for (const auto &f : kFields) {
+      if (f.name == name) {
+        m_field = f.field;
+        break;
+      }
+    }
+    return true;
+  }
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &e) {
+    error = e.what();
+    return false;
+  }
+
+private:
+  int m_depth = 0;
+  Field m_field = Field::None;
+
+  bool value() {
+    m_field = Field::None;
+    return true;
+  }
+  bool number(int64_t v) {
+    if (m_field == Field::Size)
+      size = v;
+    else if (m_field == Field::Version)
+      version = static_cast<int>(v);
+    else if (m_field != Field::None)
+      return wrongType();
+    seen |= bit(m_field);
+    return value();
+  }
+  bool open() {
+    if (m_depth == 1 && m_field != Field::None)
+      return wrongType();
+    ++m_depth;
+    return true;
+  }
+  bool close() {
+    --m_depth;
+    return value();
+  }
+  bool wrongType() {
+    for (const auto &f : kFields) {
+      if (f.field == m_field)
+        error = "field " + std::string(f.name) + " has the wrong type";
+    }
+    return false;
+  }
+  std::string *textField() {
+    switch (m_field) {
+    case Field::Type:
+      return &type;
+    case Field::Uuid:
+      return &uuid;
+    case Field::Filename:
+      return &filename;
+    case Field::Device:
+      return &device;
+    case Field::Directory:
+      return &directory;
+    case Field::Origin:
+      return &origin;
+    case Field::Checksum:
+      return &checksum;
+    case Field::Mtime:
+      return &mtime;
+    case Field::Folder:
+      return &folder;
+    case Field::Path:
+      return &path;
+    case Field::CreatedAt:
+      return &createdAt;
+    default:
+      return nullptr;
+    }
+  }
+};
+
+// Reads an item whose values are strings without escapes, integers,
+// booleans or null, which is every item a server sends in practice, at
+// several times the speed of the SAX parser. nullopt for anything else;
+// the SAX parser then takes the item from the start.
+std::optional<bool> readFlatItem(std::string_view text, ItemReader &item) {
+  size_t i = 0;
+  auto skipSpace = [&] {
+    while (i < text.size() && (text[i] == ' ' || text[i] == '\n' ||
+                               text[i] == '\r' || text[i] == '\t'))
+      ++i;
+  };
+  auto at = [&](char c) { return i < text.size() && text[i] == c; };
+  // Two memchr scans; find_first_of would look at one byte at a time
+  auto readString = [&](std::string &out) {
+    size_t end = text.find('"', i + 1);
+    if (end == std::string_view::npos ||
+        text.substr(i + 1, end - i - 1).find('\\') != std::string_view::npos)
+      return false;
+    out.assign(text.data() + i + 1, end - i - 1);
+    i = end + 1;
+    return true;
+  };
+
+  skipSpace();
+  if (!at('{'))
+    return std::nullopt;
+  ++i;
+  item.start_object(0);
+  skipSpace();
+  bool empty = at('}');
+  if (empty)
+    ++i;
+  std::string key, text_value;
+  while (!empty) {
+    skipSpace();
+    if (!at('"') || !readString(key))
+      return std::nullopt;
+    skipSpace();
+    if (!at(':'))
+      return std::nullopt;
+    ++i;
+    skipSpace();
+    item.key(key);
+    bool ok;
+    std::string_view rest = text.substr(i);
+    if (at('"')) {
+      if (!readString(text_value))
+        return std::nullopt;
+      ok = item.string(text_value);
+    } else if (at('-') || (i < text.size() && std::isdigit(
+                                                  static_cast<unsigned char>(
+                                                      text[i])))) {
+      int64_t v = 0;
+      auto [end, ec] = std::from_chars(rest.data(), rest.data() + rest.size(),
+                                       v);
+      i += end - rest.data();
+      if (ec != std::errc() || at('.') || at('e') || at('E'))
+        return std::nullopt;
+      ok = item.number_integer(v);
+    } else if (rest.substr(0, 4) == "true") {
+      i += 4;
+      ok = item.boolean(true);
+    } else if (rest.substr(0, 5) == "false") {
+      i += 5;
+      ok = item.boolean(false);
+    } else if (rest.substr(0, 4) == "null") {
+      i += 4;
+      ok = item.null();
+    } else {
+      return std::nullopt;
+    }
+    if (!ok)
+      return false;
+    skipSpace();
+    if (at('}')) {
+      ++i;
+      break;
+    }
+    if (!at(','))
+      return std::nullopt;
+    ++i;
+  }
+  skipSpace();
+  if (i != text.size())
+    return std::nullopt;
+  return item.end_object();
+}
+
+std::string missingFields(uint32_t missing) {
+  std::string names;
+  for (const auto &f : kFields) {
+    if (missing & bit(f.field))
+      names += (names.empty() ? "" : ", ") + std::string(f.name);
+  }
+  return names;
+}
+
+} // namespace
+
+SyncItemsParser::SyncItemsParser(FileSink onFile, FolderSink onFolder)
+    : m_onFile(std::move(onFile)), m_onFolder(std::move(onFolder)) {}
+
+bool SyncItemsParser::fail(std::string error) {
+  if (m_error.empty())
+    m_error = std::move(error);
+  return false;
+}
+
+bool SyncItemsParser::feed(const char *data, size_t len) {
+  if (!m_error.empty())
+    return false;
+  // Start of the current item within data, while capturing
+  size_t itemStart = 0;
+  for (size_t i = 0; i < len; ++i) {
+    char c = data[i];
+    if (m_inString) {
+      if (m_escape)
+        m_escape = false;
+      else if (c == '\\')
+        m_escape = true;
+      else if (c == '"')
+        m_inString = false;
+      else if (m_depth == 1)
+        m_key += c;
+      if (!m_inString && m_depth == 1)
+        m_lastKey.swap(m_key);
+      continue;
+    }
+    switch (c) {
+    case '"':
+      m_inString = true;
+      if (m_depth == 1)
+        m_key.clear();
+      break;
+    case '{':
+    case '[':
+      if (m_done || (m_depth == 0 && c != '{'))
+        return fail("listing is not a JSON object");
+      m_started = true;
+      if (m_depth == 1 && c == '[' && m_lastKey == "items")
+        m_inItems = true;
+      if (m_inItems && m_depth == 2 && c == '{') {
+        m_capturing = true;
+        itemStart = i;
+      }
+      ++m_depth;
+      break;
+    case '}':
+    case ']':
+      if (m_depth == 0)
+        return fail("unbalanced " + std::string(1, c));
+      --m_depth;
+      if (m_capturing && m_depth == 2) {
+        m_item.append(data + itemStart, i + 1 - itemStart);
+        m_capturing = false;
+        if (!parseItem())
+          return false;
+        m_item.clear();
+      }
+      if (m_depth == 1)
+        m_inItems = false;
+      if (m_depth == 0)
+        m_done = true;
+      break;
+    default:
+      break;
+    }
+  }
+  if (m_capturing)
+    m_item.append(data + itemStart, len - itemStart);
+  return true;
+}
+
+bool SyncItemsParser::finish() {
+  if (!m_error.empty())
+    return false;
+  if (!m_started || !m_done)
+    return fail("listing ended early");
+  return true;
+}
+
+bool SyncItemsParser::parseItem() {
+  ItemReader item;
+  auto flat = readFlatItem(m_item, item);
+  if (!flat) {
+    item = ItemReader();
+    flat = json::sax_parse(m_item.data(), m_item.data() + m_item.size(),
+                           &item);
+  }
+  if (!*flat)
+    return fail("item " + std::to_string(m_items) + ": " + item.error);
+  m_items++;
+
+  if (item.type == "file") {
+    if (uint32_t missing = kFileFields & ~item.seen)
+      return fail("item " + std::to_string(m_items - 1) + " lacks " +
+                  missingFields(missing));
+    CloudFileMetadata file;
+    file.uuid = std::move(item.uuid);
+    file.filename = std::move(item.filename);
+    file.path = "/"; // Fallback
+    if ((item.seen & bit(Field::Device)) &&
+        (item.seen & bit(Field::Directory))) {
+      if (item.device == "/")
+        file.path = "/";
+      else if (item.directory == "/")
+        file.path = "/" + item.device;
+      else
+        file.path = "/" + item.device + "/" + item.directory;
+    }
+    file.origin = std::move(item.origin);
+    file.hashvalue = std::move(item.checksum);
+    file.size = item.size;
+    file.last_modified = std::move(item.mtime);
+    file.versions = item.version;
+    file.conflictId = std::move(item.conflictId);
+    m_onFile(std::move(file));
+  } else {
+    if (uint32_t missing = kFolderFields & ~item.seen)
+      return fail("item " + std::to_string(m_items - 1) + " lacks " +
+                  missingFields(missing));
+    CloudFolderMetadata folder;
+    folder.uuid = std::move(item.uuid);
+    folder.device = std::move(item.device);
+    folder.folder = std::move(item.folder);
+    folder.path = std::move(item.path);
+    folder.created_at = std::move(item.createdAt);
+    m_onFolder(std::move(folder));
+  }
+  return true;
+}
+
+} // namespace sync
@@ -1,4 +1,5 @@
 #include "SyncWorker.hpp"
+#include "ContentHashIndex.hpp"
 #include "UuidUtils.hpp"
 #include "picosha2.h"
 #include <filesystem>
@@ -11,9 +12,12 @@ namespace sync {
 
 SyncWorker::SyncWorker(DatabaseManager &dbManager, FileSystemScanner &scanner,
                        const std::string &syncPath)
-    : m_dbManager(dbManager), m_scanner(scanner), m_syncPath(syncPath) {}
+    : m_dbManager(dbManager), m_scanner(scanner), m_syncPath(syncPath),
+      m_batch(dbManager) {}
 SyncWorker::~SyncWorker() = default;
 
+bool SyncWorker::flush() { return m_batch.flush(); }
+
 void SyncWorker::handleAdded(const std::string &path) {
   std::string type;
   if (std::filesystem::is_directory(path))
@@ -24,7 +28,7 @@ void SyncWorker::handleAdded(const std::string &path) {
     std::filesystem::path p(path);
     std::string relPath = m_scanner.toRelativePath(path);
     std::string filename = p.filename().generic_string();
-    auto file = m_dbManager.getFileByPath(relPath, filename);
+    auto file = m_batch.getFileByPath(relPath, filename);
     if (!file.has_value()) {
       FileMetadata f;
       FileQueueEntry fq;
@@ -48,9 +52,41 @@ void SyncWorker::handleAdded(const std::string &path) {
       f.absPath = path;
       f.versions = 1;
       f.lastSyncedHashValue = f.hashvalue;
+
+      // Content the server already holds is moved (a pending delete has the
+      // same hash) or copied server side instead of uploaded again
+      std::optional<ContentHashEntry> moveSource;
+      std::optional<ContentHashEntry> copySource;
+      if (f.size > 0) {
+        ContentHashIndex hashIndex;
+        if (auto deletes = m_batch.getQueuedDeletesByHash(f.hashvalue)) {
+          for (const auto &q : *deletes)
+            hashIndex.addQueuedDelete(q);
+        }
+        if (auto copies = m_batch.getSyncedFilesByHash(f.hashvalue)) {
+          for (const auto &c : *copies)
+            hashIndex.add(c);
+        }
+        for (const auto &candidate : hashIndex.find(f.hashvalue, filename)) {
+          if (candidate.queuedDelete) {
+            moveSource = candidate;
+            break;
+          }
+          if (!copySource)
+            copySource = candidate;
+        }
+        if (moveSource)
+          copySource.reset();
+      }
+      if (moveSource.has_value()) {
+        f.uuid = moveSource->uuid;
+        f.origin = moveSource->origin;
+        f.versions = moveSource->versions;
+        f.lastSyncedHashValue = moveSource->lastSyncedHashValue;
+      }
       pathParts part = m_dbManager.getFolderDevice(fs::path(relPath));
       auto dir =
-          m_dbManager.getDirectoryByPath(part.device, part.folder, f.path);
+          m_batch.getDirectoryByPath(part.device, part.folder, f.path);
       if (dir.has_value()) {
         f.dirID = dir->uuid;
       } else {
@@ -68,16 +104,32 @@ void SyncWorker::handleAdded(const std::string &path) {
         dq = DirectoryMetadata(d);
         dq.old_path = d.path;
         dq.sync_status = "FILE_LINKED";
-        m_dbManager.insertDirectory(d, dq);
-        // m_dbManager.insertDirectoryQueue(dq);
-        f.dirID = d.uuid;
+        // Checked again under the batch lock: another shard may have
+        // linked the folder for a sibling file meanwhile
+        f.dirID = m_batch.getOrInsertDirectory(d, dq).first.uuid;
       }
       fq = FileMetadata(f);
       fq.old_filename = f.filename;
       fq.old_path = f.path;
       fq.sync_status = "new";
+      if (moveSource.has_value()) {
+        std::cout << "[syncworker] move detected from " << moveSource->path
+                  << "/" << moveSource->filename << std::endl;
+        fq.old_filename = moveSource->filename;
+        fq.old_path = moveSource->path;
+        fq.sync_status = "rename";
+      } else if (copySource.has_value()) {
+        std::cout << "[syncworker] copy detected from " << copySource->path
+                  << "/" << copySource->filename << std::endl;
+        fq.old_filename = copySource->filename;
+        fq.old_path = copySource->path;
+        fq.sync_status = "copy";
+      }
       f.conflictId = "";
-      m_dbManager.insertFile(f, fq);
+      if (moveSource.has_value())
+        m_batch.moveFile(moveSource->path, moveSource->filename, f, fq);
+      else
+        m_batch.insertFile(f, fq);
       //      m_dbManager.insertFileQueue(fq);
     } else {
       std::cout << "[syncworker] File Exists in the DB skipping";
@@ -96,18 +148,16 @@ void SyncWorker::handleAdded(const std::string &path) {
     d.inode = m_scanner.getInode(path);
     auto ftime = fs::last_write_time(path);
     d.created_at = std::to_string(m_scanner.getUnixTimeStamp(ftime));
-    auto existingDir =
-        m_dbManager.getDirectoryByPath(part.device, part.folder, path);
-    if (existingDir.has_value()) {
-      d.uuid = existingDir->uuid;
-    } else {
-      d.uuid = UuidUtils::generate();
-    }
+    d.uuid = UuidUtils::generate();
     dq = DirectoryMetadata(d);
     dq.sync_status = "new";
     dq.old_path = d.path;
-    //  m_dbManager.insertDirectoryQueue(dq);
-    m_dbManager.insertDirectory(d, dq);
+    if (!m_batch.getOrInsertDirectory(d, dq).second) {
+      // Already known: a folder that came along with a moved parent, one
+      // we created ourselves, or one a file inside it linked first
+      std::cout << "[syncworker] Folder exists in the DB skipping: " << d.path
+                << std::endl;
+    }
   }
 };
 void SyncWorker::handleDeleted(const std::string &path) {
@@ -117,22 +167,29 @@ void SyncWorker::handleDeleted(const std::string &path) {
   relPath = m_scanner.normalizePathSeparators(relPath);
   pathParts p = m_dbManager.getFolderDevice(fs::path(relPath));
   auto existingDir =
-      m_dbManager.getDirectoryByPath(p.device, p.folder, relPath);
+      m_batch.getDirectoryByPath(p.device, p.folder, relPath);
   if (existingDir.has_value()) {
     DirectoryQueueEntry dq(*existingDir);
     dq.sync_status = "delete";
     dq.old_path = dq.path;
+    // Subtree writes go straight to the DB, after what is pending
+    m_batch.flush();
     m_dbManager.deleteFolderWithTransaction(relPath, dq);
   } else {
     std::string filePath = fs::path(relPath).parent_path().generic_string();
     std::string filename = fs::path(relPath).filename().generic_string();
-    auto existingFile = m_dbManager.getFileByPath(filePath, filename);
-    if (existingFile.has_value()) {
+    auto existingFile = m_batch.getFileByPath(filePath, filename);
+    auto pending = m_batch.getFileQueueByPath(filePath, filename);
+    if (existingFile.has_value() && pending && pending->notYetUploaded()) {
+      // Gone before it was uploaded: a delete row would carry content the
+      // server never had and could pose as the source of a later move
+      m_batch.forgetFile(filePath, filename);
+    } else if (existingFile.has_value()) {
       FileQueueEntry fq(*existingFile);
       fq.old_path = fq.path;
       fq.old_filename = fq.filename;
       fq.sync_status = "delete";
-      m_dbManager.deleteFile(existingFile->path, existingFile->filename, fq);
+      m_batch.deleteFile(existingFile->path, existingFile->filename, fq);
       //      m_dbManager.insertFileQueue(fq);
     }
   }
@@ -152,7 +209,7 @@ void SyncWorker::handleRenamed(const std::string &path,
     pathParts o = m_dbManager.getFolderDevice(fs::path(oldRelPath));
     pathParts n = m_dbManager.getFolderDevice(fs::path(relPath));
     auto existingDir =
-        m_dbManager.getDirectoryByPath(o.device, o.folder, oldRelPath);
+        m_batch.getDirectoryByPath(o.device, o.folder, oldRelPath);
     if (existingDir.has_value()) {
       DirectoryQueueEntry dq(*existingDir);
       dq.sync_status = "rename";
@@ -161,6 +218,7 @@ void SyncWorker::handleRenamed(const std::string &path,
       dq.absPath = path;
       dq.device = n.device;
       dq.folder = n.folder;
+      m_batch.flush();
       m_dbManager.moveDirectory(relPath, oldRelPath, dq);
     } else {
       std::cout << "[syncworker] old folder name not found in DB. It has to be "
@@ -178,8 +236,13 @@ void SyncWorker::handleRenamed(const std::string &path,
     oldRelPath = m_scanner.normalizePathSeparators(oldRelPath);
     std::string filename = p.filename().generic_string();
     std::string oldFileName = op.filename().generic_string();
-    auto file = m_dbManager.getFileByPath(oldRelPath, oldFileName);
-    if (file.has_value()) {
+    auto file = m_batch.getFileByPath(oldRelPath, oldFileName);
+    auto pending = m_batch.getFileQueueByPath(oldRelPath, oldFileName);
+    if (file.has_value() && pending && pending->notYetUploaded()) {
+      // Nothing to rename on the server; upload it from where it is now
+      m_batch.forgetFile(oldRelPath, oldFileName);
+      handleAdded(path);
+    } else if (file.has_value()) {
       FileMetadata f;
       FileQueueEntry fq;
       std::ifstream fi(path, std::ios::binary);
@@ -205,7 +268,7 @@ void SyncWorker::handleRenamed(const std::string &path,
       f.lastSyncedHashValue = file->lastSyncedHashValue;
       pathParts part = m_dbManager.getFolderDevice(fs::path(relPath));
       auto dir =
-          m_dbManager.getDirectoryByPath(part.device, part.folder, f.path);
+          m_batch.getDirectoryByPath(part.device, part.folder, f.path);
       if (dir.has_value()) {
         f.dirID = dir->uuid;
       } else {
@@ -223,20 +286,14 @@ void SyncWorker::handleRenamed(const std::string &path,
         dq = DirectoryMetadata(d);
         dq.old_path = d.path;
         dq.sync_status = "FILE_LINKED";
-        auto dirCreateResult = m_dbManager.insertDirectory(d, dq);
-        //        auto dirQueueCreateResult =
-        //        m_dbManager.insertDirectoryQueue(dq);
-        if (dirCreateResult)
-          f.dirID = d.uuid;
-        else
-          return;
+        f.dirID = m_batch.getOrInsertDirectory(d, dq).first.uuid;
       }
       fq = FileMetadata(f);
       fq.old_filename = oldFileName;
       fq.old_path = oldRelPath;
       fq.sync_status = "rename";
       f.conflictId = "";
-      m_dbManager.insertFile(f, fq);
+      m_batch.insertFile(f, fq);
       //      m_dbManager.insertFileQueue(fq);
     } else {
       std::cout << "[syncworker] oldFileName does not exist in the DB needs to "
@@ -252,38 +309,77 @@ void SyncWorker::handleModified(const std::string &path) {
   if (!fs::is_directory(path)) {
     FileMetadata f;
     FileQueueEntry fq;
+    f.filename = fs::path(path).filename().generic_string();
+    f.path = m_scanner.toRelativePath(path);
+    auto existingFile = m_batch.getFileByPath(f.path, f.filename);
+    if (!existingFile.has_value())
+      return;
+
+    // Fast reject: attribute-only changes and spurious events leave size,
+    // mtime and inode as stored, so skip the read entirely. An mtime within
+    // the last couple of seconds may hide a second write in the same
+    // (whole second) timestamp, so those are always hashed.
+    std::error_code sizeError;
+    std::error_code mtimeError;
+    auto size = fs::file_size(path, sizeError);
+    auto mtime = fs::last_write_time(path, mtimeError);
+    if (sizeError || mtimeError) {
+      std::cerr << "[syncworker] Error reading file: " << path << std::endl;
+      return;
+    }
+    std::int64_t unixMTime = m_scanner.getUnixTimeStamp(mtime);
+    std::string inode = m_scanner.getInode(path);
+    std::int64_t now = m_scanner.getUnixTimeStamp(
+        fs::file_time_type::clock::now());
+    if (static_cast<int64_t>(size) == existingFile->size &&
+        std::to_string(unixMTime) == existingFile->last_modified &&
+        inode == existingFile->inode && now - unixMTime > 2) {
+      return;
+    }
+
     std::ifstream fi(path, std::ios::binary);
     if (!fi.is_open()) {
       std::cerr << "[syncworker] Error reading file: " << path << std::endl;
       return;
     }
-    f.filename = fs::path(path).filename().generic_string();
-    f.path = m_scanner.toRelativePath(path);
+    std::vector<unsigned char> hash(picosha2::k_digest_size);
+    picosha2::hash256(fi, hash.begin(), hash.end());
+    f.hashvalue = picosha2::bytes_to_hex_string(hash.begin(), hash.end());
+    // Same content (touch, rewrite with identical bytes): nothing to sync,
+    // but the new stat lets the fast reject catch the next such event
+    if (f.hashvalue == existingFile->hashvalue) {
+      FileMetadata touched = *existingFile;
+      touched.last_modified = std::to_string(unixMTime);
+      touched.inode = inode;
+      touched.absPath = path;
+      m_batch.updateFile(touched);
+      return;
+    }
+
     std::cout << "[syncworker] fileModified path " << f.path << "/"
               << f.filename << std::endl;
-    auto existingFile = m_dbManager.getFileByPath(f.path, f.filename);
-    if (existingFile.has_value()) {
-      std::vector<unsigned char> hash(picosha2::k_digest_size);
-      picosha2::hash256(fi, hash.begin(), hash.end());
-      f.absPath = path;
-      f.inode = m_scanner.getInode(path);
-      f.hashvalue = picosha2::bytes_to_hex_string(hash.begin(), hash.end());
-      f.lastSyncedHashValue = existingFile->lastSyncedHashValue;
-      f.origin = existingFile->origin;
-      f.uuid = UuidUtils::generate();
-      f.last_modified =
-          std::to_string(m_scanner.getUnixTimeStamp(fs::last_write_time(path)));
-      f.versions = existingFile->versions + 1;
-      f.size = fs::file_size(path);
-      f.dirID = existingFile->dirID;
-      fq = FileMetadata(f);
-      fq.sync_status = "modified";
-      fq.old_path = f.path;
-      fq.old_filename = f.filename;
-      f.conflictId = "";
-      m_dbManager.insertFile(f, fq);
-      //      m_dbManager.upsertFileQueue(fq);
-    }
+    // Changed before its upload: still a new file, whose content is only
+    // on the server once that upload is done
+    auto pending = m_batch.getFileQueueByPath(f.path, f.filename);
+    bool notYetUploaded = pending && pending->notYetUploaded();
+    f.absPath = path;
+    f.inode = inode;
+    f.lastSyncedHashValue = notYetUploaded ? f.hashvalue
+                                           : existingFile->lastSyncedHashValue;
+    f.origin = existingFile->origin;
+    f.uuid = notYetUploaded ? existingFile->uuid : UuidUtils::generate();
+    f.last_modified = std::to_string(unixMTime);
+    f.versions = notYetUploaded ? existingFile->versions
+                                : existingFile->versions + 1;
+    f.size = size;
+    f.dirID = existingFile->dirID;
+    fq = FileMetadata(f);
+    fq.sync_status = notYetUploaded ? "new" : "modified";
+    fq.old_path = f.path;
+    fq.old_filename = f.filename;
+    f.conflictId = "";
+    m_batch.insertFile(f, fq);
+    //      m_dbManager.upsertFileQueue(fq);
   }
 };
 
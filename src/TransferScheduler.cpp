@@ -0,0 +1,82 @@
+#include "TransferScheduler.hpp"
+#include <algorithm>
+#include <tuple>
+
+namespace sync {
+
+TransferScheduler::Lease::Lease(Lease &&other) noexcept
+    : m_owner(other.m_owner), m_slot(other.m_slot),
+      m_endpoint(std::move(other.m_endpoint)) {
+  other.m_owner = nullptr;
+}
+
+TransferScheduler::Lease::~Lease() {
+  if (m_owner)
+    m_owner->release(m_slot, m_endpoint);
+}
+
+bool TransferScheduler::WaiterOrder::operator()(const Waiter *a,
+                                                const Waiter *b) const {
+  return std::tie(a->request.cls, a->request.size, a->seq) <
+         std::tie(b->request.cls, b->request.size, b->seq);
+}
+
+TransferScheduler::TransferScheduler(TransferSchedulerOptions options)
+    : m_options(std::move(options)) {
+  m_options.connections = std::max<size_t>(m_options.connections, 1);
+  // Popped from the back, so slot 0 (the warmest connection) goes first
+  for (size_t i = m_options.connections; i-- > 0;)
+    m_freeSlots.push_back(i);
+}
+
+void TransferScheduler::dispatchLocked() {
+  for (auto it = m_waiting.begin();
+       it != m_waiting.end() && !m_freeSlots.empty();) {
+    Waiter *waiter = *it;
+    const std::string &endpoint = waiter->request.endpoint;
+    auto cap = m_options.endpointCaps.find(endpoint);
+    if (cap != m_options.endpointCaps.end() &&
+        m_running[endpoint] >= cap->second) {
+      ++it;
+      continue;
+    }
+    waiter->slot = m_freeSlots.back();
+    waiter->granted = true;
+    m_freeSlots.pop_back();
+    m_running[endpoint]++;
+    it = m_waiting.erase(it);
+  }
+}
+
+TransferScheduler::Lease
+TransferScheduler::acquire(const TransferRequest &request) {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  Waiter waiter{request, m_nextSeq++};
+  m_waiting.insert(&waiter);
+  dispatchLocked();
+  m_cv.wait(lock, [&] { return waiter.granted; });
+  return Lease(this, waiter.slot, request.endpoint);
+}
+
+void TransferScheduler::release(size_t slot, const std::string &endpoint) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_freeSlots.push_back(slot);
+    if (--m_running[endpoint] == 0)
+      m_running.erase(endpoint);
+    m_completed++;
+    dispatchLocked();
+  }
+  m_cv.notify_all();
+}
+
+TransferStats TransferScheduler::stats() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  TransferStats stats;
+  stats.queued = m_waiting.size();
+  stats.inFlight = m_options.connections - m_freeSlots.size();
+  stats.completed = m_completed;
+  return stats;
+}
+
+} // namespace sync
@@ -0,0 +1,238 @@
+#include "WriteBatch.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace sync {
+
+WriteBatch::WriteBatch(DatabaseManager &db, WriteBatchOptions options)
+    : m_db(db), m_options(options) {
+  m_flusher = std::thread(&WriteBatch::flusherLoop, this);
+}
+
+WriteBatch::~WriteBatch() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_running = false;
+  }
+  m_cv.notify_all();
+  if (m_flusher.joinable())
+    m_flusher.join();
+}
+
+// Lookups hold the batch lock across the DB read, so a flush can never
+// fall between the two and hide a write from both
+std::optional<FileMetadata>
+WriteBatch::getFileByPath(const std::string &path,
+                          const std::string &filename) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_files.find({path, filename});
+  if (it != m_files.end())
+    return it->second;
+  return m_db.getFileByPath(path, filename);
+}
+
+std::optional<DirectoryMetadata>
+WriteBatch::getDirectoryByPath(const std::string &device,
+                               const std::string &folder,
+                               const std::string &path) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_dirs.find({device, folder, path});
+  if (it != m_dirs.end())
+    return it->second;
+  return m_db.getDirectoryByPath(device, folder, path);
+}
+
+std::optional<std::vector<FileMetadata>>
+WriteBatch::getSyncedFilesByHash(const std::string &hash) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto rows = m_db.getSyncedFilesByHash(hash);
+  if (!rows)
+    return rows;
+  // Rows the batch replaced, removed or queued are answered from the batch
+  auto queued = [&](const FileKey &key) {
+    auto it = m_fileQueue.find(key);
+    return it != m_fileQueue.end() && it->second.has_value();
+  };
+  std::erase_if(*rows, [&](const FileMetadata &f) {
+    return m_files.count({f.path, f.filename}) > 0 ||
+           queued({f.path, f.filename});
+  });
+  for (const auto &[key, file] : m_files) {
+    if (file && file->lastSyncedHashValue == hash && !queued(key))
+      rows->push_back(*file);
+  }
+  std::sort(rows->begin(), rows->end(),
+            [](const FileMetadata &a, const FileMetadata &b) {
+              return std::tie(a.path, a.filename) <
+                     std::tie(b.path, b.filename);
+            });
+  return rows;
+}
+
+std::optional<std::vector<FileQueueEntry>>
+WriteBatch::getQueuedDeletesByHash(const std::string &hash) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto rows = m_db.getQueuedDeletesByHash(hash);
+  if (!rows)
+    return rows;
+  std::erase_if(*rows, [&](const FileQueueEntry &q) {
+    return m_fileQueue.count({q.path, q.filename}) > 0;
+  });
+  for (const auto &[key, entry] : m_fileQueue) {
+    if (entry && entry->sync_status == "delete" &&
+        entry->lastSyncedHashValue == hash)
+      rows->push_back(*entry);
+  }
+  std::sort(rows->begin(), rows->end(),
+            [](const FileQueueEntry &a, const FileQueueEntry &b) {
+              return std::tie(a.path, a.filename) <
+                     std::tie(b.path, b.filename);
+            });
+  return rows;
+}
+
+std::optional<FileQueueEntry>
+WriteBatch::getFileQueueByPath(const std::string &path,
+                               const std::string &filename) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_fileQueue.find({path, filename});
+  if (it != m_fileQueue.end())
+    return it->second;
+  return m_db.getFileQueueByPath(path, filename);
+}
+
+void WriteBatch::insertFile(const FileMetadata &file,
+                            const FileQueueEntry &fileQueue) {
+  add({.kind = BatchOp::Kind::InsertFile,
+       .file = file,
+       .fileQueue = fileQueue});
+}
+
+void WriteBatch::updateFile(const FileMetadata &file) {
+  add({.kind = BatchOp::Kind::UpdateFile, .file = file});
+}
+
+void WriteBatch::deleteFile(const std::string &path,
+                            const std::string &filename,
+                            const FileQueueEntry &fq) {
+  BatchOp op{.kind = BatchOp::Kind::DeleteFile, .fileQueue = fq};
+  op.file.path = path;
+  op.file.filename = filename;
+  add(std::move(op));
+}
+
+void WriteBatch::forgetFile(const std::string &path,
+                            const std::string &filename) {
+  BatchOp op{.kind = BatchOp::Kind::ForgetFile};
+  op.file.path = path;
+  op.file.filename = filename;
+  add(std::move(op));
+}
+
+void WriteBatch::moveFile(const std::string &oldPath,
+                          const std::string &oldFilename,
+                          const FileMetadata &file,
+                          const FileQueueEntry &fileQueue) {
+  add({.kind = BatchOp::Kind::MoveFile,
+       .file = file,
+       .fileQueue = fileQueue,
+       .oldPath = oldPath,
+       .oldFilename = oldFilename});
+}
+
+void WriteBatch::insertDirectory(const DirectoryMetadata &dir,
+                                 const DirectoryQueueEntry &dirQueue) {
+  add({.kind = BatchOp::Kind::InsertDirectory,
+       .dir = dir,
+       .dirQueue = dirQueue});
+}
+
+std::pair<DirectoryMetadata, bool>
+WriteBatch::getOrInsertDirectory(const DirectoryMetadata &dir,
+                                 const DirectoryQueueEntry &dirQueue) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  auto it = m_dirs.find({dir.device, dir.folder, dir.path});
+  if (it != m_dirs.end())
+    return {it->second, false};
+  auto existing = m_db.getDirectoryByPath(dir.device, dir.folder, dir.path);
+  if (existing)
+    return {*existing, false};
+  addLocked({.kind = BatchOp::Kind::InsertDirectory,
+             .dir = dir,
+             .dirQueue = dirQueue});
+  return {dir, true};
+}
+
+void WriteBatch::add(BatchOp op) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  addLocked(std::move(op));
+}
+
+void WriteBatch::addLocked(BatchOp op) {
+  switch (op.kind) {
+  case BatchOp::Kind::InsertFile:
+    m_files[{op.file.path, op.file.filename}] = op.file;
+    m_fileQueue[{op.fileQueue.path, op.fileQueue.filename}] = op.fileQueue;
+    break;
+  case BatchOp::Kind::UpdateFile:
+    m_files[{op.file.path, op.file.filename}] = op.file;
+    break;
+  case BatchOp::Kind::DeleteFile:
+    m_files[{op.file.path, op.file.filename}] = std::nullopt;
+    m_fileQueue[{op.fileQueue.path, op.fileQueue.filename}] = op.fileQueue;
+    break;
+  case BatchOp::Kind::ForgetFile:
+    m_files[{op.file.path, op.file.filename}] = std::nullopt;
+    m_fileQueue[{op.file.path, op.file.filename}] = std::nullopt;
+    break;
+  case BatchOp::Kind::MoveFile:
+    m_files[{op.oldPath, op.oldFilename}] = std::nullopt;
+    m_fileQueue[{op.oldPath, op.oldFilename}] = std::nullopt;
+    m_files[{op.file.path, op.file.filename}] = op.file;
+    m_fileQueue[{op.fileQueue.path, op.fileQueue.filename}] = op.fileQueue;
+    break;
+  case BatchOp::Kind::InsertDirectory:
+    m_dirs[{op.dir.device, op.dir.folder, op.dir.path}] = op.dir;
+    break;
+  }
+  if (m_ops.empty()) {
+    m_firstOp = std::chrono::steady_clock::now();
+    m_cv.notify_one();
+  }
+  m_ops.push_back(std::move(op));
+  // A full batch is committed by the writer that filled it
+  if (m_ops.size() >= m_options.maxOps)
+    flushLocked();
+}
+
+bool WriteBatch::flush() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return flushLocked();
+}
+
+bool WriteBatch::flushLocked() {
+  if (m_ops.empty())
+    return true;
+  bool ok = m_db.applyBatch(m_ops);
+  m_ops.clear();
+  m_files.clear();
+  m_fileQueue.clear();
+  m_dirs.clear();
+  return ok;
+}
+
+void WriteBatch::flusherLoop() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (m_running) {
+    if (m_ops.empty())
+      m_cv.wait(lock);
+    else
+      m_cv.wait_until(lock, m_firstOp + m_options.maxDelay);
+    if (!m_ops.empty() &&
+        std::chrono::steady_clock::now() >= m_firstOp + m_options.maxDelay)
+      flushLocked();
+  }
+  flushLocked();
+}
+
+} // namespace sync
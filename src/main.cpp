@@ -1,7 +1,10 @@
 #include "ApiClient.hpp"
 #include "DatabaseManager.hpp"
+#include "EchoRegistry.hpp"
+#include "EventPipeline.hpp"
 #include "FileSystemScanner.hpp"
 #include "FilesystemWatcher.hpp"
+#include "PlanExecutor.hpp"
 #include "ReconciliationService.hpp"
 #include "SyncWorker.hpp"
 #include <atomic>
@@ -57,60 +60,108 @@ int main() {
     sync::ReconciliationService reconciliationService(dbManager, syncFolder);
     sync::FileSystemScanner scanner(syncFolder);
     sync::SyncWorker syncworker(dbManager, scanner, syncFolder);
+    // Changes the client makes itself are not synced back
+    sync::EchoRegistry echoes(syncFolder);
     std::cout << "[Main] Database initialized." << std::endl;
     std::cout << "[Main] API Client initialized." << std::endl;
 
     // 2. Initial Scan & Local Reconciliation
     std::cout << "[Main] Performing initial filesystem scan..." << std::endl;
-    sync::ScanResult scanResult = scanner.scanSyncPath(syncFolder);
-    reconciliationService.reconcileLocalState(scanResult.files,
-                                              scanResult.directories);
+    sync::LocalScanTable scanTable = scanner.scanSyncPathCompact(syncFolder);
+    std::cout << "[Main] Scanned " << scanTable.fileCount() << " files ("
+              << scanTable.memoryUsage() / 1024 << " KiB)." << std::endl;
+    reconciliationService.reconcileLocalState(scanTable);
     std::cout
         << "[Main] Initial filesystem scan and local reconciliation complete."
         << std::endl;
 
-    // 3. Initialize Watcher
+    // 3. Event pipeline: watcher threads only enqueue, workers do the
+    // hashing and DB work
+    sync::EventPipeline pipeline([&syncworker, &reconciliationService](
+                                     const sync::PipelineEvent &event) {
+      std::string eventStr;
+      switch (event.type) {
+      case sync::WatchEvent::Added:
+        eventStr = "Added";
+        std::cout << "[Watcher] Event: " << eventStr << " on " << event.path
+                  << std::endl;
+        syncworker.handleAdded(event.path);
+        break;
+      case sync::WatchEvent::Modified:
+        eventStr = "Modified";
+        std::cout << "[Watcher] Event: " << eventStr << " on " << event.path
+                  << std::endl;
+        syncworker.handleModified(event.path);
+        break;
+      case sync::WatchEvent::Deleted:
+        eventStr = "Deleted";
+        std::cout << "[Watcher] Event: " << eventStr << " on " << event.path
+                  << std::endl;
+        syncworker.handleDeleted(event.path);
+        break;
+      case sync::WatchEvent::Moved:
+        eventStr = "Moved";
+        std::cout << "[Watcher] Event: " << eventStr << " on " << event.path
+                  << std::endl;
+        syncworker.handleRenamed(event.path, event.oldPath);
+        break;
+      case sync::WatchEvent::Rescan:
+        eventStr = "Rescan";
+        std::cout << "[Watcher] Event: " << eventStr << " on " << event.path
+                  << std::endl;
+        syncworker.flush();
+        reconciliationService.reconcileSubtree(event.path);
+        break;
+      }
+    });
+    // Dropped events are recovered by reconciling a fresh scan
+    pipeline.setOverflowHandler([&]() {
+      syncworker.flush();
+      reconciliationService.reconcileLocalState(
+          scanner.scanSyncPathCompact(syncFolder));
+    });
+    pipeline.start();
+
+    // 4. Initialize Watcher
     sync::FilesystemWatcher watcher(
-        syncFolder, [&reconciliationService, &syncworker](
-                        const std::string &path, const std::string &oldPath,
-                        sync::WatchEvent event) {
-          std::string eventStr;
-          switch (event) {
-          case sync::WatchEvent::Added:
-            eventStr = "Added";
-            std::cout << "[Watcher] Event: " << eventStr << " on " << path
-                      << std::endl;
-            syncworker.handleAdded(path);
-            break;
-          case sync::WatchEvent::Modified:
-            eventStr = "Modified";
-            std::cout << "[Watcher] Event: " << eventStr << " on " << path
-                      << std::endl;
-            syncworker.handleModified(path);
-            break;
-          case sync::WatchEvent::Deleted:
-            eventStr = "Deleted";
-            std::cout << "[Watcher] Event: " << eventStr << " on " << path
-                      << std::endl;
-            syncworker.handleDeleted(path);
-            break;
-          case sync::WatchEvent::Moved:
-            eventStr = "Moved";
-            std::cout << "[Watcher] Event: " << eventStr << " on " << path
-                      << std::endl;
-            syncworker.handleRenamed(path, oldPath);
-            break;
-          }
+        syncFolder,
+        [&pipeline, &echoes](const std::string &path,
+                             const std::string &oldPath,
+                             sync::WatchEvent event) {
+          if (echoes.isEcho(path, oldPath, event))
+            return;
+          pipeline.submit(path, oldPath, event);
         });
     watcher.start();
 
     // 5. Test API GetMetadata
     std::cout << "[Main] Fetching cloud metadata..." << std::endl;
-    auto result = apiClient.getMetadata();
-    if (result && result->success) {
-      std::cout << "[Main] Found " << result->files.size() << " files and "
-                << result->directories.size() << " directories in cloud."
-                << std::endl;
+    auto result = apiClient.getMetadataCompact();
+    if (result) {
+      std::cout << "[Main] Found " << result->fileCount() << " files and "
+                << result->folders().size() << " directories in cloud ("
+                << result->memoryUsage() / 1024 << " KiB)." << std::endl;
+
+      // 6. Reconcile cloud state and apply the plan locally
+      auto dbFiles = dbManager.getAllFiles();
+      auto dbDirs = dbManager.getAllDirectories();
+      if (dbFiles && dbDirs) {
+        sync::ReconciliationResult plan = reconciliationService.reconcile(
+            *result, *dbFiles, *dbDirs);
+        sync::PlanExecutor executor(apiClient, dbManager, syncFolder);
+        executor.setEchoRegistry(&echoes);
+        executor.execute(plan, [&apiClient](const sync::PlanProgress &p) {
+          size_t done = p.completed + p.failed + p.skipped;
+          if (done % 100 == 0 || done == p.total) {
+            auto transfers = apiClient.transferStats();
+            std::cout << "[Main] Plan progress: " << done << "/" << p.total
+                      << " (" << p.failed << " failed, " << p.inFlight
+                      << " in flight; " << transfers.queued
+                      << " requests queued, " << transfers.inFlight
+                      << " on the wire)" << std::endl;
+          }
+        });
+      }
     }
 
     std::cout << "[Main] Running. Monitoring: " << syncFolder << std::endl;
@@ -125,6 +176,7 @@ int main() {
     }
 
     watcher.stop();
+    pipeline.stop();
     dbManager.close();
     std::cout << "[Main] Finished." << std::endl;
 
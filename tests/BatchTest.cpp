@@ -0,0 +1,106 @@
+#include "ApiClient.hpp"
+#include "TestSupport.hpp"
+#include "httplib.h"
+#include <algorithm>
+#include <thread>
+
+using namespace sync;
+using namespace sync::test;
+namespace fs = std::filesystem;
+
+namespace {
+
+DirectoryMetadata folder(const std::string &path) {
+  DirectoryMetadata dir;
+  dir.uuid = "uuid" + path;
+  dir.device = "device";
+  dir.path = path;
+  dir.folder = fs::path(path).filename().string();
+  return dir;
+}
+
+#ifndef _WIN32
+std::vector<std::string> cloudFolders(ApiClient &api) {
+  std::vector<std::string> paths;
+  if (auto listing = api.getMetadata())
+    for (const auto &dir : listing->directories)
+      paths.push_back(dir.path);
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+// Each item is settled on its own: the bad path fails, the rest go through
+void createAndDeleteFolders(ApiClient &api) {
+  std::vector<DirectoryMetadata> dirs = {folder("/device/a"), folder("bad"),
+                                         folder("/device/b")};
+  CHECK((api.createFolders(dirs) == std::vector<bool>{true, false, true}));
+  CHECK((cloudFolders(api) ==
+         std::vector<std::string>{"/device/a", "/device/b"}));
+
+  std::vector<DirectoryMetadata> gone = {folder("/device/a"),
+                                         folder("/device/missing")};
+  CHECK((api.deleteFolders(gone) == std::vector<bool>{true, false}));
+  CHECK((cloudFolders(api) == std::vector<std::string>{"/device/b"}));
+}
+#endif
+
+} // namespace
+
+#ifndef _WIN32
+SYNC_TEST(batchSettlesEachItem) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server");
+  ApiClient api(server.url(), "test@example.com");
+  createAndDeleteFolders(api);
+}
+
+// Same results from the one-item endpoints of a server without batches
+SYNC_TEST(batchFallsBackToSingleItems) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server", {"--no-batch"});
+  ApiClient api(server.url(), "test@example.com");
+  createAndDeleteFolders(api);
+}
+#endif
+
+// Only a reply that accounts for every item, or a plain 200, settles
+// items as done; anything else must fail them all
+SYNC_TEST(batchDistrustsUnreadableReplies) {
+  std::string reply;
+  httplib::Server server;
+  server.Post("/createFolders",
+              [&](const httplib::Request &, httplib::Response &res) {
+                res.set_content(reply, "application/json");
+              });
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&] { server.listen_after_bind(); });
+  server.wait_until_ready();
+
+  ApiClient api("http://127.0.0.1:" + std::to_string(port),
+                "test@example.com", {}, RetryOptions{.maxAttempts = 1});
+  std::vector<DirectoryMetadata> dirs = {folder("/device/a"),
+                                         folder("/device/b")};
+  const std::vector<bool> none = {false, false};
+  const std::vector<bool> all = {true, true};
+  const std::vector<std::pair<std::string, std::vector<bool>>> cases = {
+      {"", all},
+      {"{}", all},
+      {R"({"results": [{"ok": true}, {"ok": false}]})", {true, false}},
+      {"[]", none},
+      {"not json", none},
+      {R"({"results": [{"ok": true}]})", none},
+      {R"({"results": {"ok": true}})", none},
+  };
+  for (const auto &[body, expected] : cases) {
+    reply = body;
+    if (api.createFolders(dirs) != expected) {
+      server.stop();
+      listener.join();
+      fail(__FILE__, __LINE__, "reply " + body);
+    }
+  }
+  server.stop();
+  listener.join();
+}
@@ -0,0 +1,82 @@
+#include "ChunkedUploader.hpp"
+#include "TestSupport.hpp"
+#include <iostream>
+
+using namespace sync;
+using namespace sync::test;
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int64_t kPartSize = 64 * 1024;
+
+ChunkedUploadOptions smallParts() {
+  ChunkedUploadOptions options;
+  options.partSize = kPartSize;
+  options.parallelParts = 1;
+  options.minSize = 0;
+  return options;
+}
+
+} // namespace
+
+// An upload cut short by a failing part resumes at the first missing one.
+// With --fail-every 4 at most three parts get through per attempt, so the
+// file only completes if no attempt starts over.
+SYNC_TEST(chunkedUploadResumes) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server",
+                          {"--fail-every", "4"});
+  DatabaseManager db((dir.path() / "sync.db").string(), dir.path().string());
+  CHECK(db.open());
+  db.initializeSchema();
+  ApiClient api(server.url(), "test@example.com", {},
+                RetryOptions{.maxAttempts = 1});
+  ChunkedUploader uploader(api, db, smallParts());
+  auto file = writeQueuedFile(dir.path() / "big.bin", "/device/folder",
+                              12 * kPartSize + 100, 1);
+
+  std::optional<std::string> id;
+  int attempts = 0;
+  while (!id && attempts < 10) {
+    id = uploader.upload(file, {});
+    ++attempts;
+    // Kept for the next attempt
+    CHECK(id || db.getUploadSession(file.origin));
+  }
+  std::cout << "[Test] Uploaded in " << attempts << " attempts" << std::endl;
+  CHECK(id);
+  CHECK(attempts > 1);
+  CHECK(!db.getUploadSession(file.origin));
+  CHECK(readFile(dir.path() / "server" / "files" / *id) ==
+        readFile(file.absPath));
+}
+
+// A commit the server refuses (content not matching the announced
+// checksum) drops the session, so the next attempt uploads afresh instead
+// of repeating the same commit without parts
+SYNC_TEST(refusedCommitDropsSession) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server");
+  DatabaseManager db((dir.path() / "sync.db").string(), dir.path().string());
+  CHECK(db.open());
+  db.initializeSchema();
+  ApiClient api(server.url(), "test@example.com");
+  ChunkedUploader uploader(api, db, smallParts());
+  auto file = writeQueuedFile(dir.path() / "big.bin", "/device/folder",
+                              3 * kPartSize, 2);
+
+  std::string checksum = file.hashvalue;
+  file.hashvalue = std::string(64, '0');
+  CHECK(!uploader.upload(file, {}));
+  CHECK(!db.getUploadSession(file.origin));
+
+  file.hashvalue = checksum;
+  auto id = uploader.upload(file, {});
+  CHECK(id);
+  CHECK(!db.getUploadSession(file.origin));
+  CHECK(readFile(dir.path() / "server" / "files" / *id) ==
+        readFile(file.absPath));
+}
@@ -0,0 +1,144 @@
+#include "ApiClient.hpp"
+#include "RetryPolicy.hpp"
+#include "TestSupport.hpp"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using namespace sync;
+using namespace sync::test;
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+CloudFileMetadata cloudFile(const FileQueueEntry &file) {
+  CloudFileMetadata cloud{};
+  cloud.uuid = file.uuid;
+  cloud.origin = file.origin;
+  cloud.path = file.path;
+  cloud.filename = file.filename;
+  cloud.hashvalue = file.hashvalue;
+  cloud.size = file.size;
+  return cloud;
+}
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+// A canceled probe heard nothing from the server, so the circuit stays
+// open and the next request may probe again
+SYNC_TEST(canceledProbeKeepsCircuitHalfOpen) {
+  RetryPolicy policy({.breakerThreshold = 1,
+                      .breakerCooldown = std::chrono::milliseconds(10)});
+  CHECK(policy.allowRequest());
+  policy.recordFailure();
+  CHECK(policy.circuitOpen());
+  CHECK(!policy.allowRequest());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CHECK(policy.allowRequest());
+  CHECK(!policy.allowRequest());
+  policy.recordCanceled();
+  CHECK(policy.circuitOpen());
+  CHECK(policy.allowRequest());
+  policy.recordSuccess();
+  CHECK(!policy.circuitOpen());
+}
+
+#ifndef _WIN32
+// With a third of all requests failing and half the downloads cut off,
+// uploads, listings and downloads still all go through on retries
+SYNC_TEST(retriesThroughInjectedFaults) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server",
+                          {"--error-rate", "0.3", "--cut-rate", "0.5"});
+  // Retry-After asks for a second; maxDelay keeps the test quick
+  ApiClient api(server.url(), "test@example.com", {},
+                {.maxAttempts = 20,
+                 .baseDelay = std::chrono::milliseconds(5),
+                 .maxDelay = std::chrono::milliseconds(50),
+                 .breakerThreshold = 1000});
+  std::vector<FileQueueEntry> files;
+  for (uint32_t i = 0; i < 4; ++i) {
+    files.push_back(writeQueuedFile(dir.path() / ("f" + std::to_string(i)),
+                                    "/device/folder", 200 * 1024, i));
+    CHECK(api.uploadFile(files.back(), {}));
+  }
+  for (int i = 0; i < 10; ++i)
+    CHECK(api.getMetadata());
+  for (const auto &file : files) {
+    fs::path local = dir.path() / ("down" + file.filename);
+    CHECK(api.downloadFile(cloudFile(file), local.string()));
+    CHECK(readFile(local) == readFile(file.absPath));
+  }
+  // 18 operations; the rest of the attempts were retries
+  uint64_t attempts = api.transferStats().completed;
+  std::cout << "[Test] " << attempts << " attempts for 18 operations"
+            << std::endl;
+  CHECK(attempts > 18);
+  CHECK(api.serverReachable());
+}
+
+// A server failing everything opens the circuit after breakerThreshold
+// attempts; from then on requests are refused without waiting on it
+SYNC_TEST(circuitOpensOnFailingServer) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server",
+                          {"--error-rate", "1"});
+  ApiClient api(server.url(), "test@example.com", {},
+                {.maxAttempts = 2,
+                 .baseDelay = std::chrono::milliseconds(1),
+                 .maxDelay = std::chrono::milliseconds(5),
+                 .breakerThreshold = 3,
+                 .breakerCooldown = std::chrono::milliseconds(500)});
+  CHECK(!api.getMetadata());
+  CHECK(api.serverReachable());
+  CHECK(!api.getMetadata());
+  CHECK(!api.serverReachable());
+
+  uint64_t attempts = api.transferStats().completed;
+  auto start = Clock::now();
+  CHECK(!api.getMetadata());
+  CHECK(secondsSince(start) < 0.1);
+  CHECK(api.transferStats().completed == attempts);
+
+  // After the cooldown one probe goes out, fails and reopens it
+  std::this_thread::sleep_for(std::chrono::milliseconds(600));
+  CHECK(!api.getMetadata());
+  CHECK(api.transferStats().completed == attempts + 1);
+  CHECK(!api.serverReachable());
+}
+
+// File content keeps to the bandwidth caps in both directions. The
+// bucket lets a second's worth through at once and the last read need not
+// wait, so 8 s of data take a little under 7 s.
+SYNC_TEST(bandwidthCapsHoldTransfers) {
+  CHECK(!args.empty());
+  TempDir dir;
+  DevServerProcess server(args[0], dir.path() / "server");
+  constexpr int64_t kRate = 512 * 1024;
+  ApiClient api(server.url(), "test@example.com");
+  api.setBandwidthLimits(kRate, kRate);
+  auto file = writeQueuedFile(dir.path() / "capped.bin", "/device/folder",
+                              8 * kRate, 7);
+
+  auto start = Clock::now();
+  CHECK(api.uploadFile(file, {}));
+  double up = secondsSince(start);
+  start = Clock::now();
+  fs::path local = dir.path() / "down.bin";
+  CHECK(api.downloadFile(cloudFile(file), local.string()));
+  double down = secondsSince(start);
+  std::cout << "[Test] 4 MiB at 512 KiB/s: up " << up << " s, down " << down
+            << " s" << std::endl;
+  CHECK(readFile(local) == readFile(file.absPath));
+  CHECK(up > 5.5 && up < 20);
+  CHECK(down > 5.5 && down < 20);
+}
+#endif
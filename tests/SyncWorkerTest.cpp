@@ -0,0 +1,72 @@
+#include "SyncWorker.hpp"
+#include "TestSupport.hpp"
+
+using namespace sync;
+using namespace sync::test;
+namespace fs = std::filesystem;
+
+// A file deleted before its upload leaves no delete behind, so the same
+// content showing up elsewhere is uploaded rather than "moved" from a
+// path the server never had
+SYNC_TEST(unuploadedDeleteIsNoMoveSource) {
+  TempDir dir;
+  fs::path root = dir.path() / "root";
+  fs::create_directories(root / "device" / "a");
+  fs::create_directories(root / "device" / "b");
+  DatabaseManager db((dir.path() / "sync.db").string(), root.string());
+  CHECK(db.open());
+  db.initializeSchema();
+  FileSystemScanner scanner(root.string());
+  SyncWorker worker(db, scanner, root.string());
+
+  fs::path first = root / "device" / "a" / "x.bin";
+  fs::path second = root / "device" / "b" / "x.bin";
+  writeQueuedFile(first, "/device/a", 4096, 3);
+  worker.handleAdded(first.string());
+  fs::remove(first);
+  worker.handleDeleted(first.string());
+  writeQueuedFile(second, "/device/b", 4096, 3);
+  worker.handleAdded(second.string());
+  CHECK(worker.flush());
+
+  CHECK(!db.getFileQueueByPath("/device/a", "x.bin"));
+  CHECK(!db.getFileByPath("/device/a", "x.bin"));
+  auto queued = db.getFileQueueByPath("/device/b", "x.bin");
+  CHECK(queued);
+  CHECK(queued->sync_status == "new");
+}
+
+// A touch leaves nothing to sync but updates the stored mtime, so the
+// next event is rejected on stat alone instead of hashing again
+SYNC_TEST(touchRefreshesStoredStat) {
+  TempDir dir;
+  fs::path root = dir.path() / "root";
+  fs::create_directories(root / "device" / "a");
+  DatabaseManager db((dir.path() / "sync.db").string(), root.string());
+  CHECK(db.open());
+  db.initializeSchema();
+  FileSystemScanner scanner(root.string());
+  SyncWorker worker(db, scanner, root.string());
+
+  fs::path file = root / "device" / "a" / "x.bin";
+  writeQueuedFile(file, "/device/a", 4096, 5);
+  worker.handleAdded(file.string());
+  CHECK(worker.flush());
+  // As if uploaded
+  CHECK(db.deleteFileQueue("/device/a", "x.bin"));
+  auto before = db.getFileByPath("/device/a", "x.bin");
+  CHECK(before);
+
+  auto touched = fs::last_write_time(file) - std::chrono::hours(1);
+  fs::last_write_time(file, touched);
+  worker.handleModified(file.string());
+  CHECK(worker.flush());
+
+  auto after = db.getFileByPath("/device/a", "x.bin");
+  CHECK(after);
+  CHECK(after->last_modified ==
+        std::to_string(scanner.getUnixTimeStamp(touched)));
+  CHECK(after->versions == before->versions);
+  CHECK(after->hashvalue == before->hashvalue);
+  CHECK(!db.getFileQueueByPath("/device/a", "x.bin"));
+}
@@ -0,0 +1,201 @@
+#include "TestSupport.hpp"
+#include "httplib.h"
+#include "picosha2.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <arpa/inet.h>
+#include <csignal>
+#include <netinet/in.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+namespace fs = std::filesystem;
+
+namespace sync::test {
+
+namespace {
+
+std::map<std::string, TestFn> &registry() {
+  static std::map<std::string, TestFn> tests;
+  return tests;
+}
+
+#ifndef _WIN32
+// Binding port 0 lets the system pick one; it stays free for the moment
+// between closing here and the server binding it
+int freePort() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  int port = 0;
+  if (fd >= 0 && bind(fd, reinterpret_cast<sockaddr *>(&addr), len) == 0 &&
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) == 0)
+    port = ntohs(addr.sin_port);
+  if (fd >= 0)
+    close(fd);
+  if (port == 0)
+    throw std::runtime_error("no free port");
+  return port;
+}
+#endif
+
+} // namespace
+
+bool registerTest(const char *name, TestFn fn) {
+  registry()[name] = fn;
+  return true;
+}
+
+void fail(const char *file, int line, const std::string &what) {
+  std::ostringstream out;
+  out << file << ":" << line << ": CHECK(" << what << ") failed";
+  throw CheckFailed(out.str());
+}
+
+TempDir::TempDir() {
+  std::random_device rd;
+  std::ostringstream name;
+  name << "sync_tests_" << std::hex << rd() << rd();
+  m_path = fs::temp_directory_path() / name.str();
+  fs::create_directories(m_path);
+}
+
+TempDir::~TempDir() {
+  std::error_code ec;
+  fs::remove_all(m_path, ec);
+}
+
+int64_t peakRssKb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return static_cast<int64_t>(counters.PeakWorkingSetSize / 1024);
+  return 0;
+#else
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0)
+      return std::stoll(line.substr(6));
+  }
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+FileQueueEntry writeQueuedFile(const fs::path &path,
+                               const std::string &cloudDir, int64_t size,
+                               uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::string data(static_cast<size_t>(size), '\0');
+  for (auto &c : data)
+    c = static_cast<char>(rng());
+  std::ofstream(path, std::ios::binary) << data;
+
+  FileQueueEntry file;
+  file.uuid = file.origin = "test" + std::to_string(seed);
+  file.path = cloudDir;
+  file.filename = path.filename().string();
+  file.absPath = path.string();
+  file.size = size;
+  file.versions = 1;
+  file.sync_status = "new";
+  picosha2::hash256_hex_string(data, file.hashvalue);
+  return file;
+}
+
+std::string readFile(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream out;
+  out << in.rdbuf();
+  return out.str();
+}
+
+#ifndef _WIN32
+DevServerProcess::DevServerProcess(const std::string &binary,
+                                   const fs::path &root,
+                                   const std::vector<std::string> &flags)
+    : m_port(freePort()) {
+  std::vector<std::string> args = {binary, "--port", std::to_string(m_port),
+                                   "--root", root.string()};
+  args.insert(args.end(), flags.begin(), flags.end());
+  std::vector<char *> argv;
+  for (auto &arg : args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  if (posix_spawn(&m_pid, binary.c_str(), nullptr, nullptr, argv.data(),
+                  environ) != 0) {
+    m_pid = -1;
+    throw std::runtime_error("cannot start " + binary);
+  }
+
+  // Any answer will do, even an injected failure
+  httplib::Client client(url());
+  client.set_connection_timeout(0, 100000);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!client.Get("/getSyncItems")) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      kill(m_pid, SIGKILL);
+      waitpid(m_pid, nullptr, 0);
+      throw std::runtime_error(binary + " did not come up");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+DevServerProcess::~DevServerProcess() {
+  if (m_pid <= 0)
+    return;
+  kill(m_pid, SIGTERM);
+  waitpid(m_pid, nullptr, 0);
+}
+
+std::string DevServerProcess::url() const {
+  return "http://127.0.0.1:" + std::to_string(m_port);
+}
+#endif
+
+} // namespace sync::test
+
+int main(int argc, char **argv) {
+  auto &tests = sync::test::registry();
+  auto it = argc > 1 ? tests.find(argv[1]) : tests.end();
+  if (it == tests.end()) {
+    std::cerr << "Usage: sync_tests <test> [args...]\nTests:" << std::endl;
+    for (const auto &[name, fn] : tests)
+      std::cerr << "  " << name << std::endl;
+    return 2;
+  }
+  try {
+    it->second(sync::test::TestArgs(argv + 2, argv + argc));
+  } catch (const std::exception &e) {
+    std::cerr << "[Test] " << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "[Test] " << argv[1] << " passed" << std::endl;
+  return 0;
+}
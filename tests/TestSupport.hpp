@@ -0,0 +1,92 @@
+#pragma once
+#include "types.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+namespace sync::test {
+
+/**
+ * Just enough harness for sync_tests. A test is a function registered
+ * under its name by SYNC_TEST; CTest runs `sync_tests <name> [args...]`
+ * once per test, and a failed CHECK ends it with a non-zero exit. Tests
+ * that drive the stand-in server get the sync_devserver binary as their
+ * first argument.
+ */
+using TestArgs = std::vector<std::string>;
+using TestFn = void (*)(const TestArgs &);
+
+bool registerTest(const char *name, TestFn fn);
+
+struct CheckFailed : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] void fail(const char *file, int line, const std::string &what);
+
+#define SYNC_TEST(name)                                                        \
+  static void name(const ::sync::test::TestArgs &);                            \
+  [[maybe_unused]] static const bool name##Registered =                        \
+      ::sync::test::registerTest(#name, name);                                 \
+  static void name([[maybe_unused]] const ::sync::test::TestArgs &args)
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond))                                                               \
+      ::sync::test::fail(__FILE__, __LINE__, #cond);                           \
+  } while (0)
+
+/** A fresh directory under the system temp dir, removed with its contents
+ * when this goes out of scope. */
+class TempDir {
+public:
+  TempDir();
+  ~TempDir();
+  TempDir(const TempDir &) = delete;
+  TempDir &operator=(const TempDir &) = delete;
+
+  const std::filesystem::path &path() const { return m_path; }
+
+private:
+  std::filesystem::path m_path;
+};
+
+// Peak resident memory of this process in KiB, 0 where unknown
+int64_t peakRssKb();
+
+// Writes size bytes that do not compress, the same for the same seed, and
+// returns the queue entry of a new file with that content in cloudDir
+// ("/device/dir")
+FileQueueEntry writeQueuedFile(const std::filesystem::path &path,
+                               const std::string &cloudDir, int64_t size,
+                               uint32_t seed);
+std::string readFile(const std::filesystem::path &path);
+
+#ifndef _WIN32
+/** sync_devserver running on a free port over root, with extra flags
+ * (--error-rate and the like). Waits until it answers; stopped on
+ * destruction. */
+class DevServerProcess {
+public:
+  DevServerProcess(const std::string &binary,
+                   const std::filesystem::path &root,
+                   const std::vector<std::string> &flags = {});
+  ~DevServerProcess();
+  DevServerProcess(const DevServerProcess &) = delete;
+  DevServerProcess &operator=(const DevServerProcess &) = delete;
+
+  std::string url() const;
+
+private:
+  pid_t m_pid = -1;
+  int m_port = 0;
+};
+#endif
+
+} // namespace sync::test
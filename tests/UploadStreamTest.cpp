@@ -0,0 +1,104 @@
+#include "ApiClient.hpp"
+#include "TestSupport.hpp"
+#include "httplib.h"
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+using namespace sync;
+using namespace sync::test;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Past 4 GiB, so any 32-bit size or offset on the way breaks it
+constexpr int64_t kSparseSize = (int64_t(4) << 30) + 12345;
+
+} // namespace
+
+// uploadFile streams the file from disk, so a multi-GB one goes up with
+// memory to spare and arrives byte for byte. The file is sparse: a few
+// marker bytes in a hole, which costs no disk and little reading time.
+SYNC_TEST(uploadStreamsSparseFile) {
+  TempDir dir;
+  fs::path path = dir.path() / "sparse.bin";
+  std::ofstream(path).close();
+  fs::resize_file(path, kSparseSize);
+  const std::map<int64_t, char> markers = {{0, 'a'},
+                                           {(int64_t(1) << 31) - 1, 'b'},
+                                           {int64_t(1) << 32, 'c'},
+                                           {kSparseSize - 1, 'd'}};
+  {
+    std::fstream out(path, std::ios::in | std::ios::out | std::ios::binary);
+    for (const auto &[offset, byte] : markers) {
+      out.seekp(offset);
+      out.put(byte);
+    }
+  }
+
+  // Checks the file part as it streams in, never holding more than a read
+  std::string field;
+  std::string filestat;
+  int64_t received = 0;
+  std::map<int64_t, char> found;
+  int64_t nonZero = 0;
+  static const std::array<char, 64 * 1024> zeros{};
+  httplib::Server server;
+  server.Post("/syncUpFile", [&](const httplib::Request &,
+                                 httplib::Response &res,
+                                 const httplib::ContentReader &reader) {
+    reader(
+        [&](const httplib::FormData &item) {
+          field = item.name;
+          return true;
+        },
+        [&](const char *data, size_t len) {
+          if (field != "file") {
+            filestat.append(data, len);
+            return true;
+          }
+          for (size_t pos = 0; pos < len; pos += zeros.size()) {
+            size_t n = std::min(zeros.size(), len - pos);
+            if (std::memcmp(data + pos, zeros.data(), n) == 0)
+              continue;
+            for (size_t i = pos; i < pos + n; ++i) {
+              if (data[i] != 0) {
+                found[received + int64_t(i)] = data[i];
+                nonZero++;
+              }
+            }
+          }
+          received += int64_t(len);
+          return true;
+        });
+    res.set_content(R"({"id": "sparse-id"})", "application/json");
+  });
+  int port = server.bind_to_any_port("127.0.0.1");
+  std::thread listener([&] { server.listen_after_bind(); });
+  server.wait_until_ready();
+
+  FileQueueEntry file;
+  file.uuid = "sparse-id";
+  file.absPath = path.string();
+  file.path = "/device/folder";
+  file.filename = "sparse.bin";
+  file.size = kSparseSize;
+  ApiClient api("http://127.0.0.1:" + std::to_string(port), "test@example.com");
+  auto id = api.uploadFile(file, {});
+  server.stop();
+  listener.join();
+
+  std::cout << "[Test] Sent " << received << " bytes, peak RSS "
+            << peakRssKb() / 1024 << " MiB" << std::endl;
+  CHECK(id && *id == "sparse-id");
+  CHECK(filestat.find("sparse.bin") != std::string::npos);
+  CHECK(received == kSparseSize);
+  CHECK(found == markers);
+  CHECK(nonZero == int64_t(markers.size()));
+  // A buffered upload would need the whole file in memory
+  int64_t peak = peakRssKb();
+  CHECK(peak == 0 || peak < 256 * 1024);
+}
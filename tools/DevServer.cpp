@@ -0,0 +1,1175 @@
+#include "Compression.hpp"
+#include "DeltaEncoder.hpp"
+#include "httplib.h"
+#include "picosha2.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+/**
+ * sync_devserver is a local stand-in for the sync server, enough of it to
+ * exercise the client's upload and metadata paths without a real backend.
+ * Uploaded files land under --root and are listed by /getSyncItems along
+ * with folders. Chunked upload sessions live on disk, so they survive a
+ * restart of the server too.
+ *
+ *   sync_devserver --port 8080 --root /tmp/devserver [--fail-every N]
+ *                  [--error-rate P] [--cut-rate P] [--latency-ms N]
+ *                  [--no-batch] [--no-dedup]
+ *
+ * --fail-every answers every Nth part upload with 503 to test retries.
+ * --error-rate answers that share of all requests (0 to 1) with a 500 or
+ * a 503, and --cut-rate breaks that share of downloads off halfway, to
+ * test the client's retry policy and circuit breaker.
+ * --latency-ms delays every response, to mimic a distant server.
+ * --no-batch serves only the one-item metadata endpoints, like servers
+ * that predate /renameFiles, /createFolders and /renameFolders.
+ * --no-dedup leaves out /haveContent and /linkFile, so every upload
+ * carries its bytes.
+ * Uploads may be compressed with any coding this build supports; the
+ * server lists them in an Accept-Encoding header on every response.
+ */
+
+namespace {
+
+// Unfinished chunked uploads older than this are deleted at startup
+constexpr std::chrono::hours kUploadExpiry{24};
+
+struct DevConfig {
+  std::string host = "127.0.0.1";
+  int port = 8080;
+  std::string root = "devserver_data";
+  uint64_t failEvery = 0;
+  double errorRate = 0;
+  double cutRate = 0;
+  int latencyMs = 0;
+  bool batch = true;
+  bool dedup = true;
+};
+
+bool parseArgs(int argc, char **argv, DevConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--host")
+      config.host = value();
+    else if (arg == "--port")
+      config.port = std::stoi(value());
+    else if (arg == "--root")
+      config.root = value();
+    else if (arg == "--fail-every")
+      config.failEvery = std::stoull(value());
+    else if (arg == "--error-rate")
+      config.errorRate = std::stod(value());
+    else if (arg == "--cut-rate")
+      config.cutRate = std::stod(value());
+    else if (arg == "--latency-ms")
+      config.latencyMs = std::stoi(value());
+    else if (arg == "--no-batch")
+      config.batch = false;
+    else if (arg == "--no-dedup")
+      config.dedup = false;
+    else {
+      std::cerr << "Usage: sync_devserver [--host H] [--port N] [--root DIR] "
+                   "[--fail-every N] [--error-rate P] [--cut-rate P] "
+                   "[--latency-ms N] [--no-batch] [--no-dedup]"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string randomId() {
+  static std::mutex mtx;
+  static std::mt19937_64 rng{std::random_device{}()};
+  std::lock_guard<std::mutex> lock(mtx);
+  std::ostringstream out;
+  out << std::hex << rng() << rng();
+  return out.str();
+}
+
+// True with probability p
+bool chance(double p) {
+  if (p <= 0)
+    return false;
+  static std::mutex mtx;
+  static std::mt19937_64 rng{std::random_device{}()};
+  std::lock_guard<std::mutex> lock(mtx);
+  return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+// Ids come from the URL; only accept what randomId() produces
+bool validId(const std::string &id) {
+  return !id.empty() && id.size() <= 64 &&
+         id.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+void sendJson(httplib::Response &res, int status, const json &body) {
+  res.status = status;
+  res.set_content(body.dump(), "application/json");
+}
+
+// Outcome of one metadata operation: nullopt, or what went wrong
+using OpError = std::optional<std::string>;
+
+void sendResult(httplib::Response &res, const OpError &error) {
+  if (error)
+    sendJson(res, 404, {{"error", *error}});
+  else
+    sendJson(res, 200, {{"ok", true}});
+}
+
+void sendResults(httplib::Response &res, const std::vector<OpError> &errors) {
+  json results = json::array();
+  for (const auto &error : errors) {
+    if (error)
+      results.push_back({{"ok", false}, {"error", *error}});
+    else
+      results.push_back({{"ok", true}});
+  }
+  sendJson(res, 200, {{"results", results}});
+}
+
+// Folder path ("/device/a/b") of a file's device and directory ("/a/b")
+std::string folderPath(const std::string &device, const std::string &dir) {
+  return "/" + device + (dir == "/" ? "" : dir);
+}
+
+// Inverse of folderPath, as the client's parsePath splits it
+std::pair<std::string, std::string> splitFolderPath(const std::string &path) {
+  size_t start = path.find_first_not_of('/');
+  if (start == std::string::npos)
+    return {"/", "/"};
+  size_t slash = path.find('/', start);
+  if (slash == std::string::npos)
+    return {path.substr(start), "/"};
+  std::string dir = path.substr(slash);
+  while (dir.size() > 1 && dir.back() == '/')
+    dir.pop_back();
+  return {path.substr(start, slash - start), dir};
+}
+
+bool isUnder(const std::string &path, const std::string &folder) {
+  return path == folder ||
+         (path.size() > folder.size() &&
+          path.compare(0, folder.size(), folder) == 0 &&
+          path[folder.size()] == '/');
+}
+
+// Decoder for the upload's filestat.encoding. ok turns false for a coding
+// this build cannot decode.
+std::unique_ptr<sync::StreamCodec> uploadDecoder(const json &filestat,
+                                                 bool &ok) {
+  auto coding = sync::parseCoding(filestat.value("encoding", ""));
+  auto decoder = coding ? sync::StreamCodec::decoder(*coding) : nullptr;
+  ok = coding && (decoder || *coding == sync::ContentCoding::Identity);
+  return decoder;
+}
+
+uint32_t getU32(const char *p) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; --i)
+    v = (v << 8) | static_cast<unsigned char>(p[i]);
+  return v;
+}
+
+/**
+ * Rebuilds a file from a delta stream (see DeltaEncoder.hpp) and the base
+ * it was computed against. Input arrives in arbitrary pieces; literal data
+ * is passed through without being buffered whole.
+ */
+class DeltaApplier {
+public:
+  DeltaApplier(const fs::path &base, const fs::path &out)
+      : m_base(base, std::ios::binary), m_out(out, std::ios::binary),
+        m_copyBuf(256 * 1024) {}
+
+  bool feed(const char *data, size_t len) {
+    m_pending.append(data, len);
+    size_t pos = 0;
+    while (m_ok) {
+      size_t avail = m_pending.size() - pos;
+      if (m_literalLeft > 0) {
+        size_t n = std::min<size_t>(m_literalLeft, avail);
+        if (n == 0)
+          break;
+        write(m_pending.data() + pos, n);
+        pos += n;
+        m_literalLeft -= n;
+      } else if (m_blockSize == 0) {
+        if (avail < 8)
+          break;
+        m_blockSize = getU32(m_pending.data() + pos + 4);
+        m_ok = std::equal(sync::delta::kMagic, sync::delta::kMagic + 4,
+                          m_pending.data() + pos) &&
+               m_blockSize > 0;
+        pos += 8;
+      } else if (avail >= 5 && m_pending[pos] == sync::delta::kLiteral) {
+        m_literalLeft = getU32(m_pending.data() + pos + 1);
+        pos += 5;
+      } else if (avail >= 9 && m_pending[pos] == sync::delta::kCopy) {
+        copy(getU32(m_pending.data() + pos + 1),
+             getU32(m_pending.data() + pos + 5));
+        pos += 9;
+      } else {
+        m_ok = avail == 0 || m_pending[pos] == sync::delta::kLiteral ||
+               m_pending[pos] == sync::delta::kCopy;
+        break;
+      }
+    }
+    m_pending.erase(0, pos);
+    return m_ok;
+  }
+
+  // The complete result's SHA-256, or "" if the stream was malformed
+  std::string finish() {
+    m_out.close();
+    if (!m_ok || m_blockSize == 0 || m_literalLeft > 0 || !m_pending.empty())
+      return "";
+    m_hasher.finish();
+    return picosha2::get_hash_hex_string(m_hasher);
+  }
+
+  int64_t size() const { return m_size; }
+
+private:
+  std::ifstream m_base;
+  std::ofstream m_out;
+  std::vector<char> m_copyBuf;
+  std::string m_pending;
+  picosha2::hash256_one_by_one m_hasher;
+  uint32_t m_blockSize = 0;
+  size_t m_literalLeft = 0;
+  int64_t m_size = 0;
+  bool m_ok = true;
+
+  void write(const char *data, size_t len) {
+    m_hasher.process(data, data + len);
+    m_out.write(data, static_cast<std::streamsize>(len));
+    m_size += static_cast<int64_t>(len);
+  }
+
+  void copy(uint32_t first, uint32_t count) {
+    m_base.clear();
+    m_base.seekg(static_cast<std::streamoff>(first) * m_blockSize);
+    int64_t left = static_cast<int64_t>(count) * m_blockSize;
+    while (m_ok && left > 0) {
+      auto want = std::min<int64_t>(left, m_copyBuf.size());
+      m_base.read(m_copyBuf.data(), want);
+      // Blocks past the end of the base were never signed
+      m_ok = m_base.gcount() == want;
+      write(m_copyBuf.data(), static_cast<size_t>(want));
+      left -= want;
+    }
+  }
+};
+
+class DevServer {
+public:
+  explicit DevServer(DevConfig config)
+      : m_config(std::move(config)), m_root(m_config.root) {}
+
+  int run() {
+    std::error_code ec;
+    fs::create_directories(m_root / "files", ec);
+    fs::create_directories(m_root / "uploads", ec);
+    if (ec) {
+      std::cerr << "[DevServer] Cannot create " << m_root << ": "
+                << ec.message() << std::endl;
+      return 1;
+    }
+    loadCatalog();
+    pruneUploads();
+    routes();
+    std::cout << "[DevServer] Listening on " << m_config.host << ":"
+              << m_config.port << ", data in " << m_root << std::endl;
+    if (!m_server.listen(m_config.host, m_config.port)) {
+      std::cerr << "[DevServer] Cannot listen on port " << m_config.port
+                << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+private:
+  DevConfig m_config;
+  fs::path m_root;
+  httplib::Server m_server;
+  std::mutex m_mtx;
+  // Stored files by uuid, as their filestat
+  std::map<std::string, json> m_files;
+  // Folders by path
+  std::map<std::string, json> m_folders;
+  // Uuids of the stored files by their checksum, for /haveContent
+  std::map<std::string, std::set<std::string>> m_byChecksum;
+  std::atomic<uint64_t> m_partRequests{0};
+
+  fs::path catalogPath() const { return m_root / "catalog.json"; }
+  fs::path uploadDir(const std::string &id) const {
+    return m_root / "uploads" / id;
+  }
+
+  void loadCatalog() {
+    std::ifstream in(catalogPath());
+    if (!in)
+      return;
+    try {
+      json catalog = json::parse(in);
+      json files = catalog.value("files", json::object());
+      json folders = catalog.value("folders", json::object());
+      for (auto &[uuid, filestat] : files.items()) {
+        m_files[uuid] = filestat;
+        indexLocked(uuid);
+      }
+      for (auto &[path, folder] : folders.items())
+        m_folders[path] = folder;
+    } catch (const std::exception &e) {
+      std::cerr << "[DevServer] Ignoring bad catalog: " << e.what()
+                << std::endl;
+    }
+  }
+
+  void indexLocked(const std::string &uuid) {
+    std::string checksum = m_files[uuid].value("checksum", "");
+    if (!checksum.empty())
+      m_byChecksum[checksum].insert(uuid);
+  }
+
+  void unindexLocked(const std::string &uuid) {
+    auto file = m_files.find(uuid);
+    if (file == m_files.end())
+      return;
+    auto it = m_byChecksum.find(file->second.value("checksum", ""));
+    if (it != m_byChecksum.end() && it->second.erase(uuid) &&
+        it->second.empty())
+      m_byChecksum.erase(it);
+  }
+
+  // Drops a file from the catalog and from disk
+  void forgetFileLocked(const std::string &uuid) {
+    unindexLocked(uuid);
+    m_files.erase(uuid);
+    std::error_code ec;
+    fs::remove(m_root / "files" / uuid, ec);
+  }
+
+  // Caller holds m_mtx
+  void saveCatalogLocked() {
+    json catalog = {{"files", json::object()}, {"folders", json::object()}};
+    for (const auto &[uuid, filestat] : m_files)
+      catalog["files"][uuid] = filestat;
+    for (const auto &[path, folder] : m_folders)
+      catalog["folders"][path] = folder;
+    fs::path tmp = catalogPath().string() + ".tmp";
+    std::ofstream(tmp) << catalog.dump();
+    std::error_code ec;
+    fs::rename(tmp, catalogPath(), ec);
+  }
+
+  void pruneUploads() {
+    auto cutoff = fs::file_time_type::clock::now() - kUploadExpiry;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(m_root / "uploads", ec)) {
+      if (entry.last_write_time(ec) < cutoff)
+        fs::remove_all(entry.path(), ec);
+    }
+  }
+
+  // Moves a finished upload into place and lists it
+  json store(const fs::path &data, json filestat) {
+    // The client's uuid names the stored file, if it is a safe name
+    std::string uuid = filestat.value("uuid", "");
+    if (uuid.empty() || uuid.find_first_of("/\\.") != std::string::npos)
+      uuid = randomId();
+    filestat["uuid"] = uuid;
+    // Stored decoded; the coding only applied to the transfer
+    filestat.erase("encoding");
+    std::error_code ec;
+    fs::rename(data, m_root / "files" / uuid, ec);
+    std::lock_guard<std::mutex> lock(m_mtx);
+    unindexLocked(uuid);
+    m_files[uuid] = filestat;
+    indexLocked(uuid);
+    saveCatalogLocked();
+    std::cout << "[DevServer] Stored " << filestat.value("device", "") << "/"
+              << filestat.value("directory", "") << "/"
+              << filestat.value("filename", "") << " ("
+              << filestat.value("size", int64_t(0)) << " bytes)" << std::endl;
+    return json{{"id", uuid}};
+  }
+
+  void routes() {
+    m_server.set_tcp_nodelay(true);
+    int latencyMs = m_config.latencyMs;
+    double errorRate = m_config.errorRate;
+    m_server.set_pre_routing_handler(
+        [latencyMs, errorRate](const httplib::Request &,
+                               httplib::Response &res) {
+          if (latencyMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+          if (!chance(errorRate))
+            return httplib::Server::HandlerResponse::Unhandled;
+          // Half of them as an overloaded server that asks for a pause
+          if (chance(0.5)) {
+            res.set_header("Retry-After", "1");
+            sendJson(res, 503, {{"error", "injected overload"}});
+          } else {
+            sendJson(res, 500, {{"error", "injected failure"}});
+          }
+          return httplib::Server::HandlerResponse::Handled;
+        });
+    std::string codings = sync::acceptEncoding();
+    m_server.set_post_routing_handler(
+        [codings](const httplib::Request &, httplib::Response &res) {
+          if (!codings.empty())
+            res.set_header("Accept-Encoding", codings);
+        });
+    m_server.Get("/getSyncItems",
+                 [this](const httplib::Request &, httplib::Response &res) {
+                   getSyncItems(res);
+                 });
+    m_server.Get("/syncDownFile",
+                 [this](const httplib::Request &req, httplib::Response &res) {
+                   syncDownFile(req, res);
+                 });
+    m_server.Post("/syncUpFile",
+                  [this](const httplib::Request &req, httplib::Response &res,
+                         const httplib::ContentReader &reader) {
+                    syncUpFile(req, res, reader);
+                  });
+    m_server.Get("/fileSignatures",
+                 [this](const httplib::Request &req, httplib::Response &res) {
+                   fileSignatures(req, res);
+                 });
+    m_server.Post("/syncDeltaFile",
+                  [this](const httplib::Request &req, httplib::Response &res,
+                         const httplib::ContentReader &reader) {
+                    syncDeltaFile(req, res, reader);
+                  });
+    m_server.Post("/uploads",
+                  [this](const httplib::Request &req, httplib::Response &res) {
+                    startUpload(req, res);
+                  });
+    m_server.Put("/uploads/:id/parts/:n",
+                 [this](const httplib::Request &req, httplib::Response &res) {
+                   putPart(req, res);
+                 });
+    m_server.Post("/uploads/:id/commit",
+                  [this](const httplib::Request &req, httplib::Response &res) {
+                    commitUpload(req, res);
+                  });
+    if (m_config.dedup) {
+      m_server.Post("/haveContent", [this](const httplib::Request &req,
+                                           httplib::Response &res) {
+        haveContent(req, res);
+      });
+      m_server.Post("/linkFile", [this](const httplib::Request &req,
+                                        httplib::Response &res) {
+        linkFile(req, res);
+      });
+    }
+    metadataRoutes();
+  }
+
+  // Each metadata operation has a one-item endpoint taking the client's
+  // request as is, and a batch endpoint unless --no-batch. Batches apply
+  // their items in order and answer {"results": [...]} in that order.
+  void metadataRoutes() {
+    auto handle = [this](auto op) {
+      return [this, op](const httplib::Request &req, httplib::Response &res) {
+        json body = json::parse(req.body, nullptr, false);
+        std::lock_guard<std::mutex> lock(m_mtx);
+        (this->*op)(req, body, res);
+        saveCatalogLocked();
+      };
+    };
+    // /deleteFiles always took arrays; results list fileIds, then
+    // directories
+    m_server.Delete("/deleteFiles", handle(&DevServer::deleteFiles));
+    m_server.Post("/renameFile", handle(&DevServer::renameFile));
+    m_server.Post("/moveFile", handle(&DevServer::moveFile));
+    m_server.Post("/createFolder", handle(&DevServer::createFolder));
+    m_server.Delete("/deleteFolder", handle(&DevServer::deleteFolder));
+    m_server.Post("/renameFolder", handle(&DevServer::renameFolder));
+    if (!m_config.batch)
+      return;
+    m_server.Post("/renameFiles", handle(&DevServer::renameFiles));
+    m_server.Post("/createFolders", handle(&DevServer::createFolders));
+    m_server.Post("/renameFolders", handle(&DevServer::renameFolders));
+  }
+
+  // Handlers below run with m_mtx held; body is the parsed request body
+  // (discarded if it was not JSON)
+
+  void deleteFiles(const httplib::Request &, const json &body,
+                   httplib::Response &res) {
+    std::vector<OpError> errors;
+    for (const auto &fileId : body.value("fileIds", json::array()))
+      errors.push_back(deleteFileLocked(fileId.value("id", "")));
+    for (const auto &dir : body.value("directories", json::array()))
+      errors.push_back(deleteFolderLocked(dir.value("path", "")));
+    sendResults(res, errors);
+  }
+
+  void renameFile(const httplib::Request &, const json &body,
+                  httplib::Response &res) {
+    sendResult(res, renameFileLocked(body.value("data", json::object())));
+  }
+
+  void renameFiles(const httplib::Request &, const json &body,
+                   httplib::Response &res) {
+    std::vector<OpError> errors;
+    for (const auto &item : body.value("items", json::array()))
+      errors.push_back(renameFileLocked(item));
+    sendResults(res, errors);
+  }
+
+  void moveFile(const httplib::Request &, const json &body,
+                httplib::Response &res) {
+    json data = body.value("data", json::object());
+    auto uuid = findFileLocked(data.value("fromDevice", ""),
+                               data.value("fromDir", ""),
+                               data.value("filename", ""));
+    if (!uuid) {
+      sendResult(res, "no such file");
+      return;
+    }
+    json &filestat = m_files[*uuid];
+    filestat["device"] = data.value("toDevice", "");
+    filestat["directory"] = data.value("toDir", "");
+    filestat["filename"] = data.value("to", "");
+    sendResult(res, std::nullopt);
+  }
+
+  void createFolder(const httplib::Request &req, const json &,
+                    httplib::Response &res) {
+    json folder = {{"path", req.get_param_value("path")},
+                   {"device", req.get_param_value("device")},
+                   {"uuid", req.get_param_value("uuid")},
+                   {"folder", req.get_param_value("folder")}};
+    sendResult(res, createFolderLocked(folder));
+  }
+
+  void createFolders(const httplib::Request &, const json &body,
+                     httplib::Response &res) {
+    std::vector<OpError> errors;
+    for (const auto &folder : body.value("folders", json::array()))
+      errors.push_back(createFolderLocked(folder));
+    sendResults(res, errors);
+  }
+
+  void deleteFolder(const httplib::Request &req, const json &,
+                    httplib::Response &res) {
+    sendResult(res, deleteFolderLocked(req.get_param_value("path")));
+  }
+
+  void renameFolder(const httplib::Request &, const json &body,
+                    httplib::Response &res) {
+    sendResult(res, renameFolderLocked(body.value("oldPath", ""),
+                                       body.value("newPath", "")));
+  }
+
+  void renameFolders(const httplib::Request &, const json &body,
+                     httplib::Response &res) {
+    std::vector<OpError> errors;
+    for (const auto &folder : body.value("folders", json::array()))
+      errors.push_back(renameFolderLocked(folder.value("oldPath", ""),
+                                          folder.value("newPath", "")));
+    sendResults(res, errors);
+  }
+
+  std::optional<std::string> findFileLocked(const std::string &device,
+                                            const std::string &dir,
+                                            const std::string &filename) {
+    for (const auto &[uuid, filestat] : m_files) {
+      if (filestat.value("device", "") == device &&
+          filestat.value("directory", "") == dir &&
+          filestat.value("filename", "") == filename)
+        return uuid;
+    }
+    return std::nullopt;
+  }
+
+  OpError deleteFileLocked(const std::string &uuid) {
+    if (!m_files.count(uuid))
+      return "no such file";
+    forgetFileLocked(uuid);
+    return std::nullopt;
+  }
+
+  OpError renameFileLocked(const json &data) {
+    auto uuid = findFileLocked(data.value("device", ""),
+                               data.value("dir", ""),
+                               data.value("filename", ""));
+    if (!uuid)
+      return "no such file";
+    std::string to = data.value("to", "");
+    if (to.empty() || to.find('/') != std::string::npos)
+      return "bad name";
+    m_files[*uuid]["filename"] = to;
+    return std::nullopt;
+  }
+
+  OpError createFolderLocked(const json &folder) {
+    std::string path = folder.value("path", "");
+    if (path.size() < 2 || path[0] != '/')
+      return "bad path";
+    json &entry = m_folders[path];
+    entry = {{"path", path},
+             {"device", folder.value("device", "")},
+             {"uuid", folder.value("uuid", "")},
+             {"folder", folder.value("folder", "")},
+             {"created_at", std::to_string(std::time(nullptr))}};
+    return std::nullopt;
+  }
+
+  // Removes the folder with everything below it
+  OpError deleteFolderLocked(const std::string &path) {
+    if (!m_folders.count(path))
+      return "no such folder";
+    std::erase_if(m_folders, [&](const auto &entry) {
+      return isUnder(entry.first, path);
+    });
+    std::vector<std::string> inside;
+    for (const auto &[uuid, filestat] : m_files) {
+      if (isUnder(folderPath(filestat.value("device", ""),
+                             filestat.value("directory", "")),
+                  path))
+        inside.push_back(uuid);
+    }
+    for (const auto &uuid : inside)
+      forgetFileLocked(uuid);
+    return std::nullopt;
+  }
+
+  // Moves the folder, its subfolders and files to newPath
+  OpError renameFolderLocked(const std::string &oldPath,
+                             const std::string &newPath) {
+    if (!m_folders.count(oldPath))
+      return "no such folder";
+    if (newPath.size() < 2 || m_folders.count(newPath) ||
+        isUnder(newPath, oldPath))
+      return "bad target";
+    auto moved = [&](const std::string &path) {
+      return newPath + path.substr(oldPath.size());
+    };
+    std::vector<std::string> paths;
+    for (const auto &[path, folder] : m_folders) {
+      if (isUnder(path, oldPath))
+        paths.push_back(path);
+    }
+    for (const auto &path : paths) {
+      json folder = std::move(m_folders[path]);
+      m_folders.erase(path);
+      folder["path"] = moved(path);
+      folder["folder"] = fs::path(moved(path)).filename().string();
+      m_folders[moved(path)] = std::move(folder);
+    }
+    for (auto &[uuid, filestat] : m_files) {
+      std::string dir = folderPath(filestat.value("device", ""),
+                                   filestat.value("directory", ""));
+      if (!isUnder(dir, oldPath))
+        continue;
+      auto [device, directory] = splitFolderPath(moved(dir));
+      filestat["device"] = device;
+      filestat["directory"] = directory;
+    }
+    return std::nullopt;
+  }
+
+  void getSyncItems(httplib::Response &res) {
+    json items = json::array();
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (const auto &[uuid, filestat] : m_files) {
+      items.push_back({{"type", "file"},
+                       {"uuid", uuid},
+                       {"filename", filestat.value("filename", "")},
+                       {"device", filestat.value("device", "/")},
+                       {"directory", filestat.value("directory", "/")},
+                       {"origin", filestat.value("origin", uuid)},
+                       {"checksum", filestat.value("checksum", "")},
+                       {"size", filestat.value("size", int64_t(0))},
+                       {"mtime", filestat.value("mtime", "")},
+                       {"version", filestat.value("version", 1)}});
+    }
+    for (const auto &[path, folder] : m_folders) {
+      json item = folder;
+      item["type"] = "folder";
+      items.push_back(std::move(item));
+    }
+    sendJson(res, 200, {{"items", items}});
+  }
+
+  // Streams a stored file, compressed if the client accepts a coding we
+  // have and the content is worth it
+  void syncDownFile(const httplib::Request &req, httplib::Response &res) {
+    std::string uuid = req.get_param_value("uuid");
+    if (!storedFile(uuid)) {
+      sendJson(res, 404, {{"error", "no such file"}});
+      return;
+    }
+    fs::path path = m_root / "files" / uuid;
+    std::string accepted = req.get_header_value("Accept-Encoding");
+    auto coding = sync::ContentCoding::Identity;
+    if (sync::isCompressible(path.string())) {
+      for (auto candidate : sync::supportedCodings()) {
+        if (accepted.find(sync::codingName(candidate)) != std::string::npos) {
+          coding = candidate;
+          break;
+        }
+      }
+    }
+    if (coding != sync::ContentCoding::Identity)
+      res.set_header("Content-Encoding", sync::codingName(coding));
+    auto in = std::make_shared<std::ifstream>(path, std::ios::binary);
+    std::shared_ptr<sync::StreamCodec> encoder =
+        sync::StreamCodec::encoder(coding);
+    auto buffer = std::make_shared<std::vector<char>>(256 * 1024);
+    // --cut-rate: the connection drops once half the file has been read
+    std::error_code ec;
+    int64_t cutAt = chance(m_config.cutRate)
+                        ? static_cast<int64_t>(fs::file_size(path, ec) / 2)
+                        : -1;
+    auto read = std::make_shared<int64_t>(0);
+    res.set_chunked_content_provider(
+        "application/octet-stream",
+        [in, encoder, buffer, cutAt, read](size_t, httplib::DataSink &sink) {
+          size_t want = buffer->size();
+          if (cutAt >= 0) {
+            if (*read >= cutAt)
+              return false;
+            want = std::min(want, static_cast<size_t>(cutAt - *read));
+          }
+          in->read(buffer->data(), want);
+          *read += in->gcount();
+          auto n = static_cast<size_t>(in->gcount());
+          bool last = !*in;
+          if (!encoder) {
+            if (n > 0 && !sink.write(buffer->data(), n))
+              return false;
+          } else {
+            std::string out;
+            if (!encoder->process(buffer->data(), n, last, out) ||
+                (!out.empty() && !sink.write(out.data(), out.size())))
+              return false;
+          }
+          if (last)
+            sink.done();
+          return true;
+        });
+  }
+
+  // Multipart body with a JSON "filestat" field and a "file" field,
+  // streamed to disk and hashed on the way
+  void syncUpFile(const httplib::Request &req, httplib::Response &res,
+                  const httplib::ContentReader &reader) {
+    if (!req.is_multipart_form_data()) {
+      sendJson(res, 400, {{"error", "multipart body expected"}});
+      return;
+    }
+    fs::path tmp = m_root / "files" / (randomId() + ".part");
+    std::ofstream out;
+    std::string field;
+    std::string filestatText;
+    json filestat;
+    std::unique_ptr<sync::StreamCodec> decoder;
+    std::string decoded;
+    bool ok = true;
+    picosha2::hash256_one_by_one hasher;
+    int64_t size = 0;
+    auto write = [&](const char *data, size_t len) {
+      hasher.process(data, data + len);
+      size += static_cast<int64_t>(len);
+      out.write(data, static_cast<std::streamsize>(len));
+    };
+    reader(
+        [&](const httplib::FormData &item) {
+          field = item.name;
+          if (field != "file")
+            return true;
+          // filestat is sent first and says how the file is encoded
+          try {
+            filestat = json::parse(filestatText);
+          } catch (const std::exception &) {
+            return ok = false;
+          }
+          decoder = uploadDecoder(filestat, ok);
+          out.open(tmp, std::ios::binary);
+          return ok && static_cast<bool>(out);
+        },
+        [&](const char *data, size_t len) {
+          if (field == "filestat") {
+            filestatText.append(data, len);
+          } else if (field == "file" && !decoder) {
+            write(data, len);
+          } else if (field == "file") {
+            decoded.clear();
+            ok = decoder->process(data, len, false, decoded);
+            write(decoded.data(), decoded.size());
+          }
+          return ok;
+        });
+    if (ok && decoder) {
+      decoded.clear();
+      ok = decoder->process(nullptr, 0, true, decoded);
+      write(decoded.data(), decoded.size());
+    }
+    out.close();
+    hasher.finish();
+
+    if (!ok || filestat.is_null()) {
+      std::error_code ec;
+      fs::remove(tmp, ec);
+      sendJson(res, 400, {{"error", "bad filestat or encoding"}});
+      return;
+    }
+    std::string checksum = filestat.value("checksum", "");
+    if (size != filestat.value("size", int64_t(-1)) ||
+        (!checksum.empty() &&
+         picosha2::get_hash_hex_string(hasher) != checksum)) {
+      std::error_code ec;
+      fs::remove(tmp, ec);
+      sendJson(res, 409, {{"error", "size or checksum mismatch"}});
+      return;
+    }
+    sendJson(res, 200, store(tmp, filestat));
+  }
+
+  // {"hashes": [sha256, ...]} -> {"have": [the ones stored]}
+  void haveContent(const httplib::Request &req, httplib::Response &res) {
+    json body = json::parse(req.body, nullptr, false);
+    if (!body.is_object() || !body.contains("hashes") ||
+        !body["hashes"].is_array()) {
+      sendJson(res, 400, {{"error", "expected hashes"}});
+      return;
+    }
+    json have = json::array();
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (const auto &hash : body["hashes"]) {
+      if (hash.is_string() && m_byChecksum.count(hash.get<std::string>()))
+        have.push_back(hash);
+    }
+    sendJson(res, 200, {{"have", have}});
+  }
+
+  // Stores a file from content already held, found by the filestat's
+  // checksum; the upload without its bytes
+  void linkFile(const httplib::Request &req, httplib::Response &res) {
+    json body = json::parse(req.body, nullptr, false);
+    json filestat = body.is_object() ? body.value("filestat", json())
+                                     : json();
+    std::string checksum =
+        filestat.is_object() ? filestat.value("checksum", "") : "";
+    std::optional<std::string> holder;
+    {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      auto it = m_byChecksum.find(checksum);
+      if (it != m_byChecksum.end())
+        holder = *it->second.begin();
+    }
+    // Stored files are only ever replaced, never written in place, so a
+    // hard link shares the content safely
+    fs::path tmp = m_root / "files" / (randomId() + ".part");
+    std::error_code ec;
+    if (holder) {
+      fs::create_hard_link(m_root / "files" / *holder, tmp, ec);
+      if (ec)
+        fs::copy_file(m_root / "files" / *holder, tmp, ec);
+    }
+    if (!holder || ec) {
+      sendJson(res, 404, {{"error", "content not held"}});
+      return;
+    }
+    if (static_cast<int64_t>(fs::file_size(tmp, ec)) !=
+        filestat.value("size", int64_t(-1))) {
+      fs::remove(tmp, ec);
+      sendJson(res, 409, {{"error", "size mismatch"}});
+      return;
+    }
+    std::cout << "[DevServer] Linking to the content of " << *holder
+              << std::endl;
+    sendJson(res, 200, store(tmp, filestat));
+  }
+
+  std::optional<json> storedFile(const std::string &uuid) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_files.find(uuid);
+    if (it == m_files.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  void fileSignatures(const httplib::Request &req, httplib::Response &res) {
+    std::string uuid = req.get_param_value("uuid");
+    size_t blockSize = 0;
+    try {
+      blockSize = std::stoul(req.get_param_value("blockSize"));
+    } catch (const std::exception &) {
+    }
+    auto filestat = storedFile(uuid);
+    if (!filestat || blockSize == 0) {
+      sendJson(res, 404, {{"error", "no such file"}});
+      return;
+    }
+    std::ifstream in(m_root / "files" / uuid, std::ios::binary);
+    json blocks = json::array();
+    for (const auto &block : sync::computeSignatures(in, blockSize))
+      blocks.push_back({{"weak", block.weak}, {"strong", block.strong}});
+    sendJson(res, 200,
+             {{"checksum", filestat->value("checksum", "")},
+              {"blockSize", blockSize},
+              {"blocks", blocks}});
+  }
+
+  // Like /syncUpFile, but the "delta" field is applied to the stored
+  // version named by filestat.baseChecksum
+  void syncDeltaFile(const httplib::Request &, httplib::Response &res,
+                     const httplib::ContentReader &reader) {
+    std::string field;
+    std::string filestatText;
+    std::optional<json> filestat;
+    std::optional<DeltaApplier> applier;
+    std::unique_ptr<sync::StreamCodec> decoder;
+    std::string decoded;
+    fs::path tmp = m_root / "files" / (randomId() + ".part");
+    bool rejected = false;
+    reader(
+        [&](const httplib::FormData &item) {
+          field = item.name;
+          if (field != "delta")
+            return true;
+          // filestat is sent first, so the base is known by now
+          try {
+            filestat = json::parse(filestatText);
+          } catch (const std::exception &) {
+            rejected = true;
+            return false;
+          }
+          std::string uuid = filestat->value("uuid", "");
+          auto base = storedFile(uuid);
+          rejected = !base || base->value("checksum", "") !=
+                                  filestat->value("baseChecksum", "");
+          bool codingOk;
+          decoder = uploadDecoder(*filestat, codingOk);
+          rejected = rejected || !codingOk;
+          if (rejected)
+            return false;
+          applier.emplace(m_root / "files" / uuid, tmp);
+          return true;
+        },
+        [&](const char *data, size_t len) {
+          if (field == "filestat") {
+            filestatText.append(data, len);
+          } else if (field == "delta" && !decoder) {
+            return applier->feed(data, len);
+          } else if (field == "delta") {
+            decoded.clear();
+            return decoder->process(data, len, false, decoded) &&
+                   applier->feed(decoded.data(), decoded.size());
+          }
+          return true;
+        });
+    if (applier && decoder) {
+      decoded.clear();
+      rejected = rejected || !decoder->process(nullptr, 0, true, decoded) ||
+                 !applier->feed(decoded.data(), decoded.size());
+    }
+    std::string sha = applier ? applier->finish() : "";
+    if (rejected || !filestat || sha.empty() ||
+        applier->size() != filestat->value("size", int64_t(-1)) ||
+        sha != filestat->value("checksum", "")) {
+      std::error_code ec;
+      fs::remove(tmp, ec);
+      sendJson(res, 409, {{"error", "base changed or delta did not apply"}});
+      return;
+    }
+    filestat->erase("baseChecksum");
+    sendJson(res, 200, store(tmp, *filestat));
+  }
+
+  void startUpload(const httplib::Request &req, httplib::Response &res) {
+    json body;
+    try {
+      body = json::parse(req.body);
+    } catch (const std::exception &) {
+      sendJson(res, 400, {{"error", "bad json"}});
+      return;
+    }
+    int64_t partSize = body.value("partSize", int64_t(0));
+    if (!body.contains("filestat") || partSize <= 0) {
+      sendJson(res, 400, {{"error", "filestat and partSize required"}});
+      return;
+    }
+    std::string id = randomId();
+    std::error_code ec;
+    fs::create_directories(uploadDir(id), ec);
+    std::ofstream(uploadDir(id) / "meta.json") << body.dump();
+    sendJson(res, 200, {{"uploadId", id}});
+  }
+
+  std::optional<json> loadUpload(const std::string &id) {
+    if (!validId(id))
+      return std::nullopt;
+    std::ifstream in(uploadDir(id) / "meta.json");
+    if (!in)
+      return std::nullopt;
+    try {
+      return json::parse(in);
+    } catch (const std::exception &) {
+      return std::nullopt;
+    }
+  }
+
+  void putPart(const httplib::Request &req, httplib::Response &res) {
+    if (m_config.failEvery > 0 &&
+        ++m_partRequests % m_config.failEvery == 0) {
+      sendJson(res, 503, {{"error", "injected failure"}});
+      return;
+    }
+    const std::string &id = req.path_params.at("id");
+    auto meta = loadUpload(id);
+    if (!meta) {
+      sendJson(res, 404, {{"error", "unknown upload"}});
+      return;
+    }
+    int64_t part = -1;
+    try {
+      part = std::stoll(req.path_params.at("n"));
+    } catch (const std::exception &) {
+    }
+    bool codingOk;
+    auto decoder = uploadDecoder((*meta)["filestat"], codingOk);
+    std::string body;
+    if (!codingOk || (decoder && !decoder->process(req.body.data(),
+                                                   req.body.size(), true,
+                                                   body))) {
+      sendJson(res, 400, {{"error", "bad part encoding"}});
+      return;
+    }
+    if (!decoder)
+      body = req.body;
+    int64_t partSize = (*meta)["partSize"];
+    int64_t size = (*meta)["filestat"].value("size", int64_t(0));
+    int64_t offset = part * partSize;
+    if (part < 0 || offset >= std::max<int64_t>(size, 1) ||
+        int64_t(body.size()) != std::min(partSize, size - offset)) {
+      sendJson(res, 400, {{"error", "bad part number or length"}});
+      return;
+    }
+    std::string sha;
+    picosha2::hash256_hex_string(body, sha);
+    if (req.get_header_value("X-Content-Sha256") != sha) {
+      sendJson(res, 400, {{"error", "part checksum mismatch"}});
+      return;
+    }
+    // Parts are replaced whole, so a retried part never shows up torn
+    fs::path dest = uploadDir(id) / std::to_string(part);
+    fs::path tmp = dest.string() + "." + randomId();
+    std::ofstream(tmp, std::ios::binary)
+        .write(body.data(), static_cast<std::streamsize>(body.size()));
+    std::error_code ec;
+    fs::rename(tmp, dest, ec);
+    if (ec) {
+      sendJson(res, 500, {{"error", ec.message()}});
+      return;
+    }
+    sendJson(res, 200, {{"part", part}});
+  }
+
+  // Joins the parts in order and keeps the file only if it hashes to the
+  // checksum the upload was started with
+  void commitUpload(const httplib::Request &req, httplib::Response &res) {
+    const std::string &id = req.path_params.at("id");
+    auto meta = loadUpload(id);
+    if (!meta) {
+      sendJson(res, 404, {{"error", "unknown upload"}});
+      return;
+    }
+    json filestat = (*meta)["filestat"];
+    int64_t partSize = (*meta)["partSize"];
+    int64_t size = filestat.value("size", int64_t(0));
+    int64_t partCount = std::max<int64_t>((size + partSize - 1) / partSize, 1);
+    std::string checksum = filestat.value("checksum", "");
+    try {
+      json body = json::parse(req.body);
+      if (body.value("parts", int64_t(-1)) != partCount ||
+          body.value("checksum", "") != checksum) {
+        sendJson(res, 409, {{"error", "commit does not match the upload"}});
+        return;
+      }
+    } catch (const std::exception &) {
+      sendJson(res, 400, {{"error", "bad json"}});
+      return;
+    }
+
+    json missing = json::array();
+    for (int64_t part = 0; part < partCount; ++part)
+      if (size > 0 && !fs::exists(uploadDir(id) / std::to_string(part)))
+        missing.push_back(part);
+    if (!missing.empty()) {
+      sendJson(res, 409, {{"error", "missing parts"}, {"missing", missing}});
+      return;
+    }
+
+    fs::path joined = uploadDir(id) / "joined";
+    std::ofstream out(joined, std::ios::binary);
+    picosha2::hash256_one_by_one hasher;
+    std::vector<char> buffer(256 * 1024);
+    for (int64_t part = 0; size > 0 && part < partCount; ++part) {
+      std::ifstream in(uploadDir(id) / std::to_string(part), std::ios::binary);
+      while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        hasher.process(buffer.begin(), buffer.begin() + in.gcount());
+        out.write(buffer.data(), in.gcount());
+      }
+    }
+    out.close();
+    hasher.finish();
+    if (!checksum.empty() &&
+        picosha2::get_hash_hex_string(hasher) != checksum) {
+      std::error_code ec;
+      fs::remove_all(uploadDir(id), ec);
+      sendJson(res, 409, {{"error", "checksum mismatch"}});
+      return;
+    }
+    json reply = store(joined, filestat);
+    std::error_code ec;
+    fs::remove_all(uploadDir(id), ec);
+    sendJson(res, 200, reply);
+  }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  DevConfig config;
+  try {
+    if (!parseArgs(argc, argv, config))
+      return 2;
+  } catch (const std::exception &e) {
+    std::cerr << "[DevServer] Bad argument: " << e.what() << std::endl;
+    return 2;
+  }
+  return DevServer(config).run();
+}